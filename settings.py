@@ -5,7 +5,9 @@ Serial tool to modify settings of temp sensor
 """
 
 from enum import Enum
+import ipaddress
 import struct
+import time
 
 import click
 import serial
@@ -16,9 +18,26 @@ class Commands(Enum):
     UART_CMD_CONFIG_GET_WIFI_SSID = b"\x12"
     UART_CMD_CONFIG_SET_WIFI_KEY = b"\x13"
     UART_CMD_CONFIG_CLEAR_WIFI = b"\x14"
+    UART_CMD_CONFIG_SET_LABEL = b"\x15"
+    UART_CMD_CONFIG_BEGIN = b"\x16"
+    UART_CMD_CONFIG_STAGE = b"\x17"
+    UART_CMD_CONFIG_COMMIT = b"\x18"
+    UART_CMD_CONFIG_ABORT = b"\x19"
     UART_CMD_SENSOR_GET_TEMP = b"\x20"
     UART_CMD_SENSOR_GET_HUMIDITY = b"\x21"
     UART_CMD_SYS_GET_UPTIME = b"\x30"
+    UART_CMD_SYS_GET_IP = b"\x31"
+
+
+class Fields(Enum):
+    UART_FIELD_WIFI_SSID = 0x00
+    UART_FIELD_WIFI_KEY = 0x01
+    UART_FIELD_LOCATION = 0x02
+    UART_FIELD_ROOM = 0x03
+    UART_FIELD_RACK = 0x04
+    UART_FIELD_ACCESS_CONTROL = 0x05
+    UART_FIELD_BASIC_AUTH = 0x06
+    UART_FIELD_STATIC_IP = 0x07
 
 
 class Err(Enum):
@@ -28,6 +47,7 @@ class Err(Enum):
     UART_ERR_INVALID_CMD = b"\x03"
     UART_ERR_INVALID_VALUE = b"\x04"
     UART_ERR_NOT_IMPLEMENTED = b"\x05"
+    UART_ERR_INVALID_STATE = b"\x06"
 
 
 def _read(conn: serial.Serial, size: int):
@@ -48,6 +68,30 @@ def _read(conn: serial.Serial, size: int):
             return data
 
 
+def _stage(field: Fields, value: bytes) -> bytearray:
+    """
+    _stage Build a command staging one field of a provisioning transaction
+    """
+
+    buf = bytearray()
+    buf.extend(Commands.UART_CMD_CONFIG_STAGE.value)
+    buf.append(field.value)
+    buf.append(len(value))
+    buf.extend(value)
+    return buf
+
+
+def _get_ip(conn: serial.Serial) -> str:
+    """
+    _get_ip Get the station IPv4 address, 0.0.0.0 if it has none
+    """
+
+    conn.write(Commands.UART_CMD_SYS_GET_IP.value)
+    ip = _read(conn, 4)
+    _read(conn, 1)
+    return str(ipaddress.IPv4Address(ip))
+
+
 @click.group()
 @click.option("--port", help="Port temp sensor is connected to.", required=True)
 @click.option("--baud", help="Baud rate to connect at.", default=74880)
@@ -71,6 +115,111 @@ def clear_wifi_conf(ctx):
     click.echo(Err(res).name)
 
 
+@cli.command("set-label", help="Set a label added to every metric, empty to remove it")
+@click.argument("label", type=click.Choice(["location", "room", "rack"]))
+@click.argument("value")
+@click.pass_context
+def set_label(ctx, label: str, value: str):
+    encoded = value.encode()
+    buf = bytearray()
+    buf.extend(Commands.UART_CMD_CONFIG_SET_LABEL.value)
+    buf.append(["location", "room", "rack"].index(label))
+    buf.append(len(encoded))
+    buf.extend(encoded)
+
+    conn = serial.Serial(ctx.obj["port"], ctx.obj["baud"])
+    conn.write(buf)
+    res = _read(conn, 1)
+    click.echo(Err(res).name)
+
+
+@cli.command(help="Stage settings and commit them in a single write")
+@click.option("--ssid", help="Network to join.")
+@click.option("--key", help="WPA key, empty for an open network.")
+@click.option("--location", help="Location label, empty to remove it.")
+@click.option("--room", help="Room label, empty to remove it.")
+@click.option("--rack", help="Rack label, empty to remove it.")
+@click.option("--access-control", help="Allowed networks, empty to allow all.")
+@click.option("--basic-auth", help="user:password, empty to disable.")
+@click.option("--ip", help="Static IPv4 address, or dhcp.")
+@click.option("--netmask", help="Netmask for a static address.", default="255.255.255.0")
+@click.option("--gateway", help="Gateway for a static address.")
+@click.option("--dns", help="DNS server for a static address.", default="0.0.0.0")
+@click.option("--wait", help="Seconds to wait for an address after joining.", default=0.0)
+@click.pass_context
+def provision(ctx, ssid, key, location, room, rack, access_control, basic_auth, ip, netmask, gateway, dns, wait):
+    fields = [
+        (Fields.UART_FIELD_WIFI_SSID, ssid),
+        (Fields.UART_FIELD_WIFI_KEY, key),
+        (Fields.UART_FIELD_LOCATION, location),
+        (Fields.UART_FIELD_ROOM, room),
+        (Fields.UART_FIELD_RACK, rack),
+        (Fields.UART_FIELD_ACCESS_CONTROL, access_control),
+        (Fields.UART_FIELD_BASIC_AUTH, basic_auth),
+    ]
+
+    buf = bytearray()
+    buf.extend(Commands.UART_CMD_CONFIG_BEGIN.value)
+    commands = 1
+    for field, value in fields:
+        if value is not None:
+            buf.extend(_stage(field, value.encode()))
+            commands += 1
+    if ip is not None:
+        addressing = b""
+        if ip != "dhcp":
+            if gateway is None:
+                raise click.UsageError("--gateway is needed with a static address")
+            for address in (ip, netmask, gateway, dns):
+                addressing += ipaddress.IPv4Address(address).packed
+        buf.extend(_stage(Fields.UART_FIELD_STATIC_IP, addressing))
+        commands += 1
+
+    conn = serial.Serial(ctx.obj["port"], ctx.obj["baud"])
+    # Everything is staged in one go, then committed once all is well
+    conn.write(buf)
+    for _ in range(commands):
+        res = Err(_read(conn, 1))
+        if res != Err.UART_ERR_OK:
+            conn.write(Commands.UART_CMD_CONFIG_ABORT.value)
+            _read(conn, 1)
+            click.echo(res.name)
+            raise SystemExit(1)
+
+    conn.write(Commands.UART_CMD_CONFIG_COMMIT.value)
+    res = Err(_read(conn, 1))
+    click.echo(res.name)
+    if res != Err.UART_ERR_OK:
+        raise SystemExit(1)
+
+    deadline = time.monotonic() + wait
+    while wait > 0:
+        address = _get_ip(conn)
+        if address != "0.0.0.0" or time.monotonic() > deadline:
+            click.echo(address)
+            break
+        time.sleep(0.25)
+
+
+@cli.command("get-ssid", help="Get the network the sensor joins")
+@click.pass_context
+def get_ssid(ctx):
+    conn = serial.Serial(ctx.obj["port"], ctx.obj["baud"])
+    conn.write(Commands.UART_CMD_CONFIG_GET_WIFI_SSID.value)
+    length = _read(conn, 1)[0]
+    ssid = conn.read(length) if length > 0 else b""
+    click.echo(ssid.decode())
+    res = _read(conn, 1)
+    click.echo(Err(res).name)
+
+
+@cli.command("get-ip", help="Get the sensor's IPv4 address")
+@click.pass_context
+def get_ip(ctx):
+    conn = serial.Serial(ctx.obj["port"], ctx.obj["baud"])
+    click.echo(_get_ip(conn))
+
+
 @cli.command("get-temp")
 @click.pass_context
 def get_temp(ctx):
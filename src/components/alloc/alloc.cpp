@@ -0,0 +1,22 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "alloc.hpp"
+
+SemaphoreHandle_t alloc_mutex_create(alloc_mutex_t* storage) {
+#ifdef CONFIG_STATIC_MEMORY
+    return xSemaphoreCreateMutexStatic(&storage->buffer);
+#else
+    (void)storage;
+    return xSemaphoreCreateMutex();
+#endif
+}
+
+EventGroupHandle_t alloc_event_group_create(alloc_event_group_t* storage) {
+#ifdef CONFIG_STATIC_MEMORY
+    return xEventGroupCreateStatic(&storage->buffer);
+#else
+    (void)storage;
+    return xEventGroupCreate();
+#endif
+}
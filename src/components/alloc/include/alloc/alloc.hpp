@@ -0,0 +1,105 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef ALLOC_ALLOC_H_
+#define ALLOC_ALLOC_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#if defined(CONFIG_STATIC_MEMORY) && !configSUPPORT_STATIC_ALLOCATION
+// The SDK has no sdkconfig option for this, it is set in its
+// FreeRTOSConfig.h
+#error "CONFIG_STATIC_MEMORY needs configSUPPORT_STATIC_ALLOCATION set to 1 in FreeRTOSConfig.h"
+#endif
+
+/**
+ * @brief Storage for a task created with alloc_task_create
+ *
+ * Holds the control block and stack in static memory mode and is empty
+ * otherwise, so it can always be declared next to the task handle.
+ *
+ * @tparam STACK_SIZE Stack depth as passed to xTaskCreate
+ */
+template <uint32_t STACK_SIZE>
+struct alloc_task_t {
+#ifdef CONFIG_STATIC_MEMORY
+    StaticTask_t tcb;
+    StackType_t stack[STACK_SIZE];
+#endif
+};
+
+/**
+ * @brief Storage for a mutex created with alloc_mutex_create
+ */
+struct alloc_mutex_t {
+#ifdef CONFIG_STATIC_MEMORY
+    StaticSemaphore_t buffer;
+#endif
+};
+
+/**
+ * @brief Storage for an event group created with alloc_event_group_create
+ */
+struct alloc_event_group_t {
+#ifdef CONFIG_STATIC_MEMORY
+    StaticEventGroup_t buffer;
+#endif
+};
+
+/**
+ * @brief Create a task, in its own storage in static memory mode
+ *
+ * @param storage Storage that outlives the task
+ * @param function Task function
+ * @param name Task name
+ * @param arg Argument passed to the task
+ * @param priority Task priority
+ * @param handle Set to the new task, may be NULL
+ * @return esp_err_t ESP_ERR_NO_MEM if the heap is exhausted
+ */
+template <uint32_t STACK_SIZE>
+esp_err_t alloc_task_create(
+    alloc_task_t<STACK_SIZE>* storage,
+    TaskFunction_t function,
+    const char* name,
+    void* arg,
+    UBaseType_t priority,
+    TaskHandle_t* handle
+) {
+#ifdef CONFIG_STATIC_MEMORY
+    TaskHandle_t task = xTaskCreateStatic(function, name, STACK_SIZE, arg, priority, storage->stack, &storage->tcb);
+    if (handle != NULL) {
+        *handle = task;
+    }
+    return task != NULL ? ESP_OK : ESP_ERR_INVALID_ARG;
+#else
+    (void)storage;
+    BaseType_t ret = xTaskCreate(function, name, STACK_SIZE, arg, priority, handle);
+    return ret == pdPASS ? ESP_OK : ESP_ERR_NO_MEM;
+#endif
+}
+
+/**
+ * @brief Create a mutex, in its own storage in static memory mode
+ *
+ * @param storage Storage that outlives the mutex
+ * @return SemaphoreHandle_t NULL if the heap is exhausted
+ */
+SemaphoreHandle_t alloc_mutex_create(alloc_mutex_t* storage);
+
+/**
+ * @brief Create an event group, in its own storage in static memory mode
+ *
+ * @param storage Storage that outlives the event group
+ * @return EventGroupHandle_t NULL if the heap is exhausted
+ */
+EventGroupHandle_t alloc_event_group_create(alloc_event_group_t* storage);
+
+#endif // ALLOC_ALLOC_H_
@@ -1,11 +1,6 @@
 // SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
 // SPDX-License-Identifier: MIT
 
-#include <stdint.h>
-#include <stdio.h>
-#include <string.h>
-#include <sys/stat.h>
-
 #include "esp_err.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
@@ -14,20 +9,6 @@
 
 const char* Config::TAG_ = "config";
 
-esp_err_t Config::EnsureFile(const char* filename) {
-    struct stat st;
-    if (stat(filename, &st) != 0) {
-        ESP_LOGI(TAG_, "%s does not exist. Creating it", filename);
-        FILE* f = fopen(filename, "w");
-        if (f == NULL) {
-            ESP_LOGE(TAG_, "Failed to create file");
-            return ESP_FAIL;
-        }
-        fclose(f);
-    }
-    return ESP_OK;
-}
-
 esp_err_t Config::InitNVS() {
     ESP_LOGI(TAG_, "Initialising NVS");
     esp_err_t err = nvs_flash_init();
@@ -60,8 +41,3 @@ esp_err_t Config::EraseWiFiConfig() {
 
     return InitNVS();
 }
-
-Config::Config() {
-    ESP_ERROR_CHECK(EnsureFile(basic_auth_config_path_));
-    ESP_ERROR_CHECK(EnsureFile(access_control_config_path_));
-}
@@ -21,16 +21,6 @@ struct config_wifi_t {
 class Config {
 private:
     static const char* TAG_;
-    const char* basic_auth_config_path_ = "/spiffs/basicauth";
-    const char* access_control_config_path_ = "/spiffs/accesscontrol";
-
-    /**
-     * @brief Ensure that the given file exists
-     *
-     * @param filename File to check
-     * @return esp_err_t
-     */
-    esp_err_t EnsureFile(const char* filename);
 
 public:
 
@@ -47,13 +37,6 @@ public:
      * @return esp_err_t
      */
     esp_err_t EraseWiFiConfig();
-
-    /**
-     * @brief Construct a new Config object
-     * Ensures that all required files are present. Aborts if files
-     * could not be created.
-     */
-    Config();
 };
 
 #endif // CONFIG_CONFIG_H_
@@ -0,0 +1,52 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef CONFIG_LABELS_H_
+#define CONFIG_LABELS_H_
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+#include "store.hpp"
+
+// Longest label block, including the terminator, with every value at
+// its longest and every character escaped
+#define CONFIG_LABELS_BLOCK_LEN \
+    (sizeof("location=\"\",room=\"\",rack=\"\"") + 3 * 2 * (CONFIG_STORE_LABEL_LEN - 1))
+
+/**
+ * @brief Create the lock guarding the label block
+ *
+ * Called by config_store_init before the first build.
+ *
+ * @return esp_err_t
+ */
+esp_err_t config_labels_init();
+
+/**
+ * @brief Rebuild the label block from the settings
+ *
+ * Values are validated and escaped here so that serving a scrape is
+ * only a copy. A value containing control characters other than a
+ * newline is left out with a warning. The new block is built on the
+ * stack and only copied in under the lock once complete.
+ *
+ * @param settings Settings holding the label values
+ */
+void config_labels_build(const config_settings_t* settings);
+
+/**
+ * @brief Copy the label block
+ *
+ * The block is the labels as they appear between the braces of a
+ * series, e.g. location="lab",rack="2", without the braces. It is
+ * copied so a rebuild while the caller is still using it can not
+ * change it.
+ *
+ * @param block Buffer to copy the block, and its terminator, into
+ * @return size_t Length of the block, 0 if there are no labels
+ */
+size_t config_labels_get(char block[CONFIG_LABELS_BLOCK_LEN]);
+
+#endif // CONFIG_LABELS_H_
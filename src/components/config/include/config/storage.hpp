@@ -0,0 +1,32 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef CONFIG_STORAGE_H_
+#define CONFIG_STORAGE_H_
+
+#include "esp_err.h"
+
+#define STORAGE_BASE_PATH "/spiffs"
+#define STORAGE_MAX_FILES 4
+
+/**
+ * @brief Prepare for mounting
+ *
+ * Cheap, does not touch flash. Must be called before storage_mount.
+ *
+ * @return esp_err_t
+ */
+esp_err_t storage_init();
+
+/**
+ * @brief Mount the SPIFFS partition if it is not already mounted
+ *
+ * Mounting, and formatting on first use, can take seconds so this is
+ * left until the rest of startup has finished. Only the first call does
+ * any work, later calls return the same result.
+ *
+ * @return esp_err_t
+ */
+esp_err_t storage_mount();
+
+#endif // CONFIG_STORAGE_H_
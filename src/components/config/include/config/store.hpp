@@ -0,0 +1,110 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef CONFIG_STORE_H_
+#define CONFIG_STORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_event.h"
+
+#define CONFIG_STORE_PARTITION "config"
+#define CONFIG_STORE_SUBTYPE 0x40
+#define CONFIG_STORE_SLOT_SIZE 0x1000 // One flash sector per slot
+#define CONFIG_STORE_SLOTS 2
+#define CONFIG_STORE_MAGIC 0x31474643 // "CFG1"
+#define CONFIG_STORE_VERSION 1
+
+#define CONFIG_STORE_AUTH_LEN 64
+#define CONFIG_STORE_ACCESS_LEN 128
+#define CONFIG_STORE_LABEL_LEN 32
+#define CONFIG_STORE_SSID_LEN 33 // 32 byte SSID and terminator
+#define CONFIG_STORE_KEY_LEN 65 // 64 byte WPA key and terminator
+
+ESP_EVENT_DECLARE_BASE(CONFIG_EVENT);
+
+typedef enum {
+    CONFIG_EVENT_STATION_CHANGED, // Station credentials or addressing were written
+} config_event_t;
+
+/**
+ * @brief Settings kept in the config partition
+ *
+ * Stored on flash exactly as laid out here. Fields may be added to the
+ * end without changing the version, older blobs are padded with zeros
+ * so new fields must treat zero as their default.
+ */
+struct config_settings_t {
+    char basic_auth[CONFIG_STORE_AUTH_LEN]; // user:password, empty to disable
+    char access_control[CONFIG_STORE_ACCESS_LEN]; // Allowed networks, empty to allow all
+    // Labels added to every series on /metrics, empty to leave out
+    char location[CONFIG_STORE_LABEL_LEN];
+    char room[CONFIG_STORE_LABEL_LEN];
+    char rack[CONFIG_STORE_LABEL_LEN];
+    // Station to join, empty to use the one set by softAP provisioning
+    char wifi_ssid[CONFIG_STORE_SSID_LEN];
+    char wifi_key[CONFIG_STORE_KEY_LEN]; // Empty for an open network
+    // Static IPv4 addressing in network byte order, address all zero
+    // for DHCP
+    uint8_t ip[4];
+    uint8_t netmask[4];
+    uint8_t gateway[4];
+    uint8_t dns[4];
+};
+
+struct config_store_header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t length; // Length of the settings that follow
+    uint32_t sequence; // Incremented on every write, newest valid slot wins
+    uint32_t crc; // CRC-32 of the settings followed by the header before it
+};
+
+/**
+ * @brief Load the newest valid settings from the config partition
+ *
+ * Both slots are read straight into memory and checked against their
+ * CRC. If neither is valid, or the partition is missing, the defaults
+ * are used and the first write creates the blob.
+ *
+ * @return esp_err_t
+ */
+esp_err_t config_store_init();
+
+/**
+ * @brief Copy the current settings
+ *
+ * Copied under the lock as a write replaces them in place. Waits for
+ * a write in progress to finish.
+ *
+ * @param settings Where to store the settings
+ */
+void config_store_get(config_settings_t* settings);
+
+/**
+ * @brief Replace the settings
+ *
+ * The older slot is erased and rewritten, so a write interrupted by a
+ * reset leaves the previous settings in the other slot. If the station
+ * settings changed CONFIG_EVENT_STATION_CHANGED is posted to the
+ * default event loop, if it has been created, so the new network can
+ * be joined straight away.
+ *
+ * @param settings Settings to store
+ * @return esp_err_t
+ */
+esp_err_t config_store_write(const config_settings_t* settings);
+
+/**
+ * @brief Update a CRC-32 (IEEE 802.3) with more data
+ *
+ * @param crc CRC so far, 0 to start
+ * @param data Data to add
+ * @param len Length of data
+ * @return uint32_t
+ */
+uint32_t config_store_crc32(uint32_t crc, const void* data, size_t len);
+
+#endif // CONFIG_STORE_H_
@@ -7,9 +7,11 @@
 #include <stdint.h>
 
 #include "config.hpp"
-#include "sensor/aht10.hpp"
+#include "store.hpp"
+#include "sampler/sampler.hpp"
 
 #define BUF_SIZE (1024)
+#define UART_ARG_TIMEOUT 1000 // ms to wait for the arguments of a command
 
 typedef enum {
     UART_CMD_RESET = 0x01,
@@ -17,11 +19,29 @@ typedef enum {
     UART_CMD_CONFIG_GET_WIFI_SSID = 0x12,
     UART_CMD_CONFIG_SET_WIFI_AUTH = 0x13,
     UART_CMD_CONFIG_CLEAR_WIFI = 0x14,
+    UART_CMD_CONFIG_SET_LABEL = 0x15,
+    UART_CMD_CONFIG_BEGIN = 0x16,
+    UART_CMD_CONFIG_STAGE = 0x17,
+    UART_CMD_CONFIG_COMMIT = 0x18,
+    UART_CMD_CONFIG_ABORT = 0x19,
     UART_CMD_SENSOR_GET_TEMP = 0x20,
     UART_CMD_SENSOR_GET_HUMIDITY = 0x21,
     UART_CMD_SYS_GET_UPTIME = 0x30,
+    UART_CMD_SYS_GET_IP = 0x31,
 } uart_cmd_t;
 
+// Settings that can be staged with UART_CMD_CONFIG_STAGE
+typedef enum {
+    UART_FIELD_WIFI_SSID = 0x00,
+    UART_FIELD_WIFI_KEY = 0x01,
+    UART_FIELD_LOCATION = 0x02,
+    UART_FIELD_ROOM = 0x03,
+    UART_FIELD_RACK = 0x04,
+    UART_FIELD_ACCESS_CONTROL = 0x05,
+    UART_FIELD_BASIC_AUTH = 0x06,
+    UART_FIELD_STATIC_IP = 0x07, // Address, netmask, gateway and DNS, empty for DHCP
+} uart_field_t;
+
 typedef enum {
     UART_ERR_OK = 0x00,
     UART_ERR_FAIL = 0x01,
@@ -29,13 +49,18 @@ typedef enum {
     UART_ERR_INVALID_CMD = 0x03,
     UART_ERR_INVALID_VALUE = 0x04,
     UART_ERR_NOT_IMPLEMENTED = 0x05,
+    UART_ERR_INVALID_STATE = 0x06,
 } uart_err_t;
 
 class UART {
 private:
     const char* TAG_ = "UART";
     Config config_;
-    AHT10* sensor_;
+    Sampler* sampler_;
+
+    // Settings staged by a provisioning transaction
+    config_settings_t staged_;
+    bool staging_ = false;
 
     /**
      * @brief Handler for the UART_CMD_RESET command.
@@ -51,6 +76,88 @@ private:
      */
     uart_err_t ResetWiFiConf();
 
+    /**
+     * @brief Handler for setting a device label
+     *
+     * Takes the label (0 location, 1 room, 2 rack), the length of the
+     * value and then the value. An empty value removes the label.
+     *
+     * @return uart_err_t
+     */
+    uart_err_t SetLabel();
+
+    /**
+     * @brief Read a length byte followed by that many bytes
+     *
+     * @param value Where to store the value
+     * @param max Size of value
+     * @param len Set to the length read
+     * @return uart_err_t UART_ERR_INVALID_VALUE if the value is too
+     * long or does not arrive in time
+     */
+    uart_err_t ReadValue(uint8_t* value, size_t max, uint8_t* len);
+
+    /**
+     * @brief Start a provisioning transaction
+     *
+     * Stages a copy of the current settings. Staged changes are only
+     * kept in RAM until they are committed, and starting again
+     * discards them.
+     *
+     * @return uart_err_t
+     */
+    uart_err_t Begin();
+
+    /**
+     * @brief Stage a single setting
+     *
+     * Takes the uart_field_t, the length of the value and then the
+     * value. Text fields must leave room for a terminator and may be
+     * empty. The static IP is 16 bytes, or empty for DHCP. A
+     * transaction is started first if none is open.
+     *
+     * @param field Field to stage, or -1 to read it from the UART
+     * @return uart_err_t
+     */
+    uart_err_t Stage(int field);
+
+    /**
+     * @brief Write the staged settings in a single config store write
+     *
+     * The new station settings are joined straight away, without a
+     * reset. The transaction stays open if the settings are rejected.
+     *
+     * @return uart_err_t UART_ERR_INVALID_VALUE if the WPA key or
+     * static addressing is incomplete
+     */
+    uart_err_t Commit();
+
+    /**
+     * @brief Discard the staged settings
+     *
+     * @return uart_err_t
+     */
+    uart_err_t Abort();
+
+    /**
+     * @brief Get the SSID of the station to join
+     *
+     * Writes the length then the SSID.
+     *
+     * @return uart_err_t
+     */
+    uart_err_t GetSSID();
+
+    /**
+     * @brief Get the station's IPv4 address
+     *
+     * Writes 4 bytes in network byte order, all zero until an address
+     * has been assigned.
+     *
+     * @return uart_err_t
+     */
+    uart_err_t GetIP();
+
     /**
      * @brief Get the current temperature measurement
      *
@@ -77,8 +184,9 @@ public:
      * @brief Construct a new UART object
      *
      * @param baud Baudrate to listen and transmit at
+     * @param sampler Sampler whose latest sample is reported
      */
-    UART(int baud, AHT10* sensor);
+    UART(int baud, Sampler* sampler);
 
     /**
      * @brief Start listening for commands
@@ -0,0 +1,106 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "config/labels.hpp"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "alloc/alloc.hpp"
+#include "config/store.hpp"
+
+static const char TAG_[] = "config_labels";
+
+// Held only while the block is copied in or out, so a reader never
+// sees a half written block however many rebuilds happen meanwhile
+static SemaphoreHandle_t lock_ = NULL;
+static alloc_mutex_t lock_storage_;
+static char block_[CONFIG_LABELS_BLOCK_LEN];
+static size_t len_ = 0;
+
+/**
+ * @brief Append a label to a block if it has a valid value
+ *
+ * @param block Block to append to
+ * @param len Length of block so far, updated
+ * @param name Label name
+ * @param value Label value, the last byte of the field is ignored
+ */
+static void config_labels_append(char* block, size_t* len, const char* name, const char* value) {
+    const size_t value_len = strnlen(value, CONFIG_STORE_LABEL_LEN - 1);
+    if (value_len == 0) {
+        return;
+    }
+    for (size_t i = 0; i < value_len; i++) {
+        const unsigned char c = value[i];
+        if ((c < 0x20 && c != '\n') || c == 0x7f) {
+            ESP_LOGW(TAG_, "Ignoring %s label with control characters", name);
+            return;
+        }
+    }
+
+    size_t out = *len;
+    if (out > 0) {
+        block[out++] = ',';
+    }
+    const size_t name_len = strlen(name);
+    memcpy(block + out, name, name_len);
+    out += name_len;
+    block[out++] = '=';
+    block[out++] = '"';
+    for (size_t i = 0; i < value_len; i++) {
+        switch (value[i]) {
+        case '\\':
+        case '"':
+            block[out++] = '\\';
+            block[out++] = value[i];
+            break;
+        case '\n':
+            block[out++] = '\\';
+            block[out++] = 'n';
+            break;
+        default:
+            block[out++] = value[i];
+            break;
+        }
+    }
+    block[out++] = '"';
+    *len = out;
+}
+
+esp_err_t config_labels_init() {
+    lock_ = alloc_mutex_create(&lock_storage_);
+    if (lock_ == NULL) {
+        ESP_LOGE(TAG_, "Failed to create lock");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void config_labels_build(const config_settings_t* settings) {
+    char block[CONFIG_LABELS_BLOCK_LEN];
+    size_t len = 0;
+    config_labels_append(block, &len, "location", settings->location);
+    config_labels_append(block, &len, "room", settings->room);
+    config_labels_append(block, &len, "rack", settings->rack);
+    block[len] = '\0';
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    memcpy(block_, block, len + 1);
+    len_ = len;
+    xSemaphoreGive(lock_);
+    ESP_LOGI(TAG_, "Labels: {%s}", block);
+}
+
+size_t config_labels_get(char block[CONFIG_LABELS_BLOCK_LEN]) {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    const size_t len = len_;
+    memcpy(block, block_, len + 1);
+    xSemaphoreGive(lock_);
+    return len;
+}
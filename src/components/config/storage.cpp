@@ -0,0 +1,94 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "config/storage.hpp"
+
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_spiffs.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "alloc/alloc.hpp"
+
+static const char TAG_[] = "storage";
+
+static SemaphoreHandle_t lock_ = NULL;
+static alloc_mutex_t lock_storage_;
+static bool attempted_ = false;
+static esp_err_t result_ = ESP_ERR_INVALID_STATE;
+
+/**
+ * @brief Mount the partition, formatting it if needed
+ *
+ * @return esp_err_t
+ */
+static esp_err_t storage_register() {
+    ESP_LOGI(TAG_, "Initialising SPIFFS file system");
+
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = STORAGE_BASE_PATH,
+        .partition_label = NULL,
+        .max_files = STORAGE_MAX_FILES,
+        .format_if_mount_failed = true,
+    };
+
+    const int64_t start = esp_timer_get_time();
+    esp_err_t ret = esp_vfs_spiffs_register(&conf);
+    if (ret != ESP_OK) {
+        switch (ret) {
+        case ESP_FAIL:
+            ESP_LOGE(TAG_, "ESP_FAIL: Failed to mount or format file system");
+            break;
+        case ESP_ERR_NOT_FOUND:
+            ESP_LOGE(TAG_, "ESP_ERR_NOT_FOUND: Could not find SPIFFS partition");
+            break;
+        default:
+            ESP_LOGE(TAG_, "Failed to initialise SPIFFS (%s)", esp_err_to_name(ret));
+            break;
+        }
+        return ret;
+    }
+
+    size_t total = 0, used = 0;
+    ret = esp_spiffs_info(NULL, &total, &used);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to get SPIFFS partition information (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ESP_LOGI(
+        TAG_,
+        "Mounted in %lldms. Partition size: total: %d, used: %d",
+        (esp_timer_get_time() - start) / 1000,
+        total,
+        used
+    );
+    return ESP_OK;
+}
+
+esp_err_t storage_init() {
+    lock_ = alloc_mutex_create(&lock_storage_);
+    if (lock_ == NULL) {
+        ESP_LOGE(TAG_, "Failed to create lock");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t storage_mount() {
+    if (lock_ == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // Later callers wait for the first mount to finish
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    if (!attempted_) {
+        attempted_ = true;
+        result_ = storage_register();
+    }
+    xSemaphoreGive(lock_);
+    return result_;
+}
@@ -0,0 +1,197 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "config/store.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "alloc/alloc.hpp"
+#include "config/labels.hpp"
+
+// A slot as read from flash, header then settings
+struct config_store_slot_t {
+    config_store_header_t header;
+    config_settings_t settings;
+};
+
+ESP_EVENT_DEFINE_BASE(CONFIG_EVENT);
+
+static const char TAG_[] = "config_store";
+
+static const esp_partition_t* partition_ = NULL;
+static SemaphoreHandle_t lock_ = NULL;
+static alloc_mutex_t lock_storage_;
+static config_store_slot_t current_;
+static int current_slot_ = -1; // Slot current_ was read from, -1 for defaults
+
+uint32_t config_store_crc32(uint32_t crc, const void* data, size_t len) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Calculate the CRC of a slot
+ *
+ * @param slot Slot to check, settings must be header.length long
+ * @return uint32_t
+ */
+static uint32_t config_store_slot_crc(const config_store_slot_t* slot) {
+    uint32_t crc = config_store_crc32(0, &slot->settings, slot->header.length);
+    return config_store_crc32(crc, &slot->header, offsetof(config_store_header_t, crc));
+}
+
+/**
+ * @brief Read a slot and check that it is valid
+ *
+ * @param index Slot to read
+ * @param slot Where to store the slot
+ * @return esp_err_t ESP_ERR_INVALID_CRC if the slot is blank or damaged
+ */
+static esp_err_t config_store_read_slot(int index, config_store_slot_t* slot) {
+    esp_err_t err = esp_partition_read(partition_, index * CONFIG_STORE_SLOT_SIZE, slot, sizeof(*slot));
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (slot->header.magic != CONFIG_STORE_MAGIC
+        || slot->header.version != CONFIG_STORE_VERSION
+        || slot->header.length > sizeof(config_settings_t)
+        || slot->header.crc != config_store_slot_crc(slot)) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    // Written by older firmware with fewer fields
+    memset((uint8_t*)&slot->settings + slot->header.length, 0, sizeof(config_settings_t) - slot->header.length);
+    return ESP_OK;
+}
+
+/**
+ * @brief Check whether the station credentials or addressing differ
+ *
+ * @param a Settings to compare
+ * @param b Settings to compare
+ * @return true
+ * @return false
+ */
+static bool config_store_station_changed(const config_settings_t* a, const config_settings_t* b) {
+    return memcmp(a->wifi_ssid, b->wifi_ssid, sizeof(a->wifi_ssid)) != 0
+        || memcmp(a->wifi_key, b->wifi_key, sizeof(a->wifi_key)) != 0
+        || memcmp(a->ip, b->ip, sizeof(a->ip)) != 0
+        || memcmp(a->netmask, b->netmask, sizeof(a->netmask)) != 0
+        || memcmp(a->gateway, b->gateway, sizeof(a->gateway)) != 0
+        || memcmp(a->dns, b->dns, sizeof(a->dns)) != 0;
+}
+
+esp_err_t config_store_init() {
+    lock_ = alloc_mutex_create(&lock_storage_);
+    if (lock_ == NULL) {
+        ESP_LOGE(TAG_, "Failed to create lock");
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = config_labels_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    memset(&current_, 0, sizeof(current_));
+    current_slot_ = -1;
+    partition_ = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA,
+        (esp_partition_subtype_t)CONFIG_STORE_SUBTYPE,
+        CONFIG_STORE_PARTITION
+    );
+    if (partition_ == NULL) {
+        ESP_LOGW(TAG_, "No %s partition, using defaults", CONFIG_STORE_PARTITION);
+        config_labels_build(&current_.settings);
+        return ESP_OK;
+    }
+
+    for (int i = 0; i < CONFIG_STORE_SLOTS; i++) {
+        config_store_slot_t slot;
+        if (config_store_read_slot(i, &slot) != ESP_OK) {
+            continue;
+        }
+        // Compare by difference so the sequence can wrap
+        if (current_slot_ < 0 || (int32_t)(slot.header.sequence - current_.header.sequence) > 0) {
+            current_ = slot;
+            current_slot_ = i;
+        }
+    }
+
+    if (current_slot_ < 0) {
+        ESP_LOGI(TAG_, "No valid settings, using defaults");
+    }
+    else {
+        ESP_LOGI(TAG_, "Loaded settings %u from slot %d", current_.header.sequence, current_slot_);
+    }
+    config_labels_build(&current_.settings);
+    return ESP_OK;
+}
+
+void config_store_get(config_settings_t* settings) {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    *settings = current_.settings;
+    xSemaphoreGive(lock_);
+}
+
+esp_err_t config_store_write(const config_settings_t* settings) {
+    if (partition_ == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    // Static to keep both copies off the small console task stack,
+    // lock_ serialises their use
+    static config_store_slot_t slot;
+    static config_store_slot_t check;
+    slot.header.magic = CONFIG_STORE_MAGIC;
+    slot.header.version = CONFIG_STORE_VERSION;
+    slot.header.length = sizeof(config_settings_t);
+    slot.header.sequence = current_.header.sequence + 1;
+    slot.settings = *settings;
+    slot.header.crc = config_store_slot_crc(&slot);
+
+    // Never touch the slot holding the current settings
+    const int index = current_slot_ == 0 ? 1 : 0;
+    const size_t offset = index * CONFIG_STORE_SLOT_SIZE;
+    esp_err_t err = esp_partition_erase_range(partition_, offset, CONFIG_STORE_SLOT_SIZE);
+    if (err == ESP_OK) {
+        err = esp_partition_write(partition_, offset, &slot, sizeof(slot));
+    }
+    if (err == ESP_OK) {
+        // Read back so a bad write is caught now rather than next boot
+        err = config_store_read_slot(index, &check);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to write slot %d (%s)", index, esp_err_to_name(err));
+        xSemaphoreGive(lock_);
+        return err;
+    }
+
+    const bool station_changed = config_store_station_changed(&current_.settings, &slot.settings);
+    current_ = slot;
+    current_slot_ = index;
+    config_labels_build(&current_.settings);
+    xSemaphoreGive(lock_);
+    ESP_LOGI(TAG_, "Wrote settings %u to slot %d", slot.header.sequence, index);
+
+    if (station_changed) {
+        // Fails before the network is started, which reads the new
+        // settings itself
+        esp_event_post(CONFIG_EVENT, CONFIG_EVENT_STATION_CHANGED, NULL, 0, portMAX_DELAY);
+    }
+    return ESP_OK;
+}
@@ -1,6 +1,7 @@
 // SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
 // SPDX-License-Identifier: MIT
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -10,12 +11,46 @@
 
 #include "esp_system.h"
 #include "esp_timer.h"
+#include "esp_wifi.h"
 #include "nvs_flash.h"
 #include "driver/uart.h"
+#include "tcpip_adapter.h"
 
 #include "config/uart.hpp"
 #include "config/config.hpp"
-#include "sensor/aht10.hpp"
+#include "config/store.hpp"
+#include "diagnostics/diagnostics.hpp"
+#include "sampler/sampler.hpp"
+
+#define UART_WPA_KEY_MIN 8
+#define UART_STATIC_IP_LEN 16
+
+struct uart_field_layout_t {
+    size_t offset;
+    size_t size;
+};
+
+// Where each uart_field_t lives in config_settings_t
+static const uart_field_layout_t UART_FIELDS_[] = {
+    { offsetof(config_settings_t, wifi_ssid), CONFIG_STORE_SSID_LEN },
+    { offsetof(config_settings_t, wifi_key), CONFIG_STORE_KEY_LEN },
+    { offsetof(config_settings_t, location), CONFIG_STORE_LABEL_LEN },
+    { offsetof(config_settings_t, room), CONFIG_STORE_LABEL_LEN },
+    { offsetof(config_settings_t, rack), CONFIG_STORE_LABEL_LEN },
+    { offsetof(config_settings_t, access_control), CONFIG_STORE_ACCESS_LEN },
+    { offsetof(config_settings_t, basic_auth), CONFIG_STORE_AUTH_LEN },
+    { offsetof(config_settings_t, ip), UART_STATIC_IP_LEN },
+};
+
+static_assert(
+    CONFIG_STORE_ACCESS_LEN >= CONFIG_STORE_AUTH_LEN && CONFIG_STORE_ACCESS_LEN >= CONFIG_STORE_KEY_LEN,
+    "Stage reads values into a buffer sized for the longest field"
+);
+
+static_assert(
+    offsetof(config_settings_t, dns) + 4 - offsetof(config_settings_t, ip) == UART_STATIC_IP_LEN,
+    "Static IP fields must be contiguous"
+);
 
 void UART::Reset() {
     esp_restart();
@@ -27,20 +62,188 @@ uart_err_t UART::ResetWiFiConf() {
         ESP_LOGE(TAG_, "Failed to reset WiFi config");
         return UART_ERR_FAIL;
     }
+
+    // Forget a station provisioned over UART too
+    config_settings_t settings;
+    config_store_get(&settings);
+    if (settings.wifi_ssid[0] != '\0') {
+        memset(settings.wifi_ssid, 0, sizeof(settings.wifi_ssid));
+        memset(settings.wifi_key, 0, sizeof(settings.wifi_key));
+        if (config_store_write(&settings) != ESP_OK) {
+            return UART_ERR_FAIL;
+        }
+    }
+    return UART_ERR_OK;
+}
+
+uart_err_t UART::SetLabel() {
+    uint8_t header[2];
+    if (uart_read_bytes(UART_NUM_0, header, sizeof(header), UART_ARG_TIMEOUT / portTICK_RATE_MS) != sizeof(header)) {
+        return UART_ERR_INVALID_VALUE;
+    }
+    const uint8_t label = header[0];
+    const uint8_t len = header[1];
+    if (len >= CONFIG_STORE_LABEL_LEN) {
+        return UART_ERR_INVALID_VALUE;
+    }
+    char value[CONFIG_STORE_LABEL_LEN] = { 0 };
+    if (len > 0 && uart_read_bytes(UART_NUM_0, (uint8_t*)value, len, UART_ARG_TIMEOUT / portTICK_RATE_MS) != len) {
+        return UART_ERR_INVALID_VALUE;
+    }
+
+    // Part of the transaction if one is open, so the commit keeps it
+    config_settings_t settings;
+    config_store_get(&settings);
+    config_settings_t* target = staging_ ? &staged_ : &settings;
+    switch (label) {
+    case 0:
+        memcpy(target->location, value, sizeof(value));
+        break;
+    case 1:
+        memcpy(target->room, value, sizeof(value));
+        break;
+    case 2:
+        memcpy(target->rack, value, sizeof(value));
+        break;
+    default:
+        return UART_ERR_INVALID_VALUE;
+    }
+
+    if (!staging_ && config_store_write(&settings) != ESP_OK) {
+        return UART_ERR_FAIL;
+    }
+    return UART_ERR_OK;
+}
+
+uart_err_t UART::ReadValue(uint8_t* value, size_t max, uint8_t* len) {
+    if (uart_read_bytes(UART_NUM_0, len, 1, UART_ARG_TIMEOUT / portTICK_RATE_MS) != 1) {
+        return UART_ERR_INVALID_VALUE;
+    }
+    if (*len > max) {
+        // Skip the value so it is not taken for the next command
+        uint8_t discard;
+        for (uint8_t i = 0; i < *len; i++) {
+            uart_read_bytes(UART_NUM_0, &discard, 1, UART_ARG_TIMEOUT / portTICK_RATE_MS);
+        }
+        return UART_ERR_INVALID_VALUE;
+    }
+    if (*len > 0 && uart_read_bytes(UART_NUM_0, value, *len, UART_ARG_TIMEOUT / portTICK_RATE_MS) != *len) {
+        return UART_ERR_INVALID_VALUE;
+    }
+    return UART_ERR_OK;
+}
+
+uart_err_t UART::Begin() {
+    config_store_get(&staged_);
+    staging_ = true;
+    return UART_ERR_OK;
+}
+
+uart_err_t UART::Stage(int field) {
+    if (field < 0) {
+        uint8_t id;
+        if (uart_read_bytes(UART_NUM_0, &id, 1, UART_ARG_TIMEOUT / portTICK_RATE_MS) != 1) {
+            return UART_ERR_INVALID_VALUE;
+        }
+        field = id;
+    }
+    if ((size_t)field >= sizeof(UART_FIELDS_) / sizeof(UART_FIELDS_[0])) {
+        return UART_ERR_INVALID_VALUE;
+    }
+
+    // Text leaves room for a terminator, the static IP is all or nothing
+    const uart_field_layout_t* layout = &UART_FIELDS_[field];
+    const bool text = field != UART_FIELD_STATIC_IP;
+    uint8_t value[CONFIG_STORE_ACCESS_LEN] = { 0 };
+    uint8_t len;
+    uart_err_t err = ReadValue(value, text ? layout->size - 1 : layout->size, &len);
+    if (err != UART_ERR_OK) {
+        return err;
+    }
+    if (!text && len != 0 && len != layout->size) {
+        return UART_ERR_INVALID_VALUE;
+    }
+
+    if (!staging_) {
+        Begin();
+    }
+    memcpy((uint8_t*)&staged_ + layout->offset, value, layout->size);
+    return UART_ERR_OK;
+}
+
+uart_err_t UART::Commit() {
+    if (!staging_) {
+        return UART_ERR_INVALID_STATE;
+    }
+
+    const size_t key_len = strlen(staged_.wifi_key);
+    if (key_len > 0 && key_len < UART_WPA_KEY_MIN) {
+        ESP_LOGW(TAG_, "WPA key must be at least %d characters", UART_WPA_KEY_MIN);
+        return UART_ERR_INVALID_VALUE;
+    }
+    const uint8_t none[4] = { 0 };
+    if (memcmp(staged_.ip, none, sizeof(none)) != 0
+        && (memcmp(staged_.netmask, none, sizeof(none)) == 0 || memcmp(staged_.gateway, none, sizeof(none)) == 0)) {
+        ESP_LOGW(TAG_, "Static IP needs a netmask and gateway");
+        return UART_ERR_INVALID_VALUE;
+    }
+
+    if (config_store_write(&staged_) != ESP_OK) {
+        return UART_ERR_FAIL;
+    }
+    staging_ = false;
+    ESP_LOGI(TAG_, "Committed provisioning");
+    return UART_ERR_OK;
+}
+
+uart_err_t UART::Abort() {
+    staging_ = false;
+    return UART_ERR_OK;
+}
+
+uart_err_t UART::GetSSID() {
+    config_settings_t settings;
+    config_store_get(&settings);
+    char ssid[CONFIG_STORE_SSID_LEN] = { 0 };
+    memcpy(ssid, settings.wifi_ssid, sizeof(ssid) - 1);
+    if (ssid[0] == '\0') {
+        // Provisioned over softAP, so only the WiFi driver knows it
+        wifi_config_t config;
+        if (esp_wifi_get_config(WIFI_IF_STA, &config) == ESP_OK) {
+            memcpy(ssid, config.sta.ssid, sizeof(config.sta.ssid));
+        }
+    }
+    uint8_t len = strnlen(ssid, sizeof(ssid) - 1);
+    uart_write_bytes(UART_NUM_0, (const char*)&len, 1);
+    uart_write_bytes(UART_NUM_0, ssid, len);
+    return UART_ERR_OK;
+}
+
+uart_err_t UART::GetIP() {
+    tcpip_adapter_ip_info_t info = {};
+    tcpip_adapter_get_ip_info(TCPIP_ADAPTER_IF_STA, &info);
+    uart_write_bytes(UART_NUM_0, (const char*)&info.ip.addr, 4);
     return UART_ERR_OK;
 }
 
 uart_err_t UART::GetTemp() {
-    aht10_measurement_t result;
-    sensor_->Measure(&result);
-    uart_write_bytes(UART_NUM_0, (const char*)&result.temperature, 4);
+    sampler_sample_t sample;
+    if (sampler_->GetLatest(&sample) != ESP_OK) {
+        return UART_ERR_FAIL;
+    }
+    // The protocol sends a float so convert at the last moment
+    float temperature = sample.measurement.temperature / 100.0f;
+    uart_write_bytes(UART_NUM_0, (const char*)&temperature, 4);
     return UART_ERR_OK;
 }
 
 uart_err_t UART::GetHumidity() {
-    aht10_measurement_t result;
-    sensor_->Measure(&result);
-    uart_write_bytes(UART_NUM_0, (const char*)&result.humidity, 4);
+    sampler_sample_t sample;
+    if (sampler_->GetLatest(&sample) != ESP_OK) {
+        return UART_ERR_FAIL;
+    }
+    float humidity = sample.measurement.humidity / 100.0f;
+    uart_write_bytes(UART_NUM_0, (const char*)&humidity, 4);
     return UART_ERR_OK;
 }
 
@@ -50,8 +253,8 @@ uart_err_t UART::GetUptime() {
     return UART_ERR_OK;
 }
 
-UART::UART(int baud, AHT10* sensor) {
-    sensor_ = sensor;
+UART::UART(int baud, Sampler* sampler) {
+    sampler_ = sampler;
     uart_config_t conf = {
         .baud_rate = baud,
         .data_bits = UART_DATA_8_BITS,
@@ -67,8 +270,9 @@ UART::UART(int baud, AHT10* sensor) {
 void UART::Listen() {
     uint8_t cmd;
     while (1) {
-        // Poll for a command
-        int len = uart_read_bytes(UART_NUM_0, &cmd, 1, 20 / portTICK_RATE_MS);
+        // Block until a command arrives rather than polling so the idle
+        // task is left to run and the modem can sleep
+        int len = uart_read_bytes(UART_NUM_0, &cmd, 1, portMAX_DELAY);
         if (len == 0) {
             continue;
         }
@@ -81,15 +285,41 @@ void UART::Listen() {
             break;
 
         case UART_CMD_CONFIG_SET_WIFI_SSID:
+            status[0] = Stage(UART_FIELD_WIFI_SSID);
+            break;
+
         case UART_CMD_CONFIG_GET_WIFI_SSID:
+            status[0] = GetSSID();
+            break;
+
         case UART_CMD_CONFIG_SET_WIFI_AUTH:
-            status[0] = UART_ERR_NOT_IMPLEMENTED;
+            status[0] = Stage(UART_FIELD_WIFI_KEY);
             break;
 
         case UART_CMD_CONFIG_CLEAR_WIFI:
             status[0] = ResetWiFiConf();
             break;
 
+        case UART_CMD_CONFIG_SET_LABEL:
+            status[0] = SetLabel();
+            break;
+
+        case UART_CMD_CONFIG_BEGIN:
+            status[0] = Begin();
+            break;
+
+        case UART_CMD_CONFIG_STAGE:
+            status[0] = Stage(-1);
+            break;
+
+        case UART_CMD_CONFIG_COMMIT:
+            status[0] = Commit();
+            break;
+
+        case UART_CMD_CONFIG_ABORT:
+            status[0] = Abort();
+            break;
+
         case UART_CMD_SENSOR_GET_TEMP:
             status[0] = GetTemp();
             break;
@@ -102,6 +332,10 @@ void UART::Listen() {
             status[0] = GetUptime();
             break;
 
+        case UART_CMD_SYS_GET_IP:
+            status[0] = GetIP();
+            break;
+
         default:
             status[0] = UART_ERR_INVALID_CMD;
             break;
@@ -109,5 +343,6 @@ void UART::Listen() {
 
         uart_write_bytes(UART_NUM_0, (const char*)status, 1);
         cmd = 0;
+        diagnostics_check_stack();
     }
 }
@@ -0,0 +1,204 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "diagnostics.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "alloc/alloc.hpp"
+
+// Layout of the block in RTC memory. Only whole words may be accessed
+// there, so every field is a word.
+struct diagnostics_rtc_t {
+    uint32_t magic;
+    uint32_t resets;
+    uint32_t reason;
+    uint32_t i2c_errors;
+    uint32_t uptime;
+    uint32_t checksum;
+};
+
+#define DIAGNOSTICS_RTC_WORDS (sizeof(diagnostics_rtc_t) / sizeof(uint32_t))
+
+#ifdef CONFIG_DIAGNOSTICS_STACK_REPORT
+// Lowest high-water mark logged for a task
+struct diagnostics_stack_t {
+    TaskHandle_t task; // NULL if unused
+    UBaseType_t low;
+};
+#endif
+
+static const char TAG_[] = "diagnostics";
+
+static volatile uint32_t* const rtc_ = (volatile uint32_t*)DIAGNOSTICS_RTC_ADDR;
+static SemaphoreHandle_t lock_ = NULL;
+static alloc_mutex_t lock_storage_;
+static diagnostics_rtc_t block_;
+static uint32_t uptime_base_ = 0; // Seconds awake before this boot
+#ifdef CONFIG_DIAGNOSTICS_STACK_REPORT
+static diagnostics_stack_t stacks_[DIAGNOSTICS_STACK_TASKS];
+#endif
+
+/**
+ * @brief Checksum every word of the block before the checksum
+ *
+ * @param block Block to checksum
+ * @return uint32_t
+ */
+static uint32_t diagnostics_checksum(const diagnostics_rtc_t* block) {
+    const uint32_t* words = (const uint32_t*)block;
+    uint32_t sum = 0;
+    for (size_t i = 0; i < DIAGNOSTICS_RTC_WORDS - 1; i++) {
+        // Rotate so that swapped words change the result
+        sum = (sum << 5 | sum >> 27) ^ words[i];
+    }
+    return ~sum;
+}
+
+/**
+ * @brief Copy the in memory block to RTC memory
+ *
+ * Must be called with the lock held.
+ */
+static void diagnostics_store() {
+    block_.uptime = uptime_base_ + esp_timer_get_time() / 1000000;
+    block_.checksum = diagnostics_checksum(&block_);
+    const uint32_t* words = (const uint32_t*)&block_;
+    for (size_t i = 0; i < DIAGNOSTICS_RTC_WORDS; i++) {
+        rtc_[i] = words[i];
+    }
+}
+
+esp_err_t diagnostics_init() {
+    lock_ = alloc_mutex_create(&lock_storage_);
+    if (lock_ == NULL) {
+        ESP_LOGE(TAG_, "Failed to create lock");
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint32_t* words = (uint32_t*)&block_;
+    for (size_t i = 0; i < DIAGNOSTICS_RTC_WORDS; i++) {
+        words[i] = rtc_[i];
+    }
+
+    const esp_reset_reason_t reason = esp_reset_reason();
+    if (reason == ESP_RST_POWERON
+        || block_.magic != DIAGNOSTICS_MAGIC
+        || block_.checksum != diagnostics_checksum(&block_)) {
+        ESP_LOGI(TAG_, "No saved counters, starting from zero");
+        block_.magic = DIAGNOSTICS_MAGIC;
+        block_.resets = 0;
+        block_.i2c_errors = 0;
+        block_.uptime = 0;
+    }
+    else {
+        block_.resets++;
+    }
+    block_.reason = reason;
+    uptime_base_ = block_.uptime;
+
+    ESP_LOGI(
+        TAG_,
+        "Boot %u since power on, reset reason %s",
+        block_.resets,
+        diagnostics_reason_name(reason)
+    );
+    diagnostics_store();
+    return ESP_OK;
+}
+
+void diagnostics_count_i2c_error() {
+    if (lock_ == NULL) {
+        return;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    block_.i2c_errors++;
+    diagnostics_store();
+    xSemaphoreGive(lock_);
+}
+
+void diagnostics_get(diagnostics_counters_t* counters) {
+    if (lock_ == NULL) {
+        counters->resets = 0;
+        counters->reason = ESP_RST_UNKNOWN;
+        counters->i2c_errors = 0;
+        counters->uptime = 0;
+        return;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    diagnostics_store();
+    counters->resets = block_.resets;
+    counters->reason = (esp_reset_reason_t)block_.reason;
+    counters->i2c_errors = block_.i2c_errors;
+    counters->uptime = block_.uptime;
+    xSemaphoreGive(lock_);
+}
+
+void diagnostics_check_stack() {
+#ifdef CONFIG_DIAGNOSTICS_STACK_REPORT
+    if (lock_ == NULL) {
+        return;
+    }
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    UBaseType_t low = uxTaskGetStackHighWaterMark(NULL);
+
+    bool lower = false;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    for (int i = 0; i < DIAGNOSTICS_STACK_TASKS; i++) {
+        diagnostics_stack_t* stack = &stacks_[i];
+        if (stack->task == NULL || stack->task == task) {
+            lower = stack->task == NULL || low < stack->low;
+            stack->task = task;
+            stack->low = lower ? low : stack->low;
+            break;
+        }
+    }
+    xSemaphoreGive(lock_);
+
+    if (lower) {
+        ESP_LOGI(
+            TAG_,
+            "Task %s has %u bytes of stack never used",
+            pcTaskGetName(NULL),
+            (unsigned)(low * sizeof(StackType_t))
+        );
+    }
+#endif
+}
+
+const char* diagnostics_reason_name(esp_reset_reason_t reason) {
+    switch (reason) {
+    case ESP_RST_POWERON:
+        return "power_on";
+    case ESP_RST_EXT:
+        return "external";
+    case ESP_RST_SW:
+        return "software";
+    case ESP_RST_PANIC:
+        return "panic";
+    case ESP_RST_INT_WDT:
+        return "interrupt_watchdog";
+    case ESP_RST_TASK_WDT:
+        return "task_watchdog";
+    case ESP_RST_WDT:
+        return "watchdog";
+    case ESP_RST_DEEPSLEEP:
+        return "deep_sleep";
+    case ESP_RST_BROWNOUT:
+        return "brownout";
+    case ESP_RST_SDIO:
+        return "sdio";
+    default:
+        return "unknown";
+    }
+}
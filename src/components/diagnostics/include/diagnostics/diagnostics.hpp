@@ -0,0 +1,71 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef DIAGNOSTICS_DIAGNOSTICS_H_
+#define DIAGNOSTICS_DIAGNOSTICS_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_system.h"
+
+// Start of the RTC user memory. The first 256 bytes of RTC memory
+// belong to the SDK and the upper half of the user area holds
+// .rtc.data, so the counters sit at the bottom of the user area.
+#define DIAGNOSTICS_RTC_ADDR 0x60001100
+#define DIAGNOSTICS_MAGIC 0x44474e31 // "DGN1", bump if the layout changes
+#define DIAGNOSTICS_STACK_TASKS 12 // Tasks whose stack use is tracked
+
+struct diagnostics_counters_t {
+    uint32_t resets; // Boots since the device was powered on
+    esp_reset_reason_t reason; // Why the device last reset
+    uint32_t i2c_errors; // Failed bus transactions since power on
+    uint32_t uptime; // Seconds awake since power on
+};
+
+/**
+ * @brief Load the counters from RTC memory and count this boot
+ *
+ * RTC memory survives software, watchdog and panic resets but holds
+ * garbage after power on, so the block is checksummed and reset to
+ * zero when it does not match. Must be called before anything that
+ * counts an error.
+ *
+ * @return esp_err_t
+ */
+esp_err_t diagnostics_init();
+
+/**
+ * @brief Count a failed I2C transaction
+ */
+void diagnostics_count_i2c_error();
+
+/**
+ * @brief Get the counters
+ *
+ * The uptime is written back to RTC memory at the same time, so a
+ * value that has been exported is never lower after a reset and the
+ * counters stay monotonic for as long as the device has power.
+ *
+ * @param counters Struct to copy the counters into
+ */
+void diagnostics_get(diagnostics_counters_t* counters);
+
+/**
+ * @brief Log the calling task's stack high-water mark if it is a new low
+ *
+ * Does nothing unless CONFIG_DIAGNOSTICS_STACK_REPORT is set. Tasks
+ * call this after their deepest work, so the logs of a device that
+ * has been through everything show what each stack needs.
+ */
+void diagnostics_check_stack();
+
+/**
+ * @brief Get a short name for a reset reason
+ *
+ * @param reason Reason to name
+ * @return const char* Name suitable for a label value
+ */
+const char* diagnostics_reason_name(esp_reset_reason_t reason);
+
+#endif // DIAGNOSTICS_DIAGNOSTICS_H_
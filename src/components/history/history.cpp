@@ -0,0 +1,183 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "history.hpp"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "sampler/sampler.hpp"
+#include "sensor/aht10.hpp"
+
+const char* History::TAG_ = "history";
+
+static const history_raw_t empty_raw_ = { HISTORY_NO_DATA, HISTORY_NO_DATA };
+static const history_point_t empty_point_ = {
+    { HISTORY_NO_DATA, HISTORY_NO_DATA, HISTORY_NO_DATA },
+    { HISTORY_NO_DATA, HISTORY_NO_DATA, HISTORY_NO_DATA },
+};
+
+void HistoryAccumulator::Add(int16_t value) {
+    if (count_ == 0) {
+        min_ = value;
+        max_ = value;
+        sum_ = 0;
+    }
+    if (value < min_) {
+        min_ = value;
+    }
+    if (value > max_) {
+        max_ = value;
+    }
+    sum_ += value;
+    count_++;
+}
+
+void HistoryAccumulator::Result(history_rollup_t* rollup) const {
+    if (count_ == 0) {
+        rollup->min = HISTORY_NO_DATA;
+        rollup->max = HISTORY_NO_DATA;
+        rollup->mean = HISTORY_NO_DATA;
+        return;
+    }
+    rollup->min = min_;
+    rollup->max = max_;
+    // Round to nearest rather than towards zero
+    int32_t half = sum_ < 0 ? -(count_ / 2) : count_ / 2;
+    rollup->mean = (int16_t)((sum_ + half) / count_);
+}
+
+void HistoryAccumulator::Reset() {
+    count_ = 0;
+}
+
+bool HistoryAccumulator::Empty() const {
+    return count_ == 0;
+}
+
+void History::Commit(history_tier_t tier) {
+    if (pending_temperature_[tier].Empty()) {
+        return;
+    }
+
+    history_point_t point;
+    pending_temperature_[tier].Result(&point.temperature);
+    pending_humidity_[tier].Result(&point.humidity);
+    pending_temperature_[tier].Reset();
+    pending_humidity_[tier].Reset();
+
+    if (tier == HISTORY_TIER_SHORT) {
+        short_.Put(pending_bucket_[tier], point, empty_point_);
+    }
+    else {
+        long_.Put(pending_bucket_[tier], point, empty_point_);
+    }
+}
+
+void History::Accumulate(history_tier_t tier, int64_t bucket, const history_raw_t* value) {
+    if (bucket != pending_bucket_[tier]) {
+        Commit(tier);
+        pending_bucket_[tier] = bucket;
+    }
+    pending_temperature_[tier].Add(value->temperature);
+    pending_humidity_[tier].Add(value->humidity);
+}
+
+History::History(uint32_t raw_period_ms) {
+    periods_[HISTORY_TIER_RAW] = raw_period_ms < 1000 ? 1 : raw_period_ms / 1000;
+    periods_[HISTORY_TIER_SHORT] = CONFIG_HISTORY_SHORT_PERIOD;
+    periods_[HISTORY_TIER_LONG] = CONFIG_HISTORY_LONG_PERIOD;
+
+    for (int i = 0; i < HISTORY_TIER_MAX; i++) {
+        pending_bucket_[i] = -1;
+    }
+
+    lock_ = alloc_mutex_create(&lock_storage_);
+    configASSERT(lock_);
+
+    ESP_LOGI(
+        TAG_,
+        "Keeping %ds of raw samples, %ds at %ds resolution and %ds at %ds resolution",
+        CONFIG_HISTORY_RAW_SAMPLES * periods_[HISTORY_TIER_RAW],
+        CONFIG_HISTORY_SHORT_SAMPLES * CONFIG_HISTORY_SHORT_PERIOD,
+        CONFIG_HISTORY_SHORT_PERIOD,
+        CONFIG_HISTORY_LONG_SAMPLES * CONFIG_HISTORY_LONG_PERIOD,
+        CONFIG_HISTORY_LONG_PERIOD
+    );
+}
+
+void History::Record(int64_t timestamp, const aht10_measurement_t* measurement) {
+    int64_t seconds = timestamp / 1000000;
+    history_raw_t value = {
+        measurement->temperature,
+        measurement->humidity,
+    };
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    raw_.Put(seconds / periods_[HISTORY_TIER_RAW], value, empty_raw_);
+    Accumulate(HISTORY_TIER_SHORT, seconds / periods_[HISTORY_TIER_SHORT], &value);
+    Accumulate(HISTORY_TIER_LONG, seconds / periods_[HISTORY_TIER_LONG], &value);
+    xSemaphoreGive(lock_);
+}
+
+void History::Listener(const sampler_sample_t* sample, void* arg) {
+    History* history = (History*)arg;
+    history->Record(sample->timestamp, &sample->measurement);
+}
+
+uint32_t History::GetPeriod(history_tier_t tier) {
+    return periods_[tier];
+}
+
+esp_err_t History::GetRange(history_tier_t tier, int64_t* oldest, int64_t* newest) {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    switch (tier) {
+    case HISTORY_TIER_RAW:
+        *oldest = raw_.Oldest();
+        *newest = raw_.Newest();
+        break;
+    case HISTORY_TIER_SHORT:
+        *oldest = short_.Oldest();
+        *newest = short_.Newest();
+        break;
+    default:
+        *oldest = long_.Oldest();
+        *newest = long_.Newest();
+        break;
+    }
+    xSemaphoreGive(lock_);
+
+    return *newest < 0 ? ESP_ERR_NOT_FOUND : ESP_OK;
+}
+
+esp_err_t History::GetRaw(int64_t bucket, history_raw_t* value) {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    bool found = raw_.Get(bucket, value);
+    xSemaphoreGive(lock_);
+
+    if (!found || value->temperature == HISTORY_NO_DATA) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+esp_err_t History::GetRollup(history_tier_t tier, int64_t bucket, history_point_t* value) {
+    if (tier != HISTORY_TIER_SHORT && tier != HISTORY_TIER_LONG) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    bool found = tier == HISTORY_TIER_SHORT
+        ? short_.Get(bucket, value)
+        : long_.Get(bucket, value);
+    xSemaphoreGive(lock_);
+
+    if (!found || value->temperature.mean == HISTORY_NO_DATA) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return ESP_OK;
+}
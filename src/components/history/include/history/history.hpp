@@ -0,0 +1,276 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef HISTORY_HISTORY_H_
+#define HISTORY_HISTORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "alloc/alloc.hpp"
+#include "sampler/sampler.hpp"
+#include "sensor/aht10.hpp"
+
+// Marks a slot for which no samples were recorded
+#define HISTORY_NO_DATA INT16_MIN
+
+typedef enum {
+    HISTORY_TIER_RAW = 0,
+    HISTORY_TIER_SHORT = 1,
+    HISTORY_TIER_LONG = 2,
+    HISTORY_TIER_MAX,
+} history_tier_t;
+
+// Values are stored in hundredths of a degree / percent. Timestamps are
+// implicit in the slot position so are never stored.
+//
+// Values are absolute rather than deltas from a tier base. The sensor's
+// whole range (-50 to 150 degrees, 0 to 100 percent) already fits in 16
+// bits of hundredths, so a 16 bit delta would save nothing, and a
+// narrower one would clip fast changes and stop any slot being read on
+// its own. The flash log, where space matters more, is delta encoded.
+struct history_raw_t {
+    int16_t temperature;
+    int16_t humidity;
+};
+
+struct history_rollup_t {
+    int16_t min;
+    int16_t max;
+    int16_t mean;
+};
+
+struct history_point_t {
+    history_rollup_t temperature;
+    history_rollup_t humidity;
+};
+
+/**
+ * @brief Fixed size ring of slots indexed by bucket number
+ *
+ * A bucket is the sample time divided by the period of the tier, so
+ * the age of each slot can be derived from its position and no
+ * timestamps need to be kept.
+ */
+template <typename T, size_t N>
+class HistoryRing {
+private:
+    T slots_[N];
+    int64_t first_ = -1;
+    int64_t newest_ = -1;
+
+public:
+    /**
+     * @brief Store a value in the given bucket
+     *
+     * Buckets skipped since the last call are filled with empty. Values
+     * for buckets which have already been overwritten are discarded.
+     *
+     * @param bucket Bucket to store value in
+     * @param value Value to store
+     * @param empty Value to store in any skipped buckets
+     */
+    void Put(int64_t bucket, const T& value, const T& empty) {
+        if (newest_ < 0) {
+            first_ = bucket;
+            newest_ = bucket;
+        }
+        else if (bucket > newest_) {
+            int64_t gap_start = newest_ + 1;
+            if (bucket - gap_start > (int64_t)N) {
+                gap_start = bucket - N;
+            }
+            for (int64_t b = gap_start; b < bucket; b++) {
+                slots_[b % N] = empty;
+            }
+            newest_ = bucket;
+        }
+        else if (bucket <= newest_ - (int64_t)N || bucket < first_) {
+            return;
+        }
+        slots_[bucket % N] = value;
+    }
+
+    /**
+     * @brief Get the value stored in a bucket
+     *
+     * @param bucket Bucket to read
+     * @param value Where to store the value
+     * @return true Bucket is still held in the ring
+     * @return false Bucket has been overwritten or not yet written
+     */
+    bool Get(int64_t bucket, T* value) const {
+        if (newest_ < 0 || bucket > newest_ || bucket < Oldest()) {
+            return false;
+        }
+        *value = slots_[bucket % N];
+        return true;
+    }
+
+    /**
+     * @brief Get the oldest bucket still held in the ring
+     *
+     * @return int64_t -1 if the ring is empty
+     */
+    int64_t Oldest() const {
+        if (newest_ < 0) {
+            return -1;
+        }
+        int64_t oldest = newest_ - N + 1;
+        return oldest > first_ ? oldest : first_;
+    }
+
+    /**
+     * @brief Get the newest bucket held in the ring
+     *
+     * @return int64_t -1 if the ring is empty
+     */
+    int64_t Newest() const {
+        return newest_;
+    }
+};
+
+/**
+ * @brief Running min / max / mean for a single rollup bucket
+ */
+class HistoryAccumulator {
+private:
+    int16_t min_;
+    int16_t max_;
+    int32_t sum_;
+    uint16_t count_ = 0;
+
+public:
+    /**
+     * @brief Add a value to the accumulator
+     *
+     * @param value Value to add
+     */
+    void Add(int16_t value);
+
+    /**
+     * @brief Get the rollup of all values added since the last reset
+     *
+     * @param rollup Where to store the rollup
+     */
+    void Result(history_rollup_t* rollup) const;
+
+    /**
+     * @brief Clear all values
+     */
+    void Reset();
+
+    /**
+     * @brief Check if no values have been added since the last reset
+     */
+    bool Empty() const;
+};
+
+class History {
+private:
+    static const char* TAG_;
+
+    SemaphoreHandle_t lock_;
+    alloc_mutex_t lock_storage_;
+    uint32_t periods_[HISTORY_TIER_MAX];
+
+    HistoryRing<history_raw_t, CONFIG_HISTORY_RAW_SAMPLES> raw_;
+    HistoryRing<history_point_t, CONFIG_HISTORY_SHORT_SAMPLES> short_;
+    HistoryRing<history_point_t, CONFIG_HISTORY_LONG_SAMPLES> long_;
+
+    // Accumulators for the bucket currently being filled in each
+    // rollup tier. Indexed by tier.
+    int64_t pending_bucket_[HISTORY_TIER_MAX];
+    HistoryAccumulator pending_temperature_[HISTORY_TIER_MAX];
+    HistoryAccumulator pending_humidity_[HISTORY_TIER_MAX];
+
+    /**
+     * @brief Add a sample to the current bucket of a rollup tier
+     *
+     * Commits the previous bucket to the ring if the sample belongs to
+     * a new bucket.
+     *
+     * @param tier Tier to update
+     * @param bucket Bucket the sample belongs to
+     * @param value Sample to add
+     */
+    void Accumulate(history_tier_t tier, int64_t bucket, const history_raw_t* value);
+
+    /**
+     * @brief Commit the pending bucket of a rollup tier to its ring
+     *
+     * @param tier Tier to commit
+     */
+    void Commit(history_tier_t tier);
+
+public:
+    /**
+     * @brief Construct a new History object
+     *
+     * @param raw_period_ms Interval at which samples will be recorded
+     */
+    History(uint32_t raw_period_ms);
+
+    /**
+     * @brief Record a measurement
+     *
+     * @param timestamp Time of measurement from esp_timer_get_time()
+     * @param measurement Measurement to record
+     */
+    void Record(int64_t timestamp, const aht10_measurement_t* measurement);
+
+    /**
+     * @brief Sampler listener which records every sample
+     *
+     * @param sample Sample to record
+     * @param arg Pointer to History instance
+     */
+    static void Listener(const sampler_sample_t* sample, void* arg);
+
+    /**
+     * @brief Get the length of each bucket in a tier
+     *
+     * @param tier Tier to query
+     * @return uint32_t Period in seconds
+     */
+    uint32_t GetPeriod(history_tier_t tier);
+
+    /**
+     * @brief Get the range of buckets currently held in a tier
+     *
+     * @param tier Tier to query
+     * @param oldest Oldest bucket
+     * @param newest Newest bucket
+     * @return esp_err_t ESP_ERR_NOT_FOUND if the tier is empty
+     */
+    esp_err_t GetRange(history_tier_t tier, int64_t* oldest, int64_t* newest);
+
+    /**
+     * @brief Read a raw sample
+     *
+     * @param bucket Bucket to read
+     * @param value Where to store sample
+     * @return esp_err_t ESP_ERR_NOT_FOUND if the bucket is not held or
+     * holds no data
+     */
+    esp_err_t GetRaw(int64_t bucket, history_raw_t* value);
+
+    /**
+     * @brief Read a rollup from one of the coarser tiers
+     *
+     * @param tier HISTORY_TIER_SHORT or HISTORY_TIER_LONG
+     * @param bucket Bucket to read
+     * @param value Where to store rollup
+     * @return esp_err_t ESP_ERR_NOT_FOUND if the bucket is not held or
+     * holds no data
+     */
+    esp_err_t GetRollup(history_tier_t tier, int64_t bucket, history_point_t* value);
+};
+
+#endif // HISTORY_HISTORY_H_
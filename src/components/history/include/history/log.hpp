@@ -0,0 +1,238 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef HISTORY_LOG_H_
+#define HISTORY_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "alloc/alloc.hpp"
+#include "sampler/sampler.hpp"
+#include "sensor/aht10.hpp"
+
+// Size of each write to flash. Matches the SPIFFS page size so every
+// flush is a single page aligned append.
+#define SAMPLE_LOG_BLOCK_SIZE 256
+#define SAMPLE_LOG_BLOCKS_PER_SEGMENT (CONFIG_SAMPLE_LOG_SEGMENT_SIZE / SAMPLE_LOG_BLOCK_SIZE)
+#define SAMPLE_LOG_PATH_LEN 32
+
+typedef enum {
+    SAMPLE_LOG_TAG_END = 0x00,   // Rest of block is padding
+    SAMPLE_LOG_TAG_KEY = 0x4B,   // Absolute time and values
+    SAMPLE_LOG_TAG_DELTA = 0x44, // Varint deltas from previous record
+} sample_log_tag_t;
+
+struct sample_log_record_t {
+    uint32_t time; // Unix time in seconds
+    int16_t temperature; // Hundredths of a degree
+    int16_t humidity; // Hundredths of a percent
+};
+
+struct sample_log_segment_t {
+    uint32_t id;
+    uint32_t first_time;
+    uint32_t blocks;
+};
+
+/**
+ * @brief Callback run for each record read from the log
+ *
+ * Returning anything other than ESP_OK stops the read.
+ */
+typedef esp_err_t (*sample_log_reader_t)(const sample_log_record_t* record, void* arg);
+
+/**
+ * @brief Append only sample log stored on SPIFFS
+ *
+ * Records are delta encoded into fixed size blocks which each start with
+ * a key record so any block can be decoded on its own. Blocks are
+ * buffered in RAM and only written once full (or after the flush
+ * interval) to limit flash wear. Blocks are grouped into segment files
+ * and the oldest segment is deleted once the limit is reached.
+ *
+ * Records are stamped with Unix time so they can be matched to real
+ * time across reboots, and a gap in the log is a gap in the readings.
+ * Samples taken before timesync has set the clock are held in RAM and
+ * written once it has. A record which would go back in time is
+ * dropped so the log stays in order.
+ */
+class SampleLog {
+private:
+    static const char* TAG_;
+    const char* base_path_;
+
+    SemaphoreHandle_t lock_;
+    alloc_mutex_t lock_storage_;
+    bool opened_ = false; // Open has been attempted
+    bool ready_ = false;
+
+    // Index of segments on flash, oldest first
+    sample_log_segment_t segments_[CONFIG_SAMPLE_LOG_SEGMENTS];
+    size_t segment_count_ = 0;
+
+    uint8_t block_[SAMPLE_LOG_BLOCK_SIZE];
+    size_t block_len_ = 0;
+    int64_t block_opened_ = 0;
+    sample_log_record_t last_;
+    uint32_t last_time_ = 0; // Time of the newest record, 0 for none
+
+    // Samples waiting for the clock, time is uptime in seconds. Free
+    // running counts, the ring holds pending_first_ to pending_next_.
+    sample_log_record_t pending_[CONFIG_SAMPLE_LOG_PENDING];
+    uint32_t pending_first_ = 0;
+    uint32_t pending_next_ = 0;
+
+    int64_t last_logged_ = -1;
+
+    /**
+     * @brief Get the path of a segment file
+     *
+     * @param id Segment ID
+     * @param path Buffer to store path in
+     */
+    void SegmentPath(uint32_t id, char path[SAMPLE_LOG_PATH_LEN]);
+
+    /**
+     * @brief Read a block from flash
+     *
+     * @param id Segment ID
+     * @param block Block number within segment
+     * @param data Buffer to read into
+     * @param len Number of bytes to read
+     * @return esp_err_t
+     */
+    esp_err_t ReadBlock(uint32_t id, uint32_t block, uint8_t* data, size_t len);
+
+    /**
+     * @brief Write the RAM block to flash, rotating segments as needed
+     *
+     * Must be called with lock_ held.
+     *
+     * @return esp_err_t
+     */
+    esp_err_t WriteBlock();
+
+    /**
+     * @brief Add a record to the RAM block
+     *
+     * Must be called with lock_ held.
+     *
+     * @param record Record with its Unix time
+     * @param uptime Current uptime in seconds
+     */
+    void AppendRecord(const sample_log_record_t* record, int64_t uptime);
+
+    /**
+     * @brief Find the first block which may contain records at or after
+     * the given time
+     *
+     * @param segment Segment to search
+     * @param from Time to search for
+     * @return uint32_t Block number
+     */
+    uint32_t FindBlock(const sample_log_segment_t* segment, uint32_t from);
+
+    /**
+     * @brief Index existing segments and find the newest record
+     *
+     * Must be called with lock_ held once the SPIFFS partition is
+     * mounted.
+     *
+     * @return esp_err_t
+     */
+    esp_err_t Init();
+
+public:
+    /**
+     * @brief Construct a new SampleLog object
+     *
+     * Nothing is read from flash until Open is called. Samples
+     * appended before then are not logged.
+     *
+     * @param base_path Mount point of the SPIFFS partition
+     */
+    SampleLog(const char* base_path);
+
+    /**
+     * @brief Mount the partition and initialise the log
+     *
+     * Mounting, and formatting on first use, can take seconds so this
+     * is called once at the end of startup rather than from the sampler
+     * or a request handler. Only the first call does any work so a
+     * missing or broken partition is not retried.
+     *
+     * @return true if the log is ready
+     */
+    bool Open();
+
+    /**
+     * @brief Whether Open has succeeded
+     *
+     * Never touches flash.
+     *
+     * @return true if the log is ready
+     */
+    bool Ready();
+
+    /**
+     * @brief Append a measurement
+     *
+     * Measurements closer together than the log interval are ignored.
+     * Held in RAM until the clock has been set, dropping the oldest
+     * once CONFIG_SAMPLE_LOG_PENDING are waiting.
+     *
+     * @param timestamp Time of measurement from esp_timer_get_time()
+     * @param measurement Measurement to log
+     */
+    void Append(int64_t timestamp, const aht10_measurement_t* measurement);
+
+    /**
+     * @brief Write any buffered records to flash
+     *
+     * @return esp_err_t
+     */
+    esp_err_t Flush();
+
+    /**
+     * @brief Flush the log from esp_restart
+     *
+     * Soft resets would otherwise lose everything still buffered in
+     * RAM. Only one log can be registered.
+     *
+     * @return esp_err_t
+     */
+    esp_err_t FlushOnRestart();
+
+    /**
+     * @brief Sampler listener which appends every sample
+     *
+     * @param sample Sample to log
+     * @param arg Pointer to SampleLog instance
+     */
+    static void Listener(const sampler_sample_t* sample, void* arg);
+
+    /**
+     * @brief Read all records in a time range, oldest first
+     *
+     * Records are decoded one block at a time so memory use does not
+     * depend on the size of the range. The lock is not held while the
+     * reader runs. Records appended after the read starts are left
+     * out.
+     *
+     * @param from Earliest Unix time to read
+     * @param to Latest Unix time to read
+     * @param reader Callback to run for each record
+     * @param arg Argument passed to reader
+     * @return esp_err_t The first error returned by reader, if any
+     */
+    esp_err_t Read(uint32_t from, uint32_t to, sample_log_reader_t reader, void* arg);
+};
+
+#endif // HISTORY_LOG_H_
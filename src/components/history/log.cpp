@@ -0,0 +1,547 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "log.hpp"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "sdkconfig.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "config/storage.hpp"
+#include "history.hpp"
+#include "sampler/sampler.hpp"
+#include "sensor/aht10.hpp"
+#include "timesync/timesync.hpp"
+
+#define SAMPLE_LOG_KEY_LEN 9
+#define SAMPLE_LOG_DELTA_MAX_LEN 12
+
+const char* SampleLog::TAG_ = "sample_log";
+
+// Log flushed by the shutdown handler
+static SampleLog* restart_log_ = NULL;
+
+/**
+ * @brief Write an unsigned LEB128 varint
+ *
+ * @param buf Buffer to write to
+ * @param value Value to write
+ * @return size_t Number of bytes written
+ */
+static size_t sample_log_put_varint(uint8_t* buf, uint32_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        buf[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = (uint8_t)value;
+    return len;
+}
+
+/**
+ * @brief Read an unsigned LEB128 varint
+ *
+ * @param buf Buffer to read from
+ * @param len Bytes remaining in buffer
+ * @param value Where to store value
+ * @return size_t Number of bytes read, 0 if the varint is truncated
+ */
+static size_t sample_log_get_varint(const uint8_t* buf, size_t len, uint32_t* value) {
+    uint32_t result = 0;
+    for (size_t i = 0; i < len && i < 5; i++) {
+        result |= (uint32_t)(buf[i] & 0x7F) << (7 * i);
+        if (!(buf[i] & 0x80)) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t sample_log_zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t sample_log_unzigzag(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+/**
+ * @brief Encode a key record
+ *
+ * @param buf Buffer of at least SAMPLE_LOG_KEY_LEN bytes
+ * @param record Record to encode
+ * @return size_t Number of bytes written
+ */
+static size_t sample_log_encode_key(uint8_t* buf, const sample_log_record_t* record) {
+    buf[0] = SAMPLE_LOG_TAG_KEY;
+    buf[1] = record->time;
+    buf[2] = record->time >> 8;
+    buf[3] = record->time >> 16;
+    buf[4] = record->time >> 24;
+    buf[5] = (uint16_t)record->temperature;
+    buf[6] = (uint16_t)record->temperature >> 8;
+    buf[7] = (uint16_t)record->humidity;
+    buf[8] = (uint16_t)record->humidity >> 8;
+    return SAMPLE_LOG_KEY_LEN;
+}
+
+/**
+ * @brief Encode a delta record
+ *
+ * @param buf Buffer of at least SAMPLE_LOG_DELTA_MAX_LEN bytes
+ * @param prev Previous record in the block
+ * @param record Record to encode
+ * @return size_t Number of bytes written
+ */
+static size_t sample_log_encode_delta(uint8_t* buf, const sample_log_record_t* prev, const sample_log_record_t* record) {
+    size_t len = 0;
+    buf[len++] = SAMPLE_LOG_TAG_DELTA;
+    len += sample_log_put_varint(buf + len, record->time - prev->time);
+    len += sample_log_put_varint(buf + len, sample_log_zigzag(record->temperature - prev->temperature));
+    len += sample_log_put_varint(buf + len, sample_log_zigzag(record->humidity - prev->humidity));
+    return len;
+}
+
+/**
+ * @brief Decode every record in a block
+ *
+ * @param data Block data
+ * @param len Length of block data
+ * @param from Skip records before this time
+ * @param to Stop at the first record after this time
+ * @param reader Callback to run for each record
+ * @param arg Argument passed to reader
+ * @param done Set to true once a record after to has been seen
+ * @return esp_err_t The error returned by reader, if any
+ */
+static esp_err_t sample_log_decode(
+    const uint8_t* data,
+    size_t len,
+    uint32_t from,
+    uint32_t to,
+    sample_log_reader_t reader,
+    void* arg,
+    bool* done
+) {
+    sample_log_record_t record = { 0, 0, 0 };
+    bool have_key = false;
+    size_t pos = 0;
+
+    while (pos < len) {
+        uint8_t tag = data[pos++];
+        if (tag == SAMPLE_LOG_TAG_KEY) {
+            if (len - pos < SAMPLE_LOG_KEY_LEN - 1) {
+                break;
+            }
+            record.time = (uint32_t)data[pos]
+                | (uint32_t)data[pos + 1] << 8
+                | (uint32_t)data[pos + 2] << 16
+                | (uint32_t)data[pos + 3] << 24;
+            record.temperature = (int16_t)(data[pos + 4] | data[pos + 5] << 8);
+            record.humidity = (int16_t)(data[pos + 6] | data[pos + 7] << 8);
+            pos += SAMPLE_LOG_KEY_LEN - 1;
+            have_key = true;
+        }
+        else if (tag == SAMPLE_LOG_TAG_DELTA && have_key) {
+            uint32_t dt, dtemp, dhum;
+            size_t n;
+            if ((n = sample_log_get_varint(data + pos, len - pos, &dt)) == 0) {
+                break;
+            }
+            pos += n;
+            if ((n = sample_log_get_varint(data + pos, len - pos, &dtemp)) == 0) {
+                break;
+            }
+            pos += n;
+            if ((n = sample_log_get_varint(data + pos, len - pos, &dhum)) == 0) {
+                break;
+            }
+            pos += n;
+            record.time += dt;
+            record.temperature += sample_log_unzigzag(dtemp);
+            record.humidity += sample_log_unzigzag(dhum);
+        }
+        else {
+            // End of block padding or corruption
+            break;
+        }
+
+        if (record.time > to) {
+            *done = true;
+            return ESP_OK;
+        }
+        if (record.time >= from) {
+            esp_err_t err = reader(&record, arg);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Reader which keeps the last record it was given
+ */
+static esp_err_t sample_log_keep_last(const sample_log_record_t* record, void* arg) {
+    *(sample_log_record_t*)arg = *record;
+    return ESP_OK;
+}
+
+void SampleLog::SegmentPath(uint32_t id, char path[SAMPLE_LOG_PATH_LEN]) {
+    snprintf(path, SAMPLE_LOG_PATH_LEN, "%s/log.%u", base_path_, id);
+}
+
+esp_err_t SampleLog::ReadBlock(uint32_t id, uint32_t block, uint8_t* data, size_t len) {
+    char path[SAMPLE_LOG_PATH_LEN];
+    SegmentPath(id, path);
+
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = ESP_OK;
+    if (fseek(f, block * SAMPLE_LOG_BLOCK_SIZE, SEEK_SET) != 0 || fread(data, 1, len, f) != len) {
+        err = ESP_FAIL;
+    }
+    fclose(f);
+    return err;
+}
+
+esp_err_t SampleLog::WriteBlock() {
+    if (block_len_ == 0) {
+        return ESP_OK;
+    }
+    memset(block_ + block_len_, SAMPLE_LOG_TAG_END, sizeof(block_) - block_len_);
+
+    const bool new_segment = segment_count_ == 0
+        || segments_[segment_count_ - 1].blocks >= SAMPLE_LOG_BLOCKS_PER_SEGMENT;
+    const uint32_t id = segment_count_ == 0 ? 0
+        : segments_[segment_count_ - 1].id + (new_segment ? 1 : 0);
+    char path[SAMPLE_LOG_PATH_LEN];
+    SegmentPath(id, path);
+
+    FILE* f = fopen(path, "ab");
+    if (f == NULL) {
+        ESP_LOGE(TAG_, "Failed to open %s", path);
+        return ESP_FAIL;
+    }
+    size_t written = fwrite(block_, 1, sizeof(block_), f);
+    fclose(f);
+    if (written != sizeof(block_)) {
+        ESP_LOGE(TAG_, "Short write to %s (%d bytes)", path, written);
+        if (new_segment) {
+            // Leave nothing behind for Init to index
+            unlink(path);
+        }
+        return ESP_FAIL;
+    }
+
+    // Only rotate once the block is safely on flash, so a failed write
+    // never costs the oldest segment as well
+    if (new_segment) {
+        if (segment_count_ == CONFIG_SAMPLE_LOG_SEGMENTS) {
+            char oldest[SAMPLE_LOG_PATH_LEN];
+            SegmentPath(segments_[0].id, oldest);
+            ESP_LOGI(TAG_, "Removing oldest segment %s", oldest);
+            unlink(oldest);
+            memmove(&segments_[0], &segments_[1], (segment_count_ - 1) * sizeof(segments_[0]));
+            segment_count_--;
+        }
+        sample_log_segment_t* segment = &segments_[segment_count_++];
+        segment->id = id;
+        segment->blocks = 0;
+        // Every block starts with a key record
+        segment->first_time = (uint32_t)block_[1]
+            | (uint32_t)block_[2] << 8
+            | (uint32_t)block_[3] << 16
+            | (uint32_t)block_[4] << 24;
+        ESP_LOGD(TAG_, "Started segment %u", id);
+    }
+    segments_[segment_count_ - 1].blocks++;
+    block_len_ = 0;
+    return ESP_OK;
+}
+
+uint32_t SampleLog::FindBlock(const sample_log_segment_t* segment, uint32_t from) {
+    // Binary search for the last block whose key record is at or before
+    // from. Only the key record at the start of each block is read.
+    uint32_t low = 0;
+    uint32_t high = segment->blocks;
+    while (high - low > 1) {
+        uint32_t mid = low + (high - low) / 2;
+        uint8_t key[SAMPLE_LOG_KEY_LEN];
+
+        xSemaphoreTake(lock_, portMAX_DELAY);
+        esp_err_t err = ReadBlock(segment->id, mid, key, sizeof(key));
+        xSemaphoreGive(lock_);
+        if (err != ESP_OK) {
+            break;
+        }
+
+        uint32_t time = (uint32_t)key[1]
+            | (uint32_t)key[2] << 8
+            | (uint32_t)key[3] << 16
+            | (uint32_t)key[4] << 24;
+        if (time <= from) {
+            low = mid;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+SampleLog::SampleLog(const char* base_path) {
+    base_path_ = base_path;
+    lock_ = alloc_mutex_create(&lock_storage_);
+    configASSERT(lock_);
+}
+
+bool SampleLog::Open() {
+    if (ready_) {
+        return true;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    if (!opened_) {
+        opened_ = true;
+        if (storage_mount() == ESP_OK) {
+            Init();
+        }
+    }
+    const bool ready = ready_;
+    xSemaphoreGive(lock_);
+    return ready;
+}
+
+bool SampleLog::Ready() {
+    return ready_;
+}
+
+esp_err_t SampleLog::Init() {
+    DIR* dir = opendir(base_path_);
+    if (dir == NULL) {
+        ESP_LOGE(TAG_, "Failed to open %s", base_path_);
+        return ESP_FAIL;
+    }
+
+    // Build the segment index, oldest first, keeping only the newest
+    // CONFIG_SAMPLE_LOG_SEGMENTS segments.
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        uint32_t id;
+        char extra;
+        if (sscanf(entry->d_name, "log.%u%c", &id, &extra) != 1) {
+            continue;
+        }
+
+        size_t pos = segment_count_;
+        while (pos > 0 && segments_[pos - 1].id > id) {
+            pos--;
+        }
+        if (segment_count_ == CONFIG_SAMPLE_LOG_SEGMENTS) {
+            char path[SAMPLE_LOG_PATH_LEN];
+            if (pos == 0) {
+                SegmentPath(id, path);
+                unlink(path);
+                continue;
+            }
+            SegmentPath(segments_[0].id, path);
+            unlink(path);
+            memmove(&segments_[0], &segments_[1], (pos - 1) * sizeof(segments_[0]));
+            pos--;
+        }
+        else {
+            memmove(&segments_[pos + 1], &segments_[pos], (segment_count_ - pos) * sizeof(segments_[0]));
+            segment_count_++;
+        }
+        segments_[pos].id = id;
+    }
+    closedir(dir);
+
+    for (size_t i = 0; i < segment_count_; i++) {
+        char path[SAMPLE_LOG_PATH_LEN];
+        SegmentPath(segments_[i].id, path);
+
+        struct stat st;
+        uint8_t key[SAMPLE_LOG_KEY_LEN];
+        segments_[i].blocks = 0;
+        segments_[i].first_time = 0;
+        if (stat(path, &st) == 0 && ReadBlock(segments_[i].id, 0, key, sizeof(key)) == ESP_OK) {
+            segments_[i].blocks = st.st_size / SAMPLE_LOG_BLOCK_SIZE;
+            segments_[i].first_time = (uint32_t)key[1]
+                | (uint32_t)key[2] << 8
+                | (uint32_t)key[3] << 16
+                | (uint32_t)key[4] << 24;
+        }
+    }
+
+    // New records must come after the last one written
+    if (segment_count_ > 0 && segments_[segment_count_ - 1].blocks > 0) {
+        sample_log_segment_t* newest = &segments_[segment_count_ - 1];
+        uint8_t data[SAMPLE_LOG_BLOCK_SIZE];
+        if (ReadBlock(newest->id, newest->blocks - 1, data, sizeof(data)) == ESP_OK) {
+            sample_log_record_t last = { 0, 0, 0 };
+            bool done = false;
+            sample_log_decode(data, sizeof(data), 0, UINT32_MAX, sample_log_keep_last, &last, &done);
+            last_time_ = last.time;
+        }
+    }
+
+    ESP_LOGI(TAG_, "Found %d segments, newest record at %u", segment_count_, last_time_);
+    ready_ = true;
+    return ESP_OK;
+}
+
+void SampleLog::Append(int64_t timestamp, const aht10_measurement_t* measurement) {
+    if (!ready_) {
+        // Not mounted yet, which is left to startup
+        return;
+    }
+    if (last_logged_ >= 0 && timestamp - last_logged_ < (int64_t)CONFIG_SAMPLE_LOG_INTERVAL * 1000000) {
+        return;
+    }
+    last_logged_ = timestamp;
+
+    int64_t uptime = timestamp / 1000000;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    if (block_len_ > 0 && uptime - block_opened_ >= CONFIG_SAMPLE_LOG_FLUSH_INTERVAL) {
+        // A block that is not full yet is kept and retried on the next
+        // sample if the write fails
+        WriteBlock();
+    }
+
+    if (pending_next_ - pending_first_ == CONFIG_SAMPLE_LOG_PENDING) {
+        ESP_LOGW(TAG_, "Clock not set, dropping the oldest unlogged sample");
+        pending_first_++;
+    }
+    sample_log_record_t* pending = &pending_[pending_next_++ % CONFIG_SAMPLE_LOG_PENDING];
+    pending->time = (uint32_t)uptime;
+    pending->temperature = measurement->temperature;
+    pending->humidity = measurement->humidity;
+
+    while (pending_first_ != pending_next_) {
+        sample_log_record_t record = pending_[pending_first_ % CONFIG_SAMPLE_LOG_PENDING];
+        int64_t unix_ms;
+        if (timesync_to_unix_ms((int64_t)record.time * 1000000, &unix_ms) != ESP_OK) {
+            break;
+        }
+        pending_first_++;
+        record.time = (uint32_t)(unix_ms / 1000);
+        AppendRecord(&record, uptime);
+    }
+    xSemaphoreGive(lock_);
+}
+
+void SampleLog::AppendRecord(const sample_log_record_t* record, int64_t uptime) {
+    if (last_time_ != 0 && record->time <= last_time_) {
+        ESP_LOGW(TAG_, "Dropping record at %u, log is already at %u", record->time, last_time_);
+        return;
+    }
+
+    uint8_t encoded[SAMPLE_LOG_DELTA_MAX_LEN];
+    size_t len = 0;
+    if (block_len_ > 0) {
+        len = sample_log_encode_delta(encoded, &last_, record);
+        if (block_len_ + len > sizeof(block_) && WriteBlock() != ESP_OK) {
+            // Nothing more fits, so start again with a key record
+            ESP_LOGW(TAG_, "Dropping %u bytes of unwritten records", block_len_);
+            block_len_ = 0;
+        }
+    }
+    if (block_len_ == 0) {
+        len = sample_log_encode_key(encoded, record);
+        block_opened_ = uptime;
+    }
+
+    memcpy(block_ + block_len_, encoded, len);
+    block_len_ += len;
+    last_ = *record;
+    last_time_ = record->time;
+}
+
+esp_err_t SampleLog::Flush() {
+    if (!ready_) {
+        return ESP_OK;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    esp_err_t err = WriteBlock();
+    xSemaphoreGive(lock_);
+    return err;
+}
+
+static void sample_log_shutdown() {
+    restart_log_->Flush();
+}
+
+esp_err_t SampleLog::FlushOnRestart() {
+    if (restart_log_ != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    restart_log_ = this;
+    return esp_register_shutdown_handler(sample_log_shutdown);
+}
+
+void SampleLog::Listener(const sampler_sample_t* sample, void* arg) {
+    SampleLog* log = (SampleLog*)arg;
+    log->Append(sample->timestamp, &sample->measurement);
+}
+
+esp_err_t SampleLog::Read(uint32_t from, uint32_t to, sample_log_reader_t reader, void* arg) {
+    // Take the index and the unflushed block together. A block written
+    // after this is past the copied block counts, and is read from the
+    // copy instead, so it is neither missed nor read twice.
+    sample_log_segment_t segments[CONFIG_SAMPLE_LOG_SEGMENTS];
+    uint8_t unflushed[SAMPLE_LOG_BLOCK_SIZE];
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    size_t count = segment_count_;
+    memcpy(segments, segments_, count * sizeof(segments[0]));
+    size_t unflushed_len = block_len_;
+    memcpy(unflushed, block_, unflushed_len);
+    xSemaphoreGive(lock_);
+
+    uint8_t data[SAMPLE_LOG_BLOCK_SIZE];
+    bool done = false;
+    for (size_t i = 0; i < count && !done; i++) {
+        if (i + 1 < count && segments[i + 1].first_time <= from) {
+            // Everything in this segment is older than from
+            continue;
+        }
+        if (segments[i].first_time > to) {
+            return ESP_OK;
+        }
+
+        for (uint32_t block = FindBlock(&segments[i], from); block < segments[i].blocks && !done; block++) {
+            xSemaphoreTake(lock_, portMAX_DELAY);
+            esp_err_t err = ReadBlock(segments[i].id, block, data, sizeof(data));
+            xSemaphoreGive(lock_);
+            if (err != ESP_OK) {
+                // Segment was rotated out while we were reading it
+                break;
+            }
+
+            err = sample_log_decode(data, sizeof(data), from, to, reader, arg, &done);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+    }
+    if (done) {
+        return ESP_OK;
+    }
+
+    // Finish with the records which had not been flushed
+    return sample_log_decode(unflushed, unflushed_len, from, to, reader, arg, &done);
+}
@@ -0,0 +1,82 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef LINK_LINK_H_
+#define LINK_LINK_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum {
+    LINK_PHY_NONE, // Not associated yet
+    LINK_PHY_11B,
+    LINK_PHY_11G,
+    LINK_PHY_11N,
+} link_phy_t;
+
+struct link_stats_t {
+    bool associated; // Associated with an access point right now
+    int8_t rssi; // dBm at the last refresh while associated
+    uint8_t channel; // Channel of the last association
+    link_phy_t phy; // Best mode both ends support at the last refresh
+    uint8_t last_reason; // wifi_err_reason_t of the last disconnect, 0 if none
+    uint32_t disconnects; // Disconnects and failed attempts to associate
+    uint32_t reconnects; // Associations after the first
+    int64_t associated_at; // Value of esp_timer_get_time() at the last association
+};
+
+/**
+ * @brief Start refreshing the link quality in the background
+ *
+ * The signal strength and PHY mode are read from the WiFi driver every
+ * CONFIG_LINK_REFRESH_INTERVAL seconds while associated, so reading the
+ * stats never touches the driver. Everything else is recorded from the
+ * WiFi events as they happen.
+ *
+ * @return esp_err_t
+ */
+esp_err_t link_init();
+
+/**
+ * @brief Record an association and refresh straight away
+ *
+ * Call from the WIFI_EVENT_STA_CONNECTED handler.
+ *
+ * @param channel Channel of the access point
+ */
+void link_record_associated(uint8_t channel);
+
+/**
+ * @brief Record a disconnect or a failed attempt to associate
+ *
+ * Call from the WIFI_EVENT_STA_DISCONNECTED handler.
+ *
+ * @param reason wifi_err_reason_t from the event
+ */
+void link_record_disconnected(uint8_t reason);
+
+/**
+ * @brief Get the cached link quality
+ *
+ * @param stats Struct to copy the stats into
+ */
+void link_get_stats(link_stats_t* stats);
+
+/**
+ * @brief Get a short name for a PHY mode
+ *
+ * @param phy Mode to name
+ * @return const char* Name suitable for a label value
+ */
+const char* link_phy_name(link_phy_t phy);
+
+/**
+ * @brief Get a short name for a disconnect reason
+ *
+ * @param reason wifi_err_reason_t to name, 0 for none
+ * @return const char* Name suitable for a label value
+ */
+const char* link_reason_name(uint8_t reason);
+
+#endif // LINK_LINK_H_
@@ -0,0 +1,178 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "link.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+
+#include "alloc/alloc.hpp"
+
+static const char TAG_[] = "link";
+
+static SemaphoreHandle_t lock_ = NULL;
+static alloc_mutex_t lock_storage_;
+static esp_timer_handle_t timer_ = NULL;
+static link_stats_t stats_ = {};
+// Associated at least once, so the next association is a reconnect
+static bool associated_before_ = false;
+
+/**
+ * @brief Read the signal strength and PHY mode from the driver
+ *
+ * Runs from the esp_timer task and the WiFi event handler.
+ *
+ * @param arg Unused
+ */
+static void link_refresh(void* arg) {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    bool associated = stats_.associated;
+    xSemaphoreGive(lock_);
+    if (!associated) {
+        return;
+    }
+
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return;
+    }
+    uint8_t protocols = 0;
+    esp_wifi_get_protocol(WIFI_IF_STA, &protocols);
+    link_phy_t phy = LINK_PHY_NONE;
+    if (ap.phy_11n && (protocols & WIFI_PROTOCOL_11N)) {
+        phy = LINK_PHY_11N;
+    }
+    else if (ap.phy_11g && (protocols & WIFI_PROTOCOL_11G)) {
+        phy = LINK_PHY_11G;
+    }
+    else if (ap.phy_11b && (protocols & WIFI_PROTOCOL_11B)) {
+        phy = LINK_PHY_11B;
+    }
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    stats_.rssi = ap.rssi;
+    stats_.phy = phy;
+    xSemaphoreGive(lock_);
+}
+
+esp_err_t link_init() {
+    if (lock_ != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    lock_ = alloc_mutex_create(&lock_storage_);
+    if (lock_ == NULL) {
+        ESP_LOGE(TAG_, "Failed to create lock");
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_timer_create_args_t args = {};
+    args.callback = link_refresh;
+    args.name = "link";
+    esp_err_t err = esp_timer_create(&args, &timer_);
+    if (err == ESP_OK) {
+        err = esp_timer_start_periodic(timer_, CONFIG_LINK_REFRESH_INTERVAL * 1000000ULL);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to start refresh timer (%s)", esp_err_to_name(err));
+    }
+    return err;
+}
+
+void link_record_associated(uint8_t channel) {
+    if (lock_ == NULL) {
+        return;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    stats_.associated = true;
+    stats_.channel = channel;
+    stats_.associated_at = esp_timer_get_time();
+    if (associated_before_) {
+        stats_.reconnects++;
+    }
+    associated_before_ = true;
+    xSemaphoreGive(lock_);
+    link_refresh(NULL);
+}
+
+void link_record_disconnected(uint8_t reason) {
+    if (lock_ == NULL) {
+        return;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    stats_.associated = false;
+    stats_.last_reason = reason;
+    stats_.disconnects++;
+    xSemaphoreGive(lock_);
+}
+
+void link_get_stats(link_stats_t* stats) {
+    if (lock_ == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    *stats = stats_;
+    xSemaphoreGive(lock_);
+}
+
+const char* link_phy_name(link_phy_t phy) {
+    switch (phy) {
+    case LINK_PHY_11B:
+        return "11b";
+    case LINK_PHY_11G:
+        return "11g";
+    case LINK_PHY_11N:
+        return "11n";
+    default:
+        return "none";
+    }
+}
+
+const char* link_reason_name(uint8_t reason) {
+    switch (reason) {
+    case 0:
+        return "none";
+    case WIFI_REASON_UNSPECIFIED:
+        return "unspecified";
+    case WIFI_REASON_AUTH_EXPIRE:
+        return "auth_expire";
+    case WIFI_REASON_AUTH_LEAVE:
+        return "auth_leave";
+    case WIFI_REASON_ASSOC_EXPIRE:
+        return "assoc_expire";
+    case WIFI_REASON_ASSOC_TOOMANY:
+        return "assoc_too_many";
+    case WIFI_REASON_NOT_AUTHED:
+        return "not_authed";
+    case WIFI_REASON_NOT_ASSOCED:
+        return "not_assoced";
+    case WIFI_REASON_ASSOC_LEAVE:
+        return "assoc_leave";
+    case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT:
+        return "4way_handshake_timeout";
+    case WIFI_REASON_GROUP_KEY_UPDATE_TIMEOUT:
+        return "group_key_update_timeout";
+    case WIFI_REASON_802_1X_AUTH_FAILED:
+        return "802_1x_auth_failed";
+    case WIFI_REASON_BEACON_TIMEOUT:
+        return "beacon_timeout";
+    case WIFI_REASON_NO_AP_FOUND:
+        return "no_ap_found";
+    case WIFI_REASON_AUTH_FAIL:
+        return "auth_fail";
+    case WIFI_REASON_ASSOC_FAIL:
+        return "assoc_fail";
+    case WIFI_REASON_HANDSHAKE_TIMEOUT:
+        return "handshake_timeout";
+    default:
+        return "other";
+    }
+}
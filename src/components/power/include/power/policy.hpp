@@ -0,0 +1,94 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef POWER_POLICY_H_
+#define POWER_POLICY_H_
+
+#include <stdint.h>
+
+// A source with nothing scheduled
+#define POWER_WAKE_NONE INT64_MAX
+
+typedef enum {
+    POWER_STAY_AWAKE, // Wait with the CPU running, modem sleep only
+    POWER_LIGHT_SLEEP, // Stop the CPU and radio until a timer wakes it
+} power_decision_t;
+
+// All times are in microseconds
+struct power_policy_config_t {
+    bool light_sleep; // Light sleep allowed at all
+    int64_t min_sleep; // Shorter windows are not worth the wake up cost
+    int64_t max_sleep; // Longest single sleep, keeps the AP association alive
+    int64_t wake_margin; // Time to wake before something is due
+};
+
+struct power_policy_input_t {
+    int64_t now;
+    int64_t next_wake; // Earliest time a source is due, or POWER_WAKE_NONE
+    bool busy; // Some source needs the device awake
+};
+
+/**
+ * @brief Decides when the device may light sleep and keeps count
+ *
+ * This has no dependencies on the SDK so it can be built and exercised
+ * on a Linux host.
+ */
+class PowerPolicy {
+private:
+    power_policy_config_t config_;
+    int64_t start_;
+    int64_t slept_ = 0;
+    uint32_t wakes_ = 0;
+
+public:
+    /**
+     * @brief Construct a new PowerPolicy object
+     *
+     * @param config Sleep limits
+     * @param now Current time, the start of the duty cycle estimate
+     */
+    PowerPolicy(const power_policy_config_t* config, int64_t now);
+
+    /**
+     * @brief Decide what to do until the next source is due
+     *
+     * @param input Current state of the sources
+     * @param duration Time to stay awake or sleep for. POWER_WAKE_NONE
+     * when staying awake with nothing scheduled, in which case only a
+     * change to the sources ends the wait.
+     * @return power_decision_t
+     */
+    power_decision_t Decide(const power_policy_input_t* input, int64_t* duration);
+
+    /**
+     * @brief Record a completed light sleep
+     *
+     * @param duration Time actually spent asleep
+     */
+    void RecordSleep(int64_t duration);
+
+    /**
+     * @brief Estimate the fraction of time spent awake since start
+     *
+     * @param now Current time
+     * @return uint32_t Awake time in thousandths
+     */
+    uint32_t GetAwakePermille(int64_t now);
+
+    /**
+     * @brief Get the total time spent in light sleep
+     *
+     * @return int64_t
+     */
+    int64_t GetSlept();
+
+    /**
+     * @brief Get the number of wakes from light sleep
+     *
+     * @return uint32_t
+     */
+    uint32_t GetWakes();
+};
+
+#endif // POWER_POLICY_H_
@@ -0,0 +1,88 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef POWER_POWER_H_
+#define POWER_POWER_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "policy.hpp"
+
+#define POWER_MAX_SOURCES 8
+#define POWER_TASK_STACK_SIZE 1536
+#define POWER_TASK_PRIORITY 1 // Only runs once everything else is idle
+
+// Returned by power_register when there is no free slot. Every other
+// function ignores it, so callers need not check.
+#define POWER_SOURCE_INVALID -1
+
+typedef int power_source_t;
+
+struct power_stats_t {
+    uint32_t awake_permille; // Estimated duty cycle
+    int64_t slept; // Total microseconds in light sleep
+    uint32_t wakes; // Wakes from light sleep
+};
+
+/**
+ * @brief Prepare the scheduler
+ *
+ * Must be called before any source is registered.
+ *
+ * @return esp_err_t
+ */
+esp_err_t power_init();
+
+/**
+ * @brief Register something that wakes the device
+ *
+ * Sources start busy, so the device stays awake until the source says
+ * when it next needs to run.
+ *
+ * @param name Name for logging, must outlive the source
+ * @return power_source_t POWER_SOURCE_INVALID if there is no free slot
+ * or power_init has not been called
+ */
+power_source_t power_register(const char* name);
+
+/**
+ * @brief Keep the device awake until the source is idle or scheduled
+ *
+ * @param source Source that is busy
+ */
+void power_busy(power_source_t source);
+
+/**
+ * @brief Allow sleep until the source is next due
+ *
+ * @param source Source to schedule
+ * @param time Value of esp_timer_get_time() when it is due
+ */
+void power_wake_at(power_source_t source, int64_t time);
+
+/**
+ * @brief Allow sleep with nothing scheduled for the source
+ *
+ * @param source Source that is idle
+ */
+void power_idle(power_source_t source);
+
+/**
+ * @brief Apply the modem sleep settings and start the scheduler
+ *
+ * Must be called once WiFi has started.
+ *
+ * @return esp_err_t
+ */
+esp_err_t power_start();
+
+/**
+ * @brief Get the duty cycle estimate and sleep counts
+ *
+ * @param stats Struct to copy the stats into
+ */
+void power_get_stats(power_stats_t* stats);
+
+#endif // POWER_POWER_H_
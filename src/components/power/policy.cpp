@@ -0,0 +1,58 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "policy.hpp"
+
+PowerPolicy::PowerPolicy(const power_policy_config_t* config, int64_t now) {
+    config_ = *config;
+    start_ = now;
+}
+
+power_decision_t PowerPolicy::Decide(const power_policy_input_t* input, int64_t* duration) {
+    int64_t until_due = POWER_WAKE_NONE;
+    if (input->next_wake != POWER_WAKE_NONE) {
+        until_due = input->next_wake > input->now ? input->next_wake - input->now : 0;
+    }
+
+    if (input->busy || !config_.light_sleep) {
+        *duration = until_due;
+        return POWER_STAY_AWAKE;
+    }
+
+    int64_t window = config_.max_sleep;
+    if (until_due != POWER_WAKE_NONE && until_due - config_.wake_margin < window) {
+        window = until_due - config_.wake_margin;
+    }
+    if (window < config_.min_sleep) {
+        *duration = until_due;
+        return POWER_STAY_AWAKE;
+    }
+
+    *duration = window;
+    return POWER_LIGHT_SLEEP;
+}
+
+void PowerPolicy::RecordSleep(int64_t duration) {
+    slept_ += duration;
+    wakes_++;
+}
+
+uint32_t PowerPolicy::GetAwakePermille(int64_t now) {
+    int64_t elapsed = now - start_;
+    if (elapsed <= 0) {
+        return 1000;
+    }
+    int64_t awake = elapsed - slept_;
+    if (awake < 0) {
+        awake = 0;
+    }
+    return awake * 1000 / elapsed;
+}
+
+int64_t PowerPolicy::GetSlept() {
+    return slept_;
+}
+
+uint32_t PowerPolicy::GetWakes() {
+    return wakes_;
+}
@@ -0,0 +1,201 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "power.hpp"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "alloc/alloc.hpp"
+#include "diagnostics/diagnostics.hpp"
+#include "policy.hpp"
+
+struct power_source_entry_t {
+    const char* name;
+    bool busy;
+    int64_t wake; // POWER_WAKE_NONE when idle
+};
+
+static const char TAG_[] = "power";
+
+static SemaphoreHandle_t lock_ = NULL;
+static alloc_mutex_t lock_storage_;
+static TaskHandle_t task_ = NULL;
+#ifdef CONFIG_POWER_LIGHT_SLEEP
+static alloc_task_t<POWER_TASK_STACK_SIZE> task_storage_;
+#endif
+static power_source_entry_t sources_[POWER_MAX_SOURCES];
+static int source_count_ = 0;
+
+static const power_policy_config_t policy_config_ = {
+#ifdef CONFIG_POWER_LIGHT_SLEEP
+    true,
+#else
+    false,
+#endif
+    CONFIG_POWER_MIN_SLEEP * 1000LL,
+    CONFIG_POWER_MAX_SLEEP * 1000LL,
+    CONFIG_POWER_WAKE_MARGIN * 1000LL,
+};
+static PowerPolicy* policy_ = NULL;
+
+/**
+ * @brief Update a source and let the scheduler reconsider
+ *
+ * @param source Source to update
+ * @param busy Whether it needs the device awake
+ * @param wake When it is next due
+ */
+static void power_set(power_source_t source, bool busy, int64_t wake) {
+    if (source < 0 || source >= source_count_) {
+        return;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    sources_[source].busy = busy;
+    sources_[source].wake = wake;
+    xSemaphoreGive(lock_);
+    if (task_ != NULL) {
+        xTaskNotifyGive(task_);
+    }
+}
+
+#ifdef CONFIG_POWER_LIGHT_SLEEP
+static void power_task(void* arg) {
+    while (1) {
+        // Covers the previous light sleep, which is the deepest path
+        diagnostics_check_stack();
+        power_policy_input_t input = { esp_timer_get_time(), POWER_WAKE_NONE, false };
+        const char* next = NULL;
+        xSemaphoreTake(lock_, portMAX_DELAY);
+        for (int i = 0; i < source_count_; i++) {
+            input.busy |= sources_[i].busy;
+            if (!sources_[i].busy && sources_[i].wake < input.next_wake) {
+                input.next_wake = sources_[i].wake;
+                next = sources_[i].name;
+            }
+        }
+        int64_t duration;
+        power_decision_t decision = policy_->Decide(&input, &duration);
+        xSemaphoreGive(lock_);
+
+        if (decision == POWER_LIGHT_SLEEP) {
+            ESP_LOGD(TAG_, "Sleeping for %lldus until %s is due", duration, next != NULL ? next : "nothing");
+            esp_sleep_enable_timer_wakeup(duration);
+            esp_light_sleep_start();
+            int64_t slept = esp_timer_get_time() - input.now;
+
+            xSemaphoreTake(lock_, portMAX_DELAY);
+            policy_->RecordSleep(slept);
+            xSemaphoreGive(lock_);
+            continue;
+        }
+
+        // Always wait at least a tick so a source that is due but has
+        // not run yet can not starve the idle task
+        TickType_t ticks = portMAX_DELAY;
+        if (duration != POWER_WAKE_NONE) {
+            ticks = duration / 1000 / portTICK_PERIOD_MS + 1;
+        }
+        ulTaskNotifyTake(pdTRUE, ticks);
+    }
+}
+#endif
+
+esp_err_t power_init() {
+    lock_ = alloc_mutex_create(&lock_storage_);
+    if (lock_ == NULL) {
+        ESP_LOGE(TAG_, "Failed to create lock");
+        return ESP_ERR_NO_MEM;
+    }
+    static PowerPolicy policy(&policy_config_, esp_timer_get_time());
+    policy_ = &policy;
+    return ESP_OK;
+}
+
+power_source_t power_register(const char* name) {
+    if (lock_ == NULL) {
+        return POWER_SOURCE_INVALID;
+    }
+
+    power_source_t source = POWER_SOURCE_INVALID;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    if (source_count_ < POWER_MAX_SOURCES) {
+        source = source_count_++;
+        sources_[source].name = name;
+        sources_[source].busy = true;
+        sources_[source].wake = POWER_WAKE_NONE;
+    }
+    xSemaphoreGive(lock_);
+
+    if (source == POWER_SOURCE_INVALID) {
+        ESP_LOGE(TAG_, "No free slot for %s", name);
+    }
+    return source;
+}
+
+void power_busy(power_source_t source) {
+    power_set(source, true, POWER_WAKE_NONE);
+}
+
+void power_wake_at(power_source_t source, int64_t time) {
+    power_set(source, false, time);
+}
+
+void power_idle(power_source_t source) {
+    power_set(source, false, POWER_WAKE_NONE);
+}
+
+esp_err_t power_start() {
+    if (lock_ == NULL || task_ != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+#ifdef CONFIG_POWER_MAX_MODEM_SLEEP
+    wifi_config_t config;
+    esp_err_t err = esp_wifi_get_config(WIFI_IF_STA, &config);
+    if (err == ESP_OK) {
+        config.sta.listen_interval = CONFIG_POWER_LISTEN_INTERVAL;
+        err = esp_wifi_set_config(WIFI_IF_STA, &config);
+    }
+    if (err == ESP_OK) {
+        err = esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
+    }
+#else
+    esp_err_t err = esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+#endif
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to enable modem sleep (%s)", esp_err_to_name(err));
+        return err;
+    }
+
+#ifdef CONFIG_POWER_LIGHT_SLEEP
+    err = alloc_task_create(&task_storage_, power_task, "power", NULL, POWER_TASK_PRIORITY, &task_);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to create power task");
+        return err;
+    }
+    ESP_LOGI(TAG_, "Light sleep enabled with %d sources", source_count_);
+#endif
+    return ESP_OK;
+}
+
+void power_get_stats(power_stats_t* stats) {
+    if (lock_ == NULL) {
+        stats->awake_permille = 1000;
+        stats->slept = 0;
+        stats->wakes = 0;
+        return;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    stats->awake_permille = policy_->GetAwakePermille(esp_timer_get_time());
+    stats->slept = policy_->GetSlept();
+    stats->wakes = policy_->GetWakes();
+    xSemaphoreGive(lock_);
+}
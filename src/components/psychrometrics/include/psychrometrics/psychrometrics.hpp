@@ -0,0 +1,63 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef PSYCHROMETRICS_PSYCHROMETRICS_H_
+#define PSYCHROMETRICS_PSYCHROMETRICS_H_
+
+#include <stdint.h>
+
+// Range covered by the saturation vapour pressure table, in hundredths
+// of a degree. This is the operating range of the AHT10, temperatures
+// outside it are clamped.
+#define PSYCHROMETRICS_MIN_TEMPERATURE -4000
+#define PSYCHROMETRICS_MAX_TEMPERATURE 8500
+
+/**
+ * @brief Saturation vapour pressure over water
+ *
+ * Uses the Magnus formula, tabulated at 1 degree intervals and
+ * linearly interpolated between them.
+ *
+ * @param temperature Temperature in hundredths of a degree Celsius
+ * @return uint32_t Pressure in hundredths of a pascal
+ */
+uint32_t psychrometrics_saturation_pressure(int32_t temperature);
+
+/**
+ * @brief Dew point
+ *
+ * Found by looking up the actual vapour pressure in the same table
+ * used for saturation pressure, so no logarithm is needed. Very dry
+ * air whose dew point is below the table is clamped to
+ * PSYCHROMETRICS_MIN_TEMPERATURE.
+ *
+ * @param temperature Temperature in hundredths of a degree Celsius
+ * @param humidity Relative humidity in hundredths of a percent
+ * @return int32_t Dew point in hundredths of a degree Celsius
+ */
+int32_t psychrometrics_dew_point(int32_t temperature, int32_t humidity);
+
+/**
+ * @brief Absolute humidity, the mass of water vapour per volume of air
+ *
+ * @param temperature Temperature in hundredths of a degree Celsius
+ * @param humidity Relative humidity in hundredths of a percent
+ * @return int32_t Absolute humidity in hundredths of a gram per cubic
+ * metre
+ */
+int32_t psychrometrics_absolute_humidity(int32_t temperature, int32_t humidity);
+
+/**
+ * @brief Heat index, the apparent temperature felt by people
+ *
+ * Follows the US National Weather Service algorithm: the Steadman
+ * approximation for mild conditions and the Rothfusz regression with
+ * its low and high humidity adjustments otherwise.
+ *
+ * @param temperature Temperature in hundredths of a degree Celsius
+ * @param humidity Relative humidity in hundredths of a percent
+ * @return int32_t Heat index in hundredths of a degree Celsius
+ */
+int32_t psychrometrics_heat_index(int32_t temperature, int32_t humidity);
+
+#endif // PSYCHROMETRICS_PSYCHROMETRICS_H_
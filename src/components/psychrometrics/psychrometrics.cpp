@@ -0,0 +1,208 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "psychrometrics.hpp"
+
+#include <stddef.h>
+
+#define TABLE_STEP 100 // Hundredths of a degree between table entries
+#define TABLE_LEN ((PSYCHROMETRICS_MAX_TEMPERATURE - PSYCHROMETRICS_MIN_TEMPERATURE) / TABLE_STEP + 1)
+
+#define KELVIN_OFFSET 27315 // Hundredths of a degree
+
+// Saturation vapour pressure over water in hundredths of a pascal, one
+// entry per degree from PSYCHROMETRICS_MIN_TEMPERATURE. Generated from
+// the Magnus formula with the WMO coefficients:
+//   round(611.2 * exp(17.62 * t / (243.12 + t)) * 100)
+static const uint32_t saturation_table_[TABLE_LEN] = {
+    1902, 2109, 2336, 2586, 2858, 3157, 3484, 3840,
+    4230, 4654, 5117, 5620, 6168, 6764, 7410, 8112,
+    8872, 9696, 10588, 11553, 12597, 13723, 14939, 16251,
+    17665, 19187, 20826, 22589, 24483, 26518, 28703, 31047,
+    33559, 36251, 39134, 42218, 45517, 49043, 52809, 56830,
+    61120, 65695, 70570, 75763, 81292, 87174, 93430, 100079,
+    107143, 114643, 122603, 131046, 139998, 149483, 159531, 170167,
+    181423, 193327, 205913, 219212, 233260, 248090, 263742, 280251,
+    297659, 316006, 335334, 355689, 377115, 399660, 423372, 448303,
+    474505, 502031, 530939, 561284, 593128, 626531, 661558, 698274,
+    736746, 777044, 819241, 863409, 909627, 957971, 1008523, 1061367,
+    1116588, 1174274, 1234516, 1297407, 1363042, 1431521, 1502945, 1577416,
+    1655043, 1735933, 1820201, 1907960, 1999329, 2094429, 2193384, 2296322,
+    2403374, 2514671, 2630353, 2750558, 2875431, 3005117, 3139768, 3279536,
+    3424580, 3575059, 3731139, 3892987, 4060774, 4234677, 4414874, 4601548,
+    4794885, 4995078, 5202319, 5416808, 5638748, 5868344,
+};
+
+/**
+ * @brief Divide rounding half away from zero
+ *
+ * @param value Value to divide
+ * @param divisor Divisor, must be positive
+ * @return int64_t
+ */
+static int64_t psychrometrics_div_round(int64_t value, int64_t divisor) {
+    if (value < 0) {
+        return (value - divisor / 2) / divisor;
+    }
+    return (value + divisor / 2) / divisor;
+}
+
+/**
+ * @brief Integer square root, rounded down
+ *
+ * @param value Value to take the root of
+ * @return uint32_t
+ */
+static uint32_t psychrometrics_isqrt(uint32_t value) {
+    uint32_t root = 0;
+    uint32_t bit = 1u << 30;
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+/**
+ * @brief Clamp relative humidity to 0 - 100%
+ *
+ * @param humidity Relative humidity in hundredths of a percent
+ * @return int32_t
+ */
+static int32_t psychrometrics_clamp_humidity(int32_t humidity) {
+    if (humidity < 0) {
+        return 0;
+    }
+    if (humidity > 10000) {
+        return 10000;
+    }
+    return humidity;
+}
+
+/**
+ * @brief Actual vapour pressure of the air
+ *
+ * @param temperature Temperature in hundredths of a degree Celsius
+ * @param humidity Relative humidity in hundredths of a percent
+ * @return uint32_t Pressure in hundredths of a pascal
+ */
+static uint32_t psychrometrics_vapour_pressure(int32_t temperature, int32_t humidity) {
+    uint64_t saturation = psychrometrics_saturation_pressure(temperature);
+    return (saturation * psychrometrics_clamp_humidity(humidity) + 5000) / 10000;
+}
+
+uint32_t psychrometrics_saturation_pressure(int32_t temperature) {
+    if (temperature <= PSYCHROMETRICS_MIN_TEMPERATURE) {
+        return saturation_table_[0];
+    }
+    if (temperature >= PSYCHROMETRICS_MAX_TEMPERATURE) {
+        return saturation_table_[TABLE_LEN - 1];
+    }
+
+    uint32_t offset = temperature - PSYCHROMETRICS_MIN_TEMPERATURE;
+    size_t index = offset / TABLE_STEP;
+    uint32_t fraction = offset % TABLE_STEP;
+    uint32_t low = saturation_table_[index];
+    uint32_t high = saturation_table_[index + 1];
+    return low + ((high - low) * fraction + TABLE_STEP / 2) / TABLE_STEP;
+}
+
+int32_t psychrometrics_dew_point(int32_t temperature, int32_t humidity) {
+    uint32_t pressure = psychrometrics_vapour_pressure(temperature, humidity);
+    if (pressure <= saturation_table_[0]) {
+        return PSYCHROMETRICS_MIN_TEMPERATURE;
+    }
+    if (pressure >= saturation_table_[TABLE_LEN - 1]) {
+        return PSYCHROMETRICS_MAX_TEMPERATURE;
+    }
+
+    // Find the entry at or below the pressure. The table is strictly
+    // increasing so the inverse interpolates just like the forward
+    // lookup.
+    size_t low = 0;
+    size_t high = TABLE_LEN - 1;
+    while (high - low > 1) {
+        size_t mid = (low + high) / 2;
+        if (saturation_table_[mid] <= pressure) {
+            low = mid;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    uint32_t step = saturation_table_[high] - saturation_table_[low];
+    uint32_t fraction = ((uint64_t)(pressure - saturation_table_[low]) * TABLE_STEP + step / 2) / step;
+    return PSYCHROMETRICS_MIN_TEMPERATURE + (int32_t)low * TABLE_STEP + (int32_t)fraction;
+}
+
+int32_t psychrometrics_absolute_humidity(int32_t temperature, int32_t humidity) {
+    // rho = e / (Rv * T) with Rv = 461.5 J/(kg K). With e in hundredths
+    // of a pascal, T in hundredths of a kelvin and the result in
+    // hundredths of a gram per cubic metre that is
+    // e * 200000 / (923 * T).
+    uint64_t pressure = psychrometrics_vapour_pressure(temperature, humidity);
+    int64_t kelvin = (int64_t)temperature + KELVIN_OFFSET;
+    if (kelvin <= 0) {
+        return 0;
+    }
+    return psychrometrics_div_round(pressure * 200000, 923 * kelvin);
+}
+
+int32_t psychrometrics_heat_index(int32_t temperature, int32_t humidity) {
+    // The NWS formulae are in Fahrenheit so work in hundredths of a
+    // degree Fahrenheit and of a percent
+    int64_t t = psychrometrics_div_round((int64_t)temperature * 9, 5) + 3200;
+    int64_t r = psychrometrics_clamp_humidity(humidity);
+
+    // Steadman: 0.5 * (T + 61 + (T - 68) * 1.2 + RH * 0.094)
+    int64_t index = psychrometrics_div_round(t * 11, 10) - 1030 + psychrometrics_div_round(r * 47, 1000);
+
+    // The regression takes over when the average of the Steadman value
+    // and the temperature reaches 80 F. Multiplied out in terms of the
+    // Celsius input that is 3.78 T + 0.047 RH >= 103.1, which can be
+    // tested exactly rather than on the rounded values above.
+    if (3780LL * temperature + 47LL * r >= 10310000LL) {
+        // Rothfusz regression. Every product is kept in hundredths so
+        // the terms stay well within 64 bits, and the coefficients are
+        // scaled by 10^8, giving a sum in units of 10^-10 F.
+        int64_t tt = t * t / 100;
+        int64_t rr = r * r / 100;
+        int64_t tr = t * r / 100;
+        int64_t ttr = tt * r / 100;
+        int64_t trr = t * rr / 100;
+        int64_t ttrr = tt * rr / 100;
+        int64_t sum = -423790000000LL
+            + 204901523LL * t
+            + 1014333127LL * r
+            - 22475541LL * tr
+            - 683783LL * tt
+            - 5481717LL * rr
+            + 122874LL * ttr
+            + 85282LL * trr
+            - 199LL * ttrr;
+        index = psychrometrics_div_round(sum, 100000000LL);
+
+        if (r < 1300 && t >= 8000 && t <= 11200) {
+            // ((13 - RH) / 4) * sqrt((17 - |T - 95|) / 17)
+            int64_t distance = t > 9500 ? t - 9500 : 9500 - t;
+            uint32_t root = psychrometrics_isqrt((1700 - distance) * 10000 / 1700);
+            index -= psychrometrics_div_round((1300 - r) * root, 400);
+        }
+        else if (r > 8500 && t >= 8000 && t <= 8700) {
+            // ((RH - 85) / 10) * ((87 - T) / 5)
+            index += psychrometrics_div_round((r - 8500) * (8700 - t), 5000);
+        }
+    }
+
+    return psychrometrics_div_round((index - 3200) * 5, 9);
+}
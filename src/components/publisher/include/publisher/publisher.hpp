@@ -0,0 +1,136 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef PUBLISHER_PUBLISHER_H_
+#define PUBLISHER_PUBLISHER_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "alloc/alloc.hpp"
+#include "sampler/sampler.hpp"
+
+#define PUBLISHER_TASK_STACK_SIZE 3072
+#define PUBLISHER_TASK_PRIORITY 4
+#define PUBLISHER_TOPIC_LEN 64
+#define PUBLISHER_PAYLOAD_LEN 128
+
+/**
+ * @brief Publishes samples to an MQTT broker
+ *
+ * A sample is only published when temperature or humidity has moved
+ * further than the deadband from the last published value, or when
+ * the heartbeat interval has passed without a publish. Each publish is
+ * a single QoS 0 message holding the measurements and device health so
+ * the radio is used as little as possible, e.g.
+ *
+ *     {"t":21.50,"h":40.25,"up":3600,"heap":31200,"rssi":-61}
+ *
+ * with temperature in degrees Celsius, relative humidity in percent,
+ * uptime in seconds, free heap in bytes and WiFi signal strength in
+ * dBm.
+ *
+ * The broker is told the sensor is online through a retained message on
+ * the status topic, with a last will to mark it offline.
+ */
+class MqttPublisher {
+private:
+    static const char* TAG_;
+
+    const char* uri_;
+    const char* topic_;
+    char status_topic_[PUBLISHER_TOPIC_LEN];
+    esp_mqtt_client_handle_t client_ = NULL;
+    TaskHandle_t task_ = NULL;
+    alloc_task_t<PUBLISHER_TASK_STACK_SIZE> task_storage_;
+    SemaphoreHandle_t lock_;
+    alloc_mutex_t lock_storage_;
+
+    // Sample waiting for the task to publish
+    sampler_sample_t pending_;
+
+    // Last published values in hundredths
+    bool published_ = false;
+    int16_t last_temperature_;
+    int16_t last_humidity_;
+    int64_t last_publish_;
+
+    bool connected_ = false;
+
+    /**
+     * @brief FreeRTOS entry point for the publisher task
+     *
+     * @param arg Pointer to the MqttPublisher instance
+     */
+    static void Task(void* arg);
+
+    /**
+     * @brief Handle events from the MQTT client
+     *
+     * @param event MQTT event, user_context is the MqttPublisher
+     * @return esp_err_t
+     */
+    static esp_err_t EventHandler(esp_mqtt_event_handle_t event);
+
+    /**
+     * @brief Decide whether a sample should be published
+     *
+     * Must be called with lock_ held.
+     *
+     * @param sample New sample
+     * @return true Sample should be published
+     * @return false Sample is within the deadband
+     */
+    bool ShouldPublish(const sampler_sample_t* sample);
+
+    /**
+     * @brief Record a sample as the last one published
+     *
+     * Must be called with lock_ held.
+     *
+     * @param sample Sample the broker has been sent
+     */
+    void Commit(const sampler_sample_t* sample);
+
+    /**
+     * @brief Format and publish a sample
+     *
+     * @param sample Sample to publish
+     * @return esp_err_t ESP_FAIL if the client could not send it
+     */
+    esp_err_t Publish(const sampler_sample_t* sample);
+
+public:
+    /**
+     * @brief Construct a new MqttPublisher object
+     *
+     * @param uri Broker URI, e.g. mqtt://broker.local
+     * @param topic Topic to publish samples to
+     */
+    MqttPublisher(const char* uri, const char* topic);
+
+    /**
+     * @brief Sampler listener which hands samples to the publisher task
+     *
+     * @param sample New sample
+     * @param arg Pointer to MqttPublisher instance
+     */
+    static void Listener(const sampler_sample_t* sample, void* arg);
+
+    /**
+     * @brief Connect to the broker and start the publisher task
+     *
+     * Must be called once the network stack has been initialised.
+     *
+     * @return esp_err_t
+     */
+    esp_err_t Start();
+};
+
+#endif // PUBLISHER_PUBLISHER_H_
@@ -0,0 +1,185 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "publisher.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+#include "mqtt_client.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "diagnostics/diagnostics.hpp"
+#include "sensor/fixed.hpp"
+#include "sampler/sampler.hpp"
+#include "sdkconfig.h"
+
+const char* MqttPublisher::TAG_ = "publisher";
+
+void MqttPublisher::Task(void* arg) {
+    MqttPublisher* publisher = (MqttPublisher*)arg;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        xSemaphoreTake(publisher->lock_, portMAX_DELAY);
+        sampler_sample_t sample = publisher->pending_;
+        // Checked again as a sample published since the notify may
+        // have brought this one into the deadband
+        bool publish = publisher->connected_ && publisher->ShouldPublish(&sample);
+        xSemaphoreGive(publisher->lock_);
+
+        if (publish && publisher->Publish(&sample) == ESP_OK) {
+            xSemaphoreTake(publisher->lock_, portMAX_DELAY);
+            publisher->Commit(&sample);
+            xSemaphoreGive(publisher->lock_);
+        }
+        diagnostics_check_stack();
+    }
+}
+
+esp_err_t MqttPublisher::EventHandler(esp_mqtt_event_handle_t event) {
+    MqttPublisher* publisher = (MqttPublisher*)event->user_context;
+    switch (event->event_id) {
+    case MQTT_EVENT_CONNECTED:
+        ESP_LOGI(TAG_, "Connected to broker");
+        esp_mqtt_client_publish(event->client, publisher->status_topic_, "online", 0, 1, 1);
+        xSemaphoreTake(publisher->lock_, portMAX_DELAY);
+        publisher->connected_ = true;
+        // Anything published before the disconnect may have been lost
+        publisher->published_ = false;
+        xSemaphoreGive(publisher->lock_);
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        ESP_LOGW(TAG_, "Disconnected from broker");
+        xSemaphoreTake(publisher->lock_, portMAX_DELAY);
+        publisher->connected_ = false;
+        xSemaphoreGive(publisher->lock_);
+        break;
+    default:
+        break;
+    }
+    return ESP_OK;
+}
+
+bool MqttPublisher::ShouldPublish(const sampler_sample_t* sample) {
+    int16_t temperature = sample->measurement.temperature;
+    int16_t humidity = sample->measurement.humidity;
+
+    if (published_
+        && abs(temperature - last_temperature_) < CONFIG_PUBLISHER_DEADBAND_TEMPERATURE
+        && abs(humidity - last_humidity_) < CONFIG_PUBLISHER_DEADBAND_HUMIDITY
+        && sample->timestamp - last_publish_ < CONFIG_PUBLISHER_HEARTBEAT * 1000000LL) {
+        return false;
+    }
+    return true;
+}
+
+void MqttPublisher::Commit(const sampler_sample_t* sample) {
+    published_ = true;
+    last_temperature_ = sample->measurement.temperature;
+    last_humidity_ = sample->measurement.humidity;
+    last_publish_ = sample->timestamp;
+}
+
+esp_err_t MqttPublisher::Publish(const sampler_sample_t* sample) {
+    wifi_ap_record_t ap;
+    int rssi = 0;
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+        rssi = ap.rssi;
+    }
+
+    char temperature[FIXED_CENTI_STR_LEN];
+    char humidity[FIXED_CENTI_STR_LEN];
+    fixed_format_centi(temperature, sizeof(temperature), sample->measurement.temperature);
+    fixed_format_centi(humidity, sizeof(humidity), sample->measurement.humidity);
+
+    char payload[PUBLISHER_PAYLOAD_LEN];
+    int len = snprintf(
+        payload,
+        sizeof(payload),
+        "{\"t\":%s,\"h\":%s,\"up\":%lld,\"heap\":%u,\"rssi\":%d}",
+        temperature,
+        humidity,
+        (long long)(sample->timestamp / 1000000),
+        esp_get_free_heap_size(),
+        rssi
+    );
+
+    if (esp_mqtt_client_publish(client_, topic_, payload, len, 0, 0) < 0) {
+        // Left uncommitted so the next sample is sent whatever it reads
+        ESP_LOGW(TAG_, "Failed to publish sample");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+MqttPublisher::MqttPublisher(const char* uri, const char* topic) {
+    uri_ = uri;
+    topic_ = topic;
+    snprintf(status_topic_, sizeof(status_topic_), "%s/status", topic);
+    lock_ = alloc_mutex_create(&lock_storage_);
+    configASSERT(lock_);
+}
+
+void MqttPublisher::Listener(const sampler_sample_t* sample, void* arg) {
+    MqttPublisher* publisher = (MqttPublisher*)arg;
+
+    xSemaphoreTake(publisher->lock_, portMAX_DELAY);
+    // While disconnected nothing counts as published, so the first
+    // sample after reconnecting always goes out. Only a successful
+    // publish moves the deadband, so samples keep being handed over
+    // until one gets through.
+    bool publish = publisher->connected_ && publisher->ShouldPublish(sample);
+    if (publish) {
+        publisher->pending_ = *sample;
+    }
+    xSemaphoreGive(publisher->lock_);
+
+    // Publishing can block on the network so leave it to our own task
+    if (publish) {
+        xTaskNotifyGive(publisher->task_);
+    }
+}
+
+esp_err_t MqttPublisher::Start() {
+    if (task_ != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = alloc_task_create(&task_storage_, Task, "publisher", this, PUBLISHER_TASK_PRIORITY, &task_);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to create publisher task");
+        return err;
+    }
+
+    esp_mqtt_client_config_t config = {};
+    config.uri = uri_;
+    config.event_handle = EventHandler;
+    config.user_context = this;
+    config.lwt_topic = status_topic_;
+    config.lwt_msg = "offline";
+    config.lwt_qos = 1;
+    config.lwt_retain = 1;
+    config.keepalive = CONFIG_PUBLISHER_HEARTBEAT * 2;
+
+    client_ = esp_mqtt_client_init(&config);
+    if (client_ == NULL) {
+        ESP_LOGE(TAG_, "Failed to create MQTT client");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG_, "Publishing samples to %s on %s", topic_, uri_);
+    err = esp_mqtt_client_start(client_);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to start MQTT client (%s)", esp_err_to_name(err));
+        return err;
+    }
+    return ESP_OK;
+}
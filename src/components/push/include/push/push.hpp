@@ -0,0 +1,127 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef PUSH_PUSH_H_
+#define PUSH_PUSH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_http_client.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "remote_write.hpp"
+#include "alloc/alloc.hpp"
+#include "sampler/sampler.hpp"
+#include "sdkconfig.h"
+
+#define PUSH_TASK_STACK_SIZE 4096
+#define PUSH_TASK_PRIORITY 4
+#define PUSH_TIMEOUT 5000
+#define PUSH_MIN_BACKOFF 2 // Seconds
+
+/**
+ * @brief Pushes samples to a Prometheus remote_write endpoint
+ *
+ * For devices Prometheus can not scrape, e.g. behind NAT. Samples from
+ * the sampler are kept in a ring until they have been delivered, and
+ * sent in batches as snappy compressed protobuf. Failed requests are
+ * retried with exponential backoff. If the endpoint is unreachable for
+ * long enough the oldest samples are overwritten.
+ *
+ * Samples can only be sent once timesync has set the clock as
+ * remote_write needs wall clock timestamps.
+ */
+class PushExporter {
+private:
+    static const char* TAG_;
+
+    const char* url_;
+    TaskHandle_t task_ = NULL;
+    alloc_task_t<PUSH_TASK_STACK_SIZE> task_storage_;
+    SemaphoreHandle_t lock_;
+    alloc_mutex_t lock_storage_;
+
+    push_sample_t ring_[CONFIG_PUSH_RING_SAMPLES];
+    // Free running counts of samples, the ring holds first_ to next_
+    uint32_t first_ = 0;
+    uint32_t next_ = 0;
+
+#ifdef CONFIG_STATIC_MEMORY
+    // Sized for a full batch once at start and reused for every batch
+    uint8_t* raw_ = NULL;
+    size_t raw_max_ = 0;
+    uint8_t* compressed_ = NULL;
+    size_t compressed_max_ = 0;
+#endif
+
+    /**
+     * @brief FreeRTOS entry point for the push task
+     *
+     * @param arg Pointer to the PushExporter instance
+     */
+    static void Task(void* arg);
+
+    /**
+     * @brief Copy the oldest samples out of the ring
+     *
+     * @param samples Where to copy samples to
+     * @param max Maximum number of samples to copy
+     * @param start Where to store the count of the first sample copied
+     * @return size_t Number of samples copied
+     */
+    size_t Peek(push_sample_t* samples, size_t max, uint32_t* start);
+
+    /**
+     * @brief Remove samples from the ring once they have been sent
+     *
+     * Samples that have already been overwritten are skipped.
+     *
+     * @param end Count of the sample after the last one sent
+     */
+    void Consume(uint32_t end);
+
+    /**
+     * @brief Encode, compress and POST a batch of samples
+     *
+     * @param client HTTP client to send with
+     * @param samples Samples to send
+     * @param count Number of samples
+     * @param epoch_ms Unix time in milliseconds at uptime zero
+     * @return esp_err_t ESP_ERR_INVALID_RESPONSE if the endpoint
+     * rejected the batch and it should not be retried, ESP_FAIL if it
+     * should be retried
+     */
+    esp_err_t Send(esp_http_client_handle_t client, const push_sample_t* samples, size_t count, int64_t epoch_ms);
+
+public:
+    /**
+     * @brief Construct a new PushExporter object
+     *
+     * @param url remote_write endpoint to POST to
+     */
+    PushExporter(const char* url);
+
+    /**
+     * @brief Sampler listener which queues every sample to be pushed
+     *
+     * @param sample Sample to queue
+     * @param arg Pointer to PushExporter instance
+     */
+    static void Listener(const sampler_sample_t* sample, void* arg);
+
+    /**
+     * @brief Start the background push task
+     *
+     * Must be called once the network stack has been initialised.
+     *
+     * @return esp_err_t
+     */
+    esp_err_t Start();
+};
+
+#endif // PUSH_PUSH_H_
@@ -0,0 +1,62 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef PUSH_REMOTE_WRITE_H_
+#define PUSH_REMOTE_WRITE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+struct push_sample_t {
+    uint32_t uptime; // Seconds since boot when taken
+    int16_t temperature; // Hundredths of a degree
+    int16_t humidity; // Hundredths of a percent
+};
+
+struct push_label_t {
+    const char* name;
+    const char* value;
+};
+
+/**
+ * @brief Get the largest possible size of an encoded write request
+ *
+ * @param count Number of samples
+ * @param labels Labels added to every series
+ * @param label_count Number of labels
+ * @return size_t
+ */
+size_t push_remote_write_max_length(size_t count, const push_label_t* labels, size_t label_count);
+
+/**
+ * @brief Encode samples as a Prometheus remote_write WriteRequest
+ *
+ * Produces the uncompressed protobuf message with one series for
+ * temperature and one for humidity. Prometheus requires labels to be
+ * sorted by name, __name__ is added first so the given labels must
+ * sort after it.
+ *
+ * @param samples Samples to encode, oldest first
+ * @param count Number of samples
+ * @param epoch_ms Unix time in milliseconds at uptime zero
+ * @param labels Labels added to every series, sorted by name
+ * @param label_count Number of labels
+ * @param buf Buffer to write to
+ * @param len Size of buffer
+ * @param written Where to store length of message
+ * @return esp_err_t ESP_ERR_INVALID_SIZE if the buffer is too small
+ */
+esp_err_t push_remote_write_encode(
+    const push_sample_t* samples,
+    size_t count,
+    int64_t epoch_ms,
+    const push_label_t* labels,
+    size_t label_count,
+    uint8_t* buf,
+    size_t len,
+    size_t* written
+);
+
+#endif // PUSH_REMOTE_WRITE_H_
@@ -0,0 +1,43 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef PUSH_SNAPPY_H_
+#define PUSH_SNAPPY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Largest input that can be compressed, offsets are 16 bit
+#define SNAPPY_MAX_INPUT 65535
+#define SNAPPY_HASH_BITS 10
+
+/**
+ * @brief Get the largest possible size of compressed data
+ *
+ * @param len Length of uncompressed data
+ * @return size_t
+ */
+size_t snappy_max_compressed_length(size_t len);
+
+/**
+ * @brief Compress data using the Snappy block format
+ *
+ * A simple greedy compressor, producing output that any Snappy
+ * decompressor can read. Uses a 2 KiB hash table allocated on the heap
+ * for the duration of the call, or a single static table in static
+ * memory mode so calls must not overlap.
+ *
+ * @param in Data to compress
+ * @param in_len Length of data, at most SNAPPY_MAX_INPUT
+ * @param out Buffer for compressed data
+ * @param out_len Size of buffer, should be at least
+ * snappy_max_compressed_length(in_len)
+ * @param written Where to store length of compressed data
+ * @return esp_err_t ESP_ERR_INVALID_SIZE if the input is too large or
+ * the output does not fit
+ */
+esp_err_t snappy_compress(const uint8_t* in, size_t in_len, uint8_t* out, size_t out_len, size_t* written);
+
+#endif // PUSH_SNAPPY_H_
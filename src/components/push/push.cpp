@@ -0,0 +1,227 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "push.hpp"
+
+#include <stdlib.h>
+
+#include "esp_err.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_system.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "diagnostics/diagnostics.hpp"
+#include "remote_write.hpp"
+#include "sampler/sampler.hpp"
+#include "sdkconfig.h"
+#include "snappy.hpp"
+#include "timesync/timesync.hpp"
+
+const char* PushExporter::TAG_ = "push";
+
+static const push_label_t PUSH_LABELS_[] = {
+    { "instance", CONFIG_PUSH_INSTANCE },
+    { "job", CONFIG_PUSH_JOB },
+};
+
+void PushExporter::Task(void* arg) {
+    PushExporter* push = (PushExporter*)arg;
+
+    esp_http_client_config_t config = {};
+    config.url = push->url_;
+    config.method = HTTP_METHOD_POST;
+    config.timeout_ms = PUSH_TIMEOUT;
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL) {
+        ESP_LOGE(TAG_, "Failed to create HTTP client");
+        vTaskDelete(NULL);
+        return;
+    }
+    esp_http_client_set_header(client, "Content-Encoding", "snappy");
+    esp_http_client_set_header(client, "Content-Type", "application/x-protobuf");
+    esp_http_client_set_header(client, "X-Prometheus-Remote-Write-Version", "0.1.0");
+
+    push_sample_t batch[CONFIG_PUSH_BATCH_SIZE];
+    uint32_t backoff = 0;
+    uint32_t wait = CONFIG_PUSH_INTERVAL * 1000;
+    while (1) {
+        diagnostics_check_stack();
+        vTaskDelay(wait / portTICK_PERIOD_MS);
+        wait = CONFIG_PUSH_INTERVAL * 1000;
+
+        // Wall clock time at uptime zero
+        int64_t epoch_ms;
+        if (timesync_to_unix_ms(0, &epoch_ms) != ESP_OK) {
+            ESP_LOGD(TAG_, "Waiting for SNTP to set the clock");
+            continue;
+        }
+
+        uint32_t start;
+        size_t count = push->Peek(batch, CONFIG_PUSH_BATCH_SIZE, &start);
+        if (count == 0) {
+            continue;
+        }
+
+        esp_err_t err = push->Send(client, batch, count, epoch_ms);
+        if (err == ESP_OK || err == ESP_ERR_INVALID_RESPONSE) {
+            push->Consume(start + count);
+            backoff = 0;
+            if (count == CONFIG_PUSH_BATCH_SIZE) {
+                // Catching up after an outage, send the rest straight away
+                wait = 0;
+            }
+        }
+        else {
+            backoff = backoff == 0 ? PUSH_MIN_BACKOFF : backoff * 2;
+            if (backoff > CONFIG_PUSH_MAX_BACKOFF) {
+                backoff = CONFIG_PUSH_MAX_BACKOFF;
+            }
+            // Jitter so a site full of sensors does not retry in step
+            wait = backoff * 500 + esp_random() % (backoff * 500 + 1);
+            ESP_LOGW(TAG_, "Retrying %u samples in %u ms", count, wait);
+        }
+    }
+}
+
+size_t PushExporter::Peek(push_sample_t* samples, size_t max, uint32_t* start) {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    size_t count = next_ - first_;
+    if (count > max) {
+        count = max;
+    }
+    for (size_t i = 0; i < count; i++) {
+        samples[i] = ring_[(first_ + i) % CONFIG_PUSH_RING_SAMPLES];
+    }
+    *start = first_;
+    xSemaphoreGive(lock_);
+    return count;
+}
+
+void PushExporter::Consume(uint32_t end) {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    // The listener may have moved first_ past end while we were sending
+    if ((int32_t)(end - first_) > 0) {
+        first_ = end;
+    }
+    xSemaphoreGive(lock_);
+}
+
+/**
+ * @brief Free a batch buffer unless it is kept for the next batch
+ *
+ * @param buf Buffer to free
+ */
+static void push_free_batch(uint8_t* buf) {
+#ifdef CONFIG_STATIC_MEMORY
+    (void)buf;
+#else
+    free(buf);
+#endif
+}
+
+esp_err_t PushExporter::Send(esp_http_client_handle_t client, const push_sample_t* samples, size_t count, int64_t epoch_ms) {
+    size_t label_count = sizeof(PUSH_LABELS_) / sizeof(PUSH_LABELS_[0]);
+#ifdef CONFIG_STATIC_MEMORY
+    size_t raw_max = raw_max_;
+    size_t compressed_max = compressed_max_;
+    uint8_t* raw = raw_;
+    uint8_t* compressed = compressed_;
+#else
+    size_t raw_max = push_remote_write_max_length(count, PUSH_LABELS_, label_count);
+    size_t compressed_max = snappy_max_compressed_length(raw_max);
+    uint8_t* raw = (uint8_t*)malloc(raw_max);
+    uint8_t* compressed = (uint8_t*)malloc(compressed_max);
+    if (raw == NULL || compressed == NULL) {
+        ESP_LOGE(TAG_, "Failed to allocate %u bytes for batch", raw_max + compressed_max);
+        free(raw);
+        free(compressed);
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+
+    size_t raw_len;
+    size_t compressed_len;
+    esp_err_t err = push_remote_write_encode(samples, count, epoch_ms, PUSH_LABELS_, label_count, raw, raw_max, &raw_len);
+    if (err == ESP_OK) {
+        err = snappy_compress(raw, raw_len, compressed, compressed_max, &compressed_len);
+    }
+    push_free_batch(raw);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to encode batch (%s)", esp_err_to_name(err));
+        push_free_batch(compressed);
+        // Will never succeed, so drop it rather than retrying forever
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    esp_http_client_set_post_field(client, (const char*)compressed, compressed_len);
+    err = esp_http_client_perform(client);
+    push_free_batch(compressed);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG_, "Failed to send batch (%s)", esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+
+    int status = esp_http_client_get_status_code(client);
+    if (status >= 200 && status < 300) {
+        ESP_LOGD(TAG_, "Sent %u samples in %u bytes", count, compressed_len);
+        return ESP_OK;
+    }
+    // Per the remote_write spec only 5xx and 429 are worth retrying
+    if (status >= 400 && status < 500 && status != 429) {
+        ESP_LOGE(TAG_, "Endpoint rejected %u samples with HTTP %d", count, status);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    ESP_LOGW(TAG_, "Endpoint returned HTTP %d", status);
+    return ESP_FAIL;
+}
+
+PushExporter::PushExporter(const char* url) {
+    url_ = url;
+    lock_ = alloc_mutex_create(&lock_storage_);
+    configASSERT(lock_);
+}
+
+void PushExporter::Listener(const sampler_sample_t* sample, void* arg) {
+    PushExporter* push = (PushExporter*)arg;
+    push_sample_t entry;
+    entry.uptime = sample->timestamp / 1000000;
+    entry.temperature = sample->measurement.temperature;
+    entry.humidity = sample->measurement.humidity;
+
+    xSemaphoreTake(push->lock_, portMAX_DELAY);
+    push->ring_[push->next_ % CONFIG_PUSH_RING_SAMPLES] = entry;
+    push->next_++;
+    if (push->next_ - push->first_ > CONFIG_PUSH_RING_SAMPLES) {
+        push->first_ = push->next_ - CONFIG_PUSH_RING_SAMPLES;
+    }
+    xSemaphoreGive(push->lock_);
+}
+
+esp_err_t PushExporter::Start() {
+    if (task_ != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+#ifdef CONFIG_STATIC_MEMORY
+    size_t label_count = sizeof(PUSH_LABELS_) / sizeof(PUSH_LABELS_[0]);
+    raw_max_ = push_remote_write_max_length(CONFIG_PUSH_BATCH_SIZE, PUSH_LABELS_, label_count);
+    compressed_max_ = snappy_max_compressed_length(raw_max_);
+    raw_ = (uint8_t*)malloc(raw_max_);
+    compressed_ = (uint8_t*)malloc(compressed_max_);
+    if (raw_ == NULL || compressed_ == NULL) {
+        ESP_LOGE(TAG_, "Failed to allocate %u bytes for batches", raw_max_ + compressed_max_);
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+
+    ESP_LOGI(TAG_, "Pushing samples to %s", url_);
+    esp_err_t err = alloc_task_create(&task_storage_, Task, "push", this, PUSH_TASK_PRIORITY, &task_);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to create push task");
+    }
+    return err;
+}
@@ -0,0 +1,218 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "remote_write.hpp"
+
+#include <string.h>
+
+#include "esp_err.h"
+
+// Protobuf wire types
+#define PB_VARINT 0
+#define PB_FIXED64 1
+#define PB_BYTES 2
+
+#define PB_TAG(field, type) (((field) << 3) | (type))
+
+// Field numbers from prompb/remote.proto and prompb/types.proto
+#define WRITE_REQUEST_TIMESERIES 1
+#define TIMESERIES_LABELS 1
+#define TIMESERIES_SAMPLES 2
+#define LABEL_NAME 1
+#define LABEL_VALUE 2
+#define SAMPLE_VALUE 1
+#define SAMPLE_TIMESTAMP 2
+
+#define PB_MAX_VARINT 10
+
+struct pb_writer_t {
+    uint8_t* buf;
+    size_t len;
+    size_t pos;
+    bool overflow;
+};
+
+static const char* const SERIES_NAMES_[] = {
+    "environment_temperature_celsius",
+    "environment_humidity_percent",
+};
+
+/**
+ * @brief Get the encoded length of a varint
+ *
+ * @param value Value to encode
+ * @return size_t
+ */
+static size_t pb_varint_len(uint64_t value) {
+    size_t len = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        len++;
+    }
+    return len;
+}
+
+/**
+ * @brief Write a varint
+ *
+ * @param w Output
+ * @param value Value to write
+ */
+static void pb_put_varint(pb_writer_t* w, uint64_t value) {
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if (w->pos >= w->len) {
+            w->overflow = true;
+            return;
+        }
+        w->buf[w->pos++] = value ? byte | 0x80 : byte;
+    } while (value);
+}
+
+/**
+ * @brief Write raw bytes
+ *
+ * @param w Output
+ * @param data Bytes to write
+ * @param len Number of bytes
+ */
+static void pb_put_bytes(pb_writer_t* w, const void* data, size_t len) {
+    if (w->len - w->pos < len) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->pos, data, len);
+    w->pos += len;
+}
+
+/**
+ * @brief Write the value field of a Sample
+ *
+ * @param w Output
+ * @param value Value to write
+ */
+static void pb_put_double(pb_writer_t* w, double value) {
+    // Little endian IEEE 754, as stored by the ESP8266
+    pb_put_varint(w, PB_TAG(SAMPLE_VALUE, PB_FIXED64));
+    pb_put_bytes(w, &value, sizeof(value));
+}
+
+/**
+ * @brief Get the length of an encoded Label message
+ *
+ * @param name Label name
+ * @param value Label value
+ * @return size_t
+ */
+static size_t pb_label_len(const char* name, const char* value) {
+    size_t name_len = strlen(name);
+    size_t value_len = strlen(value);
+    return 1 + pb_varint_len(name_len) + name_len + 1 + pb_varint_len(value_len) + value_len;
+}
+
+/**
+ * @brief Write a Label as a field of a TimeSeries
+ *
+ * @param w Output
+ * @param name Label name
+ * @param value Label value
+ */
+static void pb_put_label(pb_writer_t* w, const char* name, const char* value) {
+    size_t name_len = strlen(name);
+    size_t value_len = strlen(value);
+    pb_put_varint(w, PB_TAG(TIMESERIES_LABELS, PB_BYTES));
+    pb_put_varint(w, pb_label_len(name, value));
+    pb_put_varint(w, PB_TAG(LABEL_NAME, PB_BYTES));
+    pb_put_varint(w, name_len);
+    pb_put_bytes(w, name, name_len);
+    pb_put_varint(w, PB_TAG(LABEL_VALUE, PB_BYTES));
+    pb_put_varint(w, value_len);
+    pb_put_bytes(w, value, value_len);
+}
+
+/**
+ * @brief Get the length of an encoded Sample message
+ *
+ * @param timestamp Sample timestamp
+ * @return size_t
+ */
+static size_t pb_sample_len(int64_t timestamp) {
+    return 1 + sizeof(double) + 1 + pb_varint_len(timestamp);
+}
+
+/**
+ * @brief Get the length of the labels of a series
+ *
+ * @param name Metric name
+ * @param labels Extra labels
+ * @param label_count Number of extra labels
+ * @return size_t
+ */
+static size_t pb_labels_len(const char* name, const push_label_t* labels, size_t label_count) {
+    size_t len = 0;
+    size_t label_len = pb_label_len("__name__", name);
+    len += 1 + pb_varint_len(label_len) + label_len;
+    for (size_t i = 0; i < label_count; i++) {
+        label_len = pb_label_len(labels[i].name, labels[i].value);
+        len += 1 + pb_varint_len(label_len) + label_len;
+    }
+    return len;
+}
+
+size_t push_remote_write_max_length(size_t count, const push_label_t* labels, size_t label_count) {
+    size_t len = 0;
+    for (size_t i = 0; i < sizeof(SERIES_NAMES_) / sizeof(SERIES_NAMES_[0]); i++) {
+        size_t series_len = pb_labels_len(SERIES_NAMES_[i], labels, label_count);
+        series_len += count * (2 + 1 + sizeof(double) + 1 + PB_MAX_VARINT);
+        len += 1 + pb_varint_len(series_len) + series_len;
+    }
+    return len;
+}
+
+esp_err_t push_remote_write_encode(
+    const push_sample_t* samples,
+    size_t count,
+    int64_t epoch_ms,
+    const push_label_t* labels,
+    size_t label_count,
+    uint8_t* buf,
+    size_t len,
+    size_t* written
+) {
+    pb_writer_t w = { buf, len, 0, false };
+
+    for (size_t series = 0; series < sizeof(SERIES_NAMES_) / sizeof(SERIES_NAMES_[0]); series++) {
+        const char* name = SERIES_NAMES_[series];
+
+        // Nested messages are length prefixed so size them up first
+        size_t series_len = pb_labels_len(name, labels, label_count);
+        for (size_t i = 0; i < count; i++) {
+            size_t sample_len = pb_sample_len(epoch_ms + samples[i].uptime * 1000LL);
+            series_len += 1 + pb_varint_len(sample_len) + sample_len;
+        }
+
+        pb_put_varint(&w, PB_TAG(WRITE_REQUEST_TIMESERIES, PB_BYTES));
+        pb_put_varint(&w, series_len);
+        pb_put_label(&w, "__name__", name);
+        for (size_t i = 0; i < label_count; i++) {
+            pb_put_label(&w, labels[i].name, labels[i].value);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            int64_t timestamp = epoch_ms + samples[i].uptime * 1000LL;
+            int16_t value = series == 0 ? samples[i].temperature : samples[i].humidity;
+            pb_put_varint(&w, PB_TAG(TIMESERIES_SAMPLES, PB_BYTES));
+            pb_put_varint(&w, pb_sample_len(timestamp));
+            pb_put_double(&w, value / 100.0);
+            pb_put_varint(&w, PB_TAG(SAMPLE_TIMESTAMP, PB_VARINT));
+            pb_put_varint(&w, timestamp);
+        }
+    }
+
+    if (w.overflow) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *written = w.pos;
+    return ESP_OK;
+}
@@ -0,0 +1,187 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "snappy.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#define SNAPPY_TAG_LITERAL 0x00
+#define SNAPPY_TAG_COPY_1 0x01
+#define SNAPPY_TAG_COPY_2 0x02
+#define SNAPPY_MIN_MATCH 4
+
+#ifdef CONFIG_STATIC_MEMORY
+static uint16_t table_[1 << SNAPPY_HASH_BITS];
+#endif
+
+struct snappy_writer_t {
+    uint8_t* buf;
+    size_t len;
+    size_t pos;
+};
+
+/**
+ * @brief Hash the four bytes at p into the match table
+ *
+ * @param p Data to hash
+ * @return uint32_t
+ */
+static uint32_t snappy_hash(const uint8_t* p) {
+    uint32_t value = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    return (value * 0x1e35a7bd) >> (32 - SNAPPY_HASH_BITS);
+}
+
+/**
+ * @brief Write a single byte
+ *
+ * @param w Output
+ * @param value Byte to write
+ * @return true Byte written
+ * @return false Output is full
+ */
+static bool snappy_put(snappy_writer_t* w, uint8_t value) {
+    if (w->pos >= w->len) {
+        return false;
+    }
+    w->buf[w->pos++] = value;
+    return true;
+}
+
+/**
+ * @brief Emit a literal run
+ *
+ * @param w Output
+ * @param data Literal bytes
+ * @param len Number of bytes, at least 1
+ * @return true Run written
+ * @return false Output is full
+ */
+static bool snappy_literal(snappy_writer_t* w, const uint8_t* data, size_t len) {
+    size_t n = len - 1;
+    bool ok;
+    if (n < 60) {
+        ok = snappy_put(w, (n << 2) | SNAPPY_TAG_LITERAL);
+    }
+    else if (n < 0x100) {
+        ok = snappy_put(w, (60 << 2) | SNAPPY_TAG_LITERAL) && snappy_put(w, n);
+    }
+    else {
+        ok = snappy_put(w, (61 << 2) | SNAPPY_TAG_LITERAL) && snappy_put(w, n & 0xff) && snappy_put(w, n >> 8);
+    }
+    if (!ok || w->len - w->pos < len) {
+        return false;
+    }
+    memcpy(w->buf + w->pos, data, len);
+    w->pos += len;
+    return true;
+}
+
+/**
+ * @brief Emit a back reference, split into as many copies as needed
+ *
+ * @param w Output
+ * @param offset Distance back to the start of the match
+ * @param len Length of the match, at least SNAPPY_MIN_MATCH
+ * @return true Copy written
+ * @return false Output is full
+ */
+static bool snappy_copy(snappy_writer_t* w, size_t offset, size_t len) {
+    while (len > 0) {
+        // Copies are limited to 64 bytes, and leave at least 4 for the
+        // last one so it can use the short form if possible
+        size_t n = len;
+        if (n > 64) {
+            n = len - 64 < SNAPPY_MIN_MATCH ? 60 : 64;
+        }
+        bool ok;
+        if (n >= 4 && n <= 11 && offset < 2048) {
+            ok = snappy_put(w, ((offset >> 8) << 5) | ((n - 4) << 2) | SNAPPY_TAG_COPY_1)
+                && snappy_put(w, offset & 0xff);
+        }
+        else {
+            ok = snappy_put(w, ((n - 1) << 2) | SNAPPY_TAG_COPY_2)
+                && snappy_put(w, offset & 0xff)
+                && snappy_put(w, offset >> 8);
+        }
+        if (!ok) {
+            return false;
+        }
+        len -= n;
+    }
+    return true;
+}
+
+size_t snappy_max_compressed_length(size_t len) {
+    return 32 + len + len / 6;
+}
+
+esp_err_t snappy_compress(const uint8_t* in, size_t in_len, uint8_t* out, size_t out_len, size_t* written) {
+    if (in_len > SNAPPY_MAX_INPUT) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    snappy_writer_t w = { out, out_len, 0 };
+
+    // Preamble is the uncompressed length as a varint
+    size_t remaining = in_len;
+    do {
+        uint8_t byte = remaining & 0x7f;
+        remaining >>= 7;
+        if (!snappy_put(&w, remaining ? byte | 0x80 : byte)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    } while (remaining);
+
+#ifdef CONFIG_STATIC_MEMORY
+    uint16_t* table = table_;
+    memset(table, 0, sizeof(table_));
+#else
+    uint16_t* table = (uint16_t*)calloc(1 << SNAPPY_HASH_BITS, sizeof(uint16_t));
+    if (table == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+
+    size_t literal_start = 0;
+    size_t pos = 0;
+    bool ok = true;
+    while (ok && in_len >= SNAPPY_MIN_MATCH && pos <= in_len - SNAPPY_MIN_MATCH) {
+        // Entries are stored plus one so zero can mark an empty slot
+        uint32_t hash = snappy_hash(in + pos);
+        size_t entry = table[hash];
+        table[hash] = pos + 1;
+        if (entry == 0 || memcmp(in + entry - 1, in + pos, SNAPPY_MIN_MATCH) != 0) {
+            pos++;
+            continue;
+        }
+        size_t candidate = entry - 1;
+
+        size_t len = SNAPPY_MIN_MATCH;
+        while (pos + len < in_len && in[candidate + len] == in[pos + len]) {
+            len++;
+        }
+
+        if (pos > literal_start) {
+            ok = snappy_literal(&w, in + literal_start, pos - literal_start);
+        }
+        ok = ok && snappy_copy(&w, pos - candidate, len);
+        pos += len;
+        literal_start = pos;
+    }
+#ifndef CONFIG_STATIC_MEMORY
+    free(table);
+#endif
+
+    if (ok && in_len > literal_start) {
+        ok = snappy_literal(&w, in + literal_start, in_len - literal_start);
+    }
+    if (!ok) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *written = w.pos;
+    return ESP_OK;
+}
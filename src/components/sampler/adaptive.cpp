@@ -0,0 +1,94 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "adaptive.hpp"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "sensor/aht10.hpp"
+
+void AdaptiveInterval::UpdateState(adaptive_state_t* state, int32_t value, int64_t elapsed_ms) {
+    int32_t diff = value * ADAPTIVE_SCALE - state->mean;
+    int32_t step = diff / (1 << ADAPTIVE_SMOOTHING_SHIFT);
+    state->mean += step;
+    int64_t variance = (int64_t)diff * diff / ADAPTIVE_SCALE;
+    if (variance > INT32_MAX / 2) {
+        // Only a wild jump gets here, it is well past any threshold
+        variance = INT32_MAX / 2;
+    }
+    state->variance += (int32_t)(variance - state->variance) / (1 << ADAPTIVE_SMOOTHING_SHIFT);
+
+    // Readings are quantised to one hundredth so the difference of two
+    // consecutive readings is mostly noise at short intervals. Take
+    // the derivative of the mean instead, and smooth that too.
+    int32_t slope = (int64_t)step * 60000 / elapsed_ms;
+    state->slope += (slope - state->slope) / (1 << ADAPTIVE_SMOOTHING_SHIFT);
+}
+
+AdaptiveInterval::AdaptiveInterval(const adaptive_config_t* config, uint32_t initial_ms) {
+    config_ = *config;
+    interval_ms_ = initial_ms;
+    if (interval_ms_ < config_.min_interval_ms) {
+        interval_ms_ = config_.min_interval_ms;
+    }
+    if (interval_ms_ > config_.max_interval_ms) {
+        interval_ms_ = config_.max_interval_ms;
+    }
+}
+
+uint32_t AdaptiveInterval::Update(int64_t timestamp, const aht10_measurement_t* measurement) {
+    const int32_t values[ADAPTIVE_CHANNEL_MAX] = { measurement->temperature, measurement->humidity };
+
+    if (!primed_) {
+        for (int i = 0; i < ADAPTIVE_CHANNEL_MAX; i++) {
+            state_[i].mean = values[i] * ADAPTIVE_SCALE;
+            state_[i].variance = 0;
+            state_[i].slope = 0;
+        }
+        last_timestamp_ = timestamp;
+        primed_ = true;
+        return interval_ms_;
+    }
+
+    int64_t elapsed_ms = (timestamp - last_timestamp_) / 1000;
+    if (elapsed_ms <= 0) {
+        return interval_ms_;
+    }
+    last_timestamp_ = timestamp;
+
+    bool active = false;
+    bool flat = true;
+    for (int i = 0; i < ADAPTIVE_CHANNEL_MAX; i++) {
+        adaptive_state_t* state = &state_[i];
+        UpdateState(state, values[i], elapsed_ms);
+
+        int32_t slope = abs(state->slope);
+        int32_t rate = config_.rate[i] * ADAPTIVE_SCALE;
+        int32_t variance = config_.deviation[i] * config_.deviation[i] * ADAPTIVE_SCALE;
+        if (slope >= rate || state->variance >= variance) {
+            active = true;
+        }
+        if (slope >= rate / 2 || state->variance >= variance / 4) {
+            flat = false;
+        }
+    }
+
+    if (active) {
+        interval_ms_ /= 2;
+        if (interval_ms_ < config_.min_interval_ms) {
+            interval_ms_ = config_.min_interval_ms;
+        }
+    }
+    else if (flat) {
+        interval_ms_ += interval_ms_ / 4 + 1;
+        if (interval_ms_ > config_.max_interval_ms) {
+            interval_ms_ = config_.max_interval_ms;
+        }
+    }
+    return interval_ms_;
+}
+
+uint32_t AdaptiveInterval::GetInterval() {
+    return interval_ms_;
+}
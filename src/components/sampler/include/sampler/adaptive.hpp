@@ -0,0 +1,94 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef SAMPLER_ADAPTIVE_H_
+#define SAMPLER_ADAPTIVE_H_
+
+#include <stdint.h>
+
+#include "sensor/aht10.hpp"
+
+// Weight of each new reading in the running statistics, as a shift. 3
+// gives each reading 1/8 of the weight.
+#define ADAPTIVE_SMOOTHING_SHIFT 3
+// Running statistics are kept at this multiple of their units so small
+// changes are not lost to rounding
+#define ADAPTIVE_SCALE 16
+
+typedef enum {
+    ADAPTIVE_TEMPERATURE = 0,
+    ADAPTIVE_HUMIDITY = 1,
+    ADAPTIVE_CHANNEL_MAX,
+} adaptive_channel_t;
+
+struct adaptive_config_t {
+    uint32_t min_interval_ms;
+    uint32_t max_interval_ms;
+    int32_t rate[ADAPTIVE_CHANNEL_MAX]; // Hundredths per minute
+    int32_t deviation[ADAPTIVE_CHANNEL_MAX]; // Hundredths
+};
+
+// Running statistics for one measured quantity, all multiplied by
+// ADAPTIVE_SCALE
+struct adaptive_state_t {
+    int32_t mean; // Hundredths
+    int32_t variance; // Hundredths squared
+    int32_t slope; // Hundredths per minute
+};
+
+/**
+ * @brief Chooses the sampling interval from how fast readings change
+ *
+ * Each quantity keeps a smoothed first derivative and a running
+ * variance. If either crosses its threshold for any quantity the
+ * interval is halved. Once every quantity is below half its thresholds
+ * the interval grows by a quarter, so it backs off more slowly than it
+ * speeds up. In between the interval is left alone.
+ *
+ * This is plain integer arithmetic with no RTOS calls.
+ */
+class AdaptiveInterval {
+private:
+    adaptive_config_t config_;
+    uint32_t interval_ms_;
+
+    bool primed_ = false;
+    int64_t last_timestamp_;
+    adaptive_state_t state_[ADAPTIVE_CHANNEL_MAX];
+
+    /**
+     * @brief Add a reading to the statistics of one quantity
+     *
+     * @param state Statistics to update
+     * @param value New reading in hundredths
+     * @param elapsed_ms Time since the previous reading
+     */
+    static void UpdateState(adaptive_state_t* state, int32_t value, int64_t elapsed_ms);
+
+public:
+    /**
+     * @brief Construct a new AdaptiveInterval object
+     *
+     * @param config Bounds and thresholds
+     * @param initial_ms Interval to start from, clamped to the bounds
+     */
+    AdaptiveInterval(const adaptive_config_t* config, uint32_t initial_ms);
+
+    /**
+     * @brief Add a new measurement and choose the next interval
+     *
+     * @param timestamp Time of the measurement in microseconds
+     * @param measurement Measurement taken
+     * @return uint32_t Interval in milliseconds until the next reading
+     */
+    uint32_t Update(int64_t timestamp, const aht10_measurement_t* measurement);
+
+    /**
+     * @brief Get the current interval
+     *
+     * @return uint32_t Interval in milliseconds
+     */
+    uint32_t GetInterval();
+};
+
+#endif // SAMPLER_ADAPTIVE_H_
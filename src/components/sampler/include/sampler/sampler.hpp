@@ -0,0 +1,157 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef SAMPLER_SAMPLER_H_
+#define SAMPLER_SAMPLER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "adaptive.hpp"
+#include "alloc/alloc.hpp"
+#include "power/power.hpp"
+#include "sensor/aht10.hpp"
+
+#define SAMPLER_MAX_LISTENERS 8
+#define SAMPLER_TASK_STACK_SIZE 2048
+#define SAMPLER_TASK_PRIORITY 5
+#define SAMPLER_POLL_INTERVAL 10 // Milliseconds between checks for a newer sample
+
+struct sampler_sample_t {
+    aht10_measurement_t measurement;
+    int64_t timestamp; // Value of esp_timer_get_time() when the conversion completed
+    uint32_t sequence; // Counts samples since boot, the first is 1
+};
+
+/**
+ * @brief Callback run from the sampler task for every new sample
+ *
+ * Listeners run in the sampler task so must return quickly.
+ */
+typedef void (*sampler_listener_t)(const sampler_sample_t* sample, void* arg);
+
+struct sampler_listener_entry_t {
+    sampler_listener_t listener;
+    void* arg;
+};
+
+class Sampler {
+private:
+    static const char* TAG_;
+
+    AHT10* sensor_;
+    uint32_t interval_ms_;
+    AdaptiveInterval* adaptive_ = NULL;
+    power_source_t power_ = POWER_SOURCE_INVALID;
+
+    TaskHandle_t task_ = NULL;
+    alloc_task_t<SAMPLER_TASK_STACK_SIZE> task_storage_;
+    SemaphoreHandle_t lock_;
+    alloc_mutex_t lock_storage_;
+
+    sampler_sample_t latest_;
+    bool has_sample_ = false;
+    uint32_t sample_count_ = 0;
+
+    sampler_listener_entry_t listeners_[SAMPLER_MAX_LISTENERS];
+    size_t listener_count_ = 0;
+
+    /**
+     * @brief FreeRTOS entry point for the sampler task
+     *
+     * @param arg Pointer to the Sampler instance
+     */
+    static void Task(void* arg);
+
+    /**
+     * @brief Take a single sample and pass it to every listener
+     */
+    void Sample();
+
+public:
+    /**
+     * @brief Construct a new Sampler object
+     *
+     * @param sensor Sensor to read from
+     * @param interval_ms Time in milliseconds between samples
+     */
+    Sampler(AHT10* sensor, uint32_t interval_ms);
+
+    /**
+     * @brief Register a callback to receive every new sample
+     *
+     * Must be called before Start().
+     *
+     * @param listener Callback to run
+     * @param arg Argument passed to the callback
+     * @return esp_err_t ESP_ERR_NO_MEM if all listener slots are in use
+     */
+    esp_err_t AddListener(sampler_listener_t listener, void* arg);
+
+    /**
+     * @brief Let the interval between samples follow the readings
+     *
+     * Must be called before Start().
+     *
+     * @param adaptive Policy choosing the interval after each sample
+     * @return esp_err_t
+     */
+    esp_err_t SetAdaptive(AdaptiveInterval* adaptive);
+
+    /**
+     * @brief Start the background sampling task
+     *
+     * @return esp_err_t
+     */
+    esp_err_t Start();
+
+    /**
+     * @brief Take a sample now rather than at the end of the interval
+     *
+     * Returns straight away. The sample is published as usual and the
+     * interval restarts from it.
+     */
+    void Trigger();
+
+    /**
+     * @brief Wait for a sample newer than one already seen
+     *
+     * @param sequence Sequence number of the sample already seen
+     * @param sample Struct to copy the newer sample into
+     * @param timeout Ticks to wait
+     * @return esp_err_t ESP_ERR_TIMEOUT if nothing newer was published
+     */
+    esp_err_t WaitNewer(uint32_t sequence, sampler_sample_t* sample, TickType_t timeout);
+
+    /**
+     * @brief Get the most recent sample
+     *
+     * @param sample Struct to copy the sample into
+     * @return esp_err_t ESP_ERR_NOT_FOUND if no sample has been taken yet
+     */
+    esp_err_t GetLatest(sampler_sample_t* sample);
+
+    /**
+     * @brief Get the sampling interval
+     *
+     * With adaptive sampling this is the interval currently in use.
+     *
+     * @return uint32_t Interval in milliseconds
+     */
+    uint32_t GetInterval();
+
+    /**
+     * @brief Get the number of samples taken since boot
+     *
+     * @return uint32_t
+     */
+    uint32_t GetSampleCount();
+};
+
+#endif // SAMPLER_SAMPLER_H_
@@ -0,0 +1,167 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "sampler.hpp"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "diagnostics/diagnostics.hpp"
+#include "power/power.hpp"
+#include "sensor/aht10.hpp"
+
+const char* Sampler::TAG_ = "sampler";
+
+void Sampler::Task(void* arg) {
+    Sampler* sampler = (Sampler*)arg;
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1) {
+        power_busy(sampler->power_);
+        // Listeners run on this task from Sample
+        sampler->Sample();
+        diagnostics_check_stack();
+
+        TickType_t interval = sampler->interval_ms_ / portTICK_PERIOD_MS;
+        int32_t remaining = (int32_t)(last_wake + interval - xTaskGetTickCount());
+        if (remaining < 0) {
+            remaining = 0;
+        }
+        power_wake_at(sampler->power_, esp_timer_get_time() + (int64_t)remaining * portTICK_PERIOD_MS * 1000);
+        if (ulTaskNotifyTake(pdTRUE, remaining) > 0) {
+            // Triggered early, so the interval restarts from now
+            last_wake = xTaskGetTickCount();
+        }
+        else {
+            last_wake += interval;
+        }
+    }
+}
+
+void Sampler::Sample() {
+    sampler_sample_t sample;
+    esp_err_t err = sensor_->Measure(&sample.measurement);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG_, "Failed to take sample (%s)", esp_err_to_name(err));
+        return;
+    }
+    sample.timestamp = sample.measurement.time;
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    sample_count_++;
+    sample.sequence = sample_count_;
+    latest_ = sample;
+    has_sample_ = true;
+    xSemaphoreGive(lock_);
+
+    for (size_t i = 0; i < listener_count_; i++) {
+        listeners_[i].listener(&sample, listeners_[i].arg);
+    }
+
+    if (adaptive_ != NULL) {
+        uint32_t interval_ms = adaptive_->Update(sample.timestamp, &sample.measurement);
+        if (interval_ms != interval_ms_) {
+            ESP_LOGI(TAG_, "Sampling interval now %dms", interval_ms);
+            xSemaphoreTake(lock_, portMAX_DELAY);
+            interval_ms_ = interval_ms;
+            xSemaphoreGive(lock_);
+        }
+    }
+}
+
+Sampler::Sampler(AHT10* sensor, uint32_t interval_ms) {
+    sensor_ = sensor;
+    interval_ms_ = interval_ms;
+    lock_ = alloc_mutex_create(&lock_storage_);
+    configASSERT(lock_);
+}
+
+esp_err_t Sampler::AddListener(sampler_listener_t listener, void* arg) {
+    if (task_ != NULL) {
+        ESP_LOGE(TAG_, "Listeners must be added before the sampler is started");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (listener_count_ >= SAMPLER_MAX_LISTENERS) {
+        ESP_LOGE(TAG_, "No free listener slots");
+        return ESP_ERR_NO_MEM;
+    }
+
+    listeners_[listener_count_].listener = listener;
+    listeners_[listener_count_].arg = arg;
+    listener_count_++;
+    return ESP_OK;
+}
+
+esp_err_t Sampler::SetAdaptive(AdaptiveInterval* adaptive) {
+    if (task_ != NULL) {
+        ESP_LOGE(TAG_, "Adaptive sampling must be set before the sampler is started");
+        return ESP_ERR_INVALID_STATE;
+    }
+    adaptive_ = adaptive;
+    interval_ms_ = adaptive->GetInterval();
+    return ESP_OK;
+}
+
+esp_err_t Sampler::Start() {
+    ESP_LOGI(TAG_, "Starting sampler with %dms interval", interval_ms_);
+    power_ = power_register("sampler");
+    esp_err_t err = alloc_task_create(&task_storage_, Task, "sampler", this, SAMPLER_TASK_PRIORITY, &task_);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to create sampler task");
+    }
+    return err;
+}
+
+void Sampler::Trigger() {
+    if (task_ != NULL) {
+        xTaskNotifyGive(task_);
+    }
+}
+
+esp_err_t Sampler::WaitNewer(uint32_t sequence, sampler_sample_t* sample, TickType_t timeout) {
+    const TickType_t start = xTaskGetTickCount();
+    while (1) {
+        xSemaphoreTake(lock_, portMAX_DELAY);
+        const bool newer = has_sample_ && latest_.sequence != sequence;
+        if (newer) {
+            *sample = latest_;
+        }
+        xSemaphoreGive(lock_);
+        if (newer) {
+            return ESP_OK;
+        }
+        if (xTaskGetTickCount() - start >= timeout) {
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(SAMPLER_POLL_INTERVAL / portTICK_PERIOD_MS);
+    }
+}
+
+esp_err_t Sampler::GetLatest(sampler_sample_t* sample) {
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    if (has_sample_) {
+        *sample = latest_;
+        err = ESP_OK;
+    }
+    xSemaphoreGive(lock_);
+    return err;
+}
+
+uint32_t Sampler::GetInterval() {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    uint32_t interval_ms = interval_ms_;
+    xSemaphoreGive(lock_);
+    return interval_ms;
+}
+
+uint32_t Sampler::GetSampleCount() {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    uint32_t count = sample_count_;
+    xSemaphoreGive(lock_);
+    return count;
+}
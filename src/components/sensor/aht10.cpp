@@ -5,91 +5,85 @@
 
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_err.h"
 
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 
 #include "driver/i2c.h"
 #include "driver/gpio.h"
 
-esp_err_t AHT10::Read(uint8_t* data, size_t len) {
-    ESP_LOGD(TAG_, "Reading from AHT10 at address %x", addr_);
+#include "diagnostics/diagnostics.hpp"
 
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, addr_ << 1 | I2C_MASTER_READ, ACK_CHECK_EN);
-    i2c_master_read(cmd, data, len, I2C_MASTER_LAST_NACK);
-    i2c_master_stop(cmd);
-    int ret = i2c_master_cmd_begin(port_, cmd, 1000 / portTICK_RATE_MS);
-    i2c_cmd_link_delete(cmd);
-
-    ESP_LOGD(TAG_, "Finished reading data. Got response %s", esp_err_to_name(ret));
+esp_err_t AHT10::SendCommand(aht10_command_t cmd, uint8_t arg0, uint8_t arg1) {
+    ESP_LOGD(TAG_, "Sending command %x to AHT10 at address %x", cmd, addr_);
+    command_[0] = cmd;
+    command_[1] = arg0;
+    command_[2] = arg1;
+    esp_err_t ret = command_write_.Run(port_, AHT10_BUS_TIMEOUT);
     CheckResponseCode(ret);
     return ret;
 }
 
-esp_err_t AHT10::Write(uint8_t* data, size_t len) {
-    ESP_LOGD(TAG_, "Writing to AHT10 at address %x", addr_);
-
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, addr_ << 1 | I2C_MASTER_WRITE, ACK_CHECK_EN);
-    i2c_master_write(cmd, data, len, ACK_CHECK_EN);
-    i2c_master_stop(cmd);
-
-    int ret = i2c_master_cmd_begin(port_, cmd, 1000 / portTICK_RATE_MS);
-    i2c_cmd_link_delete(cmd);
-
-    ESP_LOGD(TAG_, "Finished writing. Response code was %s", esp_err_to_name(ret));
+esp_err_t AHT10::ReadFrame() {
+    esp_err_t ret = frame_read_.Run(port_, AHT10_BUS_TIMEOUT);
+    ESP_LOGD(TAG_, "Read frame, status %x (%s)", frame_[0], esp_err_to_name(ret));
     CheckResponseCode(ret);
     return ret;
 }
 
+esp_err_t AHT10::WaitReady() {
+    for (int i = 0; i < AHT10_POLL_TIMEOUT; i++) {
+        esp_err_t err = ReadFrame();
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG_, "Error while reading from sensor (%s)", esp_err_to_name(err));
+            return err;
+        }
+        if (!(frame_[0] & AHT10_STATUS_BUSY)) {
+            return ESP_OK;
+        }
+        vTaskDelay(AHT10_POLL_INTERVAL / portTICK_PERIOD_MS);
+    }
+    ESP_LOGE(TAG_, "Timeout waiting for sensor");
+    return ESP_ERR_TIMEOUT;
+}
+
 void AHT10::CheckResponseCode(esp_err_t code) {
     if (code != ESP_OK) {
+        diagnostics_count_i2c_error();
         ESP_LOGW(TAG_, "Response code was not ESP_OK, got %s", esp_err_to_name(code));
     }
 }
 
 esp_err_t AHT10::Init() {
-    measurement_active_ = false;
     error_count_ = 0;
     // 20ms to allow power up
     vTaskDelay(20 / portTICK_PERIOD_MS);
 
     ESP_LOGD(TAG_, "Soft resetting sensor");
-    uint8_t cmd[3];
-    cmd[0] = AHT10_CMD_SOFTRESET;
-    ESP_ERROR_CHECK(Write(cmd, 1));
+    ESP_ERROR_CHECK(reset_write_.Run(port_, AHT10_BUS_TIMEOUT));
 
     vTaskDelay(20 / portTICK_PERIOD_MS);
 
-    uint8_t status;
-    esp_err_t err = GetStatus(&status);
+    esp_err_t err = WaitReady();
     if (err != ESP_OK) {
         ESP_LOGE(TAG_, "Error while getting status of sensor (%s)", esp_err_to_name(err));
         return err;
     }
 
-    while (status & AHT10_STATUS_BUSY) {
-        vTaskDelay(10 / portTICK_PERIOD_MS);
-    }
-
     ESP_LOGD(TAG_, "Calibrating sensor");
-    cmd[0] = AHT10_CMD_CALIBRATE;
-    cmd[1] = 0x08;
-    cmd[2] = 0x00;
-    ESP_ERROR_CHECK(Write(cmd, 3));
+    ESP_ERROR_CHECK(SendCommand(AHT10_CMD_CALIBRATE, 0x08, 0x00));
 
-    err = GetStatus(&status);
+    err = WaitReady();
     if (err != ESP_OK) {
         ESP_LOGE(TAG_, "Error while getting status of sensor (%s)", esp_err_to_name(err));
         return err;
     }
 
-    if (!(status & AHT10_STATUS_CALIBRATED)) {
+    if (!(frame_[0] & AHT10_STATUS_CALIBRATED)) {
         ESP_LOGE(TAG_, "Failed to calibrate sensor");
         return ESP_FAIL;
     }
@@ -98,67 +92,47 @@ esp_err_t AHT10::Init() {
     return ESP_OK;
 }
 
-esp_err_t AHT10::GetStatus(uint8_t* status) {
-    return Read(status, 1);
-}
-
 esp_err_t AHT10::TriggerMeasure() {
-    ESP_LOGI(TAG_, "Triggering read");
-    uint8_t cmd[3] = { AHT10_CMD_TRIGGER, 0x33, 0x00 };
-    esp_err_t err;
-    err = Write(cmd, 3);
+    ESP_LOGD(TAG_, "Triggering read");
+    esp_err_t err = SendCommand(AHT10_CMD_TRIGGER, 0x33, 0x00);
     if (err != ESP_OK) {
         ESP_LOGE(TAG_, "Error while writing to sensor (%s)", esp_err_to_name(err));
         return err;
     }
 
-    // Wait for the result to be ready
-    uint8_t status;
-    err = GetStatus(&status);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG_, "Error while getting status of sensor (%s)", esp_err_to_name(err));
-        return err;
-    }
-    while (status & AHT10_STATUS_BUSY) {
-        vTaskDelay(10 / portTICK_PERIOD_MS);
-        err = GetStatus(&status);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG_, "Error while getting status of sensor (%s)", esp_err_to_name(err));
-            return err;
-        }
-    }
-
-    ESP_LOGI(TAG_, "Data ready, reading...");
-
-    // Read our data from the sensor
-    uint8_t data[6];
-    err = Read(data, 6);
+    // Sleep through the conversion so the first read normally has the
+    // data, the status byte tells us if it needs a little longer
+    vTaskDelay(AHT10_MEASURE_TIME / portTICK_PERIOD_MS);
+    err = WaitReady();
     if (err != ESP_OK) {
-        ESP_LOGE(TAG_, "Error while reading from sensor (%s)", esp_err_to_name(err));
         return err;
     }
+    last_time_ = esp_timer_get_time();
 
+    uint8_t* data = frame_;
     uint32_t h_data = data[1];
     h_data <<= 8;
     h_data |= data[2];
     h_data <<= 4;
     h_data |= data[3] >> 4;
-    last_humidity_ = ((float)h_data * 100) / 0x100000;
+    last_humidity_ = aht10_humidity_from_raw(h_data);
 
     uint32_t t_data = data[3] & 0x0F;
     t_data <<= 8;
     t_data |= data[4];
     t_data <<= 8;
     t_data |= data[5];
-    last_temp_ = ((float)t_data * 200 / 0x100000) - 50;
+    last_temp_ = aht10_temperature_from_raw(t_data);
 
-    ESP_LOGI(TAG_, "Read data from sensor. Humidity: %f Temperature: %f", last_humidity_, last_temp_);
+    ESP_LOGI(TAG_, "Read data from sensor. Humidity: %d Temperature: %d (hundredths)", last_humidity_, last_temp_);
     return ESP_OK;
 }
 
 AHT10::AHT10(gpio_num_t scl, gpio_num_t sda, i2c_port_t port, uint8_t addr) {
     port_ = port;
     addr_ = addr;
+    lock_ = alloc_mutex_create(&lock_storage_);
+    configASSERT(lock_);
 
     i2c_config_t conf;
     conf.mode = I2C_MODE_MASTER;
@@ -171,12 +145,22 @@ AHT10::AHT10(gpio_num_t scl, gpio_num_t sda, i2c_port_t port, uint8_t addr) {
     ESP_ERROR_CHECK(i2c_driver_install(port_, conf.mode));
     ESP_ERROR_CHECK(i2c_param_config(port_, &conf));
 
+    ESP_ERROR_CHECK(reset_write_.BuildWrite(addr_, reset_, sizeof(reset_)));
+    ESP_ERROR_CHECK(command_write_.BuildWrite(addr_, command_, sizeof(command_)));
+    ESP_ERROR_CHECK(frame_read_.BuildRead(addr_, frame_, sizeof(frame_)));
+
     ESP_ERROR_CHECK(Init());
 
     ESP_LOGD(TAG_, "Setup I2C for AHT10. SCL: %d SDA: %d", scl, sda);
 }
 
 esp_err_t AHT10::Measure(aht10_measurement_t* result) {
+    const int64_t requested = esp_timer_get_time();
+    if (xSemaphoreTake(lock_, AHT10_LOCK_TIMEOUT) != pdTRUE) {
+        ESP_LOGW(TAG_, "Timeout while waiting for data");
+        return ESP_ERR_TIMEOUT;
+    }
+
     ESP_LOGI(TAG_, "Current error count %d", error_count_);
     if (error_count_ > 5) {
         // Something has clearly gone wrong so lets just reset to keep
@@ -185,33 +169,23 @@ esp_err_t AHT10::Measure(aht10_measurement_t* result) {
         esp_restart();
     }
 
-    ESP_LOGI(TAG_, "Getting measurement");
-    int timeout = 100; // 1 second timeout
-    int i = 0;
-    if (!measurement_active_) {
-        measurement_active_ = true;
-        esp_err_t err = TriggerMeasure();
-        measurement_active_ = false;
+    esp_err_t err = ESP_OK;
+    if (last_time_ < requested) {
+        ESP_LOGI(TAG_, "Getting measurement");
+        err = TriggerMeasure();
         if (err != ESP_OK) {
             error_count_++;
-            return err;
         }
     }
     else {
-        ESP_LOGI(TAG_, "Measurement in progress, waiting for result");
-        while (measurement_active_) {
-            i++;
-            if (i > timeout) {
-                error_count_++;
-                ESP_LOGW(TAG_, "Timeout while waiting for data");
-                return ESP_ERR_TIMEOUT;
-            }
-            // Wait until the data is there
-            vTaskDelay(10 / portTICK_PERIOD_MS);
-        }
+        ESP_LOGI(TAG_, "Measurement finished while waiting, using its result");
     }
 
-    result->humidity = last_humidity_;
-    result->temperature = last_temp_;
-    return ESP_OK;
+    if (err == ESP_OK) {
+        result->humidity = last_humidity_;
+        result->temperature = last_temp_;
+        result->time = last_time_;
+    }
+    xSemaphoreGive(lock_);
+    return err;
 }
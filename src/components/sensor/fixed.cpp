@@ -0,0 +1,29 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "fixed.hpp"
+
+#include <stdio.h>
+
+uint32_t fixed_shift_round(uint32_t value, unsigned shift) {
+    uint32_t quotient = value >> shift;
+    uint32_t remainder = value & ((1u << shift) - 1);
+    uint32_t half = 1u << (shift - 1);
+    if (remainder > half || (remainder == half && (quotient & 1))) {
+        quotient++;
+    }
+    return quotient;
+}
+
+int fixed_format_centi(char* buf, size_t len, int64_t value) {
+    const char* sign = value < 0 ? "-" : "";
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : value;
+    return snprintf(
+        buf,
+        len,
+        "%s%llu.%02u",
+        sign,
+        (unsigned long long)(magnitude / 100),
+        (unsigned)(magnitude % 100)
+    );
+}
@@ -0,0 +1,62 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "i2c_transaction.hpp"
+
+#include "driver/i2c.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+const char* I2CTransaction::TAG_ = "i2c_transaction";
+
+esp_err_t I2CTransaction::Begin(uint8_t addr, uint8_t rw) {
+    if (cmd_ != NULL) {
+        i2c_cmd_link_delete(cmd_);
+    }
+    cmd_ = i2c_cmd_link_create();
+    if (cmd_ == NULL) {
+        ESP_LOGE(TAG_, "Failed to allocate command list");
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = i2c_master_start(cmd_);
+    if (err == ESP_OK) {
+        err = i2c_master_write_byte(cmd_, addr << 1 | rw, ACK_CHECK_EN);
+    }
+    return err;
+}
+
+esp_err_t I2CTransaction::End(esp_err_t err) {
+    if (err == ESP_OK) {
+        err = i2c_master_stop(cmd_);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to build transaction (%s)", esp_err_to_name(err));
+        i2c_cmd_link_delete(cmd_);
+        cmd_ = NULL;
+    }
+    return err;
+}
+
+esp_err_t I2CTransaction::BuildWrite(uint8_t addr, uint8_t* data, size_t len) {
+    esp_err_t err = Begin(addr, I2C_MASTER_WRITE);
+    if (err == ESP_OK) {
+        err = i2c_master_write(cmd_, data, len, ACK_CHECK_EN);
+    }
+    return End(err);
+}
+
+esp_err_t I2CTransaction::BuildRead(uint8_t addr, uint8_t* data, size_t len) {
+    esp_err_t err = Begin(addr, I2C_MASTER_READ);
+    if (err == ESP_OK) {
+        err = i2c_master_read(cmd_, data, len, I2C_MASTER_LAST_NACK);
+    }
+    return End(err);
+}
+
+esp_err_t I2CTransaction::Run(i2c_port_t port, uint32_t timeout) {
+    if (cmd_ == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return i2c_master_cmd_begin(port, cmd_, timeout);
+}
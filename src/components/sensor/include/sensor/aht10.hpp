@@ -6,56 +6,89 @@
 
 #include "driver/i2c.h"
 #include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
-#define ACK_CHECK_EN 0x1  // Check ack from sensor
-#define ACK_CHECK_DIS 0x0 // Don't check ack from sensor
+#include "aht10_convert.hpp"
+#include "fixed.hpp"
+#include "i2c_transaction.hpp"
+#include "alloc/alloc.hpp"
 
 #define AHT10_STATUS_BUSY 0x80
 #define AHT10_STATUS_CALIBRATED 0x08
 
+#define AHT10_COMMAND_LEN 3
+#define AHT10_FRAME_LEN 6 // Status byte followed by 20 bit humidity and temperature
+#define AHT10_MEASURE_TIME 80 // Milliseconds, datasheet gives at least 75
+#define AHT10_POLL_INTERVAL 10 // Milliseconds
+#define AHT10_POLL_TIMEOUT 100 // Polls before giving up on the sensor
+#define AHT10_BUS_TIMEOUT (1000 / portTICK_RATE_MS)
+#define AHT10_LOCK_TIMEOUT (2000 / portTICK_RATE_MS) // Longer than a measurement can take
+
 typedef enum {
     AHT10_CMD_CALIBRATE = 0xE1,
     AHT10_CMD_TRIGGER = 0xAC,
     AHT10_CMD_SOFTRESET = 0xBA,
 } aht10_command_t;
 
+// Values are in hundredths of a degree / percent
 struct aht10_measurement_t {
-    float temperature;
-    float humidity;
+    int16_t temperature;
+    int16_t humidity;
+    int64_t time; // Value of esp_timer_get_time() when the conversion completed
 };
 
 class AHT10 {
 private:
     const char TAG_[6] = "AHT10";
 
-    bool measurement_active_ = false;
+    // Held for the whole of a measurement and guards everything below
+    SemaphoreHandle_t lock_;
+    alloc_mutex_t lock_storage_;
     int error_count_ = 0;
-    float last_temp_;
-    float last_humidity_;
+    int16_t last_temp_;
+    int16_t last_humidity_;
+    int64_t last_time_ = -1;
 
     i2c_port_t port_;
     uint8_t addr_;
 
+    // Transactions are built once and reused so taking a measurement
+    // does not touch the heap. They refer to these buffers.
+    uint8_t reset_[1] = { AHT10_CMD_SOFTRESET };
+    uint8_t command_[AHT10_COMMAND_LEN];
+    uint8_t frame_[AHT10_FRAME_LEN];
+    I2CTransaction reset_write_;
+    I2CTransaction command_write_;
+    I2CTransaction frame_read_;
 
     /**
-     * @brief Read data from sensor
+     * @brief Send a three byte command to the sensor
      *
-     * @param reg_addr Address to read
-     * @param data Data to read
-     * @param len Length of data to read
+     * @param cmd Command to send
+     * @param arg0 First argument byte
+     * @param arg1 Second argument byte
      * @return esp_err_t
      */
-    esp_err_t Read(uint8_t* data, size_t len);
+    esp_err_t SendCommand(aht10_command_t cmd, uint8_t arg0, uint8_t arg1);
 
     /**
-     * @brief Write data to AHT10
+     * @brief Read the status byte and measurement data in one transaction
+     *
+     * The AHT10 returns its status as the first byte of every read, so
+     * there is no need to poll the status separately from the data.
+     * The result is left in frame_.
      *
-     * @param reg_addr Address to write
-     * @param data Data to sent to AHT10
-     * @param len Length of data being sent
      * @return esp_err_t
      */
-    esp_err_t Write(uint8_t* data, size_t len);
+    esp_err_t ReadFrame();
+
+    /**
+     * @brief Read frames until the sensor is no longer busy
+     *
+     * @return esp_err_t ESP_ERR_TIMEOUT if the sensor stays busy
+     */
+    esp_err_t WaitReady();
 
     /**
      * @brief Check response code is ESP_OK. If not log warning
@@ -69,14 +102,6 @@ private:
      */
     esp_err_t Init();
 
-    /**
-     * @brief Get the current status of the sensor
-     *
-     * @param status Pointer to where we should store status
-     * @return esp_err_t
-     */
-    esp_err_t GetStatus(uint8_t* status);
-
     /**
      * @brief Trigger measurement from sensor
      *
@@ -97,11 +122,19 @@ public:
      */
     AHT10(gpio_num_t scl, gpio_num_t sda, i2c_port_t port, uint8_t addr);
 
+    // The transactions point into this object's buffers, so it must be
+    // constructed where it will live
+    AHT10(const AHT10&) = delete;
+    AHT10(AHT10&&) = delete;
+    AHT10& operator=(const AHT10&) = delete;
+    AHT10& operator=(AHT10&&) = delete;
+
     /**
      * @brief Get the current measurement from the sensor
      *
-     * If called whilst a measurement is already running will wait for
-     * previous measurement to finish and use results from that instead.
+     * Only one measurement runs at a time. If called whilst a
+     * measurement is already running will wait for it to finish and use
+     * results from that instead, as they are newer than the call.
      *
      * @param result Struct to store result in
      * @return esp_err_t
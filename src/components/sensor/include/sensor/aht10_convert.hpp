@@ -0,0 +1,43 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef SENSOR_AHT10_CONVERT_H_
+#define SENSOR_AHT10_CONVERT_H_
+
+#include <stdint.h>
+
+#include "fixed.hpp"
+
+// Kept apart from the driver so tools/fixed_sweep.cpp can check the
+// conversion on the host.
+//
+// The sensor reports 20 bit counts of full scale. Humidity is
+// raw * 10000 / 2^20 hundredths of a percent and temperature is
+// raw * 20000 / 2^20 - 5000 hundredths of a degree. Both scales reduce
+// to 625 / 2^n, which is exact and keeps raw * 625 within 32 bits.
+#define AHT10_RAW_MULTIPLIER 625
+#define AHT10_HUMIDITY_SHIFT 16
+#define AHT10_TEMPERATURE_SHIFT 15
+#define AHT10_TEMPERATURE_OFFSET 5000
+
+/**
+ * @brief Convert a raw humidity reading to hundredths of a percent
+ *
+ * @param raw 20 bit humidity count
+ * @return int16_t
+ */
+static inline int16_t aht10_humidity_from_raw(uint32_t raw) {
+    return fixed_shift_round(raw * AHT10_RAW_MULTIPLIER, AHT10_HUMIDITY_SHIFT);
+}
+
+/**
+ * @brief Convert a raw temperature reading to hundredths of a degree
+ *
+ * @param raw 20 bit temperature count
+ * @return int16_t
+ */
+static inline int16_t aht10_temperature_from_raw(uint32_t raw) {
+    return (int32_t)fixed_shift_round(raw * AHT10_RAW_MULTIPLIER, AHT10_TEMPERATURE_SHIFT) - AHT10_TEMPERATURE_OFFSET;
+}
+
+#endif // SENSOR_AHT10_CONVERT_H_
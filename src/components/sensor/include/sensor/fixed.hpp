@@ -0,0 +1,38 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef SENSOR_FIXED_H_
+#define SENSOR_FIXED_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest string fixed_format_centi can produce for an int64_t,
+// including the terminator
+#define FIXED_CENTI_STR_LEN 24
+
+/**
+ * @brief Divide by a power of two, rounding to nearest
+ *
+ * Ties go to the even result, the same as printf does when rounding a
+ * float that lands exactly half way, so values converted here format
+ * the same as the float conversion they replace.
+ *
+ * @param value Value to divide
+ * @param shift Power of two to divide by, at least 1
+ * @return uint32_t
+ */
+uint32_t fixed_shift_round(uint32_t value, unsigned shift);
+
+/**
+ * @brief Format a value stored in hundredths as a decimal string
+ *
+ * @param buf Buffer to write to
+ * @param len Size of buffer
+ * @param value Value in hundredths
+ * @return int Number of characters that would have been written, as
+ * with snprintf
+ */
+int fixed_format_centi(char* buf, size_t len, int64_t value);
+
+#endif // SENSOR_FIXED_H_
@@ -0,0 +1,88 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef SENSOR_I2C_TRANSACTION_H_
+#define SENSOR_I2C_TRANSACTION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "driver/i2c.h"
+#include "esp_err.h"
+
+#define ACK_CHECK_EN 0x1  // Check ack from sensor
+#define ACK_CHECK_DIS 0x0 // Don't check ack from sensor
+
+/**
+ * @brief A prebuilt I2C transaction that can be run repeatedly
+ *
+ * Building an I2C command list allocates from the heap for the list and
+ * for every command added to it. The driver only walks the list when it
+ * runs it, so a list built once can be run any number of times. The
+ * list refers to the data buffer rather than copying it, so the buffer
+ * must outlive the transaction and its contents may change between
+ * runs.
+ */
+class I2CTransaction {
+private:
+    static const char* TAG_;
+
+    i2c_cmd_handle_t cmd_ = NULL;
+
+    /**
+     * @brief Start a new command list addressed to a device
+     *
+     * @param addr 7 bit device address
+     * @param rw I2C_MASTER_READ or I2C_MASTER_WRITE
+     * @return esp_err_t
+     */
+    esp_err_t Begin(uint8_t addr, uint8_t rw);
+
+    /**
+     * @brief Finish the command list
+     *
+     * @param err Result of adding the body of the transaction
+     * @return esp_err_t
+     */
+    esp_err_t End(esp_err_t err);
+
+public:
+    I2CTransaction() = default;
+
+    // A copy would share the command list and the buffer it refers to
+    I2CTransaction(const I2CTransaction&) = delete;
+    I2CTransaction(I2CTransaction&&) = delete;
+    I2CTransaction& operator=(const I2CTransaction&) = delete;
+    I2CTransaction& operator=(I2CTransaction&&) = delete;
+
+    /**
+     * @brief Build a transaction that writes a buffer to a device
+     *
+     * @param addr 7 bit device address
+     * @param data Data to write, read each time the transaction runs
+     * @param len Length of data
+     * @return esp_err_t
+     */
+    esp_err_t BuildWrite(uint8_t addr, uint8_t* data, size_t len);
+
+    /**
+     * @brief Build a transaction that reads from a device into a buffer
+     *
+     * @param addr 7 bit device address
+     * @param data Buffer filled each time the transaction runs
+     * @param len Number of bytes to read
+     * @return esp_err_t
+     */
+    esp_err_t BuildRead(uint8_t addr, uint8_t* data, size_t len);
+
+    /**
+     * @brief Run the transaction
+     *
+     * @param port I2C port to use
+     * @param timeout Ticks to wait for the bus
+     * @return esp_err_t ESP_ERR_INVALID_STATE if it has not been built
+     */
+    esp_err_t Run(i2c_port_t port, uint32_t timeout);
+};
+
+#endif // SENSOR_I2C_TRANSACTION_H_
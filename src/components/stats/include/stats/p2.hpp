@@ -0,0 +1,94 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef STATS_P2_H_
+#define STATS_P2_H_
+
+#include <stdint.h>
+
+#define P2_MARKERS 5
+// Marker heights are kept in fractions of an observation so that the
+// small corrections made on each observation are not rounded away
+#define P2_HEIGHT_SCALE 256
+
+/**
+ * @brief Streaming quantile estimator using the P² algorithm
+ *
+ * Tracks a single quantile in constant memory and constant time per
+ * observation without storing the observations. See Jain & Chlamtac,
+ * "The P² algorithm for dynamic calculation of quantiles and histograms
+ * without storing observations" (1985).
+ *
+ * Everything is done with integer arithmetic. Observations are fixed
+ * point values (e.g. hundredths) and marker positions are kept in
+ * thousandths so no floating point is needed on the ESP8266.
+ * Marker heights are scaled by P2_HEIGHT_SCALE, so observations must
+ * be within +/-2^23.
+ */
+class P2Quantile {
+private:
+    uint16_t p_; // Quantile in thousandths, e.g. 990 for p99
+    uint32_t count_;
+    int32_t heights_[P2_MARKERS]; // Observations times P2_HEIGHT_SCALE
+    int32_t positions_[P2_MARKERS];
+    int64_t desired_[P2_MARKERS]; // Thousandths
+    int32_t increments_[P2_MARKERS]; // Thousandths
+
+    /**
+     * @brief Piecewise parabolic prediction of a new marker height
+     *
+     * @param i Marker to adjust
+     * @param d Direction of adjustment, 1 or -1
+     * @return int32_t
+     */
+    int32_t Parabolic(int i, int d) const;
+
+    /**
+     * @brief Linear prediction of a new marker height
+     *
+     * @param i Marker to adjust
+     * @param d Direction of adjustment, 1 or -1
+     * @return int32_t
+     */
+    int32_t Linear(int i, int d) const;
+
+public:
+    /**
+     * @brief Construct a new P2Quantile object
+     *
+     * @param p Quantile to track in thousandths
+     */
+    P2Quantile(uint16_t p);
+
+    /**
+     * @brief Forget all observations
+     */
+    void Reset();
+
+    /**
+     * @brief Add an observation
+     *
+     * @param observation Observation in fixed point
+     */
+    void Add(int32_t observation);
+
+    /**
+     * @brief Get the current estimate of the quantile
+     *
+     * Exact until more than five observations have been made.
+     *
+     * @param value Where to store estimate
+     * @return true An estimate is available
+     * @return false No observations have been made
+     */
+    bool Get(int32_t* value) const;
+
+    /**
+     * @brief Get the quantile being tracked
+     *
+     * @return uint16_t Quantile in thousandths
+     */
+    uint16_t GetQuantile() const;
+};
+
+#endif // STATS_P2_H_
@@ -0,0 +1,81 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef STATS_SUMMARY_H_
+#define STATS_SUMMARY_H_
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "window.hpp"
+#include "alloc/alloc.hpp"
+#include "sampler/sampler.hpp"
+#include "sdkconfig.h"
+
+#define STATS_CLIENT_LEN 46 // Long enough for an IPv6 address as text
+
+/**
+ * @brief Windows kept for one scraper
+ */
+struct stats_scraper_t {
+    bool used;
+    char client[STATS_CLIENT_LEN];
+    uint32_t last_collect; // Value of the collect counter at its last scrape
+    WindowSummary temperature;
+    WindowSummary humidity;
+};
+
+/**
+ * @brief Window summaries of temperature and humidity fed by the sampler
+ *
+ * Each scraper, identified by IP address, has its own window covering
+ * the samples since its previous scrape. A second Prometheus or a
+ * one off curl does not take samples out of anyone else's window. A
+ * scraper's first scrape starts its window so reports it empty. Up to
+ * CONFIG_WEBSERVER_PREFETCH_SCRAPERS scrapers are tracked, the one
+ * that scraped longest ago is forgotten to make room.
+ */
+class MeasurementSummary {
+private:
+    SemaphoreHandle_t lock_;
+    alloc_mutex_t lock_storage_;
+    stats_scraper_t scrapers_[CONFIG_WEBSERVER_PREFETCH_SCRAPERS];
+    uint32_t collects_ = 0;
+    uint32_t count_ = 0;
+    int64_t temperature_sum_ = 0;
+    int64_t humidity_sum_ = 0;
+
+    /**
+     * @brief Find a scraper's windows, starting new ones if it is new
+     *
+     * Must be called with lock_ held.
+     *
+     * @param client IP address of the scraper
+     * @return stats_scraper_t*
+     */
+    stats_scraper_t* Find(const char* client);
+
+public:
+    MeasurementSummary();
+
+    /**
+     * @brief Sampler listener which adds every sample to the summaries
+     *
+     * @param sample Sample to add
+     * @param arg Pointer to MeasurementSummary instance
+     */
+    static void Listener(const sampler_sample_t* sample, void* arg);
+
+    /**
+     * @brief Get both of a scraper's summaries and start its next window
+     *
+     * @param client IP address of the scraper
+     * @param temperature Where to store temperature summary
+     * @param humidity Where to store humidity summary
+     */
+    void Collect(const char* client, stats_snapshot_t* temperature, stats_snapshot_t* humidity);
+};
+
+#endif // STATS_SUMMARY_H_
@@ -0,0 +1,66 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef STATS_WINDOW_H_
+#define STATS_WINDOW_H_
+
+#include <stdint.h>
+
+#include "p2.hpp"
+
+#define STATS_QUANTILES 3
+// Windows with up to this many observations report exact quantiles
+// from a copy of the observations rather than the P² estimate.
+#define STATS_EXACT_SAMPLES 16
+
+struct stats_snapshot_t {
+    uint16_t quantiles[STATS_QUANTILES]; // Thousandths
+    int32_t values[STATS_QUANTILES];
+    int32_t min;
+    int32_t max;
+    uint32_t window_count; // Observations in window, 0 if empty
+    uint32_t count; // All observations since boot
+    int64_t sum; // All observations since boot
+};
+
+/**
+ * @brief Distribution of a single value between scrapes
+ *
+ * Covers the quantiles, min and max of the current window. Count and
+ * sum are left to the owner, as they cover every observation since
+ * boot as Prometheus expects of a summary.
+ */
+class WindowSummary {
+private:
+    P2Quantile estimators_[STATS_QUANTILES];
+    int32_t exact_[STATS_EXACT_SAMPLES];
+    int32_t min_;
+    int32_t max_;
+    uint32_t window_count_ = 0;
+
+public:
+    WindowSummary();
+
+    /**
+     * @brief Add an observation to the window
+     *
+     * @param value Observation in hundredths
+     */
+    void Add(int32_t value);
+
+    /**
+     * @brief Get the window and start a new one
+     *
+     * Count and sum are not touched.
+     *
+     * @param snapshot Where to store state
+     */
+    void Collect(stats_snapshot_t* snapshot);
+
+    /**
+     * @brief Start a new window without reading the current one
+     */
+    void Reset();
+};
+
+#endif // STATS_WINDOW_H_
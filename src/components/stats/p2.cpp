@@ -0,0 +1,138 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "p2.hpp"
+
+/**
+ * @brief Divide rounding to the nearest integer
+ *
+ * @param num Numerator
+ * @param den Denominator, must be positive
+ * @return int64_t
+ */
+static int64_t p2_div_round(int64_t num, int64_t den) {
+    return num >= 0 ? (num + den / 2) / den : (num - den / 2) / den;
+}
+
+int32_t P2Quantile::Parabolic(int i, int d) const {
+    int64_t n_prev = positions_[i - 1];
+    int64_t n = positions_[i];
+    int64_t n_next = positions_[i + 1];
+    int64_t q_prev = heights_[i - 1];
+    int64_t q = heights_[i];
+    int64_t q_next = heights_[i + 1];
+
+    // q + d / (n_next - n_prev) * (
+    //     (n - n_prev + d) * (q_next - q) / (n_next - n)
+    //     + (n_next - n - d) * (q - q_prev) / (n - n_prev))
+    // with everything brought over a common denominator.
+    int64_t num = (n - n_prev + d) * (q_next - q) * (n - n_prev)
+        + (n_next - n - d) * (q - q_prev) * (n_next - n);
+    int64_t den = (n_next - n_prev) * (n_next - n) * (n - n_prev);
+    return (int32_t)(q + d * p2_div_round(num, den));
+}
+
+int32_t P2Quantile::Linear(int i, int d) const {
+    int64_t num = (int64_t)d * (heights_[i + d] - heights_[i]);
+    int64_t den = (int64_t)positions_[i + d] - positions_[i];
+    if (den < 0) {
+        num = -num;
+        den = -den;
+    }
+    return (int32_t)(heights_[i] + p2_div_round(num, den));
+}
+
+P2Quantile::P2Quantile(uint16_t p) {
+    p_ = p;
+    increments_[0] = 0;
+    increments_[1] = p / 2;
+    increments_[2] = p;
+    increments_[3] = (1000 + p) / 2;
+    increments_[4] = 1000;
+    Reset();
+}
+
+void P2Quantile::Reset() {
+    count_ = 0;
+    for (int i = 0; i < P2_MARKERS; i++) {
+        positions_[i] = i + 1;
+    }
+    desired_[0] = 1000;
+    desired_[1] = 1000 + 2 * p_;
+    desired_[2] = 1000 + 4 * p_;
+    desired_[3] = 3000 + 2 * p_;
+    desired_[4] = 5000;
+}
+
+void P2Quantile::Add(int32_t observation) {
+    int32_t value = observation * P2_HEIGHT_SCALE;
+    if (count_ < P2_MARKERS) {
+        // Keep the first observations sorted, they become the markers
+        int i = count_;
+        while (i > 0 && heights_[i - 1] > value) {
+            heights_[i] = heights_[i - 1];
+            i--;
+        }
+        heights_[i] = value;
+        count_++;
+        return;
+    }
+    count_++;
+
+    int k;
+    if (value < heights_[0]) {
+        heights_[0] = value;
+        k = 0;
+    }
+    else if (value >= heights_[4]) {
+        heights_[4] = value;
+        k = 3;
+    }
+    else {
+        k = 0;
+        while (k < 3 && value >= heights_[k + 1]) {
+            k++;
+        }
+    }
+
+    for (int i = k + 1; i < P2_MARKERS; i++) {
+        positions_[i]++;
+    }
+    for (int i = 0; i < P2_MARKERS; i++) {
+        desired_[i] += increments_[i];
+    }
+
+    for (int i = 1; i < P2_MARKERS - 1; i++) {
+        int64_t diff = desired_[i] - (int64_t)positions_[i] * 1000;
+        if ((diff >= 1000 && positions_[i + 1] - positions_[i] > 1)
+            || (diff <= -1000 && positions_[i - 1] - positions_[i] < -1)) {
+            int d = diff > 0 ? 1 : -1;
+            int32_t height = Parabolic(i, d);
+            if (heights_[i - 1] < height && height < heights_[i + 1]) {
+                heights_[i] = height;
+            }
+            else {
+                heights_[i] = Linear(i, d);
+            }
+            positions_[i] += d;
+        }
+    }
+}
+
+bool P2Quantile::Get(int32_t* value) const {
+    if (count_ == 0) {
+        return false;
+    }
+    if (count_ <= P2_MARKERS) {
+        // Nearest rank on the sorted observations
+        uint32_t rank = (p_ * count_ + 999) / 1000;
+        *value = heights_[rank == 0 ? 0 : rank - 1] / P2_HEIGHT_SCALE;
+        return true;
+    }
+    *value = (int32_t)p2_div_round(heights_[2], P2_HEIGHT_SCALE);
+    return true;
+}
+
+uint16_t P2Quantile::GetQuantile() const {
+    return p_;
+}
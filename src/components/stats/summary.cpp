@@ -0,0 +1,74 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "summary.hpp"
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "sampler/sampler.hpp"
+
+stats_scraper_t* MeasurementSummary::Find(const char* client) {
+    stats_scraper_t* victim = NULL;
+    for (int i = 0; i < CONFIG_WEBSERVER_PREFETCH_SCRAPERS; i++) {
+        stats_scraper_t* scraper = &scrapers_[i];
+        if (scraper->used && strcmp(scraper->client, client) == 0) {
+            return scraper;
+        }
+        // Counter differences so wrapping does not matter
+        if (victim == NULL || (victim->used
+            && (!scraper->used || collects_ - scraper->last_collect > collects_ - victim->last_collect))) {
+            victim = scraper;
+        }
+    }
+
+    victim->used = true;
+    strncpy(victim->client, client, sizeof(victim->client) - 1);
+    victim->client[sizeof(victim->client) - 1] = '\0';
+    victim->temperature.Reset();
+    victim->humidity.Reset();
+    return victim;
+}
+
+MeasurementSummary::MeasurementSummary() {
+    lock_ = alloc_mutex_create(&lock_storage_);
+    configASSERT(lock_);
+    for (int i = 0; i < CONFIG_WEBSERVER_PREFETCH_SCRAPERS; i++) {
+        scrapers_[i].used = false;
+        scrapers_[i].last_collect = 0;
+    }
+}
+
+void MeasurementSummary::Listener(const sampler_sample_t* sample, void* arg) {
+    MeasurementSummary* summary = (MeasurementSummary*)arg;
+    int32_t temperature = sample->measurement.temperature;
+    int32_t humidity = sample->measurement.humidity;
+
+    xSemaphoreTake(summary->lock_, portMAX_DELAY);
+    summary->count_++;
+    summary->temperature_sum_ += temperature;
+    summary->humidity_sum_ += humidity;
+    for (int i = 0; i < CONFIG_WEBSERVER_PREFETCH_SCRAPERS; i++) {
+        stats_scraper_t* scraper = &summary->scrapers_[i];
+        if (scraper->used) {
+            scraper->temperature.Add(temperature);
+            scraper->humidity.Add(humidity);
+        }
+    }
+    xSemaphoreGive(summary->lock_);
+}
+
+void MeasurementSummary::Collect(const char* client, stats_snapshot_t* temperature, stats_snapshot_t* humidity) {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    stats_scraper_t* scraper = Find(client);
+    scraper->last_collect = ++collects_;
+    scraper->temperature.Collect(temperature);
+    scraper->humidity.Collect(humidity);
+    temperature->count = count_;
+    temperature->sum = temperature_sum_;
+    humidity->count = count_;
+    humidity->sum = humidity_sum_;
+    xSemaphoreGive(lock_);
+}
@@ -0,0 +1,70 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "window.hpp"
+
+#include "p2.hpp"
+
+WindowSummary::WindowSummary()
+    : estimators_{ P2Quantile(500), P2Quantile(900), P2Quantile(990) } {
+}
+
+void WindowSummary::Add(int32_t value) {
+    if (window_count_ == 0 || value < min_) {
+        min_ = value;
+    }
+    if (window_count_ == 0 || value > max_) {
+        max_ = value;
+    }
+    if (window_count_ < STATS_EXACT_SAMPLES) {
+        exact_[window_count_] = value;
+    }
+    for (int i = 0; i < STATS_QUANTILES; i++) {
+        estimators_[i].Add(value);
+    }
+    window_count_++;
+}
+
+void WindowSummary::Collect(stats_snapshot_t* snapshot) {
+    snapshot->min = min_;
+    snapshot->max = max_;
+    snapshot->window_count = window_count_;
+
+    int32_t sorted[STATS_EXACT_SAMPLES];
+    bool exact = window_count_ <= STATS_EXACT_SAMPLES;
+    if (exact) {
+        // Insertion sort is fine for this few values
+        for (uint32_t i = 0; i < window_count_; i++) {
+            uint32_t j = i;
+            while (j > 0 && sorted[j - 1] > exact_[i]) {
+                sorted[j] = sorted[j - 1];
+                j--;
+            }
+            sorted[j] = exact_[i];
+        }
+    }
+
+    for (int i = 0; i < STATS_QUANTILES; i++) {
+        uint16_t p = estimators_[i].GetQuantile();
+        snapshot->quantiles[i] = p;
+        snapshot->values[i] = 0;
+        if (window_count_ == 0) {
+            continue;
+        }
+        if (exact) {
+            uint32_t rank = (p * window_count_ + 999) / 1000;
+            snapshot->values[i] = sorted[rank == 0 ? 0 : rank - 1];
+        }
+        else {
+            estimators_[i].Get(&snapshot->values[i]);
+        }
+    }
+    Reset();
+}
+
+void WindowSummary::Reset() {
+    for (int i = 0; i < STATS_QUANTILES; i++) {
+        estimators_[i].Reset();
+    }
+    window_count_ = 0;
+}
@@ -0,0 +1,53 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef TIMESYNC_TIMESYNC_H_
+#define TIMESYNC_TIMESYNC_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define TIMESYNC_TASK_STACK_SIZE 2048
+#define TIMESYNC_TASK_PRIORITY 3
+
+struct timesync_stats_t {
+    bool synced; // The clock has been set at least once
+    int64_t offset; // Microseconds the clock was corrected by at the last sync, 0 for the first
+    int64_t delay; // Round trip in microseconds of the last sync
+    int64_t last_sync; // Value of esp_timer_get_time() at the last sync
+    uint32_t syncs;
+    uint32_t failures;
+};
+
+/**
+ * @brief Start the task keeping the clock in step with the SNTP server
+ *
+ * Timestamps are worked out from esp_timer, which counts from boot and
+ * never jumps, plus the Unix time of esp_timer zero measured at each
+ * sync. The system clock is set as well for anything using
+ * gettimeofday. Must be called once the network stack has been
+ * initialised.
+ *
+ * @return esp_err_t
+ */
+esp_err_t timesync_start();
+
+/**
+ * @brief Convert a time from esp_timer_get_time() to Unix time
+ *
+ * @param time Microseconds since boot
+ * @param unix_ms Where to store Unix time in milliseconds
+ * @return esp_err_t ESP_ERR_INVALID_STATE if the clock has not been
+ * set yet
+ */
+esp_err_t timesync_to_unix_ms(int64_t time, int64_t* unix_ms);
+
+/**
+ * @brief Get the state of the last sync
+ *
+ * @param stats Struct to copy the stats into
+ */
+void timesync_get_stats(timesync_stats_t* stats);
+
+#endif // TIMESYNC_TIMESYNC_H_
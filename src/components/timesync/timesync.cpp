@@ -0,0 +1,251 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "timesync.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+#include "sdkconfig.h"
+
+#include "alloc/alloc.hpp"
+#include "diagnostics/diagnostics.hpp"
+#include "power/power.hpp"
+
+#define TIMESYNC_PORT "123"
+#define TIMESYNC_PACKET_LEN 48
+#define TIMESYNC_TIMEOUT 2000 // Milliseconds to wait for a reply
+#define TIMESYNC_RETRY_INTERVAL 30 // Seconds before trying again after a failure
+#define TIMESYNC_NTP_TO_UNIX 2208988800LL // Seconds from 1900 to 1970
+
+// First byte of a packet is leap indicator (2 bits), version (3 bits)
+// and mode (3 bits)
+#define TIMESYNC_REQUEST_HEADER (4 << 3 | 3) // Version 4, client
+#define TIMESYNC_MODE_SERVER 4
+#define TIMESYNC_LEAP_UNSYNCHRONISED 3
+
+// Offsets of the fields used in a packet
+#define TIMESYNC_STRATUM 1
+#define TIMESYNC_ORIGINATE 24
+#define TIMESYNC_RECEIVE 32
+#define TIMESYNC_TRANSMIT 40
+
+static const char TAG_[] = "timesync";
+
+static SemaphoreHandle_t lock_ = NULL;
+static alloc_mutex_t lock_storage_;
+static TaskHandle_t task_ = NULL;
+static alloc_task_t<TIMESYNC_TASK_STACK_SIZE> task_storage_;
+static power_source_t power_ = POWER_SOURCE_INVALID;
+
+// Unix time in microseconds at esp_timer zero, 0 until the first sync
+static int64_t base_ = 0;
+static timesync_stats_t stats_ = {};
+
+/**
+ * @brief Read an NTP timestamp as Unix time
+ *
+ * Seconds below 2^31 are taken to be after the 2036 rollover, so times
+ * from 1968 to 2104 are read correctly.
+ *
+ * @param p First byte of the timestamp
+ * @return int64_t Unix time in microseconds
+ */
+static int64_t timesync_read_timestamp(const uint8_t* p) {
+    uint32_t seconds = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    uint32_t fraction = (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+    int64_t unix_seconds = (int64_t)seconds - TIMESYNC_NTP_TO_UNIX;
+    if (seconds < 0x80000000) {
+        unix_seconds += 1LL << 32;
+    }
+    return unix_seconds * 1000000 + (int64_t)(((uint64_t)fraction * 1000000) >> 32);
+}
+
+/**
+ * @brief Write Unix time as an NTP timestamp
+ *
+ * @param p First byte of the timestamp
+ * @param unix_us Unix time in microseconds
+ */
+static void timesync_write_timestamp(uint8_t* p, int64_t unix_us) {
+    uint32_t seconds = (uint32_t)(unix_us / 1000000 + TIMESYNC_NTP_TO_UNIX);
+    uint32_t fraction = (uint32_t)(((uint64_t)(unix_us % 1000000) << 32) / 1000000);
+    for (int i = 0; i < 4; i++) {
+        p[i] = seconds >> (24 - i * 8);
+        p[4 + i] = fraction >> (24 - i * 8);
+    }
+}
+
+/**
+ * @brief Ask the server for the time
+ *
+ * Uses the usual four timestamp calculation, so the offset is exact
+ * when the request and reply take equally long.
+ *
+ * @param base Current Unix time at esp_timer zero
+ * @param offset Set to how far base is behind the server in microseconds
+ * @param delay Set to the round trip time in microseconds
+ * @return esp_err_t
+ */
+static esp_err_t timesync_query(int64_t base, int64_t* offset, int64_t* delay) {
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo* server = NULL;
+    if (getaddrinfo(CONFIG_TIMESYNC_SERVER, TIMESYNC_PORT, &hints, &server) != 0 || server == NULL) {
+        ESP_LOGW(TAG_, "Failed to resolve %s", CONFIG_TIMESYNC_SERVER);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    int sock = socket(server->ai_family, server->ai_socktype, 0);
+    if (sock < 0) {
+        freeaddrinfo(server);
+        ESP_LOGW(TAG_, "Failed to create socket");
+        return ESP_FAIL;
+    }
+    struct timeval timeout = { TIMESYNC_TIMEOUT / 1000, TIMESYNC_TIMEOUT % 1000 * 1000 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    uint8_t request[TIMESYNC_PACKET_LEN] = {};
+    request[0] = TIMESYNC_REQUEST_HEADER;
+    int64_t sent = esp_timer_get_time();
+    // Echoed back in the reply's originate field, which is how a reply
+    // to this request is recognised
+    timesync_write_timestamp(request + TIMESYNC_TRANSMIT, base + sent);
+    int len = sendto(sock, request, sizeof(request), 0, server->ai_addr, server->ai_addrlen);
+    freeaddrinfo(server);
+    if (len != sizeof(request)) {
+        close(sock);
+        ESP_LOGW(TAG_, "Failed to send request");
+        return ESP_FAIL;
+    }
+
+    uint8_t reply[TIMESYNC_PACKET_LEN];
+    len = recv(sock, reply, sizeof(reply), 0);
+    int64_t received = esp_timer_get_time();
+    close(sock);
+    if (len < (int)sizeof(reply)) {
+        ESP_LOGW(TAG_, "No reply from %s", CONFIG_TIMESYNC_SERVER);
+        return ESP_ERR_TIMEOUT;
+    }
+    if ((reply[0] & 0x07) != TIMESYNC_MODE_SERVER
+        || memcmp(reply + TIMESYNC_ORIGINATE, request + TIMESYNC_TRANSMIT, 8) != 0) {
+        ESP_LOGW(TAG_, "Ignoring reply that does not match the request");
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    if (reply[0] >> 6 == TIMESYNC_LEAP_UNSYNCHRONISED || reply[TIMESYNC_STRATUM] == 0) {
+        // Stratum 0 is a kiss-o'-death, e.g. asking us to back off
+        ESP_LOGW(TAG_, "Server is not synchronised or refused the request");
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    int64_t server_received = timesync_read_timestamp(reply + TIMESYNC_RECEIVE);
+    int64_t server_sent = timesync_read_timestamp(reply + TIMESYNC_TRANSMIT);
+    *offset = ((server_received - (base + sent)) + (server_sent - (base + received))) / 2;
+    *delay = (received - sent) - (server_sent - server_received);
+    return ESP_OK;
+}
+
+static void timesync_task(void* arg) {
+    while (1) {
+        power_busy(power_);
+        xSemaphoreTake(lock_, portMAX_DELAY);
+        int64_t base = base_;
+        xSemaphoreGive(lock_);
+
+        int64_t offset;
+        int64_t delay;
+        esp_err_t err = timesync_query(base, &offset, &delay);
+        int64_t now = esp_timer_get_time();
+        uint32_t wait = CONFIG_TIMESYNC_INTERVAL;
+
+        xSemaphoreTake(lock_, portMAX_DELAY);
+        if (err == ESP_OK) {
+            base_ = base + offset;
+            // The first sync moves the clock from 1970, which says
+            // nothing about how well it keeps time
+            stats_.offset = stats_.synced ? offset : 0;
+            stats_.delay = delay;
+            stats_.last_sync = now;
+            stats_.synced = true;
+            stats_.syncs++;
+            base = base_;
+        }
+        else {
+            stats_.failures++;
+            wait = TIMESYNC_RETRY_INTERVAL;
+        }
+        xSemaphoreGive(lock_);
+
+        if (err == ESP_OK) {
+            int64_t unix_us = base + esp_timer_get_time();
+            struct timeval tv = { (time_t)(unix_us / 1000000), (suseconds_t)(unix_us % 1000000) };
+            settimeofday(&tv, NULL);
+            ESP_LOGI(TAG_, "Clock corrected by %lld us, round trip %lld us", (long long)offset, (long long)delay);
+        }
+
+        diagnostics_check_stack();
+        power_wake_at(power_, now + wait * 1000000LL);
+        vTaskDelay(wait * 1000 / portTICK_PERIOD_MS);
+    }
+}
+
+esp_err_t timesync_start() {
+    if (task_ != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    lock_ = alloc_mutex_create(&lock_storage_);
+    if (lock_ == NULL) {
+        ESP_LOGE(TAG_, "Failed to create lock");
+        return ESP_ERR_NO_MEM;
+    }
+    power_ = power_register("timesync");
+
+    ESP_LOGI(TAG_, "Syncing clock with %s every %d s", CONFIG_TIMESYNC_SERVER, CONFIG_TIMESYNC_INTERVAL);
+    esp_err_t err = alloc_task_create(
+        &task_storage_,
+        timesync_task,
+        "timesync",
+        NULL,
+        TIMESYNC_TASK_PRIORITY,
+        &task_
+    );
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to create timesync task");
+    }
+    return err;
+}
+
+esp_err_t timesync_to_unix_ms(int64_t time, int64_t* unix_ms) {
+    if (lock_ == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    bool synced = stats_.synced;
+    int64_t base = base_;
+    xSemaphoreGive(lock_);
+    if (!synced) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *unix_ms = (base + time) / 1000;
+    return ESP_OK;
+}
+
+void timesync_get_stats(timesync_stats_t* stats) {
+    if (lock_ == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    *stats = stats_;
+    xSemaphoreGive(lock_);
+}
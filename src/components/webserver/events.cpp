@@ -0,0 +1,294 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "events.hpp"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include "sys/socket.h"
+
+#include "alloc/alloc.hpp"
+#include "power/power.hpp"
+#include "sampler/sampler.hpp"
+#include "sensor/fixed.hpp"
+
+enum webserver_events_state_t {
+    WEBSERVER_EVENTS_FREE,
+    WEBSERVER_EVENTS_ACTIVE,
+    WEBSERVER_EVENTS_DROPPED, // Waiting for the httpd task to close it
+    WEBSERVER_EVENTS_CLOSING, // Close requested, waiting for free_ctx
+};
+
+struct webserver_events_client_t {
+    webserver_events_state_t state;
+    httpd_handle_t server;
+    int fd;
+    size_t len;
+    char buf[CONFIG_WEBSERVER_EVENTS_BUFFER_SIZE];
+};
+
+static const char TAG_[] = "webserver_events";
+
+static SemaphoreHandle_t lock_ = NULL;
+static alloc_mutex_t lock_storage_;
+static webserver_events_client_t clients_[CONFIG_WEBSERVER_EVENTS_MAX_CLIENTS];
+static bool flush_queued_ = false;
+static uint32_t dropped_ = 0;
+static power_source_t power_ = POWER_SOURCE_INVALID;
+
+// Most recent event, sent to new subscribers straight away
+static char latest_[WEBSERVER_EVENTS_MAX_LEN];
+static size_t latest_len_ = 0;
+static uint32_t sequence_ = 0;
+
+/**
+ * @brief Keep the device awake while anyone is subscribed
+ *
+ * Events go out as samples are taken, so a subscriber can not be
+ * served from light sleep. Must be called with the lock held.
+ */
+static void webserver_events_update_power() {
+    for (int i = 0; i < CONFIG_WEBSERVER_EVENTS_MAX_CLIENTS; i++) {
+        if (clients_[i].state != WEBSERVER_EVENTS_FREE) {
+            power_busy(power_);
+            return;
+        }
+    }
+    power_idle(power_);
+}
+
+/**
+ * @brief Send as much buffered data as each socket will take without
+ * blocking and close any dropped subscribers
+ *
+ * Runs in the httpd task via httpd_queue_work.
+ *
+ * @param arg Unused
+ */
+static void webserver_events_flush(void* arg) {
+    httpd_handle_t close_servers[CONFIG_WEBSERVER_EVENTS_MAX_CLIENTS];
+    int close_fds[CONFIG_WEBSERVER_EVENTS_MAX_CLIENTS];
+    int close_count = 0;
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    flush_queued_ = false;
+    for (int i = 0; i < CONFIG_WEBSERVER_EVENTS_MAX_CLIENTS; i++) {
+        webserver_events_client_t* client = &clients_[i];
+        if (client->state == WEBSERVER_EVENTS_ACTIVE && client->len > 0) {
+            int sent = send(client->fd, client->buf, client->len, MSG_DONTWAIT);
+            if (sent < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    ESP_LOGD(TAG_, "Send to subscriber %d failed (%d)", client->fd, errno);
+                    client->state = WEBSERVER_EVENTS_DROPPED;
+                }
+            }
+            else {
+                // Keep whatever the socket could not take for next time
+                client->len -= sent;
+                memmove(client->buf, client->buf + sent, client->len);
+            }
+        }
+        if (client->state == WEBSERVER_EVENTS_DROPPED) {
+            client->state = WEBSERVER_EVENTS_CLOSING;
+            close_servers[close_count] = client->server;
+            close_fds[close_count] = client->fd;
+            close_count++;
+        }
+    }
+    xSemaphoreGive(lock_);
+
+    // Closing calls webserver_events_free_ctx so must be done unlocked
+    for (int i = 0; i < close_count; i++) {
+        httpd_sess_trigger_close(close_servers[i], close_fds[i]);
+    }
+}
+
+/**
+ * @brief Queue a flush on the httpd task unless one is already pending
+ *
+ * Must be called with the lock held.
+ *
+ * @param server Server to queue work on
+ * @return true The caller must queue the flush once unlocked
+ * @return false A flush is already pending
+ */
+static bool webserver_events_claim_flush(httpd_handle_t server) {
+    if (flush_queued_ || server == NULL) {
+        return false;
+    }
+    flush_queued_ = true;
+    return true;
+}
+
+/**
+ * @brief Queue a claimed flush
+ *
+ * @param server Server to queue work on
+ */
+static void webserver_events_queue_flush(httpd_handle_t server) {
+    if (httpd_queue_work(server, webserver_events_flush, NULL) != ESP_OK) {
+        ESP_LOGW(TAG_, "Failed to queue event flush");
+        xSemaphoreTake(lock_, portMAX_DELAY);
+        flush_queued_ = false;
+        xSemaphoreGive(lock_);
+    }
+}
+
+/**
+ * @brief Release a subscriber slot when its session is closed
+ *
+ * Called by httpd as the session's free_ctx.
+ *
+ * @param ctx Subscriber slot
+ */
+static void webserver_events_free_ctx(void* ctx) {
+    webserver_events_client_t* client = (webserver_events_client_t*)ctx;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    ESP_LOGI(TAG_, "Subscriber %d disconnected", client->fd);
+    client->state = WEBSERVER_EVENTS_FREE;
+    client->len = 0;
+    webserver_events_update_power();
+    xSemaphoreGive(lock_);
+}
+
+esp_err_t webserver_events_init() {
+    lock_ = alloc_mutex_create(&lock_storage_);
+    if (lock_ == NULL) {
+        ESP_LOGE(TAG_, "Failed to create lock");
+        return ESP_ERR_NO_MEM;
+    }
+    power_ = power_register("events");
+    power_idle(power_);
+    return ESP_OK;
+}
+
+void webserver_events_listener(const sampler_sample_t* sample, void* arg) {
+    char temperature[FIXED_CENTI_STR_LEN];
+    char humidity[FIXED_CENTI_STR_LEN];
+    fixed_format_centi(temperature, sizeof(temperature), sample->measurement.temperature);
+    fixed_format_centi(humidity, sizeof(humidity), sample->measurement.humidity);
+
+    httpd_handle_t server = NULL;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    sequence_++;
+    int len = snprintf(
+        latest_,
+        sizeof(latest_),
+        "id: %u\n"
+        "event: sample\n"
+        "data: {\"uptime_seconds\":%lld,\"temperature_celsius\":%s,\"humidity_percent\":%s}\n\n",
+        sequence_,
+        (long long)(sample->timestamp / 1000000),
+        temperature,
+        humidity
+    );
+    latest_len_ = len > 0 && (size_t)len < sizeof(latest_) ? len : 0;
+
+    for (int i = 0; i < CONFIG_WEBSERVER_EVENTS_MAX_CLIENTS; i++) {
+        webserver_events_client_t* client = &clients_[i];
+        if (client->state != WEBSERVER_EVENTS_ACTIVE) {
+            continue;
+        }
+        if (client->len + latest_len_ > sizeof(client->buf)) {
+            // Still has older events queued, it is not keeping up
+            ESP_LOGW(TAG_, "Dropping slow subscriber %d", client->fd);
+            client->state = WEBSERVER_EVENTS_DROPPED;
+            dropped_++;
+        }
+        else {
+            memcpy(client->buf + client->len, latest_, latest_len_);
+            client->len += latest_len_;
+        }
+        server = client->server;
+    }
+    bool queue = webserver_events_claim_flush(server);
+    xSemaphoreGive(lock_);
+
+    if (queue) {
+        webserver_events_queue_flush(server);
+    }
+}
+
+esp_err_t webserver_events_subscribe(httpd_req_t* req) {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    webserver_events_client_t* client = NULL;
+    for (int i = 0; i < CONFIG_WEBSERVER_EVENTS_MAX_CLIENTS; i++) {
+        if (clients_[i].state == WEBSERVER_EVENTS_FREE) {
+            client = &clients_[i];
+            break;
+        }
+    }
+    if (client != NULL) {
+        // Reserve the slot now, it is not visible to the listener
+        // until it is active
+        client->state = WEBSERVER_EVENTS_CLOSING;
+        webserver_events_update_power();
+    }
+    xSemaphoreGive(lock_);
+
+    if (client == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    char headers[160];
+    int len = snprintf(
+        headers,
+        sizeof(headers),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "\r\n"
+        "retry: %d\n\n",
+        CONFIG_SAMPLER_INTERVAL
+    );
+    if (httpd_send(req, headers, len) != len) {
+        xSemaphoreTake(lock_, portMAX_DELAY);
+        client->state = WEBSERVER_EVENTS_FREE;
+        webserver_events_update_power();
+        xSemaphoreGive(lock_);
+        return ESP_FAIL;
+    }
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    client->server = req->handle;
+    client->fd = httpd_req_to_sockfd(req);
+    memcpy(client->buf, latest_, latest_len_);
+    client->len = latest_len_;
+    client->state = WEBSERVER_EVENTS_ACTIVE;
+    bool queue = client->len > 0 && webserver_events_claim_flush(client->server);
+    xSemaphoreGive(lock_);
+
+    // The slot is released by httpd when the session closes
+    req->sess_ctx = client;
+    req->free_ctx = webserver_events_free_ctx;
+
+    if (queue) {
+        webserver_events_queue_flush(client->server);
+    }
+    return ESP_OK;
+}
+
+int webserver_events_get_subscribers() {
+    int count = 0;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_WEBSERVER_EVENTS_MAX_CLIENTS; i++) {
+        if (clients_[i].state == WEBSERVER_EVENTS_ACTIVE) {
+            count++;
+        }
+    }
+    xSemaphoreGive(lock_);
+    return count;
+}
+
+uint32_t webserver_events_get_dropped() {
+    return dropped_;
+}
@@ -6,15 +6,30 @@
 #include "esp_err.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "sys/socket.h"
 
+#include "events.hpp"
+#include "json.hpp"
+#include "metrics.hpp"
+#include "prefetch.hpp"
 #include "util.hpp"
+#include "config/store.hpp"
+#include "history/history.hpp"
+#include "history/log.hpp"
 #include "sensor/aht10.hpp"
+#include "sensor/fixed.hpp"
+
+#define CENTI_STR_LEN 12
 
 static const char TAG_[] = "webserver_handlers";
 
 
 esp_err_t webserver_handler_get_metrics(httpd_req_t* req) {
+    // Heap kept by the scrape once it is sent, which includes the
+    // server's own per request allocations
+    uint32_t heap_before = esp_get_free_heap_size();
     char ipstr[INET6_ADDRSTRLEN] = "";
     webserver_util_get_client_ip(req, ipstr);
 
@@ -28,16 +43,332 @@ esp_err_t webserver_handler_get_metrics(httpd_req_t* req) {
     ESP_LOGI(TAG_, "GET /metrics from IP: %s User-Agent: %s", ipstr, user_agent);
     httpd_resp_set_hdr(req, "Content-Type", "text/plain; version=0.0.4");
 
-    aht10_measurement_t measurement;
-    esp_err_t err = webserver_util_get_measurement(&measurement);
+    sampler_sample_t sample;
+    char etag[WEBSERVER_ETAG_LEN];
+    if (webserver_util_get_sample(&sample) == ESP_OK && webserver_util_not_modified(req, &sample, etag)) {
+        webserver_prefetch_record(ipstr);
+        return ESP_OK;
+    }
+    esp_err_t err = webserver_prefetch_get(ipstr, &sample);
     if (err != ESP_OK) {
         httpd_resp_send_500(req);
         ESP_LOGW(TAG_, "HTTP 500 caused by %s", esp_err_to_name(err));
         return ESP_FAIL;
     }
+    webserver_util_set_etag(req, &sample, etag);
 
-    char* resp_buf = webserver_util_format_metrics(&measurement);
+    char* resp_buf = webserver_util_format_metrics(ipstr, &sample.measurement);
+    if (resp_buf == NULL) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
     httpd_resp_send(req, resp_buf, strlen(resp_buf));
-    free(resp_buf);
+    webserver_util_free_metrics(resp_buf);
+    ESP_LOGD(TAG_, "Scrape kept %d bytes of heap", (int)(heap_before - esp_get_free_heap_size()));
     return ESP_OK;
 }
+
+/**
+ * @brief Write a device label if it is set
+ *
+ * @param json Writer
+ * @param key Label name
+ * @param value Label value from the settings
+ */
+static void webserver_handler_write_label(webserver_json_t* json, const char* key, const char* value) {
+    char label[CONFIG_STORE_LABEL_LEN];
+    // The last byte of the field is never part of the value
+    memcpy(label, value, sizeof(label) - 1);
+    label[sizeof(label) - 1] = '\0';
+    if (label[0] != '\0') {
+        webserver_json_string(json, key, label);
+    }
+}
+
+esp_err_t webserver_handler_get_readings(httpd_req_t* req) {
+    char ipstr[INET6_ADDRSTRLEN] = "";
+    webserver_util_get_client_ip(req, ipstr);
+    ESP_LOGI(TAG_, "GET /api/v1/readings from IP: %s", ipstr);
+
+    // Polled by dashboards at their own pace, so the sampler's latest
+    // sample is used and the /metrics prefetch learns nothing from it
+    sampler_sample_t sample;
+    esp_err_t err = webserver_util_wait_sample(&sample);
+    if (err != ESP_OK) {
+        httpd_resp_send_500(req);
+        ESP_LOGW(TAG_, "HTTP 500 caused by %s", esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    char etag[WEBSERVER_ETAG_LEN];
+    if (webserver_util_not_modified(req, &sample, etag)) {
+        return ESP_OK;
+    }
+    webserver_util_set_etag(req, &sample, etag);
+    webserver_metrics_snapshot_t snapshot;
+    webserver_util_collect_metrics(&sample.measurement, &snapshot);
+    config_settings_t settings;
+    config_store_get(&settings);
+
+    httpd_resp_set_type(req, "application/json");
+    webserver_chunk_t chunk;
+    webserver_util_chunk_init(&chunk, req);
+    webserver_json_t json;
+    webserver_json_init(&json, &chunk);
+
+    webserver_json_begin_object(&json, NULL);
+
+    webserver_json_begin_object(&json, "readings");
+    webserver_json_number(&json, "temperature_celsius", WEBSERVER_METRICS_CENTI, snapshot.temperature);
+    webserver_json_number(&json, "humidity_percent", WEBSERVER_METRICS_CENTI, snapshot.humidity);
+    webserver_json_number(&json, "dew_point_celsius", WEBSERVER_METRICS_CENTI, snapshot.dew_point);
+    webserver_json_number(&json, "absolute_humidity_grams_per_cubic_meter", WEBSERVER_METRICS_CENTI, snapshot.absolute_humidity);
+    webserver_json_number(&json, "heat_index_celsius", WEBSERVER_METRICS_CENTI, snapshot.heat_index);
+    webserver_json_number(&json, "age_seconds", WEBSERVER_METRICS_MILLI, snapshot.sample_age);
+    webserver_json_number(&json, "sequence", WEBSERVER_METRICS_INTEGER, sample.sequence);
+    if (snapshot.timestamp >= 0) {
+        webserver_json_number(&json, "timestamp_ms", WEBSERVER_METRICS_INTEGER, snapshot.timestamp);
+    }
+    webserver_json_end_object(&json);
+
+    webserver_json_begin_object(&json, "labels");
+    webserver_handler_write_label(&json, "location", settings.location);
+    webserver_handler_write_label(&json, "room", settings.room);
+    webserver_handler_write_label(&json, "rack", settings.rack);
+    webserver_json_end_object(&json);
+
+    webserver_json_begin_object(&json, "device");
+    webserver_json_number(&json, "uptime_seconds", WEBSERVER_METRICS_INTEGER, snapshot.uptime);
+    webserver_json_number(&json, "powered_seconds", WEBSERVER_METRICS_INTEGER, snapshot.powered);
+    webserver_json_number(&json, "resets", WEBSERVER_METRICS_INTEGER, snapshot.resets);
+    webserver_json_string(&json, "last_reset_reason", snapshot.reset_reason);
+    webserver_json_number(&json, "i2c_errors", WEBSERVER_METRICS_INTEGER, snapshot.i2c_errors);
+    webserver_json_number(&json, "free_heap_bytes", WEBSERVER_METRICS_INTEGER, snapshot.heap);
+    webserver_json_number(&json, "sample_interval_seconds", WEBSERVER_METRICS_MILLI, snapshot.sample_interval);
+    webserver_json_number(&json, "samples", WEBSERVER_METRICS_INTEGER, snapshot.samples);
+    webserver_json_number(&json, "event_subscribers", WEBSERVER_METRICS_INTEGER, snapshot.subscribers);
+    webserver_json_number(&json, "power_awake_ratio", WEBSERVER_METRICS_MILLI, snapshot.awake);
+    webserver_json_number(&json, "clock_synced", WEBSERVER_METRICS_INTEGER, snapshot.clock_synced);
+    webserver_json_number(&json, "clock_offset_seconds", WEBSERVER_METRICS_MILLI, snapshot.clock_offset);
+    webserver_json_number(&json, "clock_sync_age_seconds", WEBSERVER_METRICS_MILLI, snapshot.clock_sync_age);
+    webserver_json_number(&json, "wifi_rssi_dbm", WEBSERVER_METRICS_INTEGER, snapshot.wifi_rssi);
+    webserver_json_number(&json, "wifi_channel", WEBSERVER_METRICS_INTEGER, snapshot.wifi_channel);
+    webserver_json_string(&json, "wifi_phy_mode", snapshot.wifi_phy);
+    webserver_json_number(&json, "wifi_association_age_seconds", WEBSERVER_METRICS_MILLI, snapshot.wifi_association_age);
+    webserver_json_end_object(&json);
+
+    webserver_json_end_object(&json);
+    err = webserver_json_end(&json);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG_, "Failed to send readings (%s)", esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Write the raw tier of the history as CSV rows
+ *
+ * @param chunk Chunked response to write to
+ * @param history History store
+ * @param first First bucket to write
+ * @param last Last bucket to write
+ * @return esp_err_t
+ */
+static esp_err_t webserver_handler_write_raw(webserver_chunk_t* chunk, History* history, int64_t first, int64_t last) {
+    uint32_t period = history->GetPeriod(HISTORY_TIER_RAW);
+    esp_err_t err = webserver_util_chunk_printf(chunk, "uptime_seconds,temperature_celsius,humidity_percent\n");
+
+    char temperature[CENTI_STR_LEN];
+    char humidity[CENTI_STR_LEN];
+    for (int64_t bucket = first; bucket <= last && err == ESP_OK; bucket++) {
+        history_raw_t value;
+        if (history->GetRaw(bucket, &value) != ESP_OK) {
+            continue;
+        }
+        fixed_format_centi(temperature, sizeof(temperature), value.temperature);
+        fixed_format_centi(humidity, sizeof(humidity), value.humidity);
+        err = webserver_util_chunk_printf(
+            chunk,
+            "%lld,%s,%s\n",
+            (long long)(bucket * period),
+            temperature,
+            humidity
+        );
+    }
+    return err;
+}
+
+/**
+ * @brief Write one of the rollup tiers of the history as CSV rows
+ *
+ * @param chunk Chunked response to write to
+ * @param history History store
+ * @param tier Tier to write
+ * @param first First bucket to write
+ * @param last Last bucket to write
+ * @return esp_err_t
+ */
+static esp_err_t webserver_handler_write_rollup(webserver_chunk_t* chunk, History* history, history_tier_t tier, int64_t first, int64_t last) {
+    uint32_t period = history->GetPeriod(tier);
+    esp_err_t err = webserver_util_chunk_printf(
+        chunk,
+        "uptime_seconds,"
+        "temperature_min_celsius,temperature_max_celsius,temperature_mean_celsius,"
+        "humidity_min_percent,humidity_max_percent,humidity_mean_percent\n"
+    );
+
+    char values[6][CENTI_STR_LEN];
+    for (int64_t bucket = first; bucket <= last && err == ESP_OK; bucket++) {
+        history_point_t point;
+        if (history->GetRollup(tier, bucket, &point) != ESP_OK) {
+            continue;
+        }
+        fixed_format_centi(values[0], CENTI_STR_LEN, point.temperature.min);
+        fixed_format_centi(values[1], CENTI_STR_LEN, point.temperature.max);
+        fixed_format_centi(values[2], CENTI_STR_LEN, point.temperature.mean);
+        fixed_format_centi(values[3], CENTI_STR_LEN, point.humidity.min);
+        fixed_format_centi(values[4], CENTI_STR_LEN, point.humidity.max);
+        fixed_format_centi(values[5], CENTI_STR_LEN, point.humidity.mean);
+        err = webserver_util_chunk_printf(
+            chunk,
+            "%lld,%s,%s,%s,%s,%s,%s\n",
+            (long long)(bucket * period),
+            values[0], values[1], values[2], values[3], values[4], values[5]
+        );
+    }
+    return err;
+}
+
+esp_err_t webserver_handler_get_history(httpd_req_t* req) {
+    char ipstr[INET6_ADDRSTRLEN] = "";
+    webserver_util_get_client_ip(req, ipstr);
+    ESP_LOGI(TAG_, "GET /history from IP: %s", ipstr);
+
+    History* history = webserver_util_get_history();
+    if (history == NULL) {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+
+    int64_t tier = HISTORY_TIER_RAW;
+    int64_t since = 0;
+    esp_err_t tier_err = webserver_util_get_query_int(req, "tier", &tier);
+    esp_err_t since_err = webserver_util_get_query_int(req, "since", &since);
+    if (tier_err == ESP_ERR_INVALID_ARG || since_err == ESP_ERR_INVALID_ARG
+        || tier < HISTORY_TIER_RAW || tier >= HISTORY_TIER_MAX || since < 0) {
+        const char msg[] = "Invalid tier or since parameter";
+        httpd_resp_set_status(req, HTTPD_400);
+        httpd_resp_send(req, msg, sizeof(msg) - 1);
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "text/csv");
+
+    webserver_chunk_t chunk;
+    webserver_util_chunk_init(&chunk, req);
+
+    uint32_t period = history->GetPeriod((history_tier_t)tier);
+    esp_err_t err = webserver_util_chunk_printf(
+        &chunk,
+        "# tier %d period_seconds %u uptime_seconds %lld\n",
+        (int)tier,
+        period,
+        (long long)(esp_timer_get_time() / 1000000)
+    );
+
+    int64_t first, last;
+    if (err == ESP_OK && history->GetRange((history_tier_t)tier, &first, &last) == ESP_OK) {
+        if (first < since / period) {
+            first = since / period;
+        }
+        if (tier == HISTORY_TIER_RAW) {
+            err = webserver_handler_write_raw(&chunk, history, first, last);
+        }
+        else {
+            err = webserver_handler_write_rollup(&chunk, history, (history_tier_t)tier, first, last);
+        }
+    }
+
+    if (err == ESP_OK) {
+        err = webserver_util_chunk_end(&chunk);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG_, "Failed to send history (%s)", esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+#ifdef CONFIG_SAMPLE_LOG_ENABLE
+/**
+ * @brief Sample log reader which writes each record as a CSV row
+ *
+ * @param record Record to write
+ * @param arg Chunked response to write to
+ * @return esp_err_t
+ */
+static esp_err_t webserver_handler_write_log_record(const sample_log_record_t* record, void* arg) {
+    webserver_chunk_t* chunk = (webserver_chunk_t*)arg;
+    char temperature[CENTI_STR_LEN];
+    char humidity[CENTI_STR_LEN];
+    fixed_format_centi(temperature, sizeof(temperature), record->temperature);
+    fixed_format_centi(humidity, sizeof(humidity), record->humidity);
+    return webserver_util_chunk_printf(chunk, "%u,%s,%s\n", record->time, temperature, humidity);
+}
+
+esp_err_t webserver_handler_get_sample_log(httpd_req_t* req) {
+    char ipstr[INET6_ADDRSTRLEN] = "";
+    webserver_util_get_client_ip(req, ipstr);
+    ESP_LOGI(TAG_, "GET /history/log from IP: %s", ipstr);
+
+    SampleLog* log = webserver_util_get_sample_log();
+    if (log == NULL || !log->Ready()) {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+
+    int64_t from = 0;
+    int64_t to = UINT32_MAX;
+    esp_err_t from_err = webserver_util_get_query_int(req, "from", &from);
+    esp_err_t to_err = webserver_util_get_query_int(req, "to", &to);
+    if (from_err == ESP_ERR_INVALID_ARG || to_err == ESP_ERR_INVALID_ARG
+        || from < 0 || to < from || to > UINT32_MAX) {
+        const char msg[] = "Invalid from or to parameter";
+        httpd_resp_set_status(req, HTTPD_400);
+        httpd_resp_send(req, msg, sizeof(msg) - 1);
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "text/csv");
+
+    webserver_chunk_t chunk;
+    webserver_util_chunk_init(&chunk, req);
+    esp_err_t err = webserver_util_chunk_printf(&chunk, "unix_seconds,temperature_celsius,humidity_percent\n");
+    if (err == ESP_OK) {
+        err = log->Read(from, to, webserver_handler_write_log_record, &chunk);
+    }
+    if (err == ESP_OK) {
+        err = webserver_util_chunk_end(&chunk);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG_, "Failed to send sample log (%s)", esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+#endif
+
+esp_err_t webserver_handler_get_events(httpd_req_t* req) {
+    char ipstr[INET6_ADDRSTRLEN] = "";
+    webserver_util_get_client_ip(req, ipstr);
+    ESP_LOGI(TAG_, "GET /events from IP: %s", ipstr);
+
+    esp_err_t err = webserver_events_subscribe(req);
+    if (err == ESP_ERR_NO_MEM) {
+        ESP_LOGW(TAG_, "Too many event subscribers, rejecting %s", ipstr);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
+    return err;
+}
@@ -6,6 +6,7 @@
 
 #include "esp_err.h"
 #include "esp_http_server.h"
+#include "sdkconfig.h"
 
 /**
  * @brief Handler for the /metrics URL
@@ -15,4 +16,53 @@
  */
 esp_err_t webserver_handler_get_metrics(httpd_req_t* req);
 
+/**
+ * @brief Handler for the /api/v1/readings URL
+ *
+ * Current readings, device labels and health as JSON. Uses the same
+ * measurement cache and number formatting as /metrics.
+ *
+ * @param req Client HTTP request
+ * @return esp_err_t
+ */
+esp_err_t webserver_handler_get_readings(httpd_req_t* req);
+
+/**
+ * @brief Handler for the /history URL
+ *
+ * Streams the on-device history as CSV. The tier query parameter
+ * selects raw samples (0) or one of the rollup tiers (1, 2) and since
+ * limits the response to samples taken at or after the given uptime in
+ * seconds.
+ *
+ * @param req HTTP request
+ * @return esp_err_t
+ */
+esp_err_t webserver_handler_get_history(httpd_req_t* req);
+
+#ifdef CONFIG_SAMPLE_LOG_ENABLE
+/**
+ * @brief Handler for the /history/log URL
+ *
+ * Streams the flash sample log as CSV directly from SPIFFS. The from and
+ * to query parameters limit the response to a range of Unix time in
+ * seconds.
+ *
+ * @param req HTTP request
+ * @return esp_err_t
+ */
+esp_err_t webserver_handler_get_sample_log(httpd_req_t* req);
+#endif
+
+/**
+ * @brief Handler for the /events URL
+ *
+ * Subscribes the client to a Server-Sent Events stream of every new
+ * sample. Responds with 503 if the subscriber limit has been reached.
+ *
+ * @param req HTTP request
+ * @return esp_err_t
+ */
+esp_err_t webserver_handler_get_events(httpd_req_t* req);
+
 #endif // WEBSERVER_HANDLERS_H_
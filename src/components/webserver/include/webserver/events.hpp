@@ -0,0 +1,64 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef WEBSERVER_EVENTS_H_
+#define WEBSERVER_EVENTS_H_
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#include "sampler/sampler.hpp"
+
+#define WEBSERVER_EVENTS_MAX_LEN 128
+
+/**
+ * @brief Prepare the /events subscriber table
+ *
+ * Must be called before the listener is registered with the sampler.
+ *
+ * @return esp_err_t
+ */
+esp_err_t webserver_events_init();
+
+/**
+ * @brief Sampler listener which pushes every sample to the /events
+ * subscribers
+ *
+ * Each sample is formatted once and appended to the send buffer of
+ * every subscriber. The buffers are drained from the httpd task so the
+ * sampler never blocks on a socket. A subscriber whose buffer cannot
+ * take a new event is disconnected.
+ *
+ * @param sample New sample
+ * @param arg Unused
+ */
+void webserver_events_listener(const sampler_sample_t* sample, void* arg);
+
+/**
+ * @brief Turn a request into a Server-Sent Events subscription
+ *
+ * Sends the event stream headers and the most recent sample then keeps
+ * the socket open after the handler returns. The subscription ends
+ * when the session is closed by either side.
+ *
+ * @param req HTTP request
+ * @return esp_err_t ESP_ERR_NO_MEM if there are no free subscriber
+ * slots
+ */
+esp_err_t webserver_events_subscribe(httpd_req_t* req);
+
+/**
+ * @brief Get the number of current subscribers
+ *
+ * @return int
+ */
+int webserver_events_get_subscribers();
+
+/**
+ * @brief Get the number of subscribers dropped for not keeping up
+ *
+ * @return uint32_t
+ */
+uint32_t webserver_events_get_dropped();
+
+#endif // WEBSERVER_EVENTS_H_
@@ -0,0 +1,82 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef WEBSERVER_JSON_H_
+#define WEBSERVER_JSON_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "metrics.hpp"
+#include "util.hpp"
+
+#define WEBSERVER_JSON_MAX_DEPTH 32
+
+/**
+ * @brief Streaming JSON writer on top of a chunked response
+ *
+ * Values are written straight into the chunk buffer as they are
+ * given, nothing is built up in memory. The first error is kept and
+ * everything after it is ignored, so a document can be written without
+ * checking each call and the error read at the end.
+ */
+struct webserver_json_t {
+    webserver_chunk_t* chunk;
+    uint32_t has_members; // Bit per depth, set once a member is written
+    uint8_t depth;
+    esp_err_t err;
+};
+
+/**
+ * @brief Start a document
+ *
+ * @param json Writer to prepare
+ * @param chunk Chunked response to write to
+ */
+void webserver_json_init(webserver_json_t* json, webserver_chunk_t* chunk);
+
+/**
+ * @brief Open an object
+ *
+ * @param json Writer
+ * @param key Member name, NULL for the top level object. Keys are
+ * written as is so must not need escaping.
+ */
+void webserver_json_begin_object(webserver_json_t* json, const char* key);
+
+/**
+ * @brief Close the innermost object
+ *
+ * @param json Writer
+ */
+void webserver_json_end_object(webserver_json_t* json);
+
+/**
+ * @brief Write a number formatted as it is on /metrics
+ *
+ * @param json Writer
+ * @param key Member name
+ * @param format How to format value
+ * @param value Value to write
+ */
+void webserver_json_number(webserver_json_t* json, const char* key, webserver_metrics_format_t format, int64_t value);
+
+/**
+ * @brief Write a string, escaping it as needed
+ *
+ * @param json Writer
+ * @param key Member name
+ * @param value String to write, NULL writes null
+ */
+void webserver_json_string(webserver_json_t* json, const char* key, const char* value);
+
+/**
+ * @brief Finish the document and the response
+ *
+ * @param json Writer
+ * @return esp_err_t First error hit while writing, if any
+ */
+esp_err_t webserver_json_end(webserver_json_t* json);
+
+#endif // WEBSERVER_JSON_H_
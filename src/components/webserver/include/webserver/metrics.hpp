@@ -0,0 +1,154 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef WEBSERVER_METRICS_H_
+#define WEBSERVER_METRICS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest label value rendered, longer values are truncated
+#define WEBSERVER_METRICS_LABEL_LEN 32
+// Longest value webserver_metrics_format_value can write
+#define WEBSERVER_METRICS_VALUE_LEN 24
+// Value rendered as NaN, for a window with nothing in it
+#define WEBSERVER_METRICS_NAN INT64_MIN
+
+typedef enum {
+    WEBSERVER_METRICS_CENTI, // Hundredths, rendered as a decimal
+    WEBSERVER_METRICS_MILLI, // Thousandths, rendered with three places
+    WEBSERVER_METRICS_INTEGER,
+    WEBSERVER_METRICS_LABEL, // Value is a label, the sample is always 1
+} webserver_metrics_format_t;
+
+/**
+ * @brief Summary of the samples in a window, as exported on /metrics
+ *
+ * Values are in hundredths, count is a number of samples. Quantiles,
+ * min and max are WEBSERVER_METRICS_NAN while the window is empty.
+ */
+struct webserver_metrics_window_t {
+    int64_t p50;
+    int64_t p90;
+    int64_t p99;
+    int64_t sum; // Every sample since boot
+    int64_t count; // Every sample since boot
+    int64_t min;
+    int64_t max;
+};
+
+/**
+ * @brief Every value exported on /metrics, gathered once per scrape
+ *
+ * Numbers are all int64_t so the renderer only needs to know how to
+ * format a value, not what type it is stored as.
+ */
+struct webserver_metrics_snapshot_t {
+    int64_t timestamp; // Unix milliseconds the measurement was taken, -1 if unknown
+    int64_t temperature; // Hundredths of a degree
+    int64_t humidity; // Hundredths of a percent
+    int64_t dew_point; // Hundredths of a degree
+    int64_t absolute_humidity; // Hundredths of a g/m³
+    int64_t heat_index; // Hundredths of a degree
+    int64_t uptime; // Seconds
+    int64_t powered; // Seconds
+    int64_t resets;
+    const char* reset_reason;
+    int64_t i2c_errors;
+    int64_t heap; // Bytes
+    int64_t sample_interval; // Milliseconds
+    int64_t samples;
+    int64_t prefetch_hits;
+    int64_t prefetch_misses;
+    int64_t sample_age; // Milliseconds
+    int64_t subscribers;
+    int64_t dropped;
+    int64_t awake; // Permille
+    int64_t slept; // Milliseconds
+    int64_t wakes;
+    int64_t clock_synced; // 1 once SNTP has set the clock
+    int64_t clock_offset; // Milliseconds
+    int64_t clock_sync_age; // Milliseconds
+    int64_t wifi_associated; // 1 while associated with an access point
+    int64_t wifi_rssi; // dBm
+    int64_t wifi_channel;
+    const char* wifi_phy;
+    int64_t wifi_association_age; // Milliseconds
+    int64_t wifi_reconnects;
+    int64_t wifi_disconnects;
+    const char* wifi_disconnect_reason;
+    webserver_metrics_window_t temperature_window;
+    webserver_metrics_window_t humidity_window;
+};
+
+/**
+ * @brief Metric as stored in the registry
+ *
+ * Built at compile time by the METRIC macros in metrics.cpp.
+ */
+struct webserver_metrics_descriptor_t {
+    const char* header; // HELP and TYPE lines, if any, followed by the sample name
+    size_t header_len;
+    // Label of the series, e.g. quantile="0.5". For
+    // WEBSERVER_METRICS_LABEL only its start, e.g. reason=", as the
+    // value follows. NULL if there is none.
+    const char* label;
+    size_t label_len;
+    webserver_metrics_format_t format;
+    size_t offset; // Offset of the value in webserver_metrics_snapshot_t
+    bool sampled; // Series is stamped with the measurement's timestamp
+};
+
+/**
+ * @brief Get a buffer webserver_metrics_render can always write to
+ *
+ * The most a render can write is fixed at compile time from the
+ * registry, apart from the device labels. In static memory mode the
+ * buffer is sized for the longest label block, so it never fails.
+ * Otherwise it is allocated for the given block.
+ *
+ * @param labels_len Length of the device label block
+ * @return char* NULL if it could not be allocated
+ */
+char* webserver_metrics_alloc(size_t labels_len);
+
+/**
+ * @brief Release a buffer from webserver_metrics_alloc
+ *
+ * @param buf Buffer to release
+ */
+void webserver_metrics_free(char* buf);
+
+/**
+ * @brief Format a number the way /metrics does
+ *
+ * @param out Buffer of at least WEBSERVER_METRICS_VALUE_LEN + 1 bytes
+ * @param format How to format the value, WEBSERVER_METRICS_LABEL
+ * writes nothing
+ * @param value Value to format, WEBSERVER_METRICS_NAN writes NaN
+ * @return size_t Number of characters written, not terminated
+ */
+size_t webserver_metrics_format_value(char* out, webserver_metrics_format_t format, int64_t value);
+
+/**
+ * @brief Render every registered metric
+ *
+ * The text around each value is copied as is, only the values are
+ * formatted. The device label block is spliced into every series.
+ * Series read from the sensor carry the snapshot's timestamp when it
+ * is known.
+ *
+ * @param buf Buffer from webserver_metrics_alloc
+ * @param snapshot Values to render
+ * @param labels Device label block from config_labels_get
+ * @param labels_len Length of labels
+ * @return size_t Number of characters written, excluding the terminator
+ */
+size_t webserver_metrics_render(
+    char* buf,
+    const webserver_metrics_snapshot_t* snapshot,
+    const char* labels,
+    size_t labels_len
+);
+
+#endif // WEBSERVER_METRICS_H_
@@ -0,0 +1,68 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef WEBSERVER_PREFETCH_H_
+#define WEBSERVER_PREFETCH_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "sampler/sampler.hpp"
+#include "sensor/aht10.hpp"
+
+#define WEBSERVER_PREFETCH_TASK_STACK_SIZE 2048
+#define WEBSERVER_PREFETCH_TASK_PRIORITY 5
+#define WEBSERVER_PREFETCH_WAIT (1000 / portTICK_RATE_MS) // Longest a scrape waits for a new sample
+
+struct webserver_prefetch_stats_t {
+    uint32_t hits; // Scrapes answered from a prefetched measurement
+    uint32_t misses; // Scrapes that had to wait for the sensor
+    int64_t last_age; // Age in microseconds of the last scrape's measurement
+};
+
+/**
+ * @brief Start the prefetch task
+ *
+ * The sensor is only ever read by the sampler, prefetching asks it to
+ * sample early.
+ *
+ * @param sampler Sampler to take measurements with
+ * @return esp_err_t
+ */
+esp_err_t webserver_prefetch_init(Sampler* sampler);
+
+/**
+ * @brief Get a measurement for a scrape
+ *
+ * Learns the interval between scrapes from each client. Once a client
+ * has scraped at a steady interval the sampler is triggered shortly
+ * before its next scrape is due, so the scrape is answered straight
+ * away with a sub-second old reading. If the latest sample is not
+ * fresh enough the sampler is triggered and the scrape waits for it,
+ * falling back to the latest sample if none arrives in time.
+ *
+ * @param client IP address of the scraper
+ * @param sample Struct to store the sample in
+ * @return esp_err_t
+ */
+esp_err_t webserver_prefetch_get(const char* client, sampler_sample_t* sample);
+
+/**
+ * @brief Record a scrape answered without a new measurement
+ *
+ * Keeps the learnt interval up to date for conditional scrapes that
+ * are answered with 304 Not Modified.
+ *
+ * @param client IP address of the scraper
+ */
+void webserver_prefetch_record(const char* client);
+
+/**
+ * @brief Get the prefetch hit counts and the age of the last scrape
+ *
+ * @param stats Struct to copy the stats into
+ */
+void webserver_prefetch_get_stats(webserver_prefetch_stats_t* stats);
+
+#endif // WEBSERVER_PREFETCH_H_
@@ -4,10 +4,26 @@
 #ifndef WEBSERVER_UTIL_H_
 #define WEBSERVER_UTIL_H_
 
+#include <stdint.h>
+
 #include "esp_http_server.h"
 #include "sys/socket.h"
 
+#include "metrics.hpp"
+#include "history/history.hpp"
+#include "history/log.hpp"
+#include "sampler/sampler.hpp"
 #include "sensor/aht10.hpp"
+#include "stats/summary.hpp"
+
+#define WEBSERVER_CHUNK_SIZE 512
+#define WEBSERVER_ETAG_LEN 24 // W/"<boot>-<sequence>" and terminator
+
+struct webserver_chunk_t {
+    httpd_req_t* req;
+    char buf[WEBSERVER_CHUNK_SIZE];
+    size_t len;
+};
 
 /**
  * @brief Get the IP of the calling client
@@ -19,19 +35,96 @@
 esp_err_t webserver_util_get_client_ip(httpd_req_t* req, char ip[INET6_ADDRSTRLEN]);
 
 /**
- * @brief Get sensor measurement
+ * @brief Get the sampler's latest sample
+ *
+ * Never reads the sensor.
+ *
+ * @param sample Struct to copy the sample into
+ * @return esp_err_t ESP_ERR_NOT_FOUND if nothing has been sampled yet
+ */
+esp_err_t webserver_util_get_sample(sampler_sample_t* sample);
+
+/**
+ * @brief Get the sampler's latest sample, waiting for the first one
+ *
+ * Never triggers a sample or feeds the scrape prefetch, which learns
+ * from /metrics scrapes only.
+ *
+ * @param sample Struct to copy the sample into
+ * @return esp_err_t ESP_ERR_TIMEOUT if nothing was sampled in time
+ */
+esp_err_t webserver_util_wait_sample(sampler_sample_t* sample);
+
+/**
+ * @brief Get the sampler's latest measurement
+ *
+ * Never reads the sensor, so requests cannot add to the sampler's I2C
+ * traffic.
  *
  * @param measurement Struct to fill with data.
- * @return esp_err_t
+ * @return esp_err_t ESP_ERR_NOT_FOUND if nothing has been sampled yet
  */
 esp_err_t webserver_util_get_measurement(aht10_measurement_t* measurement);
 
+/**
+ * @brief Gather the values exported on /metrics
+ *
+ * Shared by every endpoint that reports readings so they all agree.
+ * The window summaries are left for the /metrics render to fill, as
+ * collecting them starts a new window.
+ *
+ * @param measurement Measurement to report
+ * @param snapshot Struct to fill
+ */
+void webserver_util_collect_metrics(const aht10_measurement_t* measurement, webserver_metrics_snapshot_t* snapshot);
+
 /**
  * @brief Format the metrics string
  *
- * @return char*
+ * In static memory mode this is always the same buffer, so it must be
+ * freed before metrics are formatted again. Starts a new summary
+ * window for the client.
+ *
+ * @param client IP address of the scraper
+ * @param measurement Measurement to report
+ * @return char* NULL if the buffer could not be allocated
+ */
+char* webserver_util_format_metrics(const char* client, aht10_measurement_t* measurement);
+
+/**
+ * @brief Free a string from webserver_util_format_metrics
+ *
+ * @param buf Metrics string
+ */
+void webserver_util_free_metrics(char* buf);
+
+/**
+ * @brief Answer a conditional request for a sample
+ *
+ * The ETag is the sampler's sequence number, with a value random per
+ * boot, so it can be checked against the latest sample before anything
+ * waits for the sensor. It is weak as the body also holds values, such
+ * as uptime, that change between scrapes of the same sample. If
+ * If-None-Match holds the tag, or *, a 304 with no body is sent and the
+ * caller must not render or send anything else. Otherwise nothing is
+ * set on the response.
+ *
+ * @param req Client HTTP request
+ * @param sample Latest sample
+ * @param etag Buffer for the tag, must live until the response is sent
+ * @return true A 304 has been sent
+ * @return false The full response should be sent
+ */
+bool webserver_util_not_modified(httpd_req_t* req, const sampler_sample_t* sample, char etag[WEBSERVER_ETAG_LEN]);
+
+/**
+ * @brief Tag the response with the sample being reported
+ *
+ * @param req Client HTTP request
+ * @param sample Sample being reported
+ * @param etag Buffer for the tag, must live until the response is sent
  */
-char* webserver_util_format_metrics(aht10_measurement_t* measurement);
+void webserver_util_set_etag(httpd_req_t* req, const sampler_sample_t* sample, char etag[WEBSERVER_ETAG_LEN]);
 
 /**
  * @brief Set the sensor for the webserver to use
@@ -40,5 +133,100 @@ char* webserver_util_format_metrics(aht10_measurement_t* measurement);
  */
 void webserver_util_set_sensor(AHT10* sensor);
 
+/**
+ * @brief Set the history store for the webserver to use
+ *
+ * @param history History store to use
+ */
+void webserver_util_set_history(History* history);
+
+/**
+ * @brief Get the history store
+ *
+ * @return History* NULL if history has not been set
+ */
+History* webserver_util_get_history();
+
+/**
+ * @brief Set the flash sample log for the webserver to use
+ *
+ * @param log Sample log to use
+ */
+void webserver_util_set_sample_log(SampleLog* log);
+
+/**
+ * @brief Get the flash sample log
+ *
+ * @return SampleLog* NULL if the sample log has not been set
+ */
+SampleLog* webserver_util_get_sample_log();
+
+/**
+ * @brief Set the measurement summaries for the webserver to use
+ *
+ * Each scrape of /metrics collects the summaries and starts a new
+ * window.
+ *
+ * @param summary Summaries to use
+ */
+void webserver_util_set_summary(MeasurementSummary* summary);
+
+/**
+ * @brief Set the background sampler for the webserver to report on
+ *
+ * @param sampler Sampler to use
+ */
+void webserver_util_set_sampler(Sampler* sampler);
+
+/**
+ * @brief Get an integer parameter from the query string
+ *
+ * @param req Client HTTP request
+ * @param key Name of parameter
+ * @param value Where to store value
+ * @return esp_err_t ESP_ERR_NOT_FOUND if the parameter is not present,
+ * ESP_ERR_INVALID_ARG if it is not an integer
+ */
+esp_err_t webserver_util_get_query_int(httpd_req_t* req, const char* key, int64_t* value);
+
+/**
+ * @brief Prepare a chunk buffer for a chunked response
+ *
+ * @param chunk Chunk buffer to prepare
+ * @param req Client HTTP request
+ */
+void webserver_util_chunk_init(webserver_chunk_t* chunk, httpd_req_t* req);
+
+/**
+ * @brief Append formatted text to a chunked response
+ *
+ * The buffer is sent to the client whenever it fills so responses of
+ * any length can be produced with a fixed amount of memory.
+ *
+ * @param chunk Chunk buffer
+ * @param format printf style format string
+ * @return esp_err_t
+ */
+esp_err_t webserver_util_chunk_printf(webserver_chunk_t* chunk, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Append raw bytes to a chunked response
+ *
+ * @param chunk Chunk buffer
+ * @param data Data to append
+ * @param len Length of data
+ * @return esp_err_t
+ */
+esp_err_t webserver_util_chunk_write(webserver_chunk_t* chunk, const char* data, size_t len);
+
+/**
+ * @brief Send anything left in the buffer and terminate the response
+ *
+ * @param chunk Chunk buffer
+ * @return esp_err_t
+ */
+esp_err_t webserver_util_chunk_end(webserver_chunk_t* chunk);
+
 
 #endif // WEBSERVER_UTIL_H_
@@ -0,0 +1,135 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "json.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_err.h"
+
+#include "metrics.hpp"
+#include "util.hpp"
+
+/**
+ * @brief Append raw text unless an error has already happened
+ *
+ * @param json Writer
+ * @param data Text to append
+ * @param len Length of text
+ */
+static void webserver_json_write(webserver_json_t* json, const char* data, size_t len) {
+    if (json->err == ESP_OK) {
+        json->err = webserver_util_chunk_write(json->chunk, data, len);
+    }
+}
+
+/**
+ * @brief Write the separator and key before a member
+ *
+ * @param json Writer
+ * @param key Member name, NULL for none
+ */
+static void webserver_json_key(webserver_json_t* json, const char* key) {
+    const uint32_t bit = 1UL << json->depth;
+    if (json->has_members & bit) {
+        webserver_json_write(json, ",", 1);
+    }
+    json->has_members |= bit;
+    if (key != NULL) {
+        webserver_json_write(json, "\"", 1);
+        webserver_json_write(json, key, strlen(key));
+        webserver_json_write(json, "\":", 2);
+    }
+}
+
+void webserver_json_init(webserver_json_t* json, webserver_chunk_t* chunk) {
+    json->chunk = chunk;
+    json->has_members = 0;
+    json->depth = 0;
+    json->err = ESP_OK;
+}
+
+void webserver_json_begin_object(webserver_json_t* json, const char* key) {
+    if (json->depth + 1 >= WEBSERVER_JSON_MAX_DEPTH) {
+        json->err = ESP_ERR_INVALID_STATE;
+        return;
+    }
+    webserver_json_key(json, key);
+    webserver_json_write(json, "{", 1);
+    json->depth++;
+    json->has_members &= ~(1UL << json->depth);
+}
+
+void webserver_json_end_object(webserver_json_t* json) {
+    if (json->depth == 0) {
+        json->err = ESP_ERR_INVALID_STATE;
+        return;
+    }
+    json->depth--;
+    webserver_json_write(json, "}", 1);
+}
+
+void webserver_json_number(webserver_json_t* json, const char* key, webserver_metrics_format_t format, int64_t value) {
+    char buf[WEBSERVER_METRICS_VALUE_LEN + 1];
+    webserver_json_key(json, key);
+    webserver_json_write(json, buf, webserver_metrics_format_value(buf, format, value));
+}
+
+void webserver_json_string(webserver_json_t* json, const char* key, const char* value) {
+    webserver_json_key(json, key);
+    if (value == NULL) {
+        webserver_json_write(json, "null", 4);
+        return;
+    }
+
+    webserver_json_write(json, "\"", 1);
+    // Write runs of plain characters in one go
+    const char* run = value;
+    for (const char* c = value; *c != '\0'; c++) {
+        const unsigned char ch = *c;
+        if (ch >= 0x20 && ch != '"' && ch != '\\') {
+            continue;
+        }
+        webserver_json_write(json, run, c - run);
+        run = c + 1;
+
+        char escape[7] = { '\\', (char)ch, 0 };
+        size_t len = 2;
+        switch (ch) {
+        case '"':
+        case '\\':
+            break;
+        case '\n':
+            escape[1] = 'n';
+            break;
+        case '\r':
+            escape[1] = 'r';
+            break;
+        case '\t':
+            escape[1] = 't';
+            break;
+        default: {
+            const char hex[] = "0123456789abcdef";
+            memcpy(escape + 1, "u00", 3);
+            escape[4] = hex[ch >> 4];
+            escape[5] = hex[ch & 0x0F];
+            len = 6;
+            break;
+        }
+        }
+        webserver_json_write(json, escape, len);
+    }
+    webserver_json_write(json, run, strlen(run));
+    webserver_json_write(json, "\"", 1);
+}
+
+esp_err_t webserver_json_end(webserver_json_t* json) {
+    if (json->err == ESP_OK && json->depth != 0) {
+        json->err = ESP_ERR_INVALID_STATE;
+    }
+    if (json->err == ESP_OK) {
+        json->err = webserver_util_chunk_end(json->chunk);
+    }
+    return json->err;
+}
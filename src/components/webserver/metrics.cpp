@@ -0,0 +1,410 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "metrics.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "config/labels.hpp"
+#include "sensor/fixed.hpp"
+
+#define WEBSERVER_METRICS_INTEGER_LEN 20 // -9223372036854775808
+
+/**
+ * @brief Compile time check, only the true case is defined
+ *
+ * Used from inside the registry initialiser where static_assert can
+ * not go. A failed check shows up as an incomplete type error naming
+ * this struct.
+ */
+template <bool Valid>
+struct webserver_metrics_check;
+
+template <>
+struct webserver_metrics_check<true> {
+    static constexpr size_t value = 0;
+};
+
+static constexpr size_t metrics_strlen(const char* s) {
+    return *s == '\0' ? 0 : 1 + metrics_strlen(s + 1);
+}
+
+static constexpr bool metrics_ends_with(const char* s, size_t len, const char* suffix, size_t suffix_len) {
+    return suffix_len == 0
+        || (len > 0 && s[len - 1] == suffix[suffix_len - 1]
+            && metrics_ends_with(s, len - 1, suffix, suffix_len - 1));
+}
+
+/**
+ * @brief Check a metric name ends with its unit
+ *
+ * Follows the Prometheus naming convention of name_unit or
+ * name_unit_total. Unitless metrics pass an empty unit.
+ */
+static constexpr bool metrics_has_unit(const char* name, size_t len, const char* unit) {
+    return *unit == '\0'
+        || (metrics_ends_with(name, len, unit, metrics_strlen(unit))
+            && len > metrics_strlen(unit)
+            && name[len - metrics_strlen(unit) - 1] == '_')
+        || (metrics_ends_with(name, len, "_total", 6) && metrics_has_unit(name, len - 6, unit));
+}
+
+// Check the snapshot field is the type the format reads
+static constexpr bool metrics_field_matches(const int64_t*, webserver_metrics_format_t format) {
+    return format != WEBSERVER_METRICS_LABEL;
+}
+
+static constexpr bool metrics_field_matches(const char* const*, webserver_metrics_format_t format) {
+    return format == WEBSERVER_METRICS_LABEL;
+}
+
+#define METRIC_HEADER(name, type, help) \
+    "# HELP " name " " help "\n# TYPE " name " " type "\n" name
+
+#define METRIC_ENTRY(name, unit, type, help, label, label_len, format, field, sampled) \
+    { \
+        METRIC_HEADER(name, type, help), \
+        sizeof(METRIC_HEADER(name, type, help)) - 1 \
+            + webserver_metrics_check<metrics_has_unit(name, sizeof(name) - 1, unit)>::value \
+            + webserver_metrics_check<metrics_field_matches( \
+                static_cast<decltype(webserver_metrics_snapshot_t::field)*>(nullptr), \
+                format)>::value, \
+        label, \
+        label_len, \
+        format, \
+        offsetof(webserver_metrics_snapshot_t, field), \
+        sampled, \
+    }
+
+/**
+ * @brief Declare a metric
+ *
+ * @param name Metric name, must end with the unit
+ * @param unit Base unit, e.g. "seconds", or "" if it has none
+ * @param type Prometheus type, "gauge" or "counter"
+ * @param help Description for the HELP line
+ * @param format How to render the value
+ * @param field Member of webserver_metrics_snapshot_t holding the value
+ */
+#define METRIC(name, unit, type, help, format, field) \
+    METRIC_ENTRY(name, unit, type, help, NULL, 0, format, field, false)
+
+/**
+ * @brief Declare a metric read from the sensor
+ *
+ * Rendered with the time of the measurement rather than left for
+ * Prometheus to stamp with the scrape time.
+ */
+#define METRIC_SAMPLED(name, unit, type, help, format, field) \
+    METRIC_ENTRY(name, unit, type, help, NULL, 0, format, field, true)
+
+/**
+ * @brief Declare a metric whose value is a single label
+ *
+ * @param label Label name, the value comes from field
+ */
+#define METRIC_LABELLED(name, unit, type, help, label, field) \
+    METRIC_ENTRY(name, unit, type, help, label "=\"", sizeof(label "=\"") - 1, WEBSERVER_METRICS_LABEL, field, false)
+
+/**
+ * @brief Declare another series of the metric before it
+ *
+ * Has no HELP or TYPE lines, for the extra series of a summary.
+ */
+#define METRIC_SERIES_ENTRY(name, label, label_len, format, field) \
+    { \
+        name, \
+        sizeof(name) - 1 \
+            + webserver_metrics_check<metrics_field_matches( \
+                static_cast<decltype(webserver_metrics_snapshot_t::field)*>(nullptr), \
+                format)>::value, \
+        label, \
+        label_len, \
+        format, \
+        offsetof(webserver_metrics_snapshot_t, field), \
+        false, \
+    }
+
+#define METRIC_QUANTILE(name, quantile, field) \
+    METRIC_SERIES_ENTRY(name, "quantile=\"" quantile "\"", sizeof("quantile=\"" quantile "\"") - 1, \
+        WEBSERVER_METRICS_CENTI, field)
+
+/**
+ * @brief Declare a summary of a window of samples
+ *
+ * Expands to the p50, p90 and p99 series, which match the quantiles
+ * WindowSummary tracks, then _sum and _count.
+ *
+ * @param name Metric name, must end with the unit
+ * @param unit Base unit
+ * @param help Description for the HELP line
+ * @param window webserver_metrics_window_t member of the snapshot
+ */
+#define METRIC_SUMMARY(name, unit, help, window) \
+    METRIC_ENTRY(name, unit, "summary", help, "quantile=\"0.5\"", sizeof("quantile=\"0.5\"") - 1, \
+        WEBSERVER_METRICS_CENTI, window.p50, false), \
+    METRIC_QUANTILE(name, "0.9", window.p90), \
+    METRIC_QUANTILE(name, "0.99", window.p99), \
+    METRIC_SERIES_ENTRY(name "_sum", NULL, 0, WEBSERVER_METRICS_CENTI, window.sum), \
+    METRIC_SERIES_ENTRY(name "_count", NULL, 0, WEBSERVER_METRICS_INTEGER, window.count)
+
+static constexpr webserver_metrics_descriptor_t metrics_[] = {
+    METRIC_SAMPLED("environment_temperature_celsius", "celsius", "gauge",
+        "Current temperature", WEBSERVER_METRICS_CENTI, temperature),
+    METRIC_SAMPLED("environment_humidity_percent", "percent", "gauge",
+        "Current humidity", WEBSERVER_METRICS_CENTI, humidity),
+    METRIC_SAMPLED("environment_dew_point_celsius", "celsius", "gauge",
+        "Current dew point", WEBSERVER_METRICS_CENTI, dew_point),
+    METRIC_SAMPLED("environment_absolute_humidity_grams_per_cubic_meter", "grams_per_cubic_meter", "gauge",
+        "Current mass of water vapour per volume of air", WEBSERVER_METRICS_CENTI, absolute_humidity),
+    METRIC_SAMPLED("environment_heat_index_celsius", "celsius", "gauge",
+        "Current heat index", WEBSERVER_METRICS_CENTI, heat_index),
+    METRIC("device_uptime_seconds", "seconds", "counter",
+        "Uptime of device in seconds", WEBSERVER_METRICS_INTEGER, uptime),
+    METRIC("device_powered_seconds_total", "seconds", "counter",
+        "Time spent running since the device was powered on, across resets", WEBSERVER_METRICS_INTEGER, powered),
+    METRIC("device_resets_total", "", "counter",
+        "Number of resets since the device was powered on", WEBSERVER_METRICS_INTEGER, resets),
+    METRIC_LABELLED("device_last_reset_reason", "", "gauge",
+        "Reason for the most recent reset", "reason", reset_reason),
+    METRIC("device_i2c_errors_total", "", "counter",
+        "Number of failed I2C transactions since the device was powered on", WEBSERVER_METRICS_INTEGER, i2c_errors),
+    METRIC("device_free_heap_bytes", "bytes", "gauge",
+        "Number of bytes free on heap", WEBSERVER_METRICS_INTEGER, heap),
+    METRIC("device_sample_interval_seconds", "seconds", "gauge",
+        "Time between background samples", WEBSERVER_METRICS_MILLI, sample_interval),
+    METRIC("device_samples_total", "", "counter",
+        "Number of background samples taken", WEBSERVER_METRICS_INTEGER, samples),
+    METRIC("device_scrape_prefetch_hits_total", "", "counter",
+        "Number of scrapes answered from a measurement taken ahead of time", WEBSERVER_METRICS_INTEGER, prefetch_hits),
+    METRIC("device_scrape_prefetch_misses_total", "", "counter",
+        "Number of scrapes that waited for a new sample", WEBSERVER_METRICS_INTEGER, prefetch_misses),
+    METRIC("device_scrape_sample_age_seconds", "seconds", "gauge",
+        "Age of the measurement served to the last scrape", WEBSERVER_METRICS_MILLI, sample_age),
+    METRIC("device_event_subscribers", "", "gauge",
+        "Number of clients subscribed to /events", WEBSERVER_METRICS_INTEGER, subscribers),
+    METRIC("device_event_subscribers_dropped_total", "", "counter",
+        "Number of /events clients disconnected for not keeping up", WEBSERVER_METRICS_INTEGER, dropped),
+    METRIC("device_power_awake_ratio", "ratio", "gauge",
+        "Estimated fraction of time spent awake", WEBSERVER_METRICS_MILLI, awake),
+    METRIC("device_power_sleep_seconds_total", "seconds", "counter",
+        "Time spent in light sleep", WEBSERVER_METRICS_MILLI, slept),
+    METRIC("device_power_wakes_total", "", "counter",
+        "Number of wakes from light sleep", WEBSERVER_METRICS_INTEGER, wakes),
+    METRIC("device_clock_synced", "", "gauge",
+        "Whether SNTP has set the clock", WEBSERVER_METRICS_INTEGER, clock_synced),
+    METRIC("device_clock_offset_seconds", "seconds", "gauge",
+        "Correction applied to the clock by the last SNTP sync", WEBSERVER_METRICS_MILLI, clock_offset),
+    METRIC("device_clock_sync_age_seconds", "seconds", "gauge",
+        "Time since the last SNTP sync, or since boot if there has not been one", WEBSERVER_METRICS_MILLI, clock_sync_age),
+    METRIC("device_wifi_associated", "", "gauge",
+        "Whether the station is associated with an access point", WEBSERVER_METRICS_INTEGER, wifi_associated),
+    METRIC("device_wifi_rssi_dbm", "dbm", "gauge",
+        "Signal strength of the access point at the last refresh", WEBSERVER_METRICS_INTEGER, wifi_rssi),
+    METRIC("device_wifi_channel", "", "gauge",
+        "Channel of the access point", WEBSERVER_METRICS_INTEGER, wifi_channel),
+    METRIC_LABELLED("device_wifi_phy_mode", "", "gauge",
+        "PHY mode in use with the access point", "mode", wifi_phy),
+    METRIC("device_wifi_association_age_seconds", "seconds", "gauge",
+        "Time since the station associated, 0 while it is not associated", WEBSERVER_METRICS_MILLI, wifi_association_age),
+    METRIC("device_wifi_reconnects_total", "", "counter",
+        "Number of times the station has associated again since boot", WEBSERVER_METRICS_INTEGER, wifi_reconnects),
+    METRIC("device_wifi_disconnects_total", "", "counter",
+        "Number of disconnects and failed attempts to associate since boot", WEBSERVER_METRICS_INTEGER, wifi_disconnects),
+    METRIC_LABELLED("device_wifi_last_disconnect_reason", "", "gauge",
+        "Reason for the most recent disconnect", "reason", wifi_disconnect_reason),
+    METRIC_SUMMARY("environment_temperature_window_celsius", "celsius",
+        "Distribution of sampled temperature", temperature_window),
+    METRIC("environment_temperature_window_min_celsius", "celsius", "gauge",
+        "Lowest sampled temperature since last scrape", WEBSERVER_METRICS_CENTI, temperature_window.min),
+    METRIC("environment_temperature_window_max_celsius", "celsius", "gauge",
+        "Highest sampled temperature since last scrape", WEBSERVER_METRICS_CENTI, temperature_window.max),
+    METRIC_SUMMARY("environment_humidity_window_percent", "percent",
+        "Distribution of sampled humidity", humidity_window),
+    METRIC("environment_humidity_window_min_percent", "percent", "gauge",
+        "Lowest sampled humidity since last scrape", WEBSERVER_METRICS_CENTI, humidity_window.min),
+    METRIC("environment_humidity_window_max_percent", "percent", "gauge",
+        "Highest sampled humidity since last scrape", WEBSERVER_METRICS_CENTI, humidity_window.max),
+};
+
+#define METRICS_COUNT (sizeof(metrics_) / sizeof(metrics_[0]))
+
+/**
+ * @brief Longest value a format can produce
+ */
+static constexpr size_t metrics_value_len(webserver_metrics_format_t format) {
+    return format == WEBSERVER_METRICS_CENTI ? FIXED_CENTI_STR_LEN - 1
+        : format == WEBSERVER_METRICS_MILLI ? WEBSERVER_METRICS_INTEGER_LEN + 4
+        : format == WEBSERVER_METRICS_INTEGER ? WEBSERVER_METRICS_INTEGER_LEN
+        : 1;
+}
+
+static_assert(
+    FIXED_CENTI_STR_LEN - 1 <= WEBSERVER_METRICS_VALUE_LEN
+        && WEBSERVER_METRICS_INTEGER_LEN + 4 <= WEBSERVER_METRICS_VALUE_LEN,
+    "WEBSERVER_METRICS_VALUE_LEN is too short"
+);
+
+/**
+ * @brief Longest rendering of a metric without device labels
+ *
+ * Covers the braces, the series label with any value and closing
+ * quote, the space before the value, the timestamp and the newline
+ * after it.
+ */
+static constexpr size_t metrics_len(const webserver_metrics_descriptor_t* metric) {
+    return metric->header_len + 2
+        + (metric->label != NULL ? metric->label_len : 0)
+        + (metric->format == WEBSERVER_METRICS_LABEL ? WEBSERVER_METRICS_LABEL_LEN + 1 : 0)
+        + 1 + metrics_value_len(metric->format)
+        + (metric->sampled ? 1 + WEBSERVER_METRICS_INTEGER_LEN : 0) + 1;
+}
+
+/**
+ * @brief Sum the longest rendering of each metric from index onwards
+ *
+ * Includes the final terminator.
+ */
+static constexpr size_t metrics_bound(size_t index) {
+    return index == METRICS_COUNT ? 1 : metrics_len(&metrics_[index]) + metrics_bound(index + 1);
+}
+
+// constexpr so the bound is computed by the compiler, not at startup
+static constexpr size_t metrics_max_len_ = metrics_bound(0);
+
+/**
+ * @brief Most bytes a render can write with a given label block
+ *
+ * Each series may also need a comma between the device labels and its
+ * own label.
+ */
+static constexpr size_t metrics_max_len(size_t labels_len) {
+    return metrics_max_len_ + METRICS_COUNT * (labels_len + 1);
+}
+
+#ifdef CONFIG_STATIC_MEMORY
+// Only the server task renders metrics, so one buffer is enough. Sized
+// for the longest label block config_labels_build can produce.
+static char metrics_buf_[metrics_max_len(CONFIG_LABELS_BLOCK_LEN - 1)];
+#endif
+
+char* webserver_metrics_alloc(size_t labels_len) {
+#ifdef CONFIG_STATIC_MEMORY
+    return labels_len < CONFIG_LABELS_BLOCK_LEN ? metrics_buf_ : NULL;
+#else
+    return (char*)malloc(metrics_max_len(labels_len));
+#endif
+}
+
+void webserver_metrics_free(char* buf) {
+#ifndef CONFIG_STATIC_MEMORY
+    free(buf);
+#endif
+}
+
+/**
+ * @brief Write the decimal digits of a number
+ *
+ * @param out Where to write
+ * @param value Number to write
+ * @return char* End of what was written
+ */
+static char* metrics_put_digits(char* out, uint64_t value) {
+    char digits[WEBSERVER_METRICS_INTEGER_LEN];
+    size_t len = 0;
+    do {
+        digits[len++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    while (len > 0) {
+        *out++ = digits[--len];
+    }
+    return out;
+}
+
+size_t webserver_metrics_format_value(char* out, webserver_metrics_format_t format, int64_t value) {
+    if (format == WEBSERVER_METRICS_CENTI && value != WEBSERVER_METRICS_NAN) {
+        return fixed_format_centi(out, WEBSERVER_METRICS_VALUE_LEN + 1, value);
+    }
+    if (format == WEBSERVER_METRICS_LABEL) {
+        return 0;
+    }
+    if (value == WEBSERVER_METRICS_NAN) {
+        memcpy(out, "NaN", 3);
+        return 3;
+    }
+
+    char* start = out;
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : value;
+    if (value < 0) {
+        *out++ = '-';
+    }
+    if (format == WEBSERVER_METRICS_INTEGER) {
+        return metrics_put_digits(out, magnitude) - start;
+    }
+    out = metrics_put_digits(out, magnitude / 1000);
+    const unsigned fraction = magnitude % 1000;
+    *out++ = '.';
+    *out++ = '0' + fraction / 100;
+    *out++ = '0' + fraction / 10 % 10;
+    *out++ = '0' + fraction % 10;
+    return out - start;
+}
+
+size_t webserver_metrics_render(
+    char* buf,
+    const webserver_metrics_snapshot_t* snapshot,
+    const char* labels,
+    size_t labels_len
+) {
+    char* out = buf;
+    for (size_t i = 0; i < METRICS_COUNT; i++) {
+        const webserver_metrics_descriptor_t* metric = &metrics_[i];
+        memcpy(out, metric->header, metric->header_len);
+        out += metric->header_len;
+
+        const uint8_t* field = (const uint8_t*)snapshot + metric->offset;
+        if (labels_len > 0 || metric->label != NULL) {
+            *out++ = '{';
+            memcpy(out, labels, labels_len);
+            out += labels_len;
+            if (metric->label != NULL) {
+                if (labels_len > 0) {
+                    *out++ = ',';
+                }
+                memcpy(out, metric->label, metric->label_len);
+                out += metric->label_len;
+                if (metric->format == WEBSERVER_METRICS_LABEL) {
+                    const char* value = *(const char* const*)field;
+                    if (value != NULL) {
+                        size_t len = strnlen(value, WEBSERVER_METRICS_LABEL_LEN);
+                        memcpy(out, value, len);
+                        out += len;
+                    }
+                    *out++ = '"';
+                }
+            }
+            *out++ = '}';
+        }
+        *out++ = ' ';
+
+        if (metric->format == WEBSERVER_METRICS_LABEL) {
+            *out++ = '1';
+        }
+        else {
+            out += webserver_metrics_format_value(out, metric->format, *(const int64_t*)field);
+        }
+        if (metric->sampled && snapshot->timestamp >= 0) {
+            *out++ = ' ';
+            out = metrics_put_digits(out, snapshot->timestamp);
+        }
+        *out++ = '\n';
+    }
+    *out = '\0';
+    return out - buf;
+}
@@ -0,0 +1,284 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+#include "prefetch.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "sys/socket.h"
+
+#include "alloc/alloc.hpp"
+#include "diagnostics/diagnostics.hpp"
+#include "power/power.hpp"
+#include "sampler/sampler.hpp"
+#include "sensor/aht10.hpp"
+
+#define PREFETCH_TOLERANCE 8 // Scrapes within 1/8 of the learned interval are on time
+#define PREFETCH_MIN_STABLE 2 // On time scrapes needed before prefetching
+#define PREFETCH_EXPIRE 3 // Learned intervals without a scrape before a scraper is forgotten
+
+struct webserver_prefetch_scraper_t {
+    bool used;
+    bool fetched; // Sampler has been triggered for the next scrape
+    char client[INET6_ADDRSTRLEN];
+    int64_t last_seen;
+    int64_t interval; // Microseconds, 0 until a second scrape
+    uint32_t stable; // Consecutive scrapes close to the interval
+};
+
+static const char TAG_[] = "webserver_prefetch";
+
+static SemaphoreHandle_t lock_ = NULL;
+static alloc_mutex_t lock_storage_;
+static TaskHandle_t task_ = NULL;
+static alloc_task_t<WEBSERVER_PREFETCH_TASK_STACK_SIZE> task_storage_;
+static Sampler* sampler_ = NULL;
+static power_source_t power_ = POWER_SOURCE_INVALID;
+
+static webserver_prefetch_scraper_t scrapers_[CONFIG_WEBSERVER_PREFETCH_SCRAPERS];
+static webserver_prefetch_stats_t stats_ = {};
+
+/**
+ * @brief Time the sampler should be triggered for a scraper's next scrape
+ *
+ * @param scraper Scraper to check
+ * @return int64_t Time in microseconds, INT64_MAX if nothing is due
+ */
+static int64_t webserver_prefetch_due(const webserver_prefetch_scraper_t* scraper) {
+    if (!scraper->used || scraper->fetched || scraper->stable < PREFETCH_MIN_STABLE) {
+        return INT64_MAX;
+    }
+    return scraper->last_seen + scraper->interval - CONFIG_WEBSERVER_PREFETCH_LEAD * 1000LL;
+}
+
+/**
+ * @brief Find the slot for a scraper, reusing an expired or the least
+ * recently seen slot if it is new
+ *
+ * Must be called with the lock held.
+ *
+ * @param client IP address of the scraper
+ * @param now Current time
+ * @return webserver_prefetch_scraper_t*
+ */
+static webserver_prefetch_scraper_t* webserver_prefetch_find(const char* client, int64_t now) {
+    webserver_prefetch_scraper_t* victim = NULL;
+    for (int i = 0; i < CONFIG_WEBSERVER_PREFETCH_SCRAPERS; i++) {
+        webserver_prefetch_scraper_t* scraper = &scrapers_[i];
+        if (scraper->used && strcmp(scraper->client, client) == 0) {
+            return scraper;
+        }
+        if (scraper->used && scraper->interval > 0 && now - scraper->last_seen > scraper->interval * PREFETCH_EXPIRE) {
+            scraper->used = false;
+        }
+        if (victim == NULL || (victim->used && (!scraper->used || scraper->last_seen < victim->last_seen))) {
+            victim = scraper;
+        }
+    }
+
+    if (victim->used) {
+        ESP_LOGD(TAG_, "Forgetting scraper %s", victim->client);
+    }
+    memset(victim, 0, sizeof(*victim));
+    strncpy(victim->client, client, sizeof(victim->client) - 1);
+    return victim;
+}
+
+/**
+ * @brief Record a scrape and refine the scraper's interval
+ *
+ * Must be called with the lock held.
+ *
+ * @param client IP address of the scraper
+ * @param now Time of the scrape
+ */
+static void webserver_prefetch_learn(const char* client, int64_t now) {
+    webserver_prefetch_scraper_t* scraper = webserver_prefetch_find(client, now);
+    if (scraper->used) {
+        int64_t observed = now - scraper->last_seen;
+        int64_t error = observed - scraper->interval;
+        if (scraper->interval > 0 && (error < 0 ? -error : error) <= scraper->interval / PREFETCH_TOLERANCE) {
+            scraper->interval += error / 4;
+            scraper->stable++;
+        }
+        else {
+            // First interval, or the scraper has changed its schedule
+            scraper->interval = observed;
+            scraper->stable = 0;
+        }
+    }
+    scraper->used = true;
+    scraper->fetched = false;
+    scraper->last_seen = now;
+}
+
+/**
+ * @brief Tell the power scheduler when the next scrape is expected
+ *
+ * A scrape can only be slept through if it is predictable, so any
+ * scraper still being learnt, or whose sample has been triggered but
+ * has not scraped yet, keeps the device awake. Scrapers that have
+ * stopped are ignored.
+ *
+ * Must be called with the lock held.
+ *
+ * @param now Current time
+ */
+static void webserver_prefetch_update_power(int64_t now) {
+    bool busy = false;
+    int64_t due = POWER_WAKE_NONE;
+    for (int i = 0; i < CONFIG_WEBSERVER_PREFETCH_SCRAPERS; i++) {
+        webserver_prefetch_scraper_t* scraper = &scrapers_[i];
+        if (!scraper->used || (scraper->interval > 0 && now - scraper->last_seen > scraper->interval * PREFETCH_EXPIRE)) {
+            continue;
+        }
+        if (scraper->stable < PREFETCH_MIN_STABLE || scraper->fetched) {
+            busy = true;
+        }
+        int64_t scraper_due = webserver_prefetch_due(scraper);
+        if (scraper_due < due) {
+            due = scraper_due;
+        }
+    }
+
+    if (busy) {
+        power_busy(power_);
+    }
+    else if (due != POWER_WAKE_NONE) {
+        power_wake_at(power_, due);
+    }
+    else {
+        power_idle(power_);
+    }
+}
+
+static void webserver_prefetch_task(void* arg) {
+    while (1) {
+        int64_t due = INT64_MAX;
+        xSemaphoreTake(lock_, portMAX_DELAY);
+        for (int i = 0; i < CONFIG_WEBSERVER_PREFETCH_SCRAPERS; i++) {
+            int64_t scraper_due = webserver_prefetch_due(&scrapers_[i]);
+            if (scraper_due < due) {
+                due = scraper_due;
+            }
+        }
+        xSemaphoreGive(lock_);
+
+        // Scrapes wake us early as they change the schedule
+        if (due == INT64_MAX) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        int64_t wait = due - esp_timer_get_time();
+        if (wait > 0) {
+            ulTaskNotifyTake(pdTRUE, wait / 1000 / portTICK_PERIOD_MS + 1);
+            continue;
+        }
+
+        power_busy(power_);
+        sampler_->Trigger();
+        int64_t now = esp_timer_get_time();
+
+        xSemaphoreTake(lock_, portMAX_DELAY);
+        // One sample serves every scraper due by now. If it fails they
+        // fall back to waiting for the sampler themselves.
+        for (int i = 0; i < CONFIG_WEBSERVER_PREFETCH_SCRAPERS; i++) {
+            if (webserver_prefetch_due(&scrapers_[i]) <= now) {
+                scrapers_[i].fetched = true;
+            }
+        }
+        webserver_prefetch_update_power(now);
+        xSemaphoreGive(lock_);
+        diagnostics_check_stack();
+    }
+}
+
+esp_err_t webserver_prefetch_init(Sampler* sampler) {
+    sampler_ = sampler;
+    // Nothing to predict until something scrapes
+    power_ = power_register("scrape");
+    power_idle(power_);
+    lock_ = alloc_mutex_create(&lock_storage_);
+    if (lock_ == NULL) {
+        ESP_LOGE(TAG_, "Failed to create lock");
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = alloc_task_create(
+        &task_storage_,
+        webserver_prefetch_task,
+        "prefetch",
+        NULL,
+        WEBSERVER_PREFETCH_TASK_PRIORITY,
+        &task_
+    );
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to create prefetch task");
+    }
+    return err;
+}
+
+void webserver_prefetch_record(const char* client) {
+    if (task_ == NULL) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    webserver_prefetch_learn(client, now);
+    webserver_prefetch_update_power(now);
+    xSemaphoreGive(lock_);
+    // Scrapes change the schedule
+    xTaskNotifyGive(task_);
+}
+
+esp_err_t webserver_prefetch_get(const char* client, sampler_sample_t* sample) {
+    if (task_ == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    int64_t now = esp_timer_get_time();
+    esp_err_t err = sampler_->GetLatest(sample);
+    bool hit = err == ESP_OK && now - sample->timestamp <= CONFIG_WEBSERVER_PREFETCH_MAX_AGE * 1000LL;
+    webserver_prefetch_record(client);
+
+    if (!hit) {
+        // Sample now, shared with anything else polling before it is
+        // too old. Sequence numbers start at 1 so 0 matches no sample.
+        sampler_->Trigger();
+        sampler_sample_t newer;
+        if (sampler_->WaitNewer(err == ESP_OK ? sample->sequence : 0, &newer, WEBSERVER_PREFETCH_WAIT) == ESP_OK) {
+            *sample = newer;
+        }
+        else if (err != ESP_OK) {
+            return ESP_ERR_TIMEOUT;
+        }
+        else {
+            ESP_LOGW(TAG_, "No new sample in time, using sample %u", sample->sequence);
+        }
+    }
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    if (hit) {
+        stats_.hits++;
+    }
+    else {
+        stats_.misses++;
+    }
+    stats_.last_age = esp_timer_get_time() - sample->timestamp;
+    xSemaphoreGive(lock_);
+    return ESP_OK;
+}
+
+void webserver_prefetch_get_stats(webserver_prefetch_stats_t* stats) {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    *stats = stats_;
+    xSemaphoreGive(lock_);
+}
@@ -35,6 +35,60 @@ esp_err_t webserver_register_handlers_() {
         return err;
     }
 
+    httpd_uri_t readings = {
+        .uri = "/api/v1/readings",
+        .method = HTTP_GET,
+        .handler = webserver_handler_get_readings,
+        .user_ctx = NULL
+    };
+    ESP_LOGD(TAG_, "Registering GET /api/v1/readings");
+    err = httpd_register_uri_handler(server_, &readings);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to register handler for GET /api/v1/readings (%s)", esp_err_to_name(err));
+        return err;
+    }
+
+    httpd_uri_t history = {
+        .uri = "/history",
+        .method = HTTP_GET,
+        .handler = webserver_handler_get_history,
+        .user_ctx = NULL
+    };
+    ESP_LOGD(TAG_, "Registering GET /history");
+    err = httpd_register_uri_handler(server_, &history);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to register handler for GET /history (%s)", esp_err_to_name(err));
+        return err;
+    }
+
+#ifdef CONFIG_SAMPLE_LOG_ENABLE
+    httpd_uri_t sample_log = {
+        .uri = "/history/log",
+        .method = HTTP_GET,
+        .handler = webserver_handler_get_sample_log,
+        .user_ctx = NULL
+    };
+    ESP_LOGD(TAG_, "Registering GET /history/log");
+    err = httpd_register_uri_handler(server_, &sample_log);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to register handler for GET /history/log (%s)", esp_err_to_name(err));
+        return err;
+    }
+#endif
+
+    httpd_uri_t events = {
+        .uri = "/events",
+        .method = HTTP_GET,
+        .handler = webserver_handler_get_events,
+        .user_ctx = NULL
+    };
+    ESP_LOGD(TAG_, "Registering GET /events");
+    err = httpd_register_uri_handler(server_, &events);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to register handler for GET /events (%s)", esp_err_to_name(err));
+        return err;
+    }
+
     return ESP_OK;
 }
 
@@ -3,17 +3,44 @@
 
 #include "util.hpp"
 
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "string.h"
 
 #include "esp_err.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
+#include "esp_system.h"
 #include "esp_timer.h"
+#include "sdkconfig.h"
 #include "sys/socket.h"
 
+#include "events.hpp"
+#include "metrics.hpp"
+#include "prefetch.hpp"
+#include "config/labels.hpp"
+#include "diagnostics/diagnostics.hpp"
+#include "history/history.hpp"
+#include "history/log.hpp"
+#include "link/link.hpp"
+#include "power/power.hpp"
+#include "psychrometrics/psychrometrics.hpp"
+#include "sampler/sampler.hpp"
 #include "sensor/aht10.hpp"
+#include "stats/summary.hpp"
+#include "timesync/timesync.hpp"
+
+#define QUERY_VALUE_LEN 24
 
 AHT10* sensor_ = NULL;
+static History* history_ = NULL;
+static MeasurementSummary* summary_ = NULL;
+static Sampler* sampler_ = NULL;
+static SampleLog* sample_log_ = NULL;
+// Tells apart sample sequence numbers from before a reset
+static uint32_t boot_ = 0;
 static const char TAG_[] = "webserver_util";
 
 
@@ -32,50 +59,331 @@ esp_err_t webserver_util_get_client_ip(httpd_req_t* req, char ip[INET6_ADDRSTRLE
     return ESP_OK;
 }
 
+esp_err_t webserver_util_get_sample(sampler_sample_t* sample) {
+    if (sampler_ == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return sampler_->GetLatest(sample);
+}
+
+esp_err_t webserver_util_wait_sample(sampler_sample_t* sample) {
+    esp_err_t err = webserver_util_get_sample(sample);
+    if (err != ESP_ERR_NOT_FOUND) {
+        return err;
+    }
+    // Sequence numbers start at 1 so 0 matches no sample
+    return sampler_->WaitNewer(0, sample, WEBSERVER_PREFETCH_WAIT);
+}
+
 esp_err_t webserver_util_get_measurement(aht10_measurement_t* measurement) {
-    return sensor_->Measure(measurement);
-}
-
-char* webserver_util_format_metrics(aht10_measurement_t* measurement) {
-    const char metrics_template[] =
-        "# HELP environment_temperature_celsius Current temperature\n"
-        "# TYPE environment_temperature_celsius gauge\n"
-        "environment_temperature_celsius %f\n"
-        "# HELP environment_humidity_percent Current humidity\n"
-        "# TYPE environment_humidity_percent gauge\n"
-        "environment_humidity_percent %f\n"
-        "# HELP device_uptime_seconds Uptime of device in seconds\n"
-        "# TYPE device_uptime_seconds counter\n"
-        "device_uptime_seconds %.0f\n"
-        "# HELP device_free_heap_bytes Number of bytes free on heap\n"
-        "# TYPE device_free_heap_bytes gauge\n"
-        "device_free_heap_bytes %d\n";
-
-    const double uptime = (double)esp_timer_get_time() / 1000000;
-    const uint32_t heap = esp_get_free_heap_size();
-
-    char* buf;
-    size_t len = snprintf(
-        NULL,
-        0,
-        metrics_template,
-        measurement->temperature,
-        measurement->humidity,
-        uptime,
-        heap
-    );
-    buf = (char*)malloc(len);
-    sprintf(
-        buf,
-        metrics_template,
-        measurement->temperature,
-        measurement->humidity,
-        uptime,
-        heap
-    );
+    sampler_sample_t sample;
+    esp_err_t err = webserver_util_get_sample(&sample);
+    if (err == ESP_OK) {
+        *measurement = sample.measurement;
+    }
+    return err;
+}
+
+/**
+ * @brief Copy a window summary into the snapshot
+ *
+ * @param summary Summary to copy
+ * @param window Snapshot fields to copy into
+ */
+static void webserver_util_copy_window(const stats_snapshot_t* summary, webserver_metrics_window_t* window) {
+    // Quantiles are in the order WindowSummary tracks them
+    static_assert(STATS_QUANTILES == 3, "Window summary quantiles do not match the registry");
+    const bool empty = summary->window_count == 0;
+    window->p50 = empty ? WEBSERVER_METRICS_NAN : summary->values[0];
+    window->p90 = empty ? WEBSERVER_METRICS_NAN : summary->values[1];
+    window->p99 = empty ? WEBSERVER_METRICS_NAN : summary->values[2];
+    window->sum = summary->sum;
+    window->count = summary->count;
+    window->min = empty ? WEBSERVER_METRICS_NAN : summary->min;
+    window->max = empty ? WEBSERVER_METRICS_NAN : summary->max;
+}
+
+void webserver_util_collect_metrics(const aht10_measurement_t* measurement, webserver_metrics_snapshot_t* snapshot) {
+    if (timesync_to_unix_ms(measurement->time, &snapshot->timestamp) != ESP_OK) {
+        snapshot->timestamp = -1;
+    }
+    snapshot->temperature = measurement->temperature;
+    snapshot->humidity = measurement->humidity;
+    snapshot->dew_point = psychrometrics_dew_point(measurement->temperature, measurement->humidity);
+    snapshot->absolute_humidity = psychrometrics_absolute_humidity(measurement->temperature, measurement->humidity);
+    snapshot->heat_index = psychrometrics_heat_index(measurement->temperature, measurement->humidity);
+    snapshot->uptime = esp_timer_get_time() / 1000000;
+
+    diagnostics_counters_t diagnostics;
+    diagnostics_get(&diagnostics);
+    snapshot->powered = diagnostics.uptime;
+    snapshot->resets = diagnostics.resets;
+    snapshot->reset_reason = diagnostics_reason_name(diagnostics.reason);
+    snapshot->i2c_errors = diagnostics.i2c_errors;
+
+    snapshot->heap = esp_get_free_heap_size();
+    snapshot->sample_interval = sampler_ != NULL ? sampler_->GetInterval() : 0;
+    snapshot->samples = sampler_ != NULL ? sampler_->GetSampleCount() : 0;
+
+    webserver_prefetch_stats_t prefetch;
+    webserver_prefetch_get_stats(&prefetch);
+    snapshot->prefetch_hits = prefetch.hits;
+    snapshot->prefetch_misses = prefetch.misses;
+    snapshot->sample_age = prefetch.last_age / 1000;
+
+    snapshot->subscribers = webserver_events_get_subscribers();
+    snapshot->dropped = webserver_events_get_dropped();
+
+    power_stats_t power;
+    power_get_stats(&power);
+    snapshot->awake = power.awake_permille;
+    snapshot->slept = power.slept / 1000;
+    snapshot->wakes = power.wakes;
+
+    timesync_stats_t timesync;
+    timesync_get_stats(&timesync);
+    snapshot->clock_synced = timesync.synced;
+    snapshot->clock_offset = timesync.offset / 1000;
+    snapshot->clock_sync_age = (esp_timer_get_time() - (timesync.synced ? timesync.last_sync : 0)) / 1000;
+
+    link_stats_t link;
+    link_get_stats(&link);
+    snapshot->wifi_associated = link.associated;
+    snapshot->wifi_rssi = link.rssi;
+    snapshot->wifi_channel = link.channel;
+    snapshot->wifi_phy = link_phy_name(link.phy);
+    snapshot->wifi_association_age = link.associated ? (esp_timer_get_time() - link.associated_at) / 1000 : 0;
+    snapshot->wifi_reconnects = link.reconnects;
+    snapshot->wifi_disconnects = link.disconnects;
+    snapshot->wifi_disconnect_reason = link_reason_name(link.last_reason);
+}
+
+char* webserver_util_format_metrics(const char* client, aht10_measurement_t* measurement) {
+    char labels[CONFIG_LABELS_BLOCK_LEN];
+    const size_t labels_len = config_labels_get(labels);
+    // Before the window is collected, so a failure here does not lose it
+    char* buf = webserver_metrics_alloc(labels_len);
+    if (buf == NULL) {
+        ESP_LOGE(TAG_, "Failed to allocate metrics buffer");
+        return NULL;
+    }
+
+    webserver_metrics_snapshot_t snapshot;
+    webserver_util_collect_metrics(measurement, &snapshot);
+#ifndef CONFIG_TIMESYNC_METRICS_TIMESTAMPS
+    // Leave Prometheus to stamp the readings with the scrape time
+    snapshot.timestamp = -1;
+#endif
+    stats_snapshot_t temperature = {};
+    stats_snapshot_t humidity = {};
+    if (summary_ != NULL) {
+        summary_->Collect(client, &temperature, &humidity);
+    }
+    webserver_util_copy_window(&temperature, &snapshot.temperature_window);
+    webserver_util_copy_window(&humidity, &snapshot.humidity_window);
+
+    webserver_metrics_render(buf, &snapshot, labels, labels_len);
     return buf;
 }
 
+void webserver_util_free_metrics(char* buf) {
+    webserver_metrics_free(buf);
+}
+
+/**
+ * @brief Check whether an If-None-Match list holds a tag
+ *
+ * Uses the weak comparison, so W/ prefixes are ignored.
+ *
+ * @param list Header value
+ * @param tag Opaque tag with its quotes
+ * @return true
+ * @return false
+ */
+static bool webserver_util_etag_listed(const char* list, const char* tag) {
+    size_t tag_len = strlen(tag);
+    while (*list != '\0') {
+        while (*list == ' ' || *list == '\t' || *list == ',') {
+            list++;
+        }
+        size_t len = strcspn(list, ",");
+        while (len > 0 && (list[len - 1] == ' ' || list[len - 1] == '\t')) {
+            len--;
+        }
+        const char* candidate = list;
+        if (len == 1 && *candidate == '*') {
+            return true;
+        }
+        if (len >= 2 && strncmp(candidate, "W/", 2) == 0) {
+            candidate += 2;
+            len -= 2;
+        }
+        if (len == tag_len && strncmp(candidate, tag, len) == 0) {
+            return true;
+        }
+        list += strcspn(list, ",");
+    }
+    return false;
+}
+
+/**
+ * @brief Format the ETag of a sample
+ *
+ * @param sample Sample to tag
+ * @param etag Buffer for the tag
+ */
+static void webserver_util_format_etag(const sampler_sample_t* sample, char etag[WEBSERVER_ETAG_LEN]) {
+    snprintf(etag, WEBSERVER_ETAG_LEN, "W/\"%08x-%u\"", boot_, sample->sequence);
+}
+
+bool webserver_util_not_modified(httpd_req_t* req, const sampler_sample_t* sample, char etag[WEBSERVER_ETAG_LEN]) {
+    size_t match_len = httpd_req_get_hdr_value_len(req, "If-None-Match") + 1;
+    if (match_len <= 1) {
+        return false;
+    }
+    char match[match_len];
+    webserver_util_format_etag(sample, etag);
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", match, match_len) != ESP_OK
+        || !webserver_util_etag_listed(match, etag + 2)) {
+        return false;
+    }
+
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_send(req, NULL, 0);
+    return true;
+}
+
+void webserver_util_set_etag(httpd_req_t* req, const sampler_sample_t* sample, char etag[WEBSERVER_ETAG_LEN]) {
+    webserver_util_format_etag(sample, etag);
+    httpd_resp_set_hdr(req, "ETag", etag);
+}
+
 void webserver_util_set_sensor(AHT10* sensor) {
     sensor_ = sensor;
 }
+
+void webserver_util_set_history(History* history) {
+    history_ = history;
+}
+
+History* webserver_util_get_history() {
+    return history_;
+}
+
+void webserver_util_set_sample_log(SampleLog* log) {
+    sample_log_ = log;
+}
+
+SampleLog* webserver_util_get_sample_log() {
+    return sample_log_;
+}
+
+void webserver_util_set_summary(MeasurementSummary* summary) {
+    summary_ = summary;
+}
+
+void webserver_util_set_sampler(Sampler* sampler) {
+    sampler_ = sampler;
+    boot_ = esp_random();
+}
+
+esp_err_t webserver_util_get_query_int(httpd_req_t* req, const char* key, int64_t* value) {
+    size_t query_len = httpd_req_get_url_query_len(req) + 1;
+    if (query_len <= 1) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    char query[query_len];
+    if (httpd_req_get_url_query_str(req, query, query_len) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    char raw[QUERY_VALUE_LEN];
+    if (httpd_query_key_value(query, key, raw, sizeof(raw)) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    char* end;
+    long long parsed = strtoll(raw, &end, 10);
+    if (end == raw || *end != '\0') {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *value = parsed;
+    return ESP_OK;
+}
+
+void webserver_util_chunk_init(webserver_chunk_t* chunk, httpd_req_t* req) {
+    chunk->req = req;
+    chunk->len = 0;
+}
+
+/**
+ * @brief Send the buffered data as a single chunk
+ *
+ * @param chunk Chunk buffer
+ * @return esp_err_t
+ */
+static esp_err_t webserver_util_chunk_flush(webserver_chunk_t* chunk) {
+    if (chunk->len == 0) {
+        return ESP_OK;
+    }
+    esp_err_t err = httpd_resp_send_chunk(chunk->req, chunk->buf, chunk->len);
+    chunk->len = 0;
+    return err;
+}
+
+esp_err_t webserver_util_chunk_printf(webserver_chunk_t* chunk, const char* format, ...) {
+    va_list args;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t space = sizeof(chunk->buf) - chunk->len;
+        va_start(args, format);
+        int written = vsnprintf(chunk->buf + chunk->len, space, format, args);
+        va_end(args);
+
+        if (written < 0) {
+            return ESP_FAIL;
+        }
+        if ((size_t)written < space) {
+            chunk->len += written;
+            return ESP_OK;
+        }
+        if (chunk->len == 0) {
+            // Will never fit, even in an empty buffer
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        esp_err_t err = webserver_util_chunk_flush(chunk);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_ERR_INVALID_SIZE;
+}
+
+esp_err_t webserver_util_chunk_write(webserver_chunk_t* chunk, const char* data, size_t len) {
+    while (len > 0) {
+        size_t space = sizeof(chunk->buf) - chunk->len;
+        if (space == 0) {
+            esp_err_t err = webserver_util_chunk_flush(chunk);
+            if (err != ESP_OK) {
+                return err;
+            }
+            space = sizeof(chunk->buf);
+        }
+        size_t n = len < space ? len : space;
+        memcpy(chunk->buf + chunk->len, data, n);
+        chunk->len += n;
+        data += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+esp_err_t webserver_util_chunk_end(webserver_chunk_t* chunk) {
+    esp_err_t err = webserver_util_chunk_flush(chunk);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return httpd_resp_send_chunk(chunk->req, NULL, 0);
+}
@@ -4,18 +4,34 @@
 #include "esp_log.h"
 #include "esp_spi_flash.h"
 #include "esp_system.h"
-#include "esp_spiffs.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "sdkconfig.h"
 
 #include "wlan.hpp"
+#include "alloc/alloc.hpp"
+#include "config/storage.hpp"
+#include "config/store.hpp"
 #include "config/uart.hpp"
+#include "diagnostics/diagnostics.hpp"
+#include "history/history.hpp"
+#include "history/log.hpp"
+#include "power/power.hpp"
+#include "publisher/publisher.hpp"
+#include "push/push.hpp"
+#include "sampler/sampler.hpp"
 #include "sensor/aht10.hpp"
+#include "stats/summary.hpp"
+#include "timesync/timesync.hpp"
+#include "webserver/events.hpp"
+#include "webserver/prefetch.hpp"
 #include "webserver/server.hpp"
+#include "webserver/util.hpp"
 
-#define SPIFFS_MAX_FILES 4
+#if !defined(CONFIG_UART_ENABLE) && !defined(CONFIG_PROVISIONING_ENABLE)
+#error "CONFIG_UART_ENABLE or CONFIG_PROVISIONING_ENABLE is needed to set a station"
+#endif
 
 static const char* TAG_ = "main";
 
@@ -64,62 +80,92 @@ void show_startup_info() {
         (chip.features & CHIP_FEATURE_EMB_FLASH) ? "embedded" : "external");
 }
 
-esp_err_t init_spiffs() {
-    ESP_LOGI(TAG_, "Initialising SPIFFS file system");
-
-    esp_vfs_spiffs_conf_t conf = {
-        .base_path = "/spiffs",
-        .partition_label = NULL,
-        .max_files = SPIFFS_MAX_FILES,
-        .format_if_mount_failed = true,
-    };
-
-    esp_err_t ret = esp_vfs_spiffs_register(&conf);
-    if (ret != ESP_OK) {
-        switch (ret) {
-        case ESP_FAIL:
-            ESP_LOGE(TAG_, "ESP_FAIL: Failed to mount or format file system");
-            break;
-        case ESP_ERR_NOT_FOUND:
-            ESP_LOGE(TAG_, "ESP_ERR_NOT_FOUND: Could not find SPIFFS partition");
-            break;
-        default:
-            ESP_LOGE(TAG_, "Failed to initialise SPIFFS (%s)", esp_err_to_name(ret));
-            break;
-        }
-        return ret;
-    }
-
-    size_t total = 0, used = 0;
-    ret = esp_spiffs_info(NULL, &total, &used);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG_, "Failed to get SPIFFS partition information (%s)", esp_err_to_name(ret));
-        return ret;
-    }
-
-    {
-        ESP_LOGI(TAG_, "Partition size: total: %d, used: %d", total, used);
-    }
-
-    return ESP_OK;
-}
+#ifdef CONFIG_UART_ENABLE
+#define UART_TASK_STACK_SIZE 2048
 
 void uart_task(void* arg) {
-    AHT10* sensor = (AHT10*)arg;
-    UART uart = UART(74800, sensor);
-    uart.Listen();
+    UART* uart = (UART*)arg;
+    uart->Listen();
 }
+#endif
 
 extern "C" void app_main() {
     show_startup_info();
-    init_spiffs();
-
-    AHT10 sensor = AHT10(GPIO_NUM_0, GPIO_NUM_2, I2C_NUM_0, 0x38);
+    ESP_ERROR_CHECK(diagnostics_init());
+    ESP_ERROR_CHECK(config_store_init());
+#ifdef CONFIG_SAMPLE_LOG_ENABLE
+    // SPIFFS is mounted once everything else has started
+    ESP_ERROR_CHECK(storage_init());
+#endif
+    // Before anything that registers a power source
+    ESP_ERROR_CHECK(power_init());
+
+    // Static as these outlive app_main through the tasks that use them
+    static AHT10 sensor(GPIO_NUM_0, GPIO_NUM_2, I2C_NUM_0, 0x38);
+    // Only the sampler reads the sensor, everything else uses its
+    // latest sample
+    static Sampler sampler(&sensor, CONFIG_SAMPLER_INTERVAL);
+#ifdef CONFIG_UART_ENABLE
     // Start UART command handler first after initial startup
-    xTaskCreate(uart_task, "uart_listen", 2048, &sensor, 10, NULL);
+    static UART uart(74800, &sampler);
+    static alloc_task_t<UART_TASK_STACK_SIZE> uart_task_storage;
+    ESP_ERROR_CHECK(alloc_task_create(&uart_task_storage, uart_task, "uart_listen", &uart, 10, NULL));
+#endif
+
+#ifdef CONFIG_SAMPLER_ADAPTIVE_ENABLE
+    static const adaptive_config_t adaptive_config = {
+        CONFIG_SAMPLER_MIN_INTERVAL,
+        CONFIG_SAMPLER_MAX_INTERVAL,
+        { CONFIG_SAMPLER_TEMPERATURE_RATE, CONFIG_SAMPLER_HUMIDITY_RATE },
+        { CONFIG_SAMPLER_TEMPERATURE_DEVIATION, CONFIG_SAMPLER_HUMIDITY_DEVIATION },
+    };
+    static AdaptiveInterval adaptive(&adaptive_config, CONFIG_SAMPLER_INTERVAL);
+    ESP_ERROR_CHECK(sampler.SetAdaptive(&adaptive));
+#endif
+    webserver_util_set_sampler(&sampler);
+    static History history(CONFIG_SAMPLER_INTERVAL);
+    ESP_ERROR_CHECK(sampler.AddListener(History::Listener, &history));
+    webserver_util_set_history(&history);
+    static MeasurementSummary summary;
+    ESP_ERROR_CHECK(sampler.AddListener(MeasurementSummary::Listener, &summary));
+    webserver_util_set_summary(&summary);
+    ESP_ERROR_CHECK(webserver_events_init());
+    ESP_ERROR_CHECK(webserver_prefetch_init(&sampler));
+    ESP_ERROR_CHECK(sampler.AddListener(webserver_events_listener, NULL));
+
+#ifdef CONFIG_SAMPLE_LOG_ENABLE
+    static SampleLog sample_log(STORAGE_BASE_PATH);
+    ESP_ERROR_CHECK(sampler.AddListener(SampleLog::Listener, &sample_log));
+    webserver_util_set_sample_log(&sample_log);
+    ESP_ERROR_CHECK(sample_log.FlushOnRestart());
+#endif
+#ifdef CONFIG_PUSH_ENABLE
+    static PushExporter push(CONFIG_PUSH_URL);
+    ESP_ERROR_CHECK(sampler.AddListener(PushExporter::Listener, &push));
+#endif
+#ifdef CONFIG_PUBLISHER_ENABLE
+    static MqttPublisher publisher(CONFIG_PUBLISHER_URI, CONFIG_PUBLISHER_TOPIC);
+    ESP_ERROR_CHECK(sampler.AddListener(MqttPublisher::Listener, &publisher));
+#endif
+    ESP_ERROR_CHECK(sampler.Start());
 
     network_init();
+#ifdef CONFIG_TIMESYNC_ENABLE
+    ESP_ERROR_CHECK(timesync_start());
+#endif
+    ESP_ERROR_CHECK(power_start());
+#ifdef CONFIG_PUSH_ENABLE
+    ESP_ERROR_CHECK(push.Start());
+#endif
+#ifdef CONFIG_PUBLISHER_ENABLE
+    ESP_ERROR_CHECK(publisher.Start());
+#endif
     // Server server = Server(80, &sensor);
     webserver_start(80, &sensor);
     // server.Listen();
+#ifdef CONFIG_SAMPLE_LOG_ENABLE
+    // Mounting, or formatting, SPIFFS can take seconds so do it here
+    // once the server is up rather than on the sampler task
+    sample_log.Open();
+#endif
 }
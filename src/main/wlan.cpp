@@ -12,25 +12,81 @@
 #include "freertos/event_groups.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "mdns.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "sdkconfig.h"
 #include "tcpip_adapter.h"
+#ifdef CONFIG_MDNS_ENABLE
+#include "mdns.h"
+#endif
+#ifdef CONFIG_PROVISIONING_ENABLE
 #include "wifi_provisioning/manager.h"
 #include "wifi_provisioning/scheme_softap.h"
+#endif
 
+#include "alloc/alloc.hpp"
 #include "config/config.hpp"
+#include "config/store.hpp"
+#include "diagnostics/diagnostics.hpp"
+#include "link/link.hpp"
+#include "power/power.hpp"
 
 const int WIFI_CONNECTED_EVENT = BIT0;
 EventGroupHandle_t wifi_event_group;
 const char TAG_[] = "wifi_provisioning";
+// Held busy while associating so the device never sleeps through a
+// handshake it can not be woken for
+static power_source_t power_ = POWER_SOURCE_INVALID;
+#ifdef CONFIG_PROVISIONING_ENABLE
+// SoftAP provisioning is running
+static bool provisioning_ = false;
+#endif
 
 void wifi_init_station() {
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_start())
 }
 
+bool wifi_apply_station(const config_settings_t* settings) {
+    if (settings->wifi_ssid[0] == '\0') {
+        return false;
+    }
+
+    wifi_config_t config = {};
+    memcpy(config.sta.ssid, settings->wifi_ssid, strnlen(settings->wifi_ssid, sizeof(config.sta.ssid)));
+    memcpy(config.sta.password, settings->wifi_key, strnlen(settings->wifi_key, sizeof(config.sta.password)));
+    // The config store is the only copy, so a later clear takes effect
+    esp_wifi_set_storage(WIFI_STORAGE_RAM);
+    esp_err_t err = esp_wifi_set_config(WIFI_IF_STA, &config);
+    esp_wifi_set_storage(WIFI_STORAGE_FLASH);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to set station config: %s", esp_err_to_name(err));
+    }
+
+    tcpip_adapter_ip_info_t info = {};
+    memcpy(&info.ip.addr, settings->ip, sizeof(settings->ip));
+    memcpy(&info.netmask.addr, settings->netmask, sizeof(settings->netmask));
+    memcpy(&info.gw.addr, settings->gateway, sizeof(settings->gateway));
+    if (info.ip.addr == 0) {
+        // Fails harmlessly if it was already running
+        tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA);
+        return true;
+    }
+
+    tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA);
+    err = tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_STA, &info);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_, "Failed to set static IP: %s", esp_err_to_name(err));
+    }
+    tcpip_adapter_dns_info_t dns = {};
+    IP_ADDR4(&dns.ip, settings->dns[0], settings->dns[1], settings->dns[2], settings->dns[3]);
+    if (!ip_addr_isany(&dns.ip)) {
+        tcpip_adapter_set_dns_info(TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_DNS_MAIN, &dns);
+    }
+    return true;
+}
+
+#ifdef CONFIG_PROVISIONING_ENABLE
 void wifi_get_ssid(char* ssid, int max_len) {
     unsigned char mac[6];
     esp_wifi_get_mac(WIFI_IF_STA, mac);
@@ -86,12 +142,14 @@ void event_handler_wifi_prov(
     case WIFI_PROV_END:
         ESP_LOGD(TAG_, "Deinitialising provisioning manager");
         wifi_prov_mgr_deinit();
+        provisioning_ = false;
         break;
     default:
         ESP_LOGD(TAG_, "Got unrecognised event. ID: %d", id);
         break;
     }
 }
+#endif // CONFIG_PROVISIONING_ENABLE
 
 void event_handler_wifi(
     void* arg,
@@ -106,10 +164,23 @@ void event_handler_wifi(
         ESP_LOGD(TAG_, "Got WIFI_EVENT_STA_START");
         esp_wifi_connect();
         break;
+    case WIFI_EVENT_STA_CONNECTED:
+    {
+        wifi_event_sta_connected_t* event = (wifi_event_sta_connected_t*)data;
+        ESP_LOGD(TAG_, "Associated on channel %d", event->channel);
+        link_record_associated(event->channel);
+        break;
+    }
     case WIFI_EVENT_STA_DISCONNECTED:
-        ESP_LOGI(TAG_, "Disconnected. Attempting to reconnect");
+    {
+        wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*)data;
+        ESP_LOGI(TAG_, "Disconnected (%s). Attempting to reconnect", link_reason_name(event->reason));
+        link_record_disconnected(event->reason);
+        power_busy(power_);
         esp_wifi_connect();
+        diagnostics_check_stack();
         break;
+    }
     case WIFI_EVENT_AP_STACONNECTED:
         ESP_LOGI(TAG_, "Station connected to SoftAP");
         break;
@@ -138,6 +209,7 @@ void event_handler_ip(void* arg,
             IP2STR(&event->ip_info.netmask)
         );
 
+        power_idle(power_);
         // Tell the rest of the program to continue
         xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_EVENT);
     }
@@ -151,18 +223,59 @@ void event_handler_ip(void* arg,
     }
 }
 
+void event_handler_config(
+    void* arg,
+    esp_event_base_t base,
+    int id,
+    void* data
+) {
+    const char TAG_[] = "config_event";
+    if (id != CONFIG_EVENT_STATION_CHANGED) {
+        return;
+    }
+
+    config_settings_t settings;
+    config_store_get(&settings);
+    if (settings.wifi_ssid[0] == '\0') {
+        ESP_LOGI(TAG_, "Station cleared, provisioning will start after a reset");
+        return;
+    }
+    ESP_LOGI(TAG_, "Station changed, joining the new network");
+#ifdef CONFIG_PROVISIONING_ENABLE
+    if (provisioning_) {
+        // Also stops the softAP
+        wifi_prov_mgr_deinit();
+        provisioning_ = false;
+    }
+#endif
+    power_busy(power_);
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    wifi_apply_station(&settings);
+    // Both may fail harmlessly depending on how far the old station
+    // got. The disconnect handler also reconnects.
+    esp_wifi_start();
+    esp_wifi_disconnect();
+    esp_wifi_connect();
+    diagnostics_check_stack();
+}
+
 void wifi_init_events() {
     ESP_LOGD("NETWORK", "Registering events");
 
     ESP_ERROR_CHECK(esp_event_loop_create_default());
-    wifi_event_group = xEventGroupCreate();
+    static alloc_event_group_t wifi_event_group_storage;
+    wifi_event_group = alloc_event_group_create(&wifi_event_group_storage);
+    configASSERT(wifi_event_group);
+    power_ = power_register("wifi");
 
+#ifdef CONFIG_PROVISIONING_ENABLE
     ESP_ERROR_CHECK(esp_event_handler_register(
         WIFI_PROV_EVENT,
         ESP_EVENT_ANY_ID,
         &event_handler_wifi_prov,
         NULL
     ));
+#endif
 
     ESP_ERROR_CHECK(esp_event_handler_register(
         WIFI_EVENT,
@@ -177,6 +290,13 @@ void wifi_init_events() {
         &event_handler_ip,
         NULL
     ));
+
+    ESP_ERROR_CHECK(esp_event_handler_register(
+        CONFIG_EVENT,
+        ESP_EVENT_ANY_ID,
+        &event_handler_config,
+        NULL
+    ));
 }
 
 void wifi_init_net() {
@@ -186,6 +306,7 @@ void wifi_init_net() {
     ESP_ERROR_CHECK(esp_wifi_init(&config));
 }
 
+#ifdef CONFIG_MDNS_ENABLE
 void wifi_init_mdns() {
     esp_err_t err = mdns_init();
     if (err) {
@@ -194,12 +315,30 @@ void wifi_init_mdns() {
     else {
         mdns_hostname_set(CONFIG_MDNS_HOSTNAME);
         mdns_instance_name_set(CONFIG_MDNS_INSTANCE_NAME);
+        // Lets a scrape gateway find every sensor by browsing for it
+        mdns_txt_item_t txt[] = { { (char*)"path", (char*)"/metrics" } };
+        err = mdns_service_add(NULL, "_prometheus-http", "_tcp", 80, txt, 1);
+        if (err) {
+            ESP_LOGE("MDNS", "Failed to add service: %d", err);
+        }
     }
 }
+#endif
 
 void wifi_init_provisioning() {
     const char TAG[] = "WIFI_PROVISIONING";
 
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    config_settings_t settings;
+    config_store_get(&settings);
+    if (wifi_apply_station(&settings)) {
+        // Set over UART, which takes precedence over softAP provisioning
+        ESP_LOGI(TAG, "Using station from config store. Starting station");
+        ESP_ERROR_CHECK(esp_wifi_start());
+        return;
+    }
+
+#ifdef CONFIG_PROVISIONING_ENABLE
     wifi_prov_mgr_config_t config = {
         .scheme = wifi_prov_scheme_softap,
         .scheme_event_handler = WIFI_PROV_EVENT_HANDLER_NONE,
@@ -223,12 +362,25 @@ void wifi_init_provisioning() {
             ssid,
             NULL
         ));
+        provisioning_ = true;
     }
     else {
         ESP_LOGI(TAG, "Device already provisioned. Starting station");
         wifi_prov_mgr_deinit();
         wifi_init_station();
     }
+#else
+    // Credentials kept by the WiFi driver from before provisioning was
+    // compiled out still work
+    wifi_config_t config = {};
+    if (esp_wifi_get_config(WIFI_IF_STA, &config) == ESP_OK && config.sta.ssid[0] != '\0') {
+        ESP_LOGI(TAG, "Device already provisioned. Starting station");
+        wifi_init_station();
+    }
+    else {
+        ESP_LOGW(TAG, "No station set. Waiting for one over UART");
+    }
+#endif
 }
 
 void network_init() {
@@ -237,8 +389,11 @@ void network_init() {
 
     Config::InitNVS();
     wifi_init_events();       // Initialize event handlers
+    ESP_ERROR_CHECK(link_init());
     wifi_init_net();          // Initialize networking
+#ifdef CONFIG_MDNS_ENABLE
     wifi_init_mdns();         // Initialize mDNS
+#endif
     wifi_init_provisioning(); // Initialize and start provisioning as required
 
     // Wait for connection
@@ -5,10 +5,19 @@
 #define MAIN_WLAN_H_
 
 #include "esp_event.h"
+#include "sdkconfig.h"
+
+#include "config/store.hpp"
 
 // initialise WiFi in station mode
 void wifi_init_station();
 
+// Set the station credentials and addressing from settings read from
+// the config store. WiFi must be in station mode. Returns false if no
+// station has been set there, leaving softAP provisioning to choose one.
+bool wifi_apply_station(const config_settings_t* settings);
+
+#ifdef CONFIG_PROVISIONING_ENABLE
 // Get the SSID for the softAP
 // Use the prefix PROV_ followed by the last three chunks of the
 // devices MAC address
@@ -20,6 +29,7 @@ void event_handler_wifi_prov(
     esp_event_base_t base,
     int id,
     void* data);
+#endif
 
 // Handler for WiFi system events
 void event_handler_wifi(
@@ -35,14 +45,23 @@ void event_handler_ip(
     int id,
     void* data);
 
+// Handler for config store events, joins a new station straight away
+void event_handler_config(
+    void* arg,
+    esp_event_base_t base,
+    int id,
+    void* data);
+
 // Create event loop and register events
 void wifi_init_events();
 
 // Initialise TCP/IP and WiFi interface
 void wifi_init_net();
 
+#ifdef CONFIG_MDNS_ENABLE
 // Initialise the mDNS service
 void wifi_init_mdns();
+#endif
 
 // Initialise provisioning and check if we actually need to do anything
 void wifi_init_provisioning();
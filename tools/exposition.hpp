@@ -0,0 +1,167 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Line parser for the Prometheus text exposition format shared by the
+// host tools. Header only so each tool still builds from one command.
+
+#ifndef TOOLS_EXPOSITION_H_
+#define TOOLS_EXPOSITION_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+enum exposition_line_t {
+    EXPOSITION_BLANK,
+    EXPOSITION_COMMENT,
+    EXPOSITION_HELP,
+    EXPOSITION_TYPE,
+    EXPOSITION_SAMPLE,
+};
+
+static inline bool exposition_is_name_char(char c, bool first) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == ':' ||
+        (!first && c >= '0' && c <= '9');
+}
+
+/**
+ * @brief Parse a metric or label name at the start of a string
+ *
+ * @return Length of the name, 0 if there is none
+ */
+static inline size_t exposition_parse_name(const char* s) {
+    size_t len = 0;
+    while (exposition_is_name_char(s[len], len == 0)) {
+        len++;
+    }
+    return len;
+}
+
+/**
+ * @brief Check a sample value is a float as the format allows,
+ * optionally followed by an integer timestamp
+ */
+static inline bool exposition_parse_value(const char* s) {
+    if (strncmp(s, "NaN", 3) == 0 || strncmp(s, "+Inf", 4) == 0 || strncmp(s, "-Inf", 4) == 0) {
+        s += s[0] == 'N' ? 3 : 4;
+    }
+    else {
+        char* end;
+        strtod(s, &end);
+        if (end == s) {
+            return false;
+        }
+        s = end;
+    }
+    if (*s == ' ') {
+        char* end;
+        strtoll(s + 1, &end, 10);
+        if (end == s + 1) {
+            return false;
+        }
+        s = end;
+    }
+    return *s == '\0';
+}
+
+/**
+ * @brief Parse and check one line of an exposition
+ *
+ * @param line Line without its newline
+ * @param kind Set to the kind of line
+ * @param name Set to the metric name of a sample, HELP or TYPE line
+ * @param rest Set to the offset just after the name
+ * @return Description of the problem, NULL if the line is valid
+ */
+static inline const char* exposition_parse_line(
+    const std::string& line,
+    exposition_line_t* kind,
+    std::string* name,
+    size_t* rest
+) {
+    const char* s = line.c_str();
+    name->clear();
+    *rest = 0;
+    if (*s == '\0') {
+        *kind = EXPOSITION_BLANK;
+        return NULL;
+    }
+    if (*s == '#') {
+        *kind = EXPOSITION_COMMENT;
+        if (strncmp(s, "# HELP ", 7) == 0) {
+            *kind = EXPOSITION_HELP;
+        }
+        else if (strncmp(s, "# TYPE ", 7) == 0) {
+            *kind = EXPOSITION_TYPE;
+        }
+        else {
+            return NULL;
+        }
+        s += 7;
+        size_t len = exposition_parse_name(s);
+        if (len == 0) {
+            return "bad metric name in comment";
+        }
+        name->assign(s, len);
+        *rest = s + len - line.c_str();
+        if (*kind == EXPOSITION_TYPE) {
+            if (s[len] != ' ') {
+                return "missing type";
+            }
+            const char* type = s + len + 1;
+            const char* const types[] = { "counter", "gauge", "histogram", "summary", "untyped" };
+            for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+                if (strcmp(type, types[i]) == 0) {
+                    return NULL;
+                }
+            }
+            return "unknown type";
+        }
+        return s[len] == ' ' || s[len] == '\0' ? NULL : "bad HELP line";
+    }
+
+    *kind = EXPOSITION_SAMPLE;
+    size_t len = exposition_parse_name(s);
+    if (len == 0) {
+        return "bad metric name";
+    }
+    name->assign(s, len);
+    *rest = len;
+    s += len;
+    if (*s == '{') {
+        s++;
+        while (*s != '}') {
+            size_t label = exposition_parse_name(s);
+            if (label == 0 || s[label] != '=' || s[label + 1] != '"') {
+                return "bad label";
+            }
+            s += label + 2;
+            while (*s != '"') {
+                if (*s == '\0') {
+                    return "unterminated label value";
+                }
+                if (*s == '\\') {
+                    s++;
+                    if (*s != '\\' && *s != '"' && *s != 'n') {
+                        return "bad escape in label value";
+                    }
+                }
+                s++;
+            }
+            s++;
+            if (*s == ',') {
+                s++;
+            }
+            else if (*s != '}') {
+                return "bad label separator";
+            }
+        }
+        s++;
+    }
+    if (*s != ' ') {
+        return "missing value";
+    }
+    return exposition_parse_value(s + 1) ? NULL : "bad value";
+}
+
+#endif // TOOLS_EXPOSITION_H_
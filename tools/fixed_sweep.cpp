@@ -0,0 +1,150 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host check of the AHT10 fixed point conversion over every raw code
+// the sensor can report.
+//
+// Build and run from the repository root:
+//   g++ -std=c++11 -O2 -Wall -Wextra -o fixed_sweep
+//       -Isrc/components/sensor/include/sensor
+//       tools/fixed_sweep.cpp src/components/sensor/fixed.cpp
+//   ./fixed_sweep
+//
+// The contract checked for each of the 2^20 humidity and temperature
+// codes is:
+//
+//   humidity    = round(raw * 10000 / 2^20)
+//   temperature = round(raw * 20000 / 2^20) - 5000
+//
+// where round is to the nearest integer with ties to even, worked out
+// exactly in 64 bit integers rather than through the 625 / 2^n
+// reduction the firmware uses. So every result is within half a
+// hundredth of the true value, and the results are in range for int16.
+// fixed_format_centi must also print every value the same as
+// printf("%.2f") of value / 100.
+//
+// Codes where the old float conversion prints differently are
+// counted but do not fail the check. The float path rounds raw * 100
+// to a 24 bit mantissa, so it can land on the other side of a rounding
+// boundary. The exact reference above is the one that is right.
+//
+// Exits non-zero if any code breaks the contract.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "aht10_convert.hpp"
+#include "fixed.hpp"
+
+#define RAW_CODES (1u << 20)
+
+/**
+ * @brief Divide rounding to nearest, ties to even
+ */
+static int64_t reference_round(uint64_t numerator, uint64_t denominator) {
+    uint64_t quotient = numerator / denominator;
+    uint64_t remainder = numerator % denominator;
+    if (remainder * 2 > denominator || (remainder * 2 == denominator && (quotient & 1))) {
+        quotient++;
+    }
+    return quotient;
+}
+
+struct sweep_t {
+    const char* name;
+    long mismatches;
+    long out_of_range;
+    long float_differs;
+};
+
+static void report(const sweep_t* sweep) {
+    printf(
+        "%-12s %8ld mismatches %8ld out of range %8ld differ from float\n",
+        sweep->name,
+        sweep->mismatches,
+        sweep->out_of_range,
+        sweep->float_differs
+    );
+}
+
+/**
+ * @brief Check one converted value against the exact reference
+ */
+static void check(sweep_t* sweep, uint32_t raw, int32_t value, int32_t expected, int32_t min, int32_t max, float old) {
+    if (value != expected) {
+        if (sweep->mismatches < 10) {
+            printf("%s raw %u: got %d, expected %d\n", sweep->name, raw, value, expected);
+        }
+        sweep->mismatches++;
+    }
+    if (value < min || value > max) {
+        sweep->out_of_range++;
+    }
+
+    char fixed[FIXED_CENTI_STR_LEN];
+    char reference[FIXED_CENTI_STR_LEN];
+    fixed_format_centi(fixed, sizeof(fixed), value);
+    snprintf(reference, sizeof(reference), "%.2f", old);
+    if (strcmp(fixed, reference) != 0) {
+        sweep->float_differs++;
+    }
+}
+
+/**
+ * @brief Check fixed_format_centi against printf over a range
+ *
+ * @return long Number of values printed differently
+ */
+static long check_format(int32_t min, int32_t max) {
+    long mismatches = 0;
+    for (int32_t value = min; value <= max; value++) {
+        char fixed[FIXED_CENTI_STR_LEN];
+        char reference[FIXED_CENTI_STR_LEN];
+        fixed_format_centi(fixed, sizeof(fixed), value);
+        snprintf(reference, sizeof(reference), "%.2f", value / 100.0);
+        if (strcmp(fixed, reference) != 0) {
+            if (mismatches < 10) {
+                printf("%d formats as %s, expected %s\n", value, fixed, reference);
+            }
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+int main() {
+    sweep_t humidity = { "humidity", 0, 0, 0 };
+    sweep_t temperature = { "temperature", 0, 0, 0 };
+
+    for (uint32_t raw = 0; raw < RAW_CODES; raw++) {
+        check(
+            &humidity,
+            raw,
+            aht10_humidity_from_raw(raw),
+            reference_round((uint64_t)raw * 10000, RAW_CODES),
+            0,
+            10000,
+            ((float)raw * 100) / 0x100000
+        );
+        check(
+            &temperature,
+            raw,
+            aht10_temperature_from_raw(raw),
+            reference_round((uint64_t)raw * 20000, RAW_CODES) - AHT10_TEMPERATURE_OFFSET,
+            -AHT10_TEMPERATURE_OFFSET,
+            15000,
+            ((float)raw * 200 / 0x100000) - 50
+        );
+    }
+    long format = check_format(-AHT10_TEMPERATURE_OFFSET, 15000);
+
+    report(&humidity);
+    report(&temperature);
+    printf("%-12s %8ld mismatches\n", "format", format);
+
+    bool failed = humidity.mismatches || humidity.out_of_range
+        || temperature.mismatches || temperature.out_of_range || format;
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
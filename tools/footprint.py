@@ -0,0 +1,223 @@
+# SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+# SPDX-License-Identifier: MIT
+"""
+Build every feature preset and compare footprint and boot time
+
+Each preset in src/presets is applied on top of sdkconfig.defaults and
+built in its own directory, along with the defaults alone. The app
+image size is reported against the app partition, with the IRAM and
+static DRAM use from the ELF sections. Given a serial port and the
+device's address, each image is also flashed and the device reset a
+number of times, timing how long after reset /metrics first answers.
+Run by the footprint build target.
+"""
+
+import os
+import re
+import shutil
+import statistics
+import subprocess
+import time
+import urllib.error
+import urllib.request
+
+import click
+import serial
+
+from memory_report import DRAM_END, DRAM_START
+
+IRAM_START = 0x40100000
+IRAM_END = 0x4010C000
+
+SRC_DIR = os.path.abspath(os.path.join(os.path.dirname(__file__), "..", "src"))
+PRESETS_DIR = os.path.join(SRC_DIR, "presets")
+PROJECT_NAME = "temperature-sensor"
+
+_SIZE = re.compile(r"^(\.\S+)\s+(\d+)\s+(\d+)$")
+_PARTITION_SIZE = re.compile(r"^(0x[0-9a-fA-F]+|\d+)([KM]?)$")
+
+
+def _presets() -> list:
+    """
+    _presets Names of the presets, defaults first
+    """
+
+    names = sorted(
+        os.path.splitext(f)[0] for f in os.listdir(PRESETS_DIR) if f.endswith(".defaults")
+    )
+    return ["default"] + names
+
+
+def _app_partition() -> int:
+    """
+    _app_partition Size of the factory app partition in bytes
+    """
+
+    with open(os.path.join(SRC_DIR, "partitions.csv")) as f:
+        for line in f:
+            fields = [field.strip() for field in line.split(",")]
+            if line.startswith("#") or len(fields) < 5 or fields[2] != "factory":
+                continue
+            match = _PARTITION_SIZE.match(fields[4])
+            if match:
+                value, unit = match.groups()
+                return int(value, 0) * {"": 1, "K": 1024, "M": 1024 * 1024}[unit]
+    raise click.ClickException("No factory partition in partitions.csv")
+
+
+def build(preset: str, build_dir: str):
+    """
+    build Configure and build one preset from scratch
+    """
+
+    defaults = [os.path.join(SRC_DIR, "sdkconfig.defaults")]
+    if preset != "default":
+        defaults.append(os.path.join(PRESETS_DIR, f"{preset}.defaults"))
+    sdkconfig = os.path.join(build_dir, "sdkconfig")
+    # A stale sdkconfig would take precedence over the defaults
+    if os.path.exists(sdkconfig):
+        os.remove(sdkconfig)
+
+    subprocess.run(
+        [
+            "cmake", "-S", SRC_DIR, "-B", build_dir,
+            f"-DSDKCONFIG={sdkconfig}",
+            f"-DSDKCONFIG_DEFAULTS={';'.join(defaults)}",
+        ],
+        check=True,
+    )
+    subprocess.run(
+        ["cmake", "--build", build_dir, "-j", str(os.cpu_count() or 1)], check=True
+    )
+
+
+def sizes(build_dir: str) -> tuple:
+    """
+    sizes App image size, IRAM and static DRAM use of a build
+    """
+
+    tool = shutil.which("xtensa-lx106-elf-size") or "size"
+    out = subprocess.run(
+        [tool, "-A", os.path.join(build_dir, f"{PROJECT_NAME}.elf")],
+        capture_output=True, text=True, check=True,
+    ).stdout
+
+    iram = 0
+    dram = 0
+    for line in out.splitlines():
+        match = _SIZE.match(line)
+        if not match:
+            continue
+        size = int(match.group(2))
+        address = int(match.group(3))
+        if IRAM_START <= address < IRAM_END:
+            iram += size
+        elif DRAM_START <= address < DRAM_END:
+            dram += size
+
+    flash = os.path.getsize(os.path.join(build_dir, f"{PROJECT_NAME}.bin"))
+    return flash, iram, dram
+
+
+def _reset(port: serial.Serial):
+    """
+    _reset Pulse the reset line, leaving GPIO0 high for a normal boot
+    """
+
+    port.dtr = False
+    port.rts = True
+    time.sleep(0.1)
+    port.rts = False
+
+
+def _scrape(url: str) -> bool:
+    """
+    _scrape Whether a GET of url succeeds
+    """
+
+    try:
+        with urllib.request.urlopen(url, timeout=1) as response:
+            return response.status == 200
+    except (urllib.error.URLError, OSError):
+        return False
+
+
+def boot_time(build_dir: str, port: str, host: str, runs: int, timeout: float) -> list:
+    """
+    boot_time Flash a build, then time from reset to the first /metrics
+    response for each run. Runs that time out are left out.
+    """
+
+    env = dict(os.environ, ESPPORT=port)
+    subprocess.run(["cmake", "--build", build_dir, "--target", "flash"], env=env, check=True)
+
+    url = f"http://{host}/metrics"
+    times = []
+    # Opening the port must not reset the board on its own
+    device = serial.Serial()
+    device.port = port
+    device.dtr = False
+    device.rts = False
+    with device:
+        for run in range(runs):
+            _reset(device)
+            start = time.monotonic()
+            while time.monotonic() - start < timeout:
+                if _scrape(url):
+                    times.append(time.monotonic() - start)
+                    break
+                time.sleep(0.05)
+            else:
+                click.echo(f"Run {run + 1}: no response within {timeout} s", err=True)
+    return times
+
+
+@click.command()
+@click.option(
+    "--preset", "presets", multiple=True,
+    help="Preset to build, may be repeated. Defaults to all of them.",
+)
+@click.option(
+    "--build-dir", help="Directory to build the presets in.",
+    default=os.path.join(SRC_DIR, "..", "build-footprint"),
+)
+@click.option("--port", help="Serial port to flash and reset the device through.", envvar="ESPPORT")
+@click.option("--host", help="Address of the device once it has joined.", envvar="FOOTPRINT_HOST")
+@click.option("--runs", help="Number of resets to time per preset.", default=3)
+@click.option("--timeout", help="Seconds to wait for a scrape after each reset.", default=60.0)
+def cli(presets: tuple, build_dir: str, port: str, host: str, runs: int, timeout: float):
+    available = _presets()
+    for preset in presets:
+        if preset not in available:
+            raise click.BadParameter(f"{preset} is not one of {', '.join(available)}")
+    presets = presets or available
+    measure = port is not None and host is not None
+    partition = _app_partition()
+
+    results = []
+    for preset in presets:
+        preset_dir = os.path.join(build_dir, preset)
+        build(preset, preset_dir)
+        flash, iram, dram = sizes(preset_dir)
+        times = boot_time(preset_dir, port, host, runs, timeout) if measure else []
+        results.append((preset, flash, iram, dram, times))
+
+    click.echo(
+        f"\n{'Preset':<16} {'Flash':>8} {'App %':>6} {'IRAM':>8} {'DRAM':>8} {'Boot s':>8}"
+    )
+    for preset, flash, iram, dram, times in results:
+        boot = f"{statistics.median(times):.2f}" if times else "-"
+        click.echo(
+            f"{preset:<16} {flash:>8} {flash * 100 / partition:>5.1f}% "
+            f"{iram:>8} {dram:>8} {boot:>8}"
+        )
+    click.echo(
+        f"\nFlash is the app image against the {partition} byte app partition. "
+        f"DRAM is static use only."
+    )
+    if not measure:
+        click.echo("Set --port and --host to measure the time from reset to first scrape.")
+
+
+if __name__ == "__main__":
+    cli()
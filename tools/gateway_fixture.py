@@ -0,0 +1,277 @@
+# SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+# SPDX-License-Identifier: MIT
+"""
+Run scrape_gateway against fake devices on localhost
+
+Starts one fake device for each way a scrape can go wrong, plus one
+that answers properly, and points a scrape_gateway binary at them with
+discovery off. The combined /metrics is then checked for:
+
+- each failure being counted under its own result
+- the timeout being enforced
+- the good device's samples being relabelled
+- the output staying valid with most devices failing
+- cached samples being kept, then dropped, once the good device fails
+
+Build the gateway first, from the repository root:
+    g++ -std=c++11 -O2 -Itools -o scrape_gateway tools/scrape_gateway.cpp
+    python tools/gateway_fixture.py --gateway ./scrape_gateway
+
+Exits non-zero if any check fails.
+"""
+
+import re
+import socket
+import socketserver
+import subprocess
+import threading
+import time
+import urllib.request
+
+import click
+
+# Gateway options, short so the run takes seconds
+INTERVAL = 1
+TIMEOUT_MS = 500
+MAX_STALE = 3
+
+GOOD_BODY = (
+    "# HELP fixture_value A value from the fake device\n"
+    "# TYPE fixture_value gauge\n"
+    'fixture_value{sensor="a"} 1.5\n'
+    "fixture_plain 2\n"
+)
+
+_SAMPLE = re.compile(r'^([a-zA-Z_:][a-zA-Z0-9_:]*)(?:\{(.*)\})? (\S+)$')
+_LABEL = re.compile(r'(\w+)="((?:[^"\\]|\\.)*)"')
+
+
+class _Handler(socketserver.BaseRequestHandler):
+    """
+    _Handler Answers a scrape the way the server's mode says to
+    """
+
+    def handle(self):
+        request = b""
+        while b"\r\n\r\n" not in request:
+            data = self.request.recv(4096)
+            if not data:
+                return
+            request += data
+
+        mode = self.server.mode
+        if mode == "ok":
+            self._respond("200 OK", GOOD_BODY)
+        elif mode == "http":
+            self._respond("500 Internal Server Error", "")
+        elif mode == "invalid":
+            self._respond("200 OK", "this is { not exposition\n")
+        elif mode == "io":
+            # Close with no response at all
+            return
+        elif mode in ("timeout", "stall"):
+            if mode == "stall":
+                # Headers and part of the body, then nothing
+                self.request.sendall(
+                    b"HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\nfixture_value 1\n"
+                )
+            self.server.stop.wait()
+
+    def _respond(self, status: str, body: str):
+        """
+        _respond Send a complete response and close
+        """
+
+        data = body.encode()
+        self.request.sendall(
+            f"HTTP/1.1 {status}\r\nContent-Type: text/plain; version=0.0.4\r\n"
+            f"Content-Length: {len(data)}\r\nConnection: close\r\n\r\n".encode() + data
+        )
+
+
+class _Device(socketserver.ThreadingTCPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, mode: str, stop: threading.Event):
+        super().__init__(("127.0.0.1", 0), _Handler)
+        self.mode = mode
+        self.stop = stop
+        self.target = f"127.0.0.1:{self.server_address[1]}"
+
+
+def _free_port() -> int:
+    """
+    _free_port A port nothing is listening on
+    """
+
+    with socket.socket() as sock:
+        sock.bind(("127.0.0.1", 0))
+        return sock.getsockname()[1]
+
+
+def _scrape(port: int) -> dict:
+    """
+    _scrape Fetch the gateway's /metrics as {(name, labels): value}
+    """
+
+    with urllib.request.urlopen(f"http://127.0.0.1:{port}/metrics", timeout=5) as response:
+        text = response.read().decode()
+
+    samples = {}
+    for line in text.splitlines():
+        if line.startswith("#") or not line:
+            continue
+        match = _SAMPLE.match(line)
+        if not match:
+            raise click.ClickException(f"Gateway served a malformed line: {line!r}")
+        name, labels, value = match.groups()
+        key = tuple(sorted(_LABEL.findall(labels or "")))
+        samples[(name, key)] = float(value)
+    return samples
+
+
+def _value(samples: dict, name: str, **labels):
+    """
+    _value Value of the sample whose labels include the given ones
+    """
+
+    for (sample_name, key), value in samples.items():
+        if sample_name == name and set(labels.items()) <= set(key):
+            return value
+    return None
+
+
+class _Checks:
+    def __init__(self):
+        self.failures = 0
+        self.count = 0
+
+    def check(self, description: str, passed: bool):
+        """
+        check Record and print one check
+        """
+
+        self.count += 1
+        if not passed:
+            self.failures += 1
+        click.echo(f"{'ok  ' if passed else 'FAIL'} {description}")
+
+
+def _wait_for(port: int, ready, timeout: float) -> dict:
+    """
+    _wait_for Scrape the gateway until ready(samples) or the timeout
+    """
+
+    deadline = time.monotonic() + timeout
+    while True:
+        try:
+            samples = _scrape(port)
+            if ready(samples) or time.monotonic() > deadline:
+                return samples
+        except OSError:
+            if time.monotonic() > deadline:
+                raise
+        time.sleep(0.2)
+
+
+@click.command()
+@click.option("--gateway", help="Path to the scrape_gateway binary.", default="./scrape_gateway")
+def cli(gateway: str):
+    stop = threading.Event()
+    modes = ["ok", "http", "invalid", "io", "timeout", "stall"]
+    devices = {mode: _Device(mode, stop) for mode in modes}
+    for device in devices.values():
+        threading.Thread(target=device.serve_forever, daemon=True).start()
+    targets = {mode: device.target for mode, device in devices.items()}
+    targets["connect"] = f"127.0.0.1:{_free_port()}"
+
+    port = _free_port()
+    process = subprocess.Popen(
+        [
+            gateway, "-l", str(port), "-b", "0", "-i", str(INTERVAL),
+            "-t", str(TIMEOUT_MS), "-m", str(MAX_STALE),
+        ] + list(targets.values()),
+        stdout=subprocess.DEVNULL,
+    )
+    checks = _Checks()
+    try:
+        # First scrapes are spread over the interval, so wait until every
+        # device has finished one
+        samples = _wait_for(
+            port,
+            lambda s: all(
+                _value(s, "gateway_device_up", device=t) == 1
+                or (_value(s, "gateway_device_consecutive_failures", device=t) or 0) >= 1
+                for t in targets.values()
+            ),
+            timeout=10,
+        )
+
+        results = ["ok", "connect", "timeout", "io", "http", "invalid"]
+
+        for result in results:
+            checks.check(
+                f"{result} counted",
+                (_value(samples, "gateway_scrapes_total", result=result) or 0) >= 1,
+            )
+        # Both devices that never finish a response hit the deadline
+        checks.check(
+            "stalled response counted as a timeout",
+            (_value(samples, "gateway_scrapes_total", result="timeout") or 0) >= 2,
+        )
+        for mode, target in targets.items():
+            up = _value(samples, "gateway_device_up", device=target)
+            checks.check(f"{mode} device up is {int(mode == 'ok')}", up == (mode == "ok"))
+        for mode in ("timeout", "stall"):
+            duration = _value(samples, "gateway_device_scrape_duration_seconds", device=targets[mode])
+            checks.check(
+                f"{mode} device given up on at the deadline",
+                duration is not None and TIMEOUT_MS / 1000 <= duration < TIMEOUT_MS / 1000 + 0.5,
+            )
+        checks.check(
+            "good samples relabelled",
+            _value(samples, "fixture_value", device=targets["ok"], sensor="a") == 1.5
+            and _value(samples, "fixture_plain", device=targets["ok"]) == 2,
+        )
+        checks.check(
+            "failed devices contribute no samples",
+            _value(samples, "fixture_plain") == _value(samples, "fixture_plain", device=targets["ok"]),
+        )
+        checks.check("one fresh device", _value(samples, "gateway_devices", state="fresh") == 1)
+        checks.check(
+            "every device known",
+            _value(samples, "gateway_devices", state="known") == len(targets),
+        )
+
+        # The good device fails, its last samples are served from cache
+        devices["ok"].mode = "http"
+        samples = _wait_for(
+            port, lambda s: _value(s, "gateway_device_up", device=targets["ok"]) == 0, timeout=5
+        )
+        checks.check("failed device marked down", _value(samples, "gateway_device_up", device=targets["ok"]) == 0)
+        checks.check("cached samples still served", _value(samples, "fixture_value", device=targets["ok"]) == 1.5)
+        age = _value(samples, "gateway_device_cache_age_seconds", device=targets["ok"])
+        checks.check("cache age reported", age is not None and age > 0)
+
+        # Then dropped once older than the maximum staleness
+        samples = _wait_for(
+            port, lambda s: _value(s, "fixture_value") is None, timeout=MAX_STALE + 3
+        )
+        checks.check("stale samples dropped", _value(samples, "fixture_value") is None)
+        checks.check("no fresh devices", _value(samples, "gateway_devices", state="fresh") == 0)
+        checks.check("gateway still running", process.poll() is None)
+    finally:
+        stop.set()
+        process.terminate()
+        process.wait()
+        for device in devices.values():
+            device.shutdown()
+
+    click.echo(f"{checks.count} checks, {checks.failures} failures")
+    if checks.failures:
+        raise SystemExit(1)
+
+
+if __name__ == "__main__":
+    cli()
@@ -0,0 +1,21 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Enough of the SDK's esp_err.h to build firmware sources that only
+// return error codes on the host. Values match the SDK.
+
+#ifndef TOOLS_HOST_ESP_ERR_H_
+#define TOOLS_HOST_ESP_ERR_H_
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+
+#endif // TOOLS_HOST_ESP_ERR_H_
@@ -0,0 +1,5 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Empty sdkconfig for building firmware sources on the host, so every
+// option takes its off path. Pass -DCONFIG_... to turn one on.
@@ -0,0 +1,157 @@
+# SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+# SPDX-License-Identifier: MIT
+"""
+Report static RAM use from the linker map
+
+Lists the .data and .bss of every component and the largest objects in
+the firmware's own components, so the task stacks, mutexes and buffers
+reserved by CONFIG_STATIC_MEMORY can be checked against what is left
+for the heap. Run by the memory-report build target.
+"""
+
+from collections import defaultdict
+import os
+import re
+import shutil
+import subprocess
+
+import click
+
+# ESP8266 data RAM, everything here not used statically is heap
+DRAM_START = 0x3FFE8000
+DRAM_END = 0x40000000
+
+COMPONENTS_DIR = os.path.join(os.path.dirname(__file__), "..", "src", "components")
+
+_SECTION = re.compile(r"^ (\.\S+)(?:\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(.+))?$")
+_CONTINUATION = re.compile(r"^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(.+)$")
+_ARCHIVE = re.compile(r"(?:^|/)lib([^/]+)\.a\(([^)]+)\)$")
+
+
+def _component(source: str) -> str:
+    """
+    _component Name of the component an object file came from
+    """
+
+    match = _ARCHIVE.search(source)
+    if match:
+        return match.group(1)
+    return os.path.basename(source)
+
+
+def _symbol(section: str) -> str:
+    """
+    _symbol Symbol name from a per symbol section, e.g. .bss.lock_
+    """
+
+    for prefix in (".bss.", ".data.", ".dram0.bss.", ".dram0.data.", ".rodata."):
+        if section.startswith(prefix):
+            return section[len(prefix):]
+    return section
+
+
+def _demangle(names: list) -> dict:
+    """
+    _demangle Demangle C++ names with c++filt if it can be found
+    """
+
+    for tool in ("xtensa-lx106-elf-c++filt", "c++filt"):
+        path = shutil.which(tool)
+        if path:
+            out = subprocess.run(
+                [path], input="\n".join(names), capture_output=True, text=True
+            ).stdout.splitlines()
+            if len(out) == len(names):
+                return dict(zip(names, out))
+    return {name: name for name in names}
+
+
+def parse_map(path: str):
+    """
+    parse_map Yield (section, address, size, source) for every input
+    section placed in data RAM
+    """
+
+    in_map = False
+    pending = None
+    with open(path) as f:
+        for line in f:
+            line = line.rstrip("\n")
+            if line.startswith("Linker script and memory map"):
+                in_map = True
+                continue
+            if not in_map:
+                continue
+
+            if pending is not None:
+                match = _CONTINUATION.match(line)
+                section = pending
+                pending = None
+                if match:
+                    address, size, source = match.groups()
+                else:
+                    continue
+            else:
+                match = _SECTION.match(line)
+                if not match:
+                    continue
+                section, address, size, source = match.groups()
+                if address is None:
+                    # Long names put the rest on the next line
+                    pending = section
+                    continue
+
+            address = int(address, 16)
+            size = int(size, 16)
+            if size and DRAM_START <= address < DRAM_END:
+                yield section, address, size, source.strip()
+
+
+@click.command()
+@click.argument("map_file", type=click.Path(exists=True))
+@click.option("--top", help="Number of largest objects to list.", default=20)
+def cli(map_file: str, top: int):
+    ours = set()
+    if os.path.isdir(COMPONENTS_DIR):
+        ours = set(os.listdir(COMPONENTS_DIR)) | {"main"}
+
+    data = defaultdict(int)
+    bss = defaultdict(int)
+    objects = []
+    for section, _, size, source in parse_map(map_file):
+        component = _component(source)
+        if "bss" in section:
+            bss[component] += size
+        else:
+            data[component] += size
+        if component in ours:
+            objects.append((size, component, _symbol(section)))
+
+    components = sorted(set(data) | set(bss), key=lambda c: -(data[c] + bss[c]))
+    click.echo(f"{'Component':<24} {'.data':>8} {'.bss':>8} {'Total':>8}")
+    for component in components:
+        marker = "*" if component in ours else " "
+        click.echo(
+            f"{component:<23}{marker} {data[component]:>8} {bss[component]:>8} "
+            f"{data[component] + bss[component]:>8}"
+        )
+    total = sum(data.values()) + sum(bss.values())
+    ours_total = sum(data[c] + bss[c] for c in ours)
+    click.echo(f"{'Total':<24} {sum(data.values()):>8} {sum(bss.values()):>8} {total:>8}")
+    click.echo(f"\n* Firmware components, {ours_total} bytes")
+
+    objects.sort(reverse=True)
+    names = _demangle([name for _, _, name in objects[:top]])
+    click.echo(f"\nLargest firmware objects\n{'Bytes':>8}  {'Component':<14} Symbol")
+    for size, component, name in objects[:top]:
+        click.echo(f"{size:>8}  {component:<14} {names[name]}")
+
+    size = DRAM_END - DRAM_START
+    click.echo(
+        f"\n{total} of {size} bytes of data RAM used statically, "
+        f"at most {size - total} left for the heap"
+    )
+
+
+if __name__ == "__main__":
+    cli()
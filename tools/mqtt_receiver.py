@@ -0,0 +1,142 @@
+# SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+# SPDX-License-Identifier: MIT
+"""
+Stand-in MQTT broker for testing the publisher
+
+Accepts MQTT 3.1.1 connections and prints every message published to
+it along with the time since the previous message on the same topic.
+Nothing is forwarded to other clients.
+"""
+
+import socketserver
+import struct
+import time
+
+import click
+
+
+def _read_exact(sock, size: int) -> bytes:
+    """
+    _read_exact Read exactly size bytes, raising ConnectionError on EOF
+    """
+
+    data = b""
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError("Client disconnected")
+        data += chunk
+    return data
+
+
+def _read_packet(sock):
+    """
+    _read_packet Read a packet, returning the fixed header byte and the
+    rest of the packet
+    """
+
+    header = _read_exact(sock, 1)[0]
+    length = 0
+    shift = 0
+    while True:
+        byte = _read_exact(sock, 1)[0]
+        length |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            break
+        shift += 7
+    return header, _read_exact(sock, length)
+
+
+def _string(data: bytes, pos: int):
+    """
+    _string Read a length prefixed string, returning it and the new
+    position
+    """
+
+    size = struct.unpack(">H", data[pos:pos + 2])[0]
+    return data[pos + 2:pos + 2 + size].decode(), pos + 2 + size
+
+
+class Handler(socketserver.BaseRequestHandler):
+    last_seen = {}
+
+    def handle(self):
+        client = self.client_address[0]
+        try:
+            while True:
+                header, body = _read_packet(self.request)
+                kind = header >> 4
+                if kind == 1:
+                    self._connect(client, body)
+                elif kind == 3:
+                    self._publish(client, header, body)
+                elif kind == 8:
+                    # SUBSCRIBE, grant QoS 0 for every topic
+                    packet_id = body[:2]
+                    count = 0
+                    pos = 2
+                    while pos < len(body):
+                        _, pos = _string(body, pos)
+                        pos += 1
+                        count += 1
+                    self.request.sendall(
+                        bytes([0x90, 2 + count]) + packet_id + bytes(count)
+                    )
+                elif kind == 12:
+                    self.request.sendall(b"\xd0\x00")
+                elif kind == 14:
+                    click.echo(f"{client} disconnected")
+                    return
+        except ConnectionError:
+            click.echo(f"{client} connection lost")
+
+    def _connect(self, client: str, body: bytes):
+        _, pos = _string(body, 0)
+        flags = body[pos + 1]
+        client_id, pos = _string(body, pos + 4)
+        will = ""
+        if flags & 0x04:
+            will_topic, pos = _string(body, pos)
+            will_msg, pos = _string(body, pos)
+            will = f" will {will_topic}={will_msg}"
+        click.echo(f"{client} connected as {client_id}{will}")
+        self.request.sendall(b"\x20\x02\x00\x00")
+
+    def _publish(self, client: str, header: int, body: bytes):
+        qos = (header >> 1) & 0x03
+        retain = " retained" if header & 0x01 else ""
+        topic, pos = _string(body, 0)
+        if qos > 0:
+            packet_id = body[pos:pos + 2]
+            pos += 2
+            self.request.sendall(b"\x40\x02" + packet_id)
+
+        now = time.monotonic()
+        key = (client, topic)
+        since = ""
+        if key in self.last_seen:
+            since = f" (+{now - self.last_seen[key]:.0f}s)"
+        self.last_seen[key] = now
+
+        payload = body[pos:].decode(errors="replace")
+        click.echo(
+            f"{client} {topic} qos {qos}{retain} "
+            f"{len(body[pos:])} bytes{since}: {payload}"
+        )
+
+
+class Server(socketserver.ThreadingTCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+@click.command()
+@click.option("--port", help="Port to listen on.", default=1883)
+def cli(port: int):
+    server = Server(("", port), Handler)
+    click.echo(f"Listening on port {port}")
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    cli()
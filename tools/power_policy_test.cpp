@@ -0,0 +1,177 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host test of the light sleep policy. Walks PowerPolicy through each
+// decision it can make and a simulated duty cycle, checking the
+// durations and the sleep accounting.
+//
+// Build and run from the repository root:
+//   g++ -std=c++11 -O2 -Wall -Wextra -o power_policy_test
+//       -Isrc/components/power/include/power
+//       tools/power_policy_test.cpp src/components/power/policy.cpp
+//   ./power_policy_test
+//
+// Exits non-zero if any check fails.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "policy.hpp"
+
+#define MS 1000LL
+#define S (1000 * MS)
+
+static int failures_ = 0;
+static int checks_ = 0;
+
+#define CHECK_EQ(name, actual, expected) \
+    check_eq(__LINE__, name, (int64_t)(actual), (int64_t)(expected))
+
+static void check_eq(int line, const char* name, int64_t actual, int64_t expected) {
+    checks_++;
+    if (actual != expected) {
+        printf("line %d: %s: got %lld, expected %lld\n", line, name, (long long)actual, (long long)expected);
+        failures_++;
+    }
+}
+
+static const power_policy_config_t CONFIG_ = {
+    true, // light_sleep
+    50 * MS, // min_sleep
+    3 * S, // max_sleep
+    20 * MS, // wake_margin
+};
+
+/**
+ * @brief Run one decision on a fresh policy
+ */
+static power_decision_t decide(
+    const power_policy_config_t* config,
+    int64_t now,
+    int64_t next_wake,
+    bool busy,
+    int64_t* duration
+) {
+    PowerPolicy policy(config, 0);
+    power_policy_input_t input = { now, next_wake, busy };
+    return policy.Decide(&input, duration);
+}
+
+static void test_decisions() {
+    int64_t duration;
+
+    // Busy always stays awake, waking when the next source is due
+    CHECK_EQ("busy decision", decide(&CONFIG_, 10 * S, 12 * S, true, &duration), POWER_STAY_AWAKE);
+    CHECK_EQ("busy duration", duration, 2 * S);
+    CHECK_EQ("busy idle decision", decide(&CONFIG_, 10 * S, POWER_WAKE_NONE, true, &duration), POWER_STAY_AWAKE);
+    CHECK_EQ("busy idle duration", duration, POWER_WAKE_NONE);
+
+    // Light sleep disabled behaves as busy
+    power_policy_config_t disabled = CONFIG_;
+    disabled.light_sleep = false;
+    CHECK_EQ("disabled decision", decide(&disabled, 0, 1 * S, false, &duration), POWER_STAY_AWAKE);
+    CHECK_EQ("disabled duration", duration, 1 * S);
+
+    // Nothing scheduled sleeps for the longest allowed window
+    CHECK_EQ("idle decision", decide(&CONFIG_, 0, POWER_WAKE_NONE, false, &duration), POWER_LIGHT_SLEEP);
+    CHECK_EQ("idle duration", duration, 3 * S);
+
+    // A far off wake is capped by max_sleep
+    CHECK_EQ("far decision", decide(&CONFIG_, 0, 60 * S, false, &duration), POWER_LIGHT_SLEEP);
+    CHECK_EQ("far duration", duration, 3 * S);
+
+    // A near wake sleeps until the margin before it
+    CHECK_EQ("near decision", decide(&CONFIG_, 1 * S, 2 * S, false, &duration), POWER_LIGHT_SLEEP);
+    CHECK_EQ("near duration", duration, 1 * S - 20 * MS);
+
+    // Exactly min_sleep after the margin is still worth sleeping
+    CHECK_EQ("min decision", decide(&CONFIG_, 0, 70 * MS, false, &duration), POWER_LIGHT_SLEEP);
+    CHECK_EQ("min duration", duration, 50 * MS);
+
+    // Any shorter and it stays awake until the wake is due
+    CHECK_EQ("short decision", decide(&CONFIG_, 0, 69 * MS, false, &duration), POWER_STAY_AWAKE);
+    CHECK_EQ("short duration", duration, 69 * MS);
+
+    // Overdue sources are due now rather than in the past
+    CHECK_EQ("overdue decision", decide(&CONFIG_, 5 * S, 4 * S, false, &duration), POWER_STAY_AWAKE);
+    CHECK_EQ("overdue duration", duration, 0);
+}
+
+static void test_accounting() {
+    PowerPolicy policy(&CONFIG_, 1 * S);
+
+    // No time has passed, so the device counts as awake
+    CHECK_EQ("start permille", policy.GetAwakePermille(1 * S), 1000);
+    CHECK_EQ("before start permille", policy.GetAwakePermille(0), 1000);
+    CHECK_EQ("start wakes", policy.GetWakes(), 0);
+
+    policy.RecordSleep(3 * S);
+    policy.RecordSleep(1 * S);
+    CHECK_EQ("slept", policy.GetSlept(), 4 * S);
+    CHECK_EQ("wakes", policy.GetWakes(), 2);
+    // 4 s asleep out of 5 s
+    CHECK_EQ("permille", policy.GetAwakePermille(6 * S), 200);
+
+    // Sleeps reported longer than the elapsed time never go negative
+    policy.RecordSleep(10 * S);
+    CHECK_EQ("clamped permille", policy.GetAwakePermille(6 * S), 0);
+}
+
+/**
+ * @brief Simulate a sampler due every 10 s that is busy for 100 ms
+ * each time, and check the duty cycle the policy reaches
+ */
+static void test_duty_cycle() {
+    PowerPolicy policy(&CONFIG_, 0);
+    const int64_t period = 10 * S;
+    const int64_t busy_for = 100 * MS;
+    int64_t now = 0;
+    int64_t next_sample = 0;
+    int64_t busy_until = -1;
+    int sleeps = 0;
+    int samples = 0;
+
+    while (now < 60 * S) {
+        if (now >= next_sample) {
+            busy_until = now + busy_for;
+            next_sample += period;
+            samples++;
+        }
+
+        power_policy_input_t input = { now, next_sample, now < busy_until };
+        int64_t duration;
+        power_decision_t decision = policy.Decide(&input, &duration);
+        if (decision == POWER_LIGHT_SLEEP) {
+            if (now + duration > next_sample - CONFIG_.wake_margin) {
+                printf("Slept through a sample at %lld\n", (long long)next_sample);
+                failures_++;
+            }
+            policy.RecordSleep(duration);
+            now += duration;
+            sleeps++;
+        }
+        else if (input.busy) {
+            now = busy_until;
+        }
+        else {
+            now += duration;
+        }
+    }
+
+    CHECK_EQ("samples", samples, 6);
+    // 9.9 s idle per period is three 3 s sleeps then 0.88 s up to the
+    // margin
+    CHECK_EQ("sleeps", sleeps, 24);
+    CHECK_EQ("wakes", policy.GetWakes(), 24);
+    // Awake for the busy time and wake margin of every period
+    CHECK_EQ("duty cycle permille", policy.GetAwakePermille(now), 12);
+}
+
+int main() {
+    test_decisions();
+    test_accounting();
+    test_duty_cycle();
+
+    printf("%d checks, %d failures\n%s\n", checks_, failures_, failures_ ? "FAIL" : "PASS");
+    return failures_ ? 1 : 0;
+}
@@ -0,0 +1,178 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host benchmark and accuracy report for the fixed point psychrometric
+// functions, compared against a double precision reference using libm.
+//
+// Build and run from the repository root:
+//   g++ -O2 -Wall -Wextra -o psychrometrics_bench
+//       -Isrc/components/psychrometrics/include/psychrometrics
+//       tools/psychrometrics_bench.cpp
+//       src/components/psychrometrics/psychrometrics.cpp -lm
+//   ./psychrometrics_bench
+//
+// Timings are for the host, not the ESP8266. They show the relative
+// cost of the table lookups against libm but the gap on the device,
+// which has no FPU, is far larger.
+
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "psychrometrics.hpp"
+
+static double reference_saturation_pressure(double t) {
+    return 611.2 * exp(17.62 * t / (243.12 + t));
+}
+
+static double reference_dew_point(double t, double rh) {
+    double gamma = log(rh / 100) + 17.62 * t / (243.12 + t);
+    return 243.12 * gamma / (17.62 - gamma);
+}
+
+static double reference_absolute_humidity(double t, double rh) {
+    double pressure = reference_saturation_pressure(t) * rh / 100;
+    return pressure / (461.5 * (t + 273.15)) * 1000;
+}
+
+static double reference_heat_index(double t, double rh) {
+    double f = t * 9 / 5 + 32;
+    double index = 0.5 * (f + 61 + (f - 68) * 1.2 + rh * 0.094);
+    if ((index + f) / 2 >= 80) {
+        index = -42.379 + 2.04901523 * f + 10.14333127 * rh
+            - 0.22475541 * f * rh - 0.00683783 * f * f
+            - 0.05481717 * rh * rh + 0.00122874 * f * f * rh
+            + 0.00085282 * f * rh * rh - 0.00000199 * f * f * rh * rh;
+        if (rh < 13 && f >= 80 && f <= 112) {
+            index -= ((13 - rh) / 4) * sqrt((17 - fabs(f - 95)) / 17);
+        }
+        else if (rh > 85 && f >= 80 && f <= 87) {
+            index += ((rh - 85) / 10) * ((87 - f) / 5);
+        }
+    }
+    return (index - 32) * 5 / 9;
+}
+
+struct error_t {
+    const char* name;
+    const char* unit;
+    double max;
+    double sum;
+    long count;
+    double worst_t;
+    double worst_rh;
+};
+
+static void record(error_t* error, double fixed, double reference, double t, double rh) {
+    double diff = fabs(fixed - reference);
+    if (diff > error->max) {
+        error->max = diff;
+        error->worst_t = t;
+        error->worst_rh = rh;
+    }
+    error->sum += diff;
+    error->count++;
+}
+
+static void check_table() {
+    int mismatches = 0;
+    for (int t = PSYCHROMETRICS_MIN_TEMPERATURE; t <= PSYCHROMETRICS_MAX_TEMPERATURE; t += 100) {
+        uint32_t expected = lround(reference_saturation_pressure(t / 100.0) * 100);
+        if (psychrometrics_saturation_pressure(t) != expected) {
+            printf("Table entry for %d C is %u, expected %u\n", t / 100, psychrometrics_saturation_pressure(t), expected);
+            mismatches++;
+        }
+    }
+    printf("Saturation table: %d mismatches\n\n", mismatches);
+}
+
+static void check_accuracy() {
+    error_t errors[] = {
+        { "dew point", "C", 0, 0, 0, 0, 0 },
+        { "absolute humidity", "g/m3", 0, 0, 0, 0, 0 },
+        { "heat index", "C", 0, 0, 0, 0, 0 },
+    };
+
+    // Every combination the sensor can report at 0.05 C and 0.05 %
+    for (int t = PSYCHROMETRICS_MIN_TEMPERATURE; t <= PSYCHROMETRICS_MAX_TEMPERATURE; t += 5) {
+        for (int rh = 5; rh <= 10000; rh += 5) {
+            double td = t / 100.0;
+            double drh = rh / 100.0;
+
+            double dew = reference_dew_point(td, drh);
+            if (dew > PSYCHROMETRICS_MIN_TEMPERATURE / 100.0) {
+                record(&errors[0], psychrometrics_dew_point(t, rh) / 100.0, dew, td, drh);
+            }
+            record(&errors[1], psychrometrics_absolute_humidity(t, rh) / 100.0, reference_absolute_humidity(td, drh), td, drh);
+            record(&errors[2], psychrometrics_heat_index(t, rh) / 100.0, reference_heat_index(td, drh), td, drh);
+        }
+    }
+
+    printf("%-18s %10s %10s   %s\n", "Metric", "Max error", "Mean error", "Worst case");
+    for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+        error_t* e = &errors[i];
+        printf(
+            "%-18s %10.4f %10.4f   %.2f C %.2f %% (%s, %ld points)\n",
+            e->name,
+            e->max,
+            e->sum / e->count,
+            e->worst_t,
+            e->worst_rh,
+            e->unit,
+            e->count
+        );
+    }
+    printf("\n");
+}
+
+template <typename F>
+static double time_per_call(F function) {
+    const int rounds = 20;
+    auto start = std::chrono::steady_clock::now();
+    long calls = 0;
+    for (int round = 0; round < rounds; round++) {
+        for (int t = PSYCHROMETRICS_MIN_TEMPERATURE; t <= PSYCHROMETRICS_MAX_TEMPERATURE; t += 50) {
+            for (int rh = 50; rh <= 10000; rh += 50) {
+                function(t, rh);
+                calls++;
+            }
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / calls;
+}
+
+static void benchmark() {
+    volatile int32_t fixed_sink;
+    volatile double double_sink;
+
+    printf("%-18s %12s %12s\n", "Metric", "Fixed ns", "Double ns");
+    printf(
+        "%-18s %12.1f %12.1f\n",
+        "dew point",
+        time_per_call([&](int t, int rh) { fixed_sink = psychrometrics_dew_point(t, rh); }),
+        time_per_call([&](int t, int rh) { double_sink = reference_dew_point(t / 100.0, rh / 100.0); })
+    );
+    printf(
+        "%-18s %12.1f %12.1f\n",
+        "absolute humidity",
+        time_per_call([&](int t, int rh) { fixed_sink = psychrometrics_absolute_humidity(t, rh); }),
+        time_per_call([&](int t, int rh) { double_sink = reference_absolute_humidity(t / 100.0, rh / 100.0); })
+    );
+    printf(
+        "%-18s %12.1f %12.1f\n",
+        "heat index",
+        time_per_call([&](int t, int rh) { fixed_sink = psychrometrics_heat_index(t, rh); }),
+        time_per_call([&](int t, int rh) { double_sink = reference_heat_index(t / 100.0, rh / 100.0); })
+    );
+    (void)fixed_sink;
+    (void)double_sink;
+}
+
+int main() {
+    check_table();
+    check_accuracy();
+    benchmark();
+    return 0;
+}
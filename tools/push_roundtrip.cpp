@@ -0,0 +1,288 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Runs the push encoders over a set of cases and prints what they
+// produce, for push_roundtrip.py to decode with the receiver in
+// remote_write_receiver.py.
+//
+// Build from the repository root:
+//   g++ -std=c++11 -O2 -Wall -Wextra -o push_roundtrip
+//       -Itools/host -Isrc/components/push/include/push
+//       tools/push_roundtrip.cpp src/components/push/snappy.cpp
+//       src/components/push/remote_write.cpp
+//   python tools/push_roundtrip.py --encoder ./push_roundtrip
+//
+// Add -DCONFIG_STATIC_MEMORY to check the compressor's static table.
+//
+// Each case is one line of JSON. Bytes and label text are hex so no
+// escaping is needed. Snappy cases hold the input, the compressed
+// output, the bound from snappy_max_compressed_length and the status
+// of compressing into a buffer one byte short of the output. Remote
+// write cases hold the samples and labels, the encoded message, the
+// bound from push_remote_write_max_length, the message compressed as
+// push.cpp sends it and the status of encoding one byte short.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "esp_err.h"
+#include "remote_write.hpp"
+#include "snappy.hpp"
+
+static uint32_t random_state_ = 2463534242u;
+
+static uint32_t random_next() {
+    random_state_ ^= random_state_ << 13;
+    random_state_ ^= random_state_ >> 17;
+    random_state_ ^= random_state_ << 5;
+    return random_state_;
+}
+
+static std::string hex(const uint8_t* data, size_t len) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    for (size_t i = 0; i < len; i++) {
+        out += digits[data[i] >> 4];
+        out += digits[data[i] & 0x0f];
+    }
+    return out;
+}
+
+static std::string hex(const char* text) {
+    return hex((const uint8_t*)text, strlen(text));
+}
+
+static const char* status_name(esp_err_t err) {
+    switch (err) {
+    case ESP_OK:
+        return "ok";
+    case ESP_ERR_INVALID_SIZE:
+        return "invalid_size";
+    case ESP_ERR_NO_MEM:
+        return "no_mem";
+    default:
+        return "other";
+    }
+}
+
+/**
+ * @brief Compress data, returning the status and filling out
+ */
+static esp_err_t compress(const std::vector<uint8_t>& in, std::vector<uint8_t>* out) {
+    out->assign(snappy_max_compressed_length(in.size()), 0);
+    size_t written = 0;
+    esp_err_t err = snappy_compress(in.data(), in.size(), out->data(), out->size(), &written);
+    out->resize(err == ESP_OK ? written : 0);
+    return err;
+}
+
+static void snappy_case(const char* name, const std::vector<uint8_t>& in) {
+    std::vector<uint8_t> out;
+    esp_err_t err = compress(in, &out);
+
+    // One byte short of what it needs must fail rather than truncate
+    const char* short_status = "none";
+    if (err == ESP_OK) {
+        std::vector<uint8_t> small(out.size() - 1);
+        size_t written = 0;
+        short_status = status_name(snappy_compress(in.data(), in.size(), small.data(), small.size(), &written));
+    }
+
+    printf(
+        "{\"kind\":\"snappy\",\"case\":\"%s\",\"status\":\"%s\",\"input\":\"%s\","
+        "\"compressed\":\"%s\",\"max\":%zu,\"short_status\":\"%s\"}\n",
+        name,
+        status_name(err),
+        hex(in.data(), in.size()).c_str(),
+        hex(out.data(), out.size()).c_str(),
+        snappy_max_compressed_length(in.size()),
+        short_status
+    );
+}
+
+static std::vector<uint8_t> random_bytes(size_t len) {
+    std::vector<uint8_t> data(len);
+    for (size_t i = 0; i < len; i++) {
+        data[i] = random_next();
+    }
+    return data;
+}
+
+/**
+ * @brief Data built from literals and back references of every length
+ *
+ * @param len Length to build
+ * @param max_offset Furthest back a reference reaches
+ */
+static std::vector<uint8_t> lz_bytes(size_t len, size_t max_offset) {
+    std::vector<uint8_t> data;
+    while (data.size() < len) {
+        if (data.size() < 8 || random_next() % 3 == 0) {
+            size_t run = 1 + random_next() % 70;
+            for (size_t i = 0; i < run; i++) {
+                data.push_back(random_next());
+            }
+            continue;
+        }
+        size_t offset = 1 + random_next() % std::min(max_offset, data.size());
+        size_t run = 1 + random_next() % 140;
+        size_t start = data.size() - offset;
+        for (size_t i = 0; i < run; i++) {
+            data.push_back(data[start + i]);
+        }
+    }
+    data.resize(len);
+    return data;
+}
+
+static void snappy_cases() {
+    snappy_case("empty", std::vector<uint8_t>());
+    // Shorter than a match, then around the literal length forms
+    const size_t lengths[] = { 1, 3, 4, 5, 59, 60, 61, 62, 255, 256, 257, 258, 4096 };
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "random %zu", lengths[i]);
+        snappy_case(name, random_bytes(lengths[i]));
+    }
+
+    // Long runs are split into copies, check around the 64 byte split
+    for (size_t len = 60; len <= 140; len++) {
+        char name[32];
+        snprintf(name, sizeof(name), "run %zu", len);
+        std::vector<uint8_t> data(len, 'a');
+        snappy_case(name, data);
+    }
+    snappy_case("zeros max", std::vector<uint8_t>(SNAPPY_MAX_INPUT, 0));
+    snappy_case("random max", random_bytes(SNAPPY_MAX_INPUT));
+    snappy_case("too long", std::vector<uint8_t>(SNAPPY_MAX_INPUT + 1, 0));
+
+    // Near references use the one byte offset form, far ones two
+    for (int i = 0; i < 20; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "near %d", i);
+        snappy_case(name, lz_bytes(1000 + random_next() % 3000, 2047));
+        snprintf(name, sizeof(name), "far %d", i);
+        snappy_case(name, lz_bytes(10000 + random_next() % 50000, 65535));
+    }
+}
+
+struct remote_write_case_t {
+    const char* name;
+    int64_t epoch_ms;
+    std::vector<push_sample_t> samples;
+    std::vector<push_label_t> labels;
+};
+
+static void remote_write_case(const remote_write_case_t& c) {
+    const push_label_t* labels = c.labels.empty() ? NULL : c.labels.data();
+    size_t max = push_remote_write_max_length(c.samples.size(), labels, c.labels.size());
+    std::vector<uint8_t> raw(max);
+    size_t written = 0;
+    esp_err_t err = push_remote_write_encode(
+        c.samples.data(), c.samples.size(), c.epoch_ms, labels, c.labels.size(), raw.data(), raw.size(), &written
+    );
+    raw.resize(err == ESP_OK ? written : 0);
+
+    const char* short_status = "none";
+    std::vector<uint8_t> compressed;
+    if (err == ESP_OK) {
+        std::vector<uint8_t> small(written - 1);
+        size_t small_written = 0;
+        short_status = status_name(push_remote_write_encode(
+            c.samples.data(), c.samples.size(), c.epoch_ms, labels, c.labels.size(), small.data(), small.size(), &small_written
+        ));
+        compress(raw, &compressed);
+    }
+
+    printf(
+        "{\"kind\":\"remote_write\",\"case\":\"%s\",\"status\":\"%s\",\"epoch_ms\":%lld,\"samples\":[",
+        c.name,
+        status_name(err),
+        (long long)c.epoch_ms
+    );
+    for (size_t i = 0; i < c.samples.size(); i++) {
+        printf(
+            "%s[%u,%d,%d]",
+            i ? "," : "",
+            c.samples[i].uptime,
+            c.samples[i].temperature,
+            c.samples[i].humidity
+        );
+    }
+    printf("],\"labels\":[");
+    for (size_t i = 0; i < c.labels.size(); i++) {
+        printf("%s[\"%s\",\"%s\"]", i ? "," : "", hex(c.labels[i].name).c_str(), hex(c.labels[i].value).c_str());
+    }
+    printf(
+        "],\"raw\":\"%s\",\"max\":%zu,\"compressed\":\"%s\",\"short_status\":\"%s\"}\n",
+        hex(raw.data(), raw.size()).c_str(),
+        max,
+        hex(compressed.data(), compressed.size()).c_str(),
+        short_status
+    );
+}
+
+static void remote_write_cases() {
+    const int64_t epoch_ms = 1700000000000LL;
+    std::vector<push_label_t> labels;
+    labels.push_back({ "instance", "tempsensor-a1b2c3" });
+    labels.push_back({ "location", "Server room" });
+    labels.push_back({ "rack", "B07" });
+
+    remote_write_case_t c;
+    c.name = "no samples";
+    c.epoch_ms = epoch_ms;
+    c.labels = labels;
+    remote_write_case(c);
+
+    c.name = "one sample no labels";
+    c.labels.clear();
+    c.samples.push_back({ 60, 2150, 4525 });
+    remote_write_case(c);
+
+    c.name = "extremes";
+    c.labels = labels;
+    c.samples.clear();
+    c.samples.push_back({ 0, -4000, 0 });
+    c.samples.push_back({ 1, 8500, 10000 });
+    c.samples.push_back({ 2, -32768, 32767 });
+    c.samples.push_back({ 0xffffffffu, -1, 1 });
+    remote_write_case(c);
+
+    c.name = "epoch zero";
+    c.epoch_ms = 0;
+    remote_write_case(c);
+
+    // A full batch of a slowly changing room, as push.cpp sends it
+    c.name = "batch";
+    c.epoch_ms = epoch_ms;
+    c.samples.clear();
+    int16_t temperature = 2100;
+    int16_t humidity = 4500;
+    for (uint32_t i = 0; i < 120; i++) {
+        temperature += (int16_t)(random_next() % 5) - 2;
+        humidity += (int16_t)(random_next() % 9) - 4;
+        c.samples.push_back({ 3600 + i * 15, temperature, humidity });
+    }
+    remote_write_case(c);
+
+    // Long label values push the length prefixes past one byte
+    static char long_value[300];
+    memset(long_value, 'x', sizeof(long_value) - 1);
+    long_value[sizeof(long_value) - 1] = '\0';
+    c.name = "long label";
+    c.labels.clear();
+    c.labels.push_back({ "room", long_value });
+    remote_write_case(c);
+}
+
+int main() {
+    snappy_cases();
+    remote_write_cases();
+    return 0;
+}
@@ -0,0 +1,139 @@
+# SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+# SPDX-License-Identifier: MIT
+"""
+Check the push encoders round trip through the test receiver
+
+Runs a push_roundtrip binary, built from the firmware's Snappy and
+remote_write encoders, and decodes everything it prints with the
+decoder in remote_write_receiver.py. Checked are:
+
+- compressed data decompressing to the input
+- compressed and encoded lengths staying within the firmware's bounds
+- output that does not fit failing rather than being truncated
+- input over SNAPPY_MAX_INPUT being refused
+- encoded requests decoding to the samples and labels given, with
+  the timestamps and values the firmware means to send
+
+Build the encoder first, from the repository root:
+    g++ -std=c++11 -O2 -Wall -Wextra -o push_roundtrip
+        -Itools/host -Isrc/components/push/include/push
+        tools/push_roundtrip.cpp src/components/push/snappy.cpp
+        src/components/push/remote_write.cpp
+    python tools/push_roundtrip.py --encoder ./push_roundtrip
+
+Exits non-zero if any check fails.
+"""
+
+import json
+import subprocess
+
+import click
+
+from remote_write_receiver import decode_write_request, snappy_decompress
+
+SERIES_NAMES = ("environment_temperature_celsius", "environment_humidity_percent")
+
+
+class _Checks:
+    def __init__(self):
+        self.failures = 0
+        self.count = 0
+
+    def check(self, description: str, passed: bool):
+        """
+        check Record one check, printing it only if it fails
+        """
+
+        self.count += 1
+        if not passed:
+            self.failures += 1
+            click.echo(f"FAIL {description}")
+
+
+def _decompress(data: bytes):
+    """
+    _decompress Decompress, returning None if the receiver rejects it
+    """
+
+    try:
+        return snappy_decompress(data)
+    except (ValueError, IndexError):
+        return None
+
+
+def _check_snappy(checks: _Checks, case: dict):
+    name = case["case"]
+    data = bytes.fromhex(case["input"])
+    if len(data) > 65535:
+        checks.check(f"{name}: refused", case["status"] == "invalid_size")
+        return
+
+    checks.check(f"{name}: compressed", case["status"] == "ok")
+    compressed = bytes.fromhex(case["compressed"])
+    checks.check(f"{name}: round trips", _decompress(compressed) == data)
+    checks.check(
+        f"{name}: {len(compressed)} bytes within bound of {case['max']}",
+        len(compressed) <= case["max"],
+    )
+    checks.check(f"{name}: short buffer refused", case["short_status"] == "invalid_size")
+
+
+def _expected_series(case: dict) -> list:
+    """
+    _expected_series What the receiver should decode from a case
+    """
+
+    labels = {
+        bytes.fromhex(name).decode(): bytes.fromhex(value).decode()
+        for name, value in case["labels"]
+    }
+    series = []
+    for index, name in enumerate(SERIES_NAMES):
+        samples = [
+            (case["epoch_ms"] + uptime * 1000, values[index] / 100)
+            for uptime, *values in case["samples"]
+        ]
+        series.append(({"__name__": name, **labels}, samples))
+    return series
+
+
+def _check_remote_write(checks: _Checks, case: dict):
+    name = case["case"]
+    checks.check(f"{name}: encoded", case["status"] == "ok")
+    raw = bytes.fromhex(case["raw"])
+    checks.check(
+        f"{name}: {len(raw)} bytes within bound of {case['max']}",
+        len(raw) <= case["max"],
+    )
+    checks.check(f"{name}: short buffer refused", case["short_status"] == "invalid_size")
+
+    decompressed = _decompress(bytes.fromhex(case["compressed"]))
+    checks.check(f"{name}: compressed request round trips", decompressed == raw)
+    try:
+        series = decode_write_request(raw)
+    except (ValueError, IndexError, KeyError, UnicodeDecodeError):
+        series = None
+    checks.check(f"{name}: decodes to the samples sent", series == _expected_series(case))
+
+
+@click.command()
+@click.option("--encoder", help="Path to the push_roundtrip binary.", default="./push_roundtrip")
+def cli(encoder: str):
+    output = subprocess.run([encoder], stdout=subprocess.PIPE, check=True).stdout
+    checks = _Checks()
+    cases = 0
+    for line in output.decode().splitlines():
+        case = json.loads(line)
+        cases += 1
+        if case["kind"] == "snappy":
+            _check_snappy(checks, case)
+        else:
+            _check_remote_write(checks, case)
+
+    click.echo(f"{cases} cases, {checks.count} checks, {checks.failures} failures")
+    click.echo("FAIL" if checks.failures else "PASS")
+    raise SystemExit(1 if checks.failures else 0)
+
+
+if __name__ == "__main__":
+    cli()
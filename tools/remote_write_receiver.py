@@ -0,0 +1,172 @@
+# SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+# SPDX-License-Identifier: MIT
+"""
+Stand-in Prometheus remote_write receiver for testing push mode
+
+Decodes each request with no dependencies beyond click and prints the
+samples it contains.
+"""
+
+from datetime import datetime, timezone
+from http.server import BaseHTTPRequestHandler, HTTPServer
+import random
+import struct
+
+import click
+
+
+def _varint(data: bytes, pos: int):
+    """
+    _varint Read a varint, returning the value and the new position
+    """
+
+    result = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        result |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            return result, pos
+        shift += 7
+
+
+def snappy_decompress(data: bytes) -> bytes:
+    """
+    snappy_decompress Decompress the Snappy block format
+    """
+
+    length, pos = _varint(data, 0)
+    out = bytearray()
+    while pos < len(data):
+        tag = data[pos]
+        pos += 1
+        kind = tag & 0x03
+        if kind == 0:
+            size = tag >> 2
+            if size >= 60:
+                extra = size - 59
+                size = int.from_bytes(data[pos:pos + extra], "little")
+                pos += extra
+            size += 1
+            out += data[pos:pos + size]
+            pos += size
+            continue
+        if kind == 1:
+            size = ((tag >> 2) & 0x07) + 4
+            offset = ((tag >> 5) << 8) | data[pos]
+            pos += 1
+        elif kind == 2:
+            size = (tag >> 2) + 1
+            offset = int.from_bytes(data[pos:pos + 2], "little")
+            pos += 2
+        else:
+            size = (tag >> 2) + 1
+            offset = int.from_bytes(data[pos:pos + 4], "little")
+            pos += 4
+        if offset == 0 or offset > len(out):
+            raise ValueError("Invalid copy offset")
+        for _ in range(size):
+            out.append(out[-offset])
+    if len(out) != length:
+        raise ValueError("Length mismatch")
+    return bytes(out)
+
+
+def _fields(data: bytes):
+    """
+    _fields Iterate over the fields of a protobuf message
+    """
+
+    pos = 0
+    while pos < len(data):
+        key, pos = _varint(data, pos)
+        field, wire = key >> 3, key & 0x07
+        if wire == 0:
+            value, pos = _varint(data, pos)
+        elif wire == 1:
+            value = data[pos:pos + 8]
+            pos += 8
+        elif wire == 2:
+            size, pos = _varint(data, pos)
+            value = data[pos:pos + size]
+            pos += size
+        else:
+            raise ValueError(f"Unsupported wire type {wire}")
+        yield field, value
+
+
+def decode_write_request(data: bytes):
+    """
+    decode_write_request Decode a WriteRequest into a list of
+    (labels, samples) tuples
+    """
+
+    series = []
+    for field, value in _fields(data):
+        if field != 1:
+            continue
+        labels = {}
+        samples = []
+        for ts_field, ts_value in _fields(value):
+            if ts_field == 1:
+                label = dict(_fields(ts_value))
+                labels[label[1].decode()] = label[2].decode()
+            elif ts_field == 2:
+                sample = dict(_fields(ts_value))
+                samples.append((
+                    sample.get(2, 0),
+                    struct.unpack("<d", sample[1])[0]
+                ))
+        series.append((labels, samples))
+    return series
+
+
+class Handler(BaseHTTPRequestHandler):
+    fail_rate = 0.0
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers["Content-Length"]))
+
+        if random.random() < self.fail_rate:
+            click.echo("Failing request on purpose")
+            self.send_response(503)
+            self.end_headers()
+            return
+
+        if self.headers.get("Content-Encoding") != "snappy":
+            self.send_response(400)
+            self.end_headers()
+            return
+
+        raw = snappy_decompress(body)
+        click.echo(
+            f"{len(body)} bytes ({len(raw)} uncompressed) from "
+            f"{self.client_address[0]}"
+        )
+        for labels, samples in decode_write_request(raw):
+            click.echo(f"  {labels}")
+            for timestamp, value in samples:
+                time = datetime.fromtimestamp(timestamp / 1000, timezone.utc)
+                click.echo(f"    {time.isoformat()} {value}")
+
+        self.send_response(204)
+        self.end_headers()
+
+
+@click.command()
+@click.option("--port", help="Port to listen on.", default=9201)
+@click.option(
+    "--fail-rate",
+    help="Fraction of requests to reject with 503 to exercise retries.",
+    default=0.0
+)
+def cli(port: int, fail_rate: float):
+    Handler.fail_rate = fail_rate
+    server = HTTPServer(("", port), Handler)
+    click.echo(f"Listening on port {port}")
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    cli()
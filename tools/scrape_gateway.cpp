@@ -0,0 +1,1064 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Scrape gateway for a fleet of sensors. Finds sensors by browsing for
+// the _prometheus-http._tcp service they advertise over mDNS, scrapes
+// them all concurrently from a single non-blocking event loop and
+// serves the combined result as one /metrics for Prometheus to scrape.
+//
+// Build and run from the repository root:
+//   g++ -std=c++11 -O2 -Itools -o scrape_gateway tools/scrape_gateway.cpp
+//   ./scrape_gateway -l 9101
+//
+// Sensors that can not be found by mDNS, or simulated ones on
+// localhost, can be given as host[:port] arguments. Use -b 0 to turn
+// discovery off and only scrape those.
+//
+// Every sample gets device and hostname labels. A failed scrape keeps
+// serving the last good result, with gateway_device_up set to 0 and
+// gateway_device_cache_age_seconds showing how old it is. Once older
+// than the maximum staleness the cached samples are dropped, so
+// Prometheus marks those series stale itself.
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <functional>
+#include <getopt.h>
+#include <map>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "exposition.hpp"
+
+#define GATEWAY_MDNS_ADDR "224.0.0.251"
+#define GATEWAY_MDNS_PORT 5353
+#define GATEWAY_DNS_PTR 12
+#define GATEWAY_DNS_TXT 16
+#define GATEWAY_DNS_A 1
+#define GATEWAY_DNS_SRV 33
+// Maximum size of a response we will hold for a device or a client
+#define GATEWAY_MAX_RESPONSE (256 * 1024)
+#define GATEWAY_CLIENT_TIMEOUT 10000
+
+typedef std::chrono::steady_clock gateway_clock_t;
+
+enum gateway_result_t {
+    GATEWAY_OK,
+    GATEWAY_CONNECT,  // Could not connect
+    GATEWAY_TIMEOUT,  // No complete response before the deadline
+    GATEWAY_IO,       // Connection reset or closed early
+    GATEWAY_HTTP,     // Malformed response or status other than 200
+    GATEWAY_INVALID,  // Body is not valid exposition
+    GATEWAY_RESULT_MAX,
+};
+
+static const char* const gateway_result_names_[GATEWAY_RESULT_MAX] = {
+    "ok", "connect", "timeout", "io", "http", "invalid",
+};
+
+enum gateway_state_t {
+    GATEWAY_IDLE,
+    GATEWAY_CONNECTING,
+    GATEWAY_SENDING,
+    GATEWAY_RECEIVING,
+};
+
+struct gateway_options_t {
+    int listen_port;
+    std::string service;
+    int browse;       // Seconds, 0 to disable discovery
+    int interval;     // Seconds between scrapes of each device
+    int timeout;      // Milliseconds
+    int concurrency;
+    int max_stale;    // Seconds
+    int forget;       // Seconds
+    std::string path;
+    std::vector<std::string> targets;
+};
+
+struct gateway_device_t {
+    struct sockaddr_storage address;
+    socklen_t address_len;
+    std::string key;      // address:port, used as the device label
+    std::string hostname;
+    std::string path;
+    bool is_static;
+    gateway_clock_t::time_point seen;
+
+    // Scrape in progress
+    gateway_state_t state;
+    int fd;
+    gateway_clock_t::time_point next;
+    gateway_clock_t::time_point started;
+    gateway_clock_t::time_point deadline;
+    std::string request;
+    size_t sent;
+    std::string response;
+
+    // Last good result
+    std::string body;
+    gateway_clock_t::time_point success;
+    double success_unix;
+    bool up;
+    long failures;
+    double duration;
+};
+
+struct gateway_client_t {
+    int fd;
+    std::string request;
+    std::string response;
+    size_t sent;
+    gateway_clock_t::time_point deadline;
+};
+
+static gateway_options_t options_;
+static std::map<std::string, gateway_device_t> devices_;
+static std::vector<gateway_client_t> clients_;
+static long results_[GATEWAY_RESULT_MAX];
+static int in_flight_ = 0;
+
+static int gateway_ms_until(gateway_clock_t::time_point deadline, gateway_clock_t::time_point now) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+    return left < 0 ? 0 : (int)left;
+}
+
+static void gateway_set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+/**
+ * @brief Format an address as host:port
+ */
+static std::string gateway_address_key(const struct sockaddr* address) {
+    char host[INET6_ADDRSTRLEN] = "";
+    char buf[INET6_ADDRSTRLEN + 8];
+    if (address->sa_family == AF_INET6) {
+        const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)address;
+        inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+        snprintf(buf, sizeof(buf), "[%s]:%u", host, ntohs(in6->sin6_port));
+    }
+    else {
+        const struct sockaddr_in* in = (const struct sockaddr_in*)address;
+        inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+        snprintf(buf, sizeof(buf), "%s:%u", host, ntohs(in->sin_port));
+    }
+    return buf;
+}
+
+/**
+ * @brief Add a device or refresh one that is already known
+ */
+static void gateway_add_device(
+    const struct sockaddr* address,
+    socklen_t address_len,
+    const std::string& hostname,
+    const std::string& path,
+    bool is_static,
+    gateway_clock_t::time_point now
+) {
+    std::string key = gateway_address_key(address);
+    std::map<std::string, gateway_device_t>::iterator it = devices_.find(key);
+    if (it != devices_.end()) {
+        it->second.seen = now;
+        it->second.hostname = hostname;
+        it->second.path = path;
+        return;
+    }
+
+    gateway_device_t& device = devices_[key];
+    memcpy(&device.address, address, address_len);
+    device.address_len = address_len;
+    device.key = key;
+    device.hostname = hostname;
+    device.path = path;
+    device.is_static = is_static;
+    device.seen = now;
+    device.state = GATEWAY_IDLE;
+    device.fd = -1;
+    // Spread first scrapes over the interval so a large fleet found in
+    // one browse is not all scraped at once
+    long spread = std::hash<std::string>()(key) % (options_.interval * 1000L);
+    device.next = now + std::chrono::milliseconds(spread);
+    device.success_unix = 0;
+    device.up = false;
+    device.failures = 0;
+    device.duration = 0;
+    printf("Found %s (%s)\n", hostname.c_str(), key.c_str());
+    fflush(stdout);
+}
+
+// --- mDNS discovery -------------------------------------------------
+
+/**
+ * @brief Append a dotted name in DNS label format
+ */
+static void gateway_dns_put_name(std::string* packet, const std::string& name) {
+    size_t start = 0;
+    while (start < name.size()) {
+        size_t end = name.find('.', start);
+        if (end == std::string::npos) {
+            end = name.size();
+        }
+        packet->push_back((char)(end - start));
+        packet->append(name, start, end - start);
+        start = end + 1;
+    }
+    packet->push_back('\0');
+}
+
+/**
+ * @brief Read a possibly compressed name from a DNS message
+ *
+ * @param msg Message
+ * @param len Length of message
+ * @param pos Offset of the name, moved past it
+ * @param name Dotted name without a trailing dot
+ * @return false if the name is malformed
+ */
+static bool gateway_dns_get_name(const uint8_t* msg, size_t len, size_t* pos, std::string* name) {
+    name->clear();
+    size_t p = *pos;
+    bool jumped = false;
+    for (int jumps = 0; jumps < 16;) {
+        if (p >= len) {
+            return false;
+        }
+        uint8_t label = msg[p];
+        if ((label & 0xC0) == 0xC0) {
+            if (p + 1 >= len) {
+                return false;
+            }
+            if (!jumped) {
+                *pos = p + 2;
+            }
+            p = ((label & 0x3F) << 8) | msg[p + 1];
+            jumped = true;
+            jumps++;
+            continue;
+        }
+        if (label == 0) {
+            if (!jumped) {
+                *pos = p + 1;
+            }
+            return true;
+        }
+        if (p + 1 + label > len) {
+            return false;
+        }
+        if (!name->empty()) {
+            name->push_back('.');
+        }
+        name->append((const char*)msg + p + 1, label);
+        p += 1 + label;
+    }
+    return false;
+}
+
+static bool gateway_name_equal(const std::string& a, const std::string& b) {
+    return a.size() == b.size() && strncasecmp(a.c_str(), b.c_str(), a.size()) == 0;
+}
+
+/**
+ * @brief Send a one-shot mDNS question
+ *
+ * Sent from an ephemeral port, so responders reply directly to us and
+ * no other mDNS software on this host is disturbed.
+ */
+static void gateway_mdns_query(int fd, const std::string& name, uint16_t type) {
+    std::string packet(12, '\0');
+    packet[5] = 1; // One question
+    gateway_dns_put_name(&packet, name);
+    packet.push_back((char)(type >> 8));
+    packet.push_back((char)type);
+    packet.push_back((char)0x80); // Unicast response requested, class IN
+    packet.push_back(1);
+
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port = htons(GATEWAY_MDNS_PORT);
+    inet_pton(AF_INET, GATEWAY_MDNS_ADDR, &to.sin_addr);
+    sendto(fd, packet.data(), packet.size(), 0, (struct sockaddr*)&to, sizeof(to));
+}
+
+struct gateway_srv_t {
+    std::string target;
+    uint16_t port;
+};
+
+/**
+ * @brief Add every instance of the service described in a response
+ *
+ * @return false once there are no more responses waiting
+ */
+static bool gateway_mdns_receive(int fd, gateway_clock_t::time_point now) {
+    uint8_t msg[1500];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len = recvfrom(fd, msg, sizeof(msg), 0, (struct sockaddr*)&from, &from_len);
+    if (len < 0) {
+        return false;
+    }
+    if (len < 12 || !(msg[2] & 0x80)) {
+        return true;
+    }
+
+    size_t pos = 12;
+    int questions = (msg[4] << 8) | msg[5];
+    int records = ((msg[6] << 8) | msg[7]) + ((msg[8] << 8) | msg[9]) + ((msg[10] << 8) | msg[11]);
+    std::string name;
+    for (int i = 0; i < questions; i++) {
+        if (!gateway_dns_get_name(msg, len, &pos, &name) || pos + 4 > (size_t)len) {
+            return true;
+        }
+        pos += 4;
+    }
+
+    std::vector<std::string> instances;
+    std::map<std::string, gateway_srv_t> srv;
+    std::map<std::string, std::string> paths;
+    std::map<std::string, struct in_addr> hosts;
+    for (int i = 0; i < records; i++) {
+        if (!gateway_dns_get_name(msg, len, &pos, &name) || pos + 10 > (size_t)len) {
+            return true;
+        }
+        uint16_t type = (msg[pos] << 8) | msg[pos + 1];
+        uint16_t rdlength = (msg[pos + 8] << 8) | msg[pos + 9];
+        size_t rdata = pos + 10;
+        pos = rdata + rdlength;
+        if (pos > (size_t)len) {
+            return true;
+        }
+        std::string lower = name;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+        size_t p = rdata;
+        std::string value;
+        if (type == GATEWAY_DNS_PTR && gateway_name_equal(name, options_.service)) {
+            if (gateway_dns_get_name(msg, len, &p, &value)) {
+                instances.push_back(value);
+            }
+        }
+        else if (type == GATEWAY_DNS_SRV && rdlength > 6) {
+            p += 6;
+            if (gateway_dns_get_name(msg, len, &p, &value)) {
+                gateway_srv_t entry = { value, (uint16_t)((msg[rdata + 4] << 8) | msg[rdata + 5]) };
+                srv[lower] = entry;
+            }
+        }
+        else if (type == GATEWAY_DNS_TXT) {
+            while (p < pos) {
+                std::string item((const char*)msg + p + 1, std::min<size_t>(msg[p], pos - p - 1));
+                if (item.compare(0, 5, "path=") == 0) {
+                    paths[lower] = item.substr(5);
+                }
+                p += 1 + msg[p];
+            }
+        }
+        else if (type == GATEWAY_DNS_A && rdlength == 4) {
+            struct in_addr addr;
+            memcpy(&addr, msg + rdata, 4);
+            hosts[lower] = addr;
+        }
+    }
+
+    for (size_t i = 0; i < instances.size(); i++) {
+        std::string instance = instances[i];
+        std::transform(instance.begin(), instance.end(), instance.begin(), ::tolower);
+        std::map<std::string, gateway_srv_t>::iterator entry = srv.find(instance);
+        if (entry == srv.end()) {
+            // Answer only had the pointer, ask the device for the rest
+            gateway_mdns_query(fd, instances[i], GATEWAY_DNS_SRV);
+            continue;
+        }
+        // Every sensor shares the default instance and host names, so
+        // the address is taken from the responder where it is not given
+        std::string target = entry->second.target;
+        std::transform(target.begin(), target.end(), target.begin(), ::tolower);
+        struct sockaddr_in address = from;
+        address.sin_port = htons(entry->second.port);
+        if (hosts.count(target)) {
+            address.sin_addr = hosts[target];
+        }
+        std::string path = paths.count(instance) ? paths[instance] : options_.path;
+        gateway_add_device((struct sockaddr*)&address, sizeof(address), entry->second.target, path, false, now);
+    }
+    return true;
+}
+
+// --- Scraping -------------------------------------------------------
+
+/**
+ * @brief Check whether a buffered HTTP response is complete
+ *
+ * @param raw Response received so far
+ * @param eof Whether the connection has been closed
+ * @param status Set to the status code
+ * @param body Set to the decoded body once complete
+ * @return GATEWAY_OK when complete, GATEWAY_TIMEOUT if more is needed,
+ * otherwise the reason it is unusable
+ */
+static gateway_result_t gateway_parse_response(const std::string& raw, bool eof, int* status, std::string* body) {
+    size_t header_end = raw.find("\r\n\r\n");
+    if (header_end == std::string::npos) {
+        return eof ? GATEWAY_IO : GATEWAY_TIMEOUT;
+    }
+    if (sscanf(raw.c_str(), "HTTP/1.%*d %d", status) != 1) {
+        return GATEWAY_HTTP;
+    }
+    std::string headers = raw.substr(0, header_end);
+    std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+    size_t start = header_end + 4;
+
+    if (headers.find("\r\ntransfer-encoding: chunked") != std::string::npos) {
+        body->clear();
+        size_t pos = start;
+        while (true) {
+            size_t line = raw.find("\r\n", pos);
+            if (line == std::string::npos) {
+                return eof ? GATEWAY_IO : GATEWAY_TIMEOUT;
+            }
+            char* end;
+            unsigned long len = strtoul(raw.c_str() + pos, &end, 16);
+            if (end == raw.c_str() + pos) {
+                return GATEWAY_HTTP;
+            }
+            size_t data = line + 2;
+            if (raw.size() < data + len + 2) {
+                return eof ? GATEWAY_IO : GATEWAY_TIMEOUT;
+            }
+            if (len == 0) {
+                return GATEWAY_OK;
+            }
+            body->append(raw, data, len);
+            pos = data + len + 2;
+        }
+    }
+
+    size_t length = headers.find("\r\ncontent-length:");
+    if (length != std::string::npos) {
+        size_t len = strtoul(headers.c_str() + length + 17, NULL, 10);
+        if (raw.size() - start < len) {
+            return eof ? GATEWAY_IO : GATEWAY_TIMEOUT;
+        }
+        body->assign(raw, start, len);
+        return GATEWAY_OK;
+    }
+
+    // Body runs until the connection is closed
+    if (!eof) {
+        return GATEWAY_TIMEOUT;
+    }
+    body->assign(raw, start, std::string::npos);
+    return GATEWAY_OK;
+}
+
+/**
+ * @brief Check every line of a body so one bad device can not break
+ * the combined output
+ */
+static bool gateway_validate(const std::string& body) {
+    if (body.empty() || body[body.size() - 1] != '\n') {
+        return false;
+    }
+    exposition_line_t kind;
+    std::string name;
+    size_t rest;
+    size_t start = 0;
+    while (start < body.size()) {
+        size_t end = body.find('\n', start);
+        if (exposition_parse_line(body.substr(start, end - start), &kind, &name, &rest) != NULL) {
+            return false;
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+static void gateway_finish(gateway_device_t* device, gateway_result_t result, gateway_clock_t::time_point now) {
+    if (device->fd >= 0) {
+        close(device->fd);
+        in_flight_--;
+    }
+    device->fd = -1;
+    device->state = GATEWAY_IDLE;
+    device->request.clear();
+    device->duration = std::chrono::duration<double>(now - device->started).count();
+
+    std::string body;
+    if (result == GATEWAY_OK) {
+        int status = 0;
+        result = gateway_parse_response(device->response, true, &status, &body);
+        if (result == GATEWAY_OK && status != 200) {
+            result = GATEWAY_HTTP;
+        }
+        if (result == GATEWAY_OK && !gateway_validate(body)) {
+            result = GATEWAY_INVALID;
+        }
+    }
+    device->response.clear();
+    results_[result]++;
+
+    if (result != GATEWAY_OK) {
+        if (device->up || device->failures == 0) {
+            printf("Scrape of %s (%s) failed: %s\n", device->hostname.c_str(), device->key.c_str(), gateway_result_names_[result]);
+            fflush(stdout);
+        }
+        device->up = false;
+        device->failures++;
+        return;
+    }
+    device->body.swap(body);
+    device->success = now;
+    device->success_unix = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+    device->up = true;
+    device->failures = 0;
+}
+
+static void gateway_start_scrape(gateway_device_t* device, gateway_clock_t::time_point now) {
+    device->started = now;
+    device->deadline = now + std::chrono::milliseconds(options_.timeout);
+    // Keep to the schedule rather than drifting by the scrape time
+    while (device->next <= now) {
+        device->next += std::chrono::seconds(options_.interval);
+    }
+
+    device->fd = socket(device->address.ss_family, SOCK_STREAM, 0);
+    if (device->fd < 0) {
+        gateway_finish(device, GATEWAY_CONNECT, now);
+        return;
+    }
+    in_flight_++;
+    gateway_set_nonblocking(device->fd);
+    int one = 1;
+    setsockopt(device->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    device->request = "GET " + device->path + " HTTP/1.1\r\nHost: " + device->hostname + "\r\nConnection: close\r\n\r\n";
+    device->sent = 0;
+    device->response.clear();
+    device->state = GATEWAY_SENDING;
+    if (connect(device->fd, (struct sockaddr*)&device->address, device->address_len) != 0) {
+        if (errno != EINPROGRESS) {
+            gateway_finish(device, GATEWAY_CONNECT, now);
+            return;
+        }
+        device->state = GATEWAY_CONNECTING;
+    }
+}
+
+static void gateway_scrape_event(gateway_device_t* device, short revents, gateway_clock_t::time_point now) {
+    if (device->state == GATEWAY_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(device->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            gateway_finish(device, GATEWAY_CONNECT, now);
+            return;
+        }
+        device->state = GATEWAY_SENDING;
+    }
+
+    if (device->state == GATEWAY_SENDING) {
+        ssize_t ret = send(device->fd, device->request.data() + device->sent, device->request.size() - device->sent, 0);
+        if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            gateway_finish(device, GATEWAY_IO, now);
+            return;
+        }
+        if (ret > 0) {
+            device->sent += ret;
+        }
+        if (device->sent == device->request.size()) {
+            device->state = GATEWAY_RECEIVING;
+        }
+        return;
+    }
+
+    if (!(revents & (POLLIN | POLLHUP | POLLERR))) {
+        return;
+    }
+    char buf[4096];
+    ssize_t ret = recv(device->fd, buf, sizeof(buf), 0);
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    if (ret < 0) {
+        gateway_finish(device, GATEWAY_IO, now);
+        return;
+    }
+    if (ret == 0) {
+        gateway_finish(device, GATEWAY_OK, now);
+        return;
+    }
+    device->response.append(buf, ret);
+    if (device->response.size() > GATEWAY_MAX_RESPONSE) {
+        gateway_finish(device, GATEWAY_HTTP, now);
+        return;
+    }
+    // The device's server keeps the connection open after responding,
+    // so finish as soon as the whole response is here
+    int status;
+    std::string body;
+    if (gateway_parse_response(device->response, false, &status, &body) != GATEWAY_TIMEOUT) {
+        gateway_finish(device, GATEWAY_OK, now);
+    }
+}
+
+// --- Federated output -----------------------------------------------
+
+struct gateway_family_t {
+    std::string help;
+    std::string type;
+    std::string samples;
+};
+
+static std::string gateway_escape_label(const std::string& value) {
+    std::string out;
+    for (size_t i = 0; i < value.size(); i++) {
+        if (value[i] == '\\' || value[i] == '"') {
+            out.push_back('\\');
+        }
+        if (value[i] == '\n') {
+            out += "\\n";
+            continue;
+        }
+        out.push_back(value[i]);
+    }
+    return out;
+}
+
+static void gateway_put_family(
+    std::string* out,
+    const char* name,
+    const char* type,
+    const char* help
+) {
+    *out += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+}
+
+static void gateway_put_sample(std::string* out, const char* name, const std::string& labels, double value) {
+    char buf[64];
+    if (value == (long long)value) {
+        snprintf(buf, sizeof(buf), "} %lld\n", (long long)value);
+    }
+    else {
+        snprintf(buf, sizeof(buf), "} %.6f\n", value);
+    }
+    *out += std::string(name) + "{" + labels + buf;
+}
+
+/**
+ * @brief Combine the cached results of every device, grouping samples
+ * from all devices under one HELP and TYPE per metric family
+ */
+static std::string gateway_render(gateway_clock_t::time_point now) {
+    std::vector<std::string> order;
+    std::map<std::string, gateway_family_t> families;
+    std::string gateway;
+    long fresh = 0;
+
+    gateway_put_family(&gateway, "gateway_device_up", "gauge", "Whether the last scrape of the device succeeded");
+    std::string age_lines;
+    std::string success_lines;
+    std::string duration_lines;
+    std::string failure_lines;
+
+    for (std::map<std::string, gateway_device_t>::iterator it = devices_.begin(); it != devices_.end(); ++it) {
+        gateway_device_t& device = it->second;
+        std::string labels = "device=\"" + gateway_escape_label(device.key) + "\",hostname=\"" + gateway_escape_label(device.hostname) + "\"";
+        gateway_put_sample(&gateway, "gateway_device_up", labels, device.up);
+        gateway_put_sample(&duration_lines, "gateway_device_scrape_duration_seconds", labels, device.duration);
+        gateway_put_sample(&failure_lines, "gateway_device_consecutive_failures", labels, device.failures);
+        if (device.body.empty()) {
+            continue;
+        }
+        double age = std::chrono::duration<double>(now - device.success).count();
+        if (age > options_.max_stale) {
+            device.body.clear();
+            continue;
+        }
+        gateway_put_sample(&age_lines, "gateway_device_cache_age_seconds", labels, age);
+        gateway_put_sample(&success_lines, "gateway_device_last_success_timestamp_seconds", labels, device.success_unix);
+        fresh++;
+
+        // Samples follow the HELP and TYPE of their family, which also
+        // covers the suffixed series of summaries and histograms
+        std::string family;
+        exposition_line_t kind;
+        std::string name;
+        size_t rest;
+        size_t start = 0;
+        while (start < device.body.size()) {
+            size_t end = device.body.find('\n', start);
+            std::string line = device.body.substr(start, end - start);
+            start = end + 1;
+            exposition_parse_line(line, &kind, &name, &rest);
+            if (kind == EXPOSITION_HELP || kind == EXPOSITION_TYPE) {
+                family = name;
+            }
+            else if (kind != EXPOSITION_SAMPLE) {
+                continue;
+            }
+            else if (family.empty() || name.compare(0, family.size(), family) != 0) {
+                family = name;
+            }
+
+            if (!families.count(family)) {
+                order.push_back(family);
+            }
+            gateway_family_t& entry = families[family];
+            if (kind == EXPOSITION_HELP) {
+                if (entry.help.empty()) {
+                    entry.help = line;
+                }
+                continue;
+            }
+            if (kind == EXPOSITION_TYPE) {
+                if (entry.type.empty()) {
+                    entry.type = line;
+                }
+                continue;
+            }
+            entry.samples += name + "{" + labels;
+            if (line[rest] == '{' && line[rest + 1] != '}') {
+                entry.samples += "," + line.substr(rest + 1);
+            }
+            else if (line[rest] == '{') {
+                entry.samples += line.substr(rest + 1);
+            }
+            else {
+                entry.samples += "}" + line.substr(rest);
+            }
+            entry.samples += "\n";
+        }
+    }
+
+    gateway_put_family(&gateway, "gateway_device_scrape_duration_seconds", "gauge", "Time taken by the last scrape of the device");
+    gateway += duration_lines;
+    gateway_put_family(&gateway, "gateway_device_consecutive_failures", "gauge", "Scrapes of the device that have failed since the last success");
+    gateway += failure_lines;
+    gateway_put_family(&gateway, "gateway_device_cache_age_seconds", "gauge", "Age of the cached samples served for the device");
+    gateway += age_lines;
+    gateway_put_family(&gateway, "gateway_device_last_success_timestamp_seconds", "gauge", "Time of the last successful scrape of the device");
+    gateway += success_lines;
+    gateway_put_family(&gateway, "gateway_devices", "gauge", "Devices known to the gateway and those with fresh samples");
+    gateway_put_sample(&gateway, "gateway_devices", "state=\"known\"", devices_.size());
+    gateway_put_sample(&gateway, "gateway_devices", "state=\"fresh\"", fresh);
+    gateway_put_family(&gateway, "gateway_scrapes_total", "counter", "Scrapes of devices by result");
+    for (int r = 0; r < GATEWAY_RESULT_MAX; r++) {
+        gateway_put_sample(&gateway, "gateway_scrapes_total", std::string("result=\"") + gateway_result_names_[r] + "\"", results_[r]);
+    }
+
+    std::string out;
+    for (size_t i = 0; i < order.size(); i++) {
+        gateway_family_t& entry = families[order[i]];
+        out += entry.help.empty() ? "" : entry.help + "\n";
+        out += entry.type.empty() ? "" : entry.type + "\n";
+        out += entry.samples;
+    }
+    return out + gateway;
+}
+
+static void gateway_client_event(gateway_client_t* client, gateway_clock_t::time_point now) {
+    if (client->response.empty()) {
+        char buf[1024];
+        ssize_t ret = recv(client->fd, buf, sizeof(buf), 0);
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return;
+        }
+        if (ret <= 0 || client->request.size() + ret > GATEWAY_MAX_RESPONSE) {
+            client->deadline = now;
+            return;
+        }
+        client->request.append(buf, ret);
+        if (client->request.find("\r\n\r\n") == std::string::npos) {
+            return;
+        }
+
+        std::string status = "200 OK";
+        std::string body;
+        if (client->request.compare(0, 13, "GET /metrics ") == 0 || client->request.compare(0, 14, "GET /metrics? ") == 0) {
+            body = gateway_render(now);
+        }
+        else {
+            status = "404 Not Found";
+            body = "Not found\n";
+        }
+        char headers[256];
+        snprintf(
+            headers, sizeof(headers),
+            "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+            status.c_str(), body.size()
+        );
+        client->response = headers + body;
+        client->sent = 0;
+    }
+
+    ssize_t ret = send(client->fd, client->response.data() + client->sent, client->response.size() - client->sent, 0);
+    if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        client->deadline = now;
+        return;
+    }
+    if (ret > 0) {
+        client->sent += ret;
+    }
+    if (client->sent == client->response.size()) {
+        client->deadline = now;
+    }
+}
+
+// --- Main loop ------------------------------------------------------
+
+static void gateway_usage(const char* argv0) {
+    fprintf(
+        stderr,
+        "Usage: %s [options] [host[:port]...]\n"
+        "  -l, --listen PORT     port to serve /metrics on (default 9101)\n"
+        "  -s, --service NAME    mDNS service to browse (default _prometheus-http._tcp.local)\n"
+        "  -b, --browse S        seconds between browses, 0 to disable (default 60)\n"
+        "  -i, --interval S      seconds between scrapes of each device (default 15)\n"
+        "  -t, --timeout MS      deadline for each scrape (default 5000)\n"
+        "  -c, --concurrency N   scrapes in flight at once (default 64)\n"
+        "  -m, --max-stale S     drop cached samples older than this (default 300)\n"
+        "  -f, --forget S        forget devices not found for this long (default 900)\n"
+        "  -p, --path PATH       path to scrape without a TXT record (default /metrics)\n",
+        argv0
+    );
+}
+
+static bool gateway_parse_args(int argc, char** argv) {
+    options_.listen_port = 9101;
+    options_.service = "_prometheus-http._tcp.local";
+    options_.browse = 60;
+    options_.interval = 15;
+    options_.timeout = 5000;
+    options_.concurrency = 64;
+    options_.max_stale = 300;
+    options_.forget = 900;
+    options_.path = "/metrics";
+
+    static const struct option long_options[] = {
+        { "listen", required_argument, NULL, 'l' },
+        { "service", required_argument, NULL, 's' },
+        { "browse", required_argument, NULL, 'b' },
+        { "interval", required_argument, NULL, 'i' },
+        { "timeout", required_argument, NULL, 't' },
+        { "concurrency", required_argument, NULL, 'c' },
+        { "max-stale", required_argument, NULL, 'm' },
+        { "forget", required_argument, NULL, 'f' },
+        { "path", required_argument, NULL, 'p' },
+        { NULL, 0, NULL, 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "l:s:b:i:t:c:m:f:p:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'l':
+            options_.listen_port = atoi(optarg);
+            break;
+        case 's':
+            options_.service = optarg;
+            break;
+        case 'b':
+            options_.browse = atoi(optarg);
+            break;
+        case 'i':
+            options_.interval = atoi(optarg);
+            break;
+        case 't':
+            options_.timeout = atoi(optarg);
+            break;
+        case 'c':
+            options_.concurrency = atoi(optarg);
+            break;
+        case 'm':
+            options_.max_stale = atoi(optarg);
+            break;
+        case 'f':
+            options_.forget = atoi(optarg);
+            break;
+        case 'p':
+            options_.path = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+    for (int i = optind; i < argc; i++) {
+        options_.targets.push_back(argv[i]);
+    }
+    return options_.interval > 0 && options_.timeout > 0 && options_.concurrency > 0 &&
+        (options_.browse > 0 || !options_.targets.empty());
+}
+
+static bool gateway_add_static(const std::string& target, gateway_clock_t::time_point now) {
+    std::string host = target;
+    std::string port = "80";
+    size_t colon = host.rfind(':');
+    if (colon != std::string::npos && host.find(':') == colon) {
+        port = host.substr(colon + 1);
+        host.erase(colon);
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* address;
+    int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &address);
+    if (err != 0) {
+        fprintf(stderr, "Failed to resolve %s: %s\n", host.c_str(), gai_strerror(err));
+        return false;
+    }
+    gateway_add_device(address->ai_addr, address->ai_addrlen, host, options_.path, true, now);
+    freeaddrinfo(address);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (!gateway_parse_args(argc, argv)) {
+        gateway_usage(argv[0]);
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    gateway_clock_t::time_point now = gateway_clock_t::now();
+
+    for (size_t i = 0; i < options_.targets.size(); i++) {
+        if (!gateway_add_static(options_.targets[i], now)) {
+            return 2;
+        }
+    }
+
+    int listener = socket(AF_INET6, SOCK_STREAM, 0);
+    int off = 0;
+    int one = 1;
+    setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in6 bind_address;
+    memset(&bind_address, 0, sizeof(bind_address));
+    bind_address.sin6_family = AF_INET6;
+    bind_address.sin6_addr = in6addr_any;
+    bind_address.sin6_port = htons(options_.listen_port);
+    if (bind(listener, (struct sockaddr*)&bind_address, sizeof(bind_address)) != 0 || listen(listener, 16) != 0) {
+        fprintf(stderr, "Failed to listen on port %d: %s\n", options_.listen_port, strerror(errno));
+        return 1;
+    }
+    gateway_set_nonblocking(listener);
+
+    int mdns = -1;
+    if (options_.browse > 0) {
+        mdns = socket(AF_INET, SOCK_DGRAM, 0);
+        gateway_set_nonblocking(mdns);
+    }
+    gateway_clock_t::time_point next_browse = now;
+    printf("Serving /metrics on port %d\n", options_.listen_port);
+    fflush(stdout);
+
+    std::vector<struct pollfd> fds;
+    std::vector<gateway_device_t*> polled;
+    while (true) {
+        now = gateway_clock_t::now();
+        gateway_clock_t::time_point wake = now + std::chrono::seconds(1);
+
+        if (mdns >= 0 && now >= next_browse) {
+            gateway_mdns_query(mdns, options_.service, GATEWAY_DNS_PTR);
+            next_browse = now + std::chrono::seconds(options_.browse);
+        }
+        if (mdns >= 0) {
+            wake = std::min(wake, next_browse);
+        }
+
+        polled.clear();
+        fds.clear();
+        for (std::map<std::string, gateway_device_t>::iterator it = devices_.begin(); it != devices_.end();) {
+            gateway_device_t& device = it->second;
+            if (device.state == GATEWAY_IDLE && !device.is_static &&
+                now - device.seen > std::chrono::seconds(options_.forget)) {
+                printf("Forgetting %s (%s)\n", device.hostname.c_str(), device.key.c_str());
+                devices_.erase(it++);
+                continue;
+            }
+            if (device.state != GATEWAY_IDLE && now >= device.deadline) {
+                gateway_finish(&device, GATEWAY_TIMEOUT, now);
+            }
+            if (device.state == GATEWAY_IDLE && now >= device.next && in_flight_ < options_.concurrency) {
+                gateway_start_scrape(&device, now);
+            }
+            if (device.state == GATEWAY_IDLE) {
+                wake = std::min(wake, device.next);
+            }
+            else {
+                wake = std::min(wake, device.deadline);
+                struct pollfd p = { device.fd, (short)(device.state == GATEWAY_RECEIVING ? POLLIN : POLLOUT), 0 };
+                fds.push_back(p);
+                polled.push_back(&device);
+            }
+            ++it;
+        }
+
+        for (size_t i = 0; i < clients_.size();) {
+            if (now >= clients_[i].deadline) {
+                close(clients_[i].fd);
+                clients_.erase(clients_.begin() + i);
+                continue;
+            }
+            wake = std::min(wake, clients_[i].deadline);
+            struct pollfd p = { clients_[i].fd, (short)(clients_[i].response.empty() ? POLLIN : POLLOUT), 0 };
+            fds.push_back(p);
+            i++;
+        }
+        size_t first_client = polled.size();
+        size_t client_count = clients_.size();
+        struct pollfd listen_poll = { listener, POLLIN, 0 };
+        fds.push_back(listen_poll);
+        if (mdns >= 0) {
+            struct pollfd mdns_poll = { mdns, POLLIN, 0 };
+            fds.push_back(mdns_poll);
+        }
+
+        if (poll(fds.data(), fds.size(), gateway_ms_until(wake, now)) < 0 && errno != EINTR) {
+            perror("poll");
+            return 1;
+        }
+        now = gateway_clock_t::now();
+
+        for (size_t i = 0; i < polled.size(); i++) {
+            if (fds[i].revents != 0) {
+                gateway_scrape_event(polled[i], fds[i].revents, now);
+            }
+        }
+        for (size_t i = 0; i < client_count; i++) {
+            if (fds[first_client + i].revents != 0) {
+                gateway_client_event(&clients_[i], now);
+            }
+        }
+        if (fds[first_client + client_count].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listener, NULL, NULL)) >= 0) {
+                gateway_set_nonblocking(fd);
+                gateway_client_t client;
+                client.fd = fd;
+                client.sent = 0;
+                client.deadline = now + std::chrono::milliseconds(GATEWAY_CLIENT_TIMEOUT);
+                clients_.push_back(client);
+            }
+        }
+        if (mdns >= 0 && (fds[first_client + client_count + 1].revents & POLLIN)) {
+            while (gateway_mdns_receive(mdns, now)) {
+            }
+        }
+    }
+}
@@ -0,0 +1,605 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Load generator and soak test for the /metrics endpoint. Scrapes a
+// device from a number of concurrent connections, checks every
+// response is valid Prometheus exposition and reports throughput,
+// latency percentiles and failures.
+//
+// Build and run from the repository root:
+//   g++ -std=c++11 -O2 -pthread -Itools -o scrape_load
+//       tools/scrape_load.cpp
+//   ./scrape_load -c 4 -d 60 -k tempsensor.local
+//
+// Only HTTP is spoken, so the same run can be pointed at a device or
+// anything else serving the endpoint to compare server side changes.
+// The device's server accepts only a handful of sockets at once, so
+// more connections than that measure queueing in the TCP stack rather
+// than the server. Latency includes connecting when not using
+// keep-alive.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "exposition.hpp"
+
+typedef std::chrono::steady_clock load_clock_t;
+
+enum load_result_t {
+    LOAD_OK,
+    LOAD_CONNECT,   // Could not connect
+    LOAD_TIMEOUT,   // No complete response before the timeout
+    LOAD_IO,        // Connection reset or closed early
+    LOAD_HTTP,      // Malformed response or status other than 200
+    LOAD_INVALID,   // Body is not valid exposition
+    LOAD_RESULT_MAX,
+};
+
+static const char* const load_result_names_[LOAD_RESULT_MAX] = {
+    "ok", "connect", "timeout", "io", "http", "invalid",
+};
+
+struct load_options_t {
+    std::string host;
+    std::string port;
+    std::string path;
+    int connections;
+    double duration;
+    long requests;
+    int timeout;
+    bool keep_alive;
+    double interval;
+    std::vector<std::string> expect;
+};
+
+struct load_worker_t {
+    std::vector<uint32_t> latencies; // Successful requests, microseconds
+    long results[LOAD_RESULT_MAX];
+    long reconnects;
+    std::string last_error;
+};
+
+static const load_options_t* options_;
+static const struct addrinfo* address_;
+static load_clock_t::time_point deadline_;
+static std::atomic<long> remaining_;
+static std::atomic<long> completed_;
+static std::atomic<long> failed_;
+
+/**
+ * @brief Milliseconds left until a deadline, at least 0
+ */
+static int load_ms_until(load_clock_t::time_point deadline) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - load_clock_t::now()).count();
+    return left < 0 ? 0 : (int)left;
+}
+
+/**
+ * @brief Wait for a socket to become ready before a deadline
+ *
+ * @return true if ready, false on timeout
+ */
+static bool load_wait(int fd, short events, load_clock_t::time_point deadline) {
+    struct pollfd p = { fd, events, 0 };
+    while (true) {
+        int ret = poll(&p, 1, load_ms_until(deadline));
+        if (ret > 0) {
+            return true;
+        }
+        if (ret == 0 || errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+static load_result_t load_connect(int* fd, load_clock_t::time_point deadline) {
+    *fd = socket(address_->ai_family, address_->ai_socktype, address_->ai_protocol);
+    if (*fd < 0) {
+        return LOAD_CONNECT;
+    }
+    fcntl(*fd, F_SETFL, fcntl(*fd, F_GETFL) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(*fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(*fd, address_->ai_addr, address_->ai_addrlen) == 0) {
+        return LOAD_OK;
+    }
+    if (errno != EINPROGRESS) {
+        return LOAD_CONNECT;
+    }
+    if (!load_wait(*fd, POLLOUT, deadline)) {
+        return LOAD_TIMEOUT;
+    }
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(*fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    return err == 0 ? LOAD_OK : LOAD_CONNECT;
+}
+
+static load_result_t load_send(int fd, const std::string& request, load_clock_t::time_point deadline) {
+    size_t sent = 0;
+    while (sent < request.size()) {
+        ssize_t ret = send(fd, request.data() + sent, request.size() - sent, 0);
+        if (ret > 0) {
+            sent += ret;
+            continue;
+        }
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            if (!load_wait(fd, POLLOUT, deadline)) {
+                return LOAD_TIMEOUT;
+            }
+            continue;
+        }
+        return LOAD_IO;
+    }
+    return LOAD_OK;
+}
+
+/**
+ * @brief Read more of the response into a buffer
+ *
+ * @return LOAD_OK when data was read, LOAD_IO on EOF or error
+ */
+static load_result_t load_recv(int fd, std::string* buf, load_clock_t::time_point deadline) {
+    char chunk[4096];
+    while (true) {
+        ssize_t ret = recv(fd, chunk, sizeof(chunk), 0);
+        if (ret > 0) {
+            buf->append(chunk, ret);
+            return LOAD_OK;
+        }
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            if (!load_wait(fd, POLLIN, deadline)) {
+                return LOAD_TIMEOUT;
+            }
+            continue;
+        }
+        return LOAD_IO;
+    }
+}
+
+/**
+ * @brief Case insensitive search for a header, returning its value
+ */
+static bool load_header(const std::string& headers, const char* name, std::string* value) {
+    size_t name_len = strlen(name);
+    size_t pos = headers.find("\r\n");
+    while (pos != std::string::npos && pos + 2 < headers.size()) {
+        size_t start = pos + 2;
+        size_t end = headers.find("\r\n", start);
+        if (end == std::string::npos) {
+            end = headers.size();
+        }
+        if (end - start > name_len && headers[start + name_len] == ':' &&
+            strncasecmp(headers.c_str() + start, name, name_len) == 0) {
+            size_t v = start + name_len + 1;
+            while (v < end && (headers[v] == ' ' || headers[v] == '\t')) {
+                v++;
+            }
+            value->assign(headers, v, end - v);
+            return true;
+        }
+        pos = end;
+    }
+    return false;
+}
+
+/**
+ * @brief Remove chunked transfer encoding
+ *
+ * @param raw Everything after the headers received so far
+ * @param body Decoded body
+ * @param malformed Set if a chunk size can not be parsed
+ * @return true once the terminating chunk has been seen
+ */
+static bool load_dechunk(const std::string& raw, std::string* body, bool* malformed) {
+    body->clear();
+    size_t pos = 0;
+    while (true) {
+        size_t line = raw.find("\r\n", pos);
+        if (line == std::string::npos) {
+            return false;
+        }
+        char* end;
+        unsigned long len = strtoul(raw.c_str() + pos, &end, 16);
+        if (end == raw.c_str() + pos) {
+            *malformed = true;
+            return false;
+        }
+        size_t data = line + 2;
+        if (len == 0) {
+            // No trailers are sent, just the final CRLF
+            return raw.size() >= data + 2;
+        }
+        if (raw.size() < data + len + 2) {
+            return false;
+        }
+        body->append(raw, data, len);
+        pos = data + len + 2;
+    }
+}
+
+/**
+ * @brief Read one complete response
+ *
+ * @param fd Connection
+ * @param body Response body
+ * @param keep Set to whether the connection can be reused
+ * @return Result of the request
+ */
+static load_result_t load_read_response(int fd, std::string* body, bool* keep, load_clock_t::time_point deadline) {
+    std::string buf;
+    size_t header_end;
+    while ((header_end = buf.find("\r\n\r\n")) == std::string::npos) {
+        load_result_t ret = load_recv(fd, &buf, deadline);
+        if (ret != LOAD_OK) {
+            return ret;
+        }
+    }
+    std::string headers = buf.substr(0, header_end);
+    std::string raw = buf.substr(header_end + 4);
+
+    int status = 0;
+    if (sscanf(headers.c_str(), "HTTP/1.%*d %d", &status) != 1) {
+        return LOAD_HTTP;
+    }
+    std::string value;
+    *keep = options_->keep_alive;
+    if (load_header(headers, "Connection", &value) && strcasecmp(value.c_str(), "close") == 0) {
+        *keep = false;
+    }
+
+    if (load_header(headers, "Transfer-Encoding", &value) && strcasecmp(value.c_str(), "chunked") == 0) {
+        bool malformed = false;
+        while (!load_dechunk(raw, body, &malformed)) {
+            if (malformed) {
+                return LOAD_HTTP;
+            }
+            load_result_t ret = load_recv(fd, &raw, deadline);
+            if (ret != LOAD_OK) {
+                return ret;
+            }
+        }
+    }
+    else if (load_header(headers, "Content-Length", &value)) {
+        size_t len = strtoul(value.c_str(), NULL, 10);
+        while (raw.size() < len) {
+            load_result_t ret = load_recv(fd, &raw, deadline);
+            if (ret != LOAD_OK) {
+                return ret;
+            }
+        }
+        body->assign(raw, 0, len);
+    }
+    else {
+        // Body runs until the connection is closed
+        load_result_t ret;
+        while ((ret = load_recv(fd, &raw, deadline)) == LOAD_OK) {
+        }
+        if (ret == LOAD_TIMEOUT) {
+            return ret;
+        }
+        *body = raw;
+        *keep = false;
+    }
+    return status == 200 ? LOAD_OK : LOAD_HTTP;
+}
+
+/**
+ * @brief Check a whole body is valid exposition containing every
+ * expected metric
+ *
+ * @return Description of the first problem, empty if valid
+ */
+static std::string load_validate(const std::string& body) {
+    if (body.empty() || body[body.size() - 1] != '\n') {
+        return "body does not end with a newline";
+    }
+    std::vector<bool> found(options_->expect.size(), false);
+    long samples = 0;
+    size_t start = 0;
+    std::string name;
+    exposition_line_t kind;
+    size_t rest;
+    while (start < body.size()) {
+        size_t end = body.find('\n', start);
+        std::string line = body.substr(start, end - start);
+        const char* problem = exposition_parse_line(line, &kind, &name, &rest);
+        if (problem != NULL) {
+            return std::string(problem) + ": " + line;
+        }
+        if (kind == EXPOSITION_SAMPLE) {
+            samples++;
+            for (size_t i = 0; i < found.size(); i++) {
+                found[i] = found[i] || name == options_->expect[i];
+            }
+        }
+        start = end + 1;
+    }
+    if (samples == 0) {
+        return "no samples";
+    }
+    for (size_t i = 0; i < found.size(); i++) {
+        if (!found[i]) {
+            return "missing " + options_->expect[i];
+        }
+    }
+    return "";
+}
+
+static void load_worker(load_worker_t* worker) {
+    std::string request = "GET " + options_->path + " HTTP/1.1\r\nHost: " + options_->host +
+        "\r\nConnection: " + (options_->keep_alive ? "keep-alive" : "close") + "\r\n\r\n";
+    std::string body;
+    int fd = -1;
+
+    while (load_clock_t::now() < deadline_ && remaining_.fetch_sub(1) > 0) {
+        auto start = load_clock_t::now();
+        auto timeout = start + std::chrono::milliseconds(options_->timeout);
+        load_result_t result = LOAD_OK;
+        bool keep = false;
+
+        if (fd < 0) {
+            result = load_connect(&fd, timeout);
+            worker->reconnects++;
+        }
+        if (result == LOAD_OK) {
+            result = load_send(fd, request, timeout);
+        }
+        if (result == LOAD_OK) {
+            result = load_read_response(fd, &body, &keep, timeout);
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(load_clock_t::now() - start).count();
+        if (result == LOAD_OK) {
+            std::string problem = load_validate(body);
+            if (!problem.empty()) {
+                result = LOAD_INVALID;
+                worker->last_error = problem;
+            }
+        }
+
+        worker->results[result]++;
+        if (result == LOAD_OK) {
+            worker->latencies.push_back(elapsed);
+            completed_++;
+        }
+        else {
+            failed_++;
+        }
+        if (result != LOAD_OK || !keep) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            fd = -1;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+/**
+ * @brief Nearest rank percentile of sorted latencies in milliseconds
+ */
+static double load_percentile(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = (size_t)(p / 100 * sorted.size() + 0.999999);
+    rank = std::min(std::max(rank, (size_t)1), sorted.size());
+    return sorted[rank - 1] / 1000.0;
+}
+
+static void load_usage(const char* argv0) {
+    fprintf(
+        stderr,
+        "Usage: %s [options] host[:port]\n"
+        "  -c, --connections N  concurrent connections (default 4)\n"
+        "  -d, --duration S     run for S seconds (default 10 without -n)\n"
+        "  -n, --requests N     stop after N requests in total\n"
+        "  -t, --timeout MS     per request timeout (default 2000)\n"
+        "  -k, --keep-alive     reuse connections between requests\n"
+        "  -p, --path PATH      path to scrape (default /metrics)\n"
+        "  -e, --expect NAME    fail responses without this metric, repeatable\n"
+        "  -i, --interval S     print progress every S seconds during a soak\n",
+        argv0
+    );
+}
+
+static bool load_parse_args(int argc, char** argv, load_options_t* options) {
+    options->port = "80";
+    options->path = "/metrics";
+    options->connections = 4;
+    options->duration = -1;
+    options->requests = -1;
+    options->timeout = 2000;
+    options->keep_alive = false;
+    options->interval = 0;
+
+    static const struct option long_options[] = {
+        { "connections", required_argument, NULL, 'c' },
+        { "duration", required_argument, NULL, 'd' },
+        { "requests", required_argument, NULL, 'n' },
+        { "timeout", required_argument, NULL, 't' },
+        { "keep-alive", no_argument, NULL, 'k' },
+        { "path", required_argument, NULL, 'p' },
+        { "expect", required_argument, NULL, 'e' },
+        { "interval", required_argument, NULL, 'i' },
+        { NULL, 0, NULL, 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:d:n:t:kp:e:i:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'c':
+            options->connections = atoi(optarg);
+            break;
+        case 'd':
+            options->duration = atof(optarg);
+            break;
+        case 'n':
+            options->requests = atol(optarg);
+            break;
+        case 't':
+            options->timeout = atoi(optarg);
+            break;
+        case 'k':
+            options->keep_alive = true;
+            break;
+        case 'p':
+            options->path = optarg;
+            break;
+        case 'e':
+            options->expect.push_back(optarg);
+            break;
+        case 'i':
+            options->interval = atof(optarg);
+            break;
+        default:
+            return false;
+        }
+    }
+    if (optind != argc - 1 || options->connections < 1 || options->timeout < 1) {
+        return false;
+    }
+
+    if (options->duration < 0) {
+        // A request count runs to completion unless given a duration
+        options->duration = options->requests > 0 ? 0 : 10;
+    }
+
+    options->host = argv[optind];
+    size_t colon = options->host.rfind(':');
+    if (colon != std::string::npos && options->host.find(':') == colon) {
+        options->port = options->host.substr(colon + 1);
+        options->host.erase(colon);
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    load_options_t options;
+    if (!load_parse_args(argc, argv, &options)) {
+        load_usage(argv[0]);
+        return 2;
+    }
+    options_ = &options;
+    signal(SIGPIPE, SIG_IGN);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* address;
+    int err = getaddrinfo(options.host.c_str(), options.port.c_str(), &hints, &address);
+    if (err != 0) {
+        fprintf(stderr, "Failed to resolve %s: %s\n", options.host.c_str(), gai_strerror(err));
+        return 2;
+    }
+    address_ = address;
+
+    remaining_ = options.requests > 0 ? options.requests : (long)1 << 62;
+    auto start = load_clock_t::now();
+    deadline_ = load_clock_t::time_point::max();
+    if (options.duration > 0) {
+        deadline_ = start + std::chrono::milliseconds((long long)(options.duration * 1000));
+    }
+
+    printf(
+        "Scraping http://%s:%s%s from %d %s connections\n",
+        options.host.c_str(),
+        options.port.c_str(),
+        options.path.c_str(),
+        options.connections,
+        options.keep_alive ? "keep-alive" : "fresh"
+    );
+
+    std::vector<load_worker_t> workers(options.connections);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < options.connections; i++) {
+        memset(workers[i].results, 0, sizeof(workers[i].results));
+        workers[i].reconnects = 0;
+        threads.push_back(std::thread(load_worker, &workers[i]));
+    }
+
+    if (options.interval > 0) {
+        auto next = start;
+        long last_completed = 0;
+        long last_failed = 0;
+        while (load_clock_t::now() < deadline_ && remaining_ > 0) {
+            next += std::chrono::milliseconds((long long)(options.interval * 1000));
+            std::this_thread::sleep_until(std::min(next, deadline_));
+            long completed = completed_;
+            long failed = failed_;
+            printf(
+                "%8.1fs %8.1f req/s %6ld errors\n",
+                std::chrono::duration<double>(load_clock_t::now() - start).count(),
+                (completed - last_completed) / options.interval,
+                failed - last_failed
+            );
+            fflush(stdout);
+            last_completed = completed;
+            last_failed = failed;
+        }
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    double elapsed = std::chrono::duration<double>(load_clock_t::now() - start).count();
+    freeaddrinfo(address);
+
+    std::vector<uint32_t> latencies;
+    long results[LOAD_RESULT_MAX] = {};
+    long reconnects = 0;
+    std::string last_error;
+    for (size_t i = 0; i < workers.size(); i++) {
+        latencies.insert(latencies.end(), workers[i].latencies.begin(), workers[i].latencies.end());
+        for (int r = 0; r < LOAD_RESULT_MAX; r++) {
+            results[r] += workers[i].results[r];
+        }
+        reconnects += workers[i].reconnects;
+        if (!workers[i].last_error.empty()) {
+            last_error = workers[i].last_error;
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    long failures = 0;
+    for (int r = LOAD_OK + 1; r < LOAD_RESULT_MAX; r++) {
+        failures += results[r];
+    }
+    printf("\n%-12s %10ld in %.1fs\n", "Requests", results[LOAD_OK] + failures, elapsed);
+    printf("%-12s %10.1f req/s\n", "Throughput", results[LOAD_OK] / elapsed);
+    printf("%-12s %10ld\n", "Connections", reconnects);
+    printf("\n%-12s %10s\n", "Latency", "ms");
+    printf("%-12s %10.2f\n", "min", latencies.empty() ? 0 : latencies.front() / 1000.0);
+    printf("%-12s %10.2f\n", "p50", load_percentile(latencies, 50));
+    printf("%-12s %10.2f\n", "p99", load_percentile(latencies, 99));
+    printf("%-12s %10.2f\n", "p999", load_percentile(latencies, 99.9));
+    printf("%-12s %10.2f\n", "max", latencies.empty() ? 0 : latencies.back() / 1000.0);
+    printf("\n%-12s %10s\n", "Result", "Count");
+    for (int r = 0; r < LOAD_RESULT_MAX; r++) {
+        printf("%-12s %10ld\n", load_result_names_[r], results[r]);
+    }
+    if (!last_error.empty()) {
+        printf("\nLast invalid response: %s\n", last_error.c_str());
+    }
+    return failures == 0 ? 0 : 1;
+}
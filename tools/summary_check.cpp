@@ -0,0 +1,311 @@
+// SPDX-FileCopyrightText: 2024 Sidings Media <contact@sidingsmedia.com>
+// SPDX-License-Identifier: MIT
+
+// Host check of the window summary quantiles against a sorted
+// reference.
+//
+// Build and run from the repository root:
+//   g++ -std=c++11 -O2 -Wall -Wextra -o summary_check
+//       -Isrc/components/stats/include/stats
+//       tools/summary_check.cpp src/components/stats/p2.cpp
+//       src/components/stats/window.cpp
+//   ./summary_check
+//
+// The reference quantile of n observations is the nearest rank, the
+// ceil(p * n)th smallest. Checked are:
+//
+//   - P2Quantile with up to five observations, which must equal the
+//     reference exactly
+//   - P2Quantile over runs of several distributions, where the
+//     estimate must fall within a tolerance of the reference, measured
+//     as the distance in rank between the two so the same tolerance
+//     works whatever the spread of the values
+//   - WindowSummary with up to STATS_EXACT_SAMPLES observations, which
+//     must report the reference exactly, and with more, which must
+//     report what its P² estimators do
+//   - WindowSummary min, max and window count, and that Collect starts
+//     a new window
+//
+// Exits non-zero if any check fails.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "p2.hpp"
+#include "window.hpp"
+
+static const uint16_t QUANTILES_[STATS_QUANTILES] = { 500, 900, 990 };
+
+static int failures_ = 0;
+static int checks_ = 0;
+
+#define CHECK_EQ(name, actual, expected) \
+    check_eq(__LINE__, name, (int64_t)(actual), (int64_t)(expected))
+
+static void check_eq(int line, const char* name, int64_t actual, int64_t expected) {
+    checks_++;
+    if (actual != expected) {
+        printf("line %d: %s: got %lld, expected %lld\n", line, name, (long long)actual, (long long)expected);
+        failures_++;
+    }
+}
+
+/**
+ * @brief Deterministic generator so runs are repeatable on any host
+ */
+static uint32_t random_state_ = 2463534242u;
+
+static uint32_t random_next() {
+    random_state_ ^= random_state_ << 13;
+    random_state_ ^= random_state_ >> 17;
+    random_state_ ^= random_state_ << 5;
+    return random_state_;
+}
+
+static int32_t random_range(int32_t low, int32_t high) {
+    return low + (int32_t)(random_next() % (uint32_t)(high - low + 1));
+}
+
+/**
+ * @brief Nearest rank quantile of the observations
+ */
+static int32_t reference(std::vector<int32_t> values, uint16_t p) {
+    std::sort(values.begin(), values.end());
+    size_t rank = ((size_t)p * values.size() + 999) / 1000;
+    return values[rank == 0 ? 0 : rank - 1];
+}
+
+/**
+ * @brief How far an estimate is from quantile p in thousandths of rank
+ *
+ * Zero if some rank the estimate could hold in the sorted observations
+ * is the one wanted, so runs of equal values are not penalised.
+ */
+static int64_t rank_error(std::vector<int32_t> values, uint16_t p, int32_t estimate) {
+    std::sort(values.begin(), values.end());
+    int64_t n = values.size();
+    int64_t below = std::lower_bound(values.begin(), values.end(), estimate) - values.begin();
+    int64_t through = std::upper_bound(values.begin(), values.end(), estimate) - values.begin();
+    int64_t wanted = ((int64_t)p * n + 999) / 1000;
+    int64_t distance = 0;
+    if (wanted <= below) {
+        distance = below + 1 - wanted;
+    }
+    else if (wanted > through) {
+        distance = wanted - through;
+    }
+    return distance * 1000 / n;
+}
+
+static void test_p2_exact() {
+    for (int n = 1; n <= P2_MARKERS; n++) {
+        for (int run = 0; run < 200; run++) {
+            std::vector<int32_t> values;
+            for (int i = 0; i < n; i++) {
+                values.push_back(random_range(-50, 50));
+            }
+            for (int q = 0; q < STATS_QUANTILES; q++) {
+                P2Quantile estimator(QUANTILES_[q]);
+                for (size_t i = 0; i < values.size(); i++) {
+                    estimator.Add(values[i]);
+                }
+                int32_t value = 0;
+                CHECK_EQ("p2 exact available", estimator.Get(&value), true);
+                CHECK_EQ("p2 exact value", value, reference(values, QUANTILES_[q]));
+            }
+        }
+    }
+
+    P2Quantile empty(500);
+    int32_t value;
+    CHECK_EQ("p2 empty", empty.Get(&value), false);
+}
+
+struct distribution_t {
+    const char* name;
+    int32_t (*next)(int i, int n);
+};
+
+// Ambient temperature in hundredths wandering a few degrees
+static int32_t walk_(int, int) {
+    static int32_t value = 2000;
+    value += random_range(-5, 5);
+    return value;
+}
+
+static int32_t uniform_(int, int) {
+    return random_range(-4000, 8500);
+}
+
+// Sum of uniforms is near enough normal
+static int32_t normal_(int, int) {
+    int32_t sum = 0;
+    for (int i = 0; i < 12; i++) {
+        sum += random_range(-100, 100);
+    }
+    return 5000 + sum;
+}
+
+static int32_t ascending_(int i, int) {
+    return i;
+}
+
+static int32_t descending_(int i, int n) {
+    return n - i;
+}
+
+// Flat with the odd spike, e.g. a sensor in direct sun now and then
+static int32_t spiky_(int, int) {
+    return random_next() % 50 == 0 ? random_range(3000, 4000) : random_range(2000, 2010);
+}
+
+// Few distinct values, as when the sensor sits still
+static int32_t steps_(int, int) {
+    return 2000 + random_range(0, 3);
+}
+
+static const distribution_t DISTRIBUTIONS_[] = {
+    { "walk", walk_ },
+    { "uniform", uniform_ },
+    { "normal", normal_ },
+    { "ascending", ascending_ },
+    { "descending", descending_ },
+    { "spiky", spiky_ },
+    { "steps", steps_ },
+};
+
+// Rank error allowed for each quantile, in thousandths. P² settles
+// slowly, so runs of under SHORT_RUN_ observations get more leeway.
+#define SHORT_RUN_ 1000
+static const int64_t TOLERANCE_[STATS_QUANTILES] = { 30, 20, 8 };
+static const int64_t SHORT_TOLERANCE_[STATS_QUANTILES] = { 250, 100, 50 };
+
+static void test_p2_estimates() {
+    const int lengths[] = { 6, 50, 100, 1000, 10000 };
+
+    for (size_t d = 0; d < sizeof(DISTRIBUTIONS_) / sizeof(DISTRIBUTIONS_[0]); d++) {
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            int n = lengths[l];
+            std::vector<int32_t> values;
+            for (int i = 0; i < n; i++) {
+                values.push_back(DISTRIBUTIONS_[d].next(i, n));
+            }
+
+            for (int q = 0; q < STATS_QUANTILES; q++) {
+                P2Quantile estimator(QUANTILES_[q]);
+                for (size_t i = 0; i < values.size(); i++) {
+                    estimator.Add(values[i]);
+                }
+                int32_t value = 0;
+                estimator.Get(&value);
+                int64_t error = rank_error(values, QUANTILES_[q], value);
+                // Short runs have too few observations for any rank to
+                // be near p99, so allow the five markers' worth
+                int64_t tolerance = std::max(
+                    n < SHORT_RUN_ ? SHORT_TOLERANCE_[q] : TOLERANCE_[q],
+                    (int64_t)(1000 * P2_MARKERS / n)
+                );
+                checks_++;
+                if (error > tolerance) {
+                    printf(
+                        "%s n=%d p%u: estimate %d, reference %d, rank error %lld/1000 over %lld\n",
+                        DISTRIBUTIONS_[d].name,
+                        n,
+                        QUANTILES_[q] / 10,
+                        value,
+                        reference(values, QUANTILES_[q]),
+                        (long long)error,
+                        (long long)tolerance
+                    );
+                    failures_++;
+                }
+            }
+        }
+    }
+}
+
+static void test_window() {
+    WindowSummary window;
+    stats_snapshot_t snapshot;
+
+    window.Collect(&snapshot);
+    CHECK_EQ("empty count", snapshot.window_count, 0);
+    for (int q = 0; q < STATS_QUANTILES; q++) {
+        CHECK_EQ("empty quantile", snapshot.quantiles[q], QUANTILES_[q]);
+        CHECK_EQ("empty value", snapshot.values[q], 0);
+    }
+
+    // Up to the exact limit every quantile is the reference, beyond it
+    // they are whatever the estimators say
+    for (int n = 1; n <= 3 * STATS_EXACT_SAMPLES; n++) {
+        for (int run = 0; run < 50; run++) {
+            std::vector<int32_t> values;
+            P2Quantile estimators[STATS_QUANTILES] = {
+                P2Quantile(QUANTILES_[0]),
+                P2Quantile(QUANTILES_[1]),
+                P2Quantile(QUANTILES_[2]),
+            };
+            for (int i = 0; i < n; i++) {
+                int32_t value = random_range(-200, 200);
+                values.push_back(value);
+                window.Add(value);
+                for (int q = 0; q < STATS_QUANTILES; q++) {
+                    estimators[q].Add(value);
+                }
+            }
+
+            window.Collect(&snapshot);
+            CHECK_EQ("window count", snapshot.window_count, n);
+            CHECK_EQ("window min", snapshot.min, *std::min_element(values.begin(), values.end()));
+            CHECK_EQ("window max", snapshot.max, *std::max_element(values.begin(), values.end()));
+            for (int q = 0; q < STATS_QUANTILES; q++) {
+                CHECK_EQ("window quantile", snapshot.quantiles[q], QUANTILES_[q]);
+                if (n <= STATS_EXACT_SAMPLES) {
+                    CHECK_EQ("window exact value", snapshot.values[q], reference(values, QUANTILES_[q]));
+                }
+                else {
+                    int32_t estimate = 0;
+                    estimators[q].Get(&estimate);
+                    CHECK_EQ("window estimated value", snapshot.values[q], estimate);
+                }
+            }
+        }
+    }
+
+    // Collect starts a new window, nothing from the last one remains
+    window.Add(-1000);
+    window.Add(1000);
+    window.Collect(&snapshot);
+    window.Add(7);
+    window.Collect(&snapshot);
+    CHECK_EQ("new window count", snapshot.window_count, 1);
+    CHECK_EQ("new window min", snapshot.min, 7);
+    CHECK_EQ("new window max", snapshot.max, 7);
+    for (int q = 0; q < STATS_QUANTILES; q++) {
+        CHECK_EQ("new window value", snapshot.values[q], 7);
+    }
+
+    // As does Reset, without reading the window
+    window.Add(-1000);
+    window.Reset();
+    window.Add(3);
+    window.Add(5);
+    window.Collect(&snapshot);
+    CHECK_EQ("reset count", snapshot.window_count, 2);
+    CHECK_EQ("reset min", snapshot.min, 3);
+    CHECK_EQ("reset max", snapshot.max, 5);
+    CHECK_EQ("reset p50", snapshot.values[0], 3);
+    CHECK_EQ("reset p99", snapshot.values[2], 5);
+}
+
+int main() {
+    test_p2_exact();
+    test_p2_estimates();
+    test_window();
+
+    printf("%d checks, %d failures\n%s\n", checks_, failures_, failures_ ? "FAIL" : "PASS");
+    return failures_ ? 1 : 0;
+}